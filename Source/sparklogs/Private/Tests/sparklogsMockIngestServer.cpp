@@ -0,0 +1,492 @@
+// Copyright (C) 2024-2025 IT Lightning, LLC. All rights reserved.
+// Licensed software - see LICENSE
+
+#include "sparklogsMockIngestServer.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Async/Async.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "IPAddress.h"
+
+namespace
+{
+	constexpr int32 MaxHeaderBytes = 64 * 1024;
+	/** Ingest payloads are at most a few MB; anything much larger means the request was not parsed correctly. */
+	constexpr int32 MaxBodyBytes = 256 * 1024 * 1024;
+	/** Connections that stay idle this long are closed, like a real server would. */
+	constexpr double IdleConnectionTimeoutSecs = 30.0;
+	constexpr double PollIntervalSecs = 0.05;
+
+	const TCHAR* ITLGetHTTPReasonPhrase(int32 Status)
+	{
+		switch (Status)
+		{
+		case 100: return TEXT("Continue");
+		case 200: return TEXT("OK");
+		case 400: return TEXT("Bad Request");
+		case 401: return TEXT("Unauthorized");
+		case 404: return TEXT("Not Found");
+		case 411: return TEXT("Length Required");
+		case 429: return TEXT("Too Many Requests");
+		case 500: return TEXT("Internal Server Error");
+		case 503: return TEXT("Service Unavailable");
+		default: return TEXT("Unknown");
+		}
+	}
+}
+
+FsparklogsMockIngestServer::FsparklogsMockIngestServer()
+	: ListenSocket(nullptr)
+	, Port(0)
+	, Stopping(false)
+	, Random(1234)
+	, NumFailedFirst(0)
+	, KeepRequests(true)
+{
+}
+
+FsparklogsMockIngestServer::~FsparklogsMockIngestServer()
+{
+	Stop();
+}
+
+bool FsparklogsMockIngestServer::Start()
+{
+	check(ListenSocket == nullptr);
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	if (SocketSubsystem == nullptr)
+	{
+		return false;
+	}
+	ListenSocket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("sparklogs mock ingest server"), false);
+	if (ListenSocket == nullptr)
+	{
+		return false;
+	}
+	TSharedRef<FInternetAddr> Addr = SocketSubsystem->CreateInternetAddr();
+	Addr->SetLoopbackAddress();
+	Addr->SetPort(0);
+	if (!ListenSocket->Bind(*Addr) || !ListenSocket->Listen(64))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("MockIngestServer: failed to listen on the loopback interface"));
+		SocketSubsystem->DestroySocket(ListenSocket);
+		ListenSocket = nullptr;
+		return false;
+	}
+	Port = ListenSocket->GetPortNo();
+	Stopping = false;
+	AcceptThread = Async(EAsyncExecution::Thread, [this]() { AcceptLoop(); });
+	return true;
+}
+
+void FsparklogsMockIngestServer::Stop()
+{
+	if (ListenSocket == nullptr)
+	{
+		return;
+	}
+	Stopping = true;
+	if (AcceptThread.IsValid())
+	{
+		AcceptThread.Wait();
+	}
+	TArray<TFuture<void>> Connections;
+	{
+		FScopeLock ScopeLock(&Lock);
+		Connections = MoveTemp(ConnectionThreads);
+	}
+	// Every connection notices Stopping within one poll interval, closes its socket and exits
+	for (TFuture<void>& Connection : Connections)
+	{
+		Connection.Wait();
+	}
+	ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenSocket);
+	ListenSocket = nullptr;
+}
+
+FString FsparklogsMockIngestServer::GetEndpointURI() const
+{
+	return FString::Printf(TEXT("http://127.0.0.1:%d/ingest"), Port);
+}
+
+void FsparklogsMockIngestServer::SetFaults(const FsparklogsMockIngestFaults& InFaults)
+{
+	FScopeLock ScopeLock(&Lock);
+	Faults = InFaults;
+	NumFailedFirst = 0;
+}
+
+void FsparklogsMockIngestServer::SetCompressionDictionary(TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> InDictionary)
+{
+	FScopeLock ScopeLock(&Lock);
+	Dictionary = InDictionary;
+}
+
+void FsparklogsMockIngestServer::SetKeepRequests(bool InKeepRequests)
+{
+	FScopeLock ScopeLock(&Lock);
+	KeepRequests = InKeepRequests;
+}
+
+TArray<FsparklogsMockIngestRequest> FsparklogsMockIngestServer::GetRequests() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Requests;
+}
+
+TArray<FString> FsparklogsMockIngestServer::GetAcceptedPayloads() const
+{
+	FScopeLock ScopeLock(&Lock);
+	TArray<FString> Payloads;
+	for (const FsparklogsMockIngestRequest& Request : Requests)
+	{
+		if (Request.ResponseStatus == 200)
+		{
+			Payloads.Add(ITLConvertUTF8(Request.Body.GetData(), Request.Body.Num()));
+		}
+	}
+	return Payloads;
+}
+
+void FsparklogsMockIngestServer::AcceptLoop()
+{
+	while (!Stopping)
+	{
+		bool HasPendingConnection = false;
+		if (!ListenSocket->WaitForPendingConnection(HasPendingConnection, FTimespan::FromSeconds(PollIntervalSecs)) || !HasPendingConnection)
+		{
+			continue;
+		}
+		FSocket* Socket = ListenSocket->Accept(TEXT("sparklogs mock ingest connection"));
+		if (Socket == nullptr)
+		{
+			continue;
+		}
+		FScopeLock ScopeLock(&Lock);
+		ConnectionThreads.RemoveAll([](const TFuture<void>& Connection) { return Connection.IsReady(); });
+		ConnectionThreads.Add(Async(EAsyncExecution::Thread, [this, Socket]() { ServeConnection(Socket); }));
+	}
+}
+
+bool FsparklogsMockIngestServer::ReadAtLeast(FSocket* Socket, TArray<uint8>& Buffer, int32 Len)
+{
+	double IdleSince = FPlatformTime::Seconds();
+	uint8 Chunk[64 * 1024];
+	while (Buffer.Num() < Len)
+	{
+		if (Stopping || FPlatformTime::Seconds() - IdleSince > IdleConnectionTimeoutSecs)
+		{
+			return false;
+		}
+		if (!Socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(PollIntervalSecs)))
+		{
+			continue;
+		}
+		int32 BytesRead = 0;
+		// Readable with nothing to read means the peer closed the connection
+		if (!Socket->Recv(Chunk, sizeof(Chunk), BytesRead) || BytesRead <= 0)
+		{
+			return false;
+		}
+		Buffer.Append(Chunk, BytesRead);
+		NumReceivedBytes.Add(BytesRead);
+		IdleSince = FPlatformTime::Seconds();
+	}
+	return true;
+}
+
+bool FsparklogsMockIngestServer::SendAll(FSocket* Socket, const uint8* Data, int32 Len)
+{
+	while (Len > 0)
+	{
+		int32 BytesSent = 0;
+		if (Stopping || !Socket->Send(Data, Len, BytesSent))
+		{
+			return false;
+		}
+		Data += BytesSent;
+		Len -= BytesSent;
+	}
+	return true;
+}
+
+bool FsparklogsMockIngestServer::SendResponse(FSocket* Socket, int32 Status, const FString& Body, double StallSecs)
+{
+	FTCHARToUTF8 BodyUTF8(*Body);
+	FTCHARToUTF8 Headers(*FString::Printf(TEXT("HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n"), Status, ITLGetHTTPReasonPhrase(Status), BodyUTF8.Length()));
+	if (!SendAll(Socket, (const uint8*)Headers.Get(), Headers.Length()))
+	{
+		return false;
+	}
+	if (StallSecs > 0.0 && (!InterruptibleSleep(StallSecs) || IsPeerClosed(Socket)))
+	{
+		// A client that gave up during the stall never sees the response, even though sending the rest of it would likely still succeed
+		return false;
+	}
+	return SendAll(Socket, (const uint8*)BodyUTF8.Get(), BodyUTF8.Length());
+}
+
+bool FsparklogsMockIngestServer::IsPeerClosed(FSocket* Socket)
+{
+	// The client does not pipeline requests, so the connection being readable while a response is outstanding means it was closed
+	if (!Socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::Zero()))
+	{
+		return false;
+	}
+	uint8 Peek = 0;
+	int32 BytesRead = 0;
+	return !Socket->Recv(&Peek, 1, BytesRead, ESocketReceiveFlags::Peek) || BytesRead <= 0;
+}
+
+bool FsparklogsMockIngestServer::InterruptibleSleep(double Secs)
+{
+	const double EndTime = FPlatformTime::Seconds() + Secs;
+	for (double Now = FPlatformTime::Seconds(); Now < EndTime; Now = FPlatformTime::Seconds())
+	{
+		if (Stopping)
+		{
+			return false;
+		}
+		FPlatformProcess::SleepNoStats((float)FMath::Min(EndTime - Now, PollIntervalSecs));
+	}
+	return !Stopping;
+}
+
+FsparklogsMockIngestServer::FFault FsparklogsMockIngestServer::PickFault()
+{
+	FScopeLock ScopeLock(&Lock);
+	FFault Fault;
+	Fault.DelaySecs = Faults.LatencySecs + Faults.LatencyJitterSecs * Random.GetFraction();
+	if (NumFailedFirst < Faults.FailFirstN)
+	{
+		NumFailedFirst++;
+		Fault.Status = Faults.FailFirstStatus;
+		return Fault;
+	}
+	// One roll, so the rates add up instead of masking each other
+	float Roll = Random.GetFraction();
+	if ((Roll -= Faults.DropConnectionRate) < 0.0f)
+	{
+		Fault.Status = 0;
+	}
+	else if ((Roll -= Faults.ServerErrorRate) < 0.0f)
+	{
+		Fault.Status = 503;
+	}
+	else if ((Roll -= Faults.TooManyRequestsRate) < 0.0f)
+	{
+		Fault.Status = 429;
+	}
+	else if ((Roll -= Faults.SlowResponseRate) < 0.0f)
+	{
+		Fault.StallSecs = Faults.SlowResponseSecs;
+	}
+	return Fault;
+}
+
+bool FsparklogsMockIngestServer::DecodeBody(const FsparklogsMockIngestRequest& Request, const uint8* Data, int32 Len, TArray<uint8>& OutBody)
+{
+	const FString* Encoding = Request.Headers.Find(TEXT("content-encoding"));
+	if (Encoding == nullptr || Encoding->IsEmpty() || *Encoding == TEXT("identity"))
+	{
+		return ITLDecompressData(ITLCompressionMode::None, Data, Len, Len, OutBody);
+	}
+	const FString* OriginalLenHeader = Request.Headers.Find(TEXT("x-original-content-length"));
+	const int32 OriginalLen = OriginalLenHeader != nullptr ? FCString::Atoi(**OriginalLenHeader) : -1;
+	if (*Encoding == TEXT("lz4-block") || *Encoding == TEXT("lz4-block-dict") || *Encoding == TEXT("lz4-frame") || *Encoding == TEXT("lz4-multiblock"))
+	{
+		if (OriginalLen < 0)
+		{
+			return false;
+		}
+		if (*Encoding == TEXT("lz4-frame"))
+		{
+			return ITLDecompressData(ITLCompressionMode::LZ4Frame, Data, Len, OriginalLen, OutBody);
+		}
+		if (*Encoding == TEXT("lz4-multiblock"))
+		{
+			return ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Data, Len, OriginalLen, OutBody);
+		}
+		if (*Encoding == TEXT("lz4-block"))
+		{
+			return ITLDecompressData(ITLCompressionMode::LZ4, Data, Len, OriginalLen, OutBody);
+		}
+		const FString* DictionaryId = Request.Headers.Find(TEXT("x-compression-dictionary-id"));
+		if (DictionaryId == nullptr)
+		{
+			return false;
+		}
+		TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> UseDictionary;
+		{
+			FScopeLock ScopeLock(&Lock);
+			UseDictionary = Dictionary;
+		}
+		if (!UseDictionary.IsValid() || *DictionaryId != FString::Printf(TEXT("%08x"), UseDictionary->GetId()))
+		{
+			return false;
+		}
+		return ITLDecompressData(ITLCompressionMode::LZ4Dictionary, Data, Len, OriginalLen, OutBody, UseDictionary.Get());
+	}
+	if (*Encoding == TEXT("gzip") || *Encoding == TEXT("deflate"))
+	{
+		const ITLCompressionMode Mode = *Encoding == TEXT("gzip") ? ITLCompressionMode::Gzip : ITLCompressionMode::Deflate;
+		if (OriginalLen >= 0)
+		{
+			return ITLDecompressData(Mode, Data, Len, OriginalLen, OutBody);
+		}
+		// The decompressed size is not sent along for these, so grow the buffer until it fits
+		for (int64 GuessLen = FMath::Max(Len * 8, 64 * 1024); GuessLen <= MaxBodyBytes; GuessLen *= 4)
+		{
+			if (ITLDecompressData(Mode, Data, Len, (int)GuessLen, OutBody))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void FsparklogsMockIngestServer::ServeConnection(FSocket* Socket)
+{
+	TArray<uint8> Buffer;
+	while (!Stopping)
+	{
+		// Read the request line and headers
+		int32 HeaderEnd = INDEX_NONE;
+		for (int32 SearchFrom = 0; HeaderEnd == INDEX_NONE; )
+		{
+			for (int32 i = SearchFrom; i + 3 < Buffer.Num(); i++)
+			{
+				if (Buffer[i] == '\r' && Buffer[i + 1] == '\n' && Buffer[i + 2] == '\r' && Buffer[i + 3] == '\n')
+				{
+					HeaderEnd = i + 4;
+					break;
+				}
+			}
+			if (HeaderEnd != INDEX_NONE)
+			{
+				break;
+			}
+			SearchFrom = FMath::Max(0, Buffer.Num() - 3);
+			if (Buffer.Num() > MaxHeaderBytes || !ReadAtLeast(Socket, Buffer, Buffer.Num() + 1))
+			{
+				break;
+			}
+		}
+		if (HeaderEnd == INDEX_NONE)
+		{
+			break;
+		}
+
+		FsparklogsMockIngestRequest Request;
+		Request.ReceivedTime = FPlatformTime::Seconds();
+		TArray<FString> HeaderLines;
+		ITLConvertUTF8(Buffer.GetData(), HeaderEnd - 4).ParseIntoArray(HeaderLines, TEXT("\r\n"), true);
+		if (HeaderLines.Num() <= 0)
+		{
+			break;
+		}
+		TArray<FString> RequestLine;
+		HeaderLines[0].ParseIntoArrayWS(RequestLine);
+		Request.Method = RequestLine.Num() > 0 ? RequestLine[0] : FString();
+		Request.Path = RequestLine.Num() > 1 ? RequestLine[1] : FString();
+		for (int32 i = 1; i < HeaderLines.Num(); i++)
+		{
+			FString Name, Value;
+			if (HeaderLines[i].Split(TEXT(":"), &Name, &Value))
+			{
+				Request.Headers.Add(Name.TrimStartAndEnd().ToLower(), Value.TrimStartAndEnd());
+			}
+		}
+		const FString* ContentLength = Request.Headers.Find(TEXT("content-length"));
+		if (ContentLength == nullptr)
+		{
+			// The HTTP module always sends the length of the payload, so chunked bodies are not supported
+			SendResponse(Socket, 411, TEXT("{\"error\":\"content-length required\"}"), 0.0);
+			break;
+		}
+		Request.ContentLength = FCString::Atoi(**ContentLength);
+		if (Request.ContentLength < 0 || Request.ContentLength > MaxBodyBytes)
+		{
+			SendResponse(Socket, 400, TEXT("{\"error\":\"bad content-length\"}"), 0.0);
+			break;
+		}
+		const FString* Expect = Request.Headers.Find(TEXT("expect"));
+		if (Expect != nullptr && Expect->Equals(TEXT("100-continue"), ESearchCase::IgnoreCase) && Buffer.Num() == HeaderEnd)
+		{
+			static const ANSICHAR Continue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			if (!SendAll(Socket, (const uint8*)Continue, sizeof(Continue) - 1))
+			{
+				break;
+			}
+		}
+		const int32 BodyLen = Request.ContentLength;
+		if (!ReadAtLeast(Socket, Buffer, HeaderEnd + BodyLen))
+		{
+			break;
+		}
+		NumRequests.Increment();
+
+		FFault Fault = PickFault();
+		bool KeepConnection = true;
+		if (Fault.DelaySecs > 0.0 && !InterruptibleSleep(Fault.DelaySecs))
+		{
+			break;
+		}
+		if (Fault.Status == 0)
+		{
+			NumInjectedFailures.Increment();
+			KeepConnection = false;
+		}
+		else if (Fault.Status != 200)
+		{
+			NumInjectedFailures.Increment();
+			Request.ResponseStatus = Fault.Status;
+			KeepConnection = SendResponse(Socket, Fault.Status, FString::Printf(TEXT("{\"error\":\"injected %d\"}"), Fault.Status), 0.0);
+		}
+		else if (!DecodeBody(Request, Buffer.GetData() + HeaderEnd, BodyLen, Request.Body))
+		{
+			NumDecodeFailures.Increment();
+			Request.Body.Empty();
+			Request.ResponseStatus = 400;
+			KeepConnection = SendResponse(Socket, 400, TEXT("{\"error\":\"cannot decode body\"}"), 0.0);
+		}
+		else
+		{
+			if (Fault.StallSecs > 0.0)
+			{
+				NumInjectedFailures.Increment();
+			}
+			// Only accepted once the whole response made it out, so a stalled response the client gave up on does not count
+			KeepConnection = SendResponse(Socket, 200, TEXT("{}"), Fault.StallSecs);
+			if (KeepConnection)
+			{
+				NumAccepted.Increment();
+				NumDecodedBytes.Add(Request.Body.Num());
+				Request.ResponseStatus = 200;
+			}
+			else
+			{
+				Request.Body.Empty();
+			}
+		}
+		{
+			FScopeLock ScopeLock(&Lock);
+			if (KeepRequests)
+			{
+				Requests.Add(MoveTemp(Request));
+			}
+		}
+		Buffer.RemoveAt(0, HeaderEnd + BodyLen, false);
+		if (!KeepConnection)
+		{
+			break;
+		}
+	}
+	Socket->Close();
+	ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
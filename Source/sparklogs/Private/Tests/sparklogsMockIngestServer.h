@@ -0,0 +1,139 @@
+// Copyright (C) 2024-2025 IT Lightning, LLC. All rights reserved.
+// Licensed software - see LICENSE
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Async/Future.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "Math/RandomStream.h"
+#include "sparklogs.h"
+
+class FSocket;
+
+/** Faults the mock ingest server injects. The rates are probabilities in [0,1], rolled once per request. */
+struct FsparklogsMockIngestFaults
+{
+	/** Every request waits this long (plus a random amount up to LatencyJitterSecs) before it is answered. */
+	double LatencySecs = 0.0;
+	double LatencyJitterSecs = 0.0;
+	/** Answers with 503 Service Unavailable. */
+	float ServerErrorRate = 0.0f;
+	/** Answers with 429 Too Many Requests. */
+	float TooManyRequestsRate = 0.0f;
+	/** Reads the request and then closes the connection without answering. */
+	float DropConnectionRate = 0.0f;
+	/**
+	 * Sends the response headers, then stalls for SlowResponseSecs before sending the body. Counts as an injected failure, and the
+	 * request is only accepted if the client is still waiting for the body once the stall is over.
+	 */
+	float SlowResponseRate = 0.0f;
+	double SlowResponseSecs = 0.0;
+	/** The first N requests fail with FailFirstStatus (or a dropped connection if it is 0) before the rates above apply. */
+	int32 FailFirstN = 0;
+	int32 FailFirstStatus = 503;
+};
+
+/** One request as seen by the mock ingest server. */
+struct FsparklogsMockIngestRequest
+{
+	FString Method;
+	FString Path;
+	/** Header names are lowercase. */
+	TMap<FString, FString> Headers;
+	/** Size of the body on the wire. */
+	int32 ContentLength = 0;
+	/** The body after Content-Encoding was undone (empty if the request was not accepted). */
+	TArray<uint8> Body;
+	/** HTTP status sent back, or 0 if the connection was dropped. */
+	int32 ResponseStatus = 0;
+	double ReceivedTime = 0.0;
+};
+
+/**
+ * A loopback HTTP/1.1 server that stands in for the ingest endpoint in automation tests, so FsparklogsWriteHTTPPayloadProcessor
+ * can be driven end to end without an external service. Request bodies are decoded according to Content-Encoding (lz4-block,
+ * lz4-block-dict, lz4-frame, lz4-multiblock, gzip, deflate or none) and answered with 200, unless a fault is injected (see FsparklogsMockIngestFaults).
+ * Undecodable bodies are answered with 400. Every connection is served on its own thread, with keep-alive.
+ */
+class FsparklogsMockIngestServer
+{
+public:
+	FsparklogsMockIngestServer();
+	~FsparklogsMockIngestServer();
+
+	/** Starts listening on an ephemeral port on the loopback interface. Returns false if the socket could not be set up. */
+	bool Start();
+	/** Closes every connection and waits for the server threads to exit. Safe to call more than once. */
+	void Stop();
+	/** The URI to point FsparklogsWriteHTTPPayloadProcessor at. */
+	FString GetEndpointURI() const;
+
+	void SetFaults(const FsparklogsMockIngestFaults& InFaults);
+	/** Dictionary to decompress lz4-block-dict bodies with. */
+	void SetCompressionDictionary(TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> InDictionary);
+	/** Whether requests (and their decoded bodies) are kept for GetRequests. Turn off for throughput tests. Defaults to true. */
+	void SetKeepRequests(bool InKeepRequests);
+
+	TArray<FsparklogsMockIngestRequest> GetRequests() const;
+	/** The decoded bodies of all requests answered with 200, in the order they were accepted. */
+	TArray<FString> GetAcceptedPayloads() const;
+	int64 GetNumRequests() const { return NumRequests.GetValue(); }
+	int64 GetNumAccepted() const { return NumAccepted.GetValue(); }
+	/** Requests answered with an injected error status, a dropped connection, or a stalled response. */
+	int64 GetNumInjectedFailures() const { return NumInjectedFailures.GetValue(); }
+	int64 GetNumDecodeFailures() const { return NumDecodeFailures.GetValue(); }
+	int64 GetNumReceivedBytes() const { return NumReceivedBytes.GetValue(); }
+	int64 GetNumDecodedBytes() const { return NumDecodedBytes.GetValue(); }
+
+protected:
+	/** What to do with a request, picked by PickFault. */
+	struct FFault
+	{
+		/** 0 = drop the connection */
+		int32 Status = 200;
+		double DelaySecs = 0.0;
+		double StallSecs = 0.0;
+	};
+
+	void AcceptLoop();
+	void ServeConnection(FSocket* Socket);
+	/** Reads until Buffer holds at least Len bytes. Returns false if the peer closed the connection or the server is stopping. */
+	bool ReadAtLeast(FSocket* Socket, TArray<uint8>& Buffer, int32 Len);
+	bool SendAll(FSocket* Socket, const uint8* Data, int32 Len);
+	/** Returns false if the response could not be sent in full, including when the client closed the connection during the stall. */
+	bool SendResponse(FSocket* Socket, int32 Status, const FString& Body, double StallSecs);
+	/** Whether the client closed the connection. Only meaningful while a response is outstanding. */
+	bool IsPeerClosed(FSocket* Socket);
+	/** Sleeps in small steps so Stop does not have to wait for injected delays. Returns false if the server is stopping. */
+	bool InterruptibleSleep(double Secs);
+	FFault PickFault();
+	bool DecodeBody(const FsparklogsMockIngestRequest& Request, const uint8* Data, int32 Len, TArray<uint8>& OutBody);
+
+	FSocket* ListenSocket;
+	int32 Port;
+	FThreadSafeBool Stopping;
+	TFuture<void> AcceptThread;
+
+	mutable FCriticalSection Lock;
+	TArray<TFuture<void>> ConnectionThreads;
+	FsparklogsMockIngestFaults Faults;
+	FRandomStream Random;
+	int32 NumFailedFirst;
+	TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> Dictionary;
+	bool KeepRequests;
+	TArray<FsparklogsMockIngestRequest> Requests;
+
+	FThreadSafeCounter64 NumRequests;
+	FThreadSafeCounter64 NumAccepted;
+	FThreadSafeCounter64 NumInjectedFailures;
+	FThreadSafeCounter64 NumDecodeFailures;
+	FThreadSafeCounter64 NumReceivedBytes;
+	FThreadSafeCounter64 NumDecodedBytes;
+};
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -2,13 +2,25 @@
 // Licensed software - see LICENSE
 
 #include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
 #include "CoreTypes.h"
 #include "Containers/UnrealString.h"
 #include "GenericPlatform/GenericPlatform.h"
 #include "Templates/UniquePtr.h"
 #include "Templates/SharedPointer.h"
 #include "Algo/Compare.h"
+#include "Async/Async.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/ThreadManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/CommandLine.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
 #include "sparklogs.h"
+#include "sparklogsMockIngestServer.h"
 
 class FTempDirectory
 {
@@ -57,11 +69,16 @@ class FsparklogsStoreInMemPayloadProcessor : public IsparklogsPayloadProcessor
 {
 public:
     bool FailProcessing;
+    /** If non-empty, fails processing of any payload that contains this string */
+    FString FailPayloadsContaining;
     TArray<FString> Payloads;
     int LastOriginalPayloadLen;
+    /** Payloads can be processed concurrently */
+    FCriticalSection Lock;
     FsparklogsStoreInMemPayloadProcessor() : FailProcessing(false) { }
-    virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override
+    virtual bool ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override
     {
+        FScopeLock ScopeLock(&Lock);
         LastOriginalPayloadLen = OriginalPayloadLen;
         if (FailProcessing)
         {
@@ -69,12 +86,18 @@ public:
             return false;
         }
         TArray<uint8> DecompressedData;
-        if (!ITLDecompressData(CompressionMode, JSONPayloadInUTF8.GetData(), PayloadLen, OriginalPayloadLen, DecompressedData))
+        if (!ITLDecompressData(CompressionMode, JSONPayloadInUTF8->GetData(), PayloadLen, OriginalPayloadLen, DecompressedData, Streamer != nullptr ? Streamer->GetCompressionDictionary() : nullptr))
         {
             UE_LOG(LogPluginSparkLogs, Warning, TEXT("TEST: failed to decompress data in payload: mode=%d, len=%d, original_len=%d"), (int)CompressionMode, PayloadLen, OriginalPayloadLen);
             return false;
         }
-        Payloads.Add(ITLConvertUTF8(DecompressedData.GetData(), DecompressedData.Num()));
+        FString Payload = ITLConvertUTF8(DecompressedData.GetData(), DecompressedData.Num());
+        if (FailPayloadsContaining.Len() > 0 && Payload.Contains(FailPayloadsContaining))
+        {
+            ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("TEST: forcefully failing processing of payload containing '%s'"), *FailPayloadsContaining);
+            return false;
+        }
+        Payloads.Add(Payload);
         return true;
     }
 };
@@ -104,6 +127,12 @@ static void SetupCompressionModes(TArray<FString>& OutBeautifiedNames, TArray <F
     OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::None));
     OutBeautifiedNames.Add(TEXT("LZ4"));
     OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::LZ4));
+    OutBeautifiedNames.Add(TEXT("LZ4Frame"));
+    OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::LZ4Frame));
+    OutBeautifiedNames.Add(TEXT("LZ4MultiBlock"));
+    OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::LZ4MultiBlock));
+    OutBeautifiedNames.Add(TEXT("Gzip"));
+    OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::Gzip));
 }
 
 IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestSkipByteMarker, "sparklogs.UnitTests.SkipByteMarker", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
@@ -461,6 +490,85 @@ bool FsparklogsPluginUnitTestStopAndResume::RunTest(const FString& Parameters)
     return true;
 }
 
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestProgressJournal, "sparklogs.UnitTests.ProgressJournal", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestProgressJournal::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString JournalPath = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-progress.journal"));
+    FsparklogsProgressJournal::FRecord Record;
+    {
+        FsparklogsProgressJournal Journal(*JournalPath, 0.0);
+        TestFalse(TEXT("Read should fail without a journal"), Journal.Read(Record));
+        TestTrue(TEXT("Write[1] should succeed"), Journal.Write(100, 1, 2));
+        TestTrue(TEXT("Write[2] should succeed"), Journal.Write(((int64)1 << 53) + 1, 1, 2));
+        TestTrue(TEXT("Read[2] should succeed"), Journal.Read(Record));
+        // Offsets beyond 2^53 could not be stored exactly in the old INI progress marker (a double)
+        TestEqual(TEXT("Read[2] offset should match exactly"), Record.Offset, ((int64)1 << 53) + 1);
+        TestEqual(TEXT("Read[2] sequence should match"), Record.Sequence, (uint64)2);
+        TestEqual(TEXT("Read[2] inode should match"), Record.FileInode, (uint64)2);
+    }
+    TArray<uint8> Bytes;
+    TestTrue(TEXT("Journal file should exist"), FFileHelper::LoadFileToArray(Bytes, *JournalPath));
+    TestEqual(TEXT("Journal should hold exactly two records"), Bytes.Num(), 2 * FsparklogsProgressJournal::RecordSize);
+
+    // Simulate a torn write of the newest record (slot 0 holds even sequence numbers): the previous record should be used instead
+    Bytes[20] ^= 0xFF;
+    TestTrue(TEXT("Saving damaged journal should succeed"), FFileHelper::SaveArrayToFile(Bytes, *JournalPath));
+    {
+        FsparklogsProgressJournal Journal(*JournalPath, 0.0);
+        TestTrue(TEXT("Read[damaged] should succeed"), Journal.Read(Record));
+        TestEqual(TEXT("Read[damaged] should fall back to the previous offset"), Record.Offset, (int64)100);
+        TestEqual(TEXT("Read[damaged] should fall back to the previous sequence"), Record.Sequence, (uint64)1);
+        // The next write continues the sequence and replaces the damaged record
+        TestTrue(TEXT("Write[3] should succeed"), Journal.Write(300, 1, 2));
+        TestTrue(TEXT("Read[3] should succeed"), Journal.Read(Record));
+        TestEqual(TEXT("Read[3] offset should match"), Record.Offset, (int64)300);
+        TestEqual(TEXT("Read[3] sequence should match"), Record.Sequence, (uint64)2);
+        Journal.Delete();
+    }
+    TestFalse(TEXT("Journal should be deleted"), IFileManager::Get().FileExists(*JournalPath));
+    return true;
+}
+
+#if PLATFORM_LINUX
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestResumeReplacedLogfile, "sparklogs.UnitTests.ResumeReplacedLogfile", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestResumeReplacedLogfile::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    {
+        TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+        ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n"));
+    }
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1-FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    Streamer.Reset();
+
+    // While stopped, the logfile is replaced by a new (larger) one. The recorded offset must not be applied to it.
+    // The new file is created before the old one goes away so it cannot reuse the same inode.
+    FString NewLogFile = TestLogFile + TEXT(".new");
+    {
+        TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*NewLogFile, true, true));
+        ITLWriteStringToFile(LogWriter, TEXT("New line 1\r\nNew line 2\r\n"));
+    }
+    TestTrue(TEXT("Replacing the logfile should succeed"), IFileManager::Get().Move(*TestLogFile, *NewLogFile, true));
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"New line 1\"},{\"message\":\"New line 2\"}]"));
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor2(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer2 = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor2, 16 * 1024, nullptr, nullptr);
+    TestTrue(TEXT("FlushAndWait[2-FINAL] should succeed"), Streamer2->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[2-FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor2->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[2-FINAL] should capture everything"), FlushedEverything);
+    Streamer2.Reset();
+    return true;
+}
+#endif
+
 IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestHandleLogRotation, "sparklogs.UnitTests.HandleLogRotation", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
 void FsparklogsPluginUnitTestHandleLogRotation::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
 {
@@ -511,6 +619,57 @@ bool FsparklogsPluginUnitTestHandleLogRotation::RunTest(const FString& Parameter
     return true;
 }
 
+#if PLATFORM_LINUX
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestHandleSameSizeLogRotation, "sparklogs.UnitTests.HandleSameSizeLogRotation", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestHandleSameSizeLogRotation::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestHandleSameSizeLogRotation::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    FString RotatedLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs-backup.log"));
+
+    TArray<FString> ExpectedPayloads;
+
+    TSharedPtr<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter.ToSharedRef(), TEXT("Line 1 first file\r\n"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1 first file\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(2, false, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[1] should capture everything"), FlushedEverything);
+
+    // Rotate the logfile the way the engine does (rename, then start a new file) and write exactly as many bytes as before.
+    // Looking at the size alone, nothing appears to have changed.
+    LogWriter.Reset();
+    TestTrue(TEXT("Logfile should be rotated"), IFileManager::Get().Move(*RotatedLogFile, *TestLogFile));
+    LogWriter = MakeShareable(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter.ToSharedRef(), TEXT("Line 2 new file!!\r\n"));
+    LogWriter->Flush();
+    TestEqual(TEXT("Rotated logfile should have the same size"), IFileManager::Get().FileSize(*TestLogFile), IFileManager::Get().FileSize(*RotatedLogFile));
+
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 2 new file!!\"}]"));
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(3, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+    int64 ProgressMarker = 0;
+    Streamer->ReadProgressMarker(ProgressMarker);
+    TestEqual(TEXT("FlushAndWait[FINAL] progress marker should match"), ProgressMarker, (int64)19);
+
+    Streamer.Reset();
+    return true;
+}
+#endif
+
 IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestRetryDelay, "sparklogs.UnitTests.RetryDelay", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
 void FsparklogsPluginUnitTestRetryDelay::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
 {
@@ -739,3 +898,2430 @@ bool FsparklogsPluginUnitTestAdditionalAttributes::RunTest(const FString& Parame
     Streamer.Reset();
     return true;
 }
+
+/** Returns the index just past the JSON object or array that starts at Start, or INDEX_NONE if it is not terminated. */
+static int ITLFindEndOfJSONValue(const FString& JSON, int Start)
+{
+    int Depth = 0;
+    bool InString = false;
+    for (int i = Start; i < JSON.Len(); i++)
+    {
+        const TCHAR c = JSON[i];
+        if (InString)
+        {
+            if (c == '\\')
+            {
+                i++;
+            }
+            else if (c == '"')
+            {
+                InString = false;
+            }
+        }
+        else if (c == '"')
+        {
+            InString = true;
+        }
+        else if (c == '{' || c == '[')
+        {
+            Depth++;
+        }
+        else if ((c == '}' || c == ']') && --Depth == 0)
+        {
+            return i + 1;
+        }
+    }
+    return INDEX_NONE;
+}
+
+/**
+ * Decodes an envelope payload the way an ingest endpoint would: merges the common fields into each event, and returns the
+ * events as an array payload (exactly what the array format would have sent). Returns false if the envelope is malformed.
+ */
+static bool ITLDecodeEnvelopePayload(const FString& Payload, FString& OutArrayPayload)
+{
+    const TCHAR* CommonPrefix = TEXT("{\"common\":");
+    const TCHAR* EventsPrefix = TEXT(",\"events\":");
+    if (!Payload.StartsWith(CommonPrefix, ESearchCase::CaseSensitive))
+    {
+        return false;
+    }
+    const int CommonStart = FCString::Strlen(CommonPrefix);
+    const int CommonEnd = ITLFindEndOfJSONValue(Payload, CommonStart);
+    if (CommonEnd == INDEX_NONE || Payload[CommonStart] != '{' || Payload.Mid(CommonEnd, FCString::Strlen(EventsPrefix)) != EventsPrefix)
+    {
+        return false;
+    }
+    const FString CommonFields = Payload.Mid(CommonStart + 1, CommonEnd - CommonStart - 2);
+    int Pos = CommonEnd + FCString::Strlen(EventsPrefix);
+    if (Pos >= Payload.Len() || Payload[Pos] != '[' || ITLFindEndOfJSONValue(Payload, Pos) != Payload.Len() - 1 || Payload[Payload.Len() - 1] != '}')
+    {
+        return false;
+    }
+    OutArrayPayload = TEXT("[");
+    Pos++;
+    while (Payload[Pos] == '{')
+    {
+        const int EventEnd = ITLFindEndOfJSONValue(Payload, Pos);
+        if (OutArrayPayload.Len() > 1)
+        {
+            OutArrayPayload += TEXT(",");
+        }
+        OutArrayPayload += TEXT("{");
+        const FString EventFields = Payload.Mid(Pos + 1, EventEnd - Pos - 2);
+        if (CommonFields.Len() > 0)
+        {
+            OutArrayPayload += CommonFields;
+            if (EventFields.Len() > 0)
+            {
+                OutArrayPayload += TEXT(",");
+            }
+        }
+        OutArrayPayload += EventFields;
+        OutArrayPayload += TEXT("}");
+        Pos = EventEnd;
+        if (Payload[Pos] == ',')
+        {
+            Pos++;
+        }
+    }
+    if (Payload[Pos] != ']')
+    {
+        return false;
+    }
+    OutArrayPayload += TEXT("]");
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestEnvelopePayload, "sparklogs.UnitTests.EnvelopePayload", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestEnvelopePayload::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestEnvelopePayload::RunTest(const FString& Parameters)
+{
+    TMap<FString, FString> AdditionalAttributes;
+    AdditionalAttributes.Add(TEXT("game_version"), TEXT("v1.2.3"));
+    AdditionalAttributes.Add(TEXT("game_name"), TEXT("hello world"));
+    TArray<FString> PayloadsByFormat[2];
+    for (ITLPayloadFormat Format : { ITLPayloadFormat::Array, ITLPayloadFormat::Envelope })
+    {
+        // Separate directories, so the second streamer does not resume from the progress marker of the first
+        FTempDirectory TempDir(ITLGetTestDir());
+        FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+        TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+        ITLWriteStringToFile(LogWriter, TEXT("Hello {world}\r\nLine \"2\" ]}\r\n"));
+        LogWriter->Flush();
+
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+        Settings->IncludeCommonMetadata = false;
+        Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+        Settings->PayloadFormat = Format;
+        TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+        TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, &AdditionalAttributes);
+        bool FlushedEverything = false;
+        TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+        TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+        Streamer.Reset();
+        PayloadsByFormat[(int)Format] = PayloadProcessor->Payloads;
+    }
+
+    TArray<FString> ExpectedEnvelopes;
+    ExpectedEnvelopes.Add(TEXT("{\"common\":{\"game_version\":\"v1.2.3\",\"game_name\":\"hello world\"},\"events\":[{\"message\":\"Hello {world}\"},{\"message\":\"Line \\\"2\\\" ]}\"}]}"));
+    TestTrue(TEXT("Envelope payloads should match"), ITLComparePayloads(this, PayloadsByFormat[(int)ITLPayloadFormat::Envelope], ExpectedEnvelopes));
+    TArray<FString> Decoded;
+    for (const FString& Envelope : PayloadsByFormat[(int)ITLPayloadFormat::Envelope])
+    {
+        FString ArrayPayload;
+        TestTrue(TEXT("Envelope should decode"), ITLDecodeEnvelopePayload(Envelope, ArrayPayload));
+        Decoded.Add(ArrayPayload);
+        TestTrue(TEXT("Envelope should be smaller than the array format"), Envelope.Len() < PayloadsByFormat[(int)ITLPayloadFormat::Array][0].Len());
+    }
+    TestTrue(TEXT("Decoded envelopes should match the array format"), ITLComparePayloads(this, Decoded, PayloadsByFormat[(int)ITLPayloadFormat::Array]));
+
+    // Without any common fields
+    FString ArrayPayload;
+    TestTrue(TEXT("Envelope without common fields should decode"), ITLDecodeEnvelopePayload(TEXT("{\"common\":{},\"events\":[{\"message\":\"a\"}]}"), ArrayPayload));
+    TestEqual(TEXT("Envelope without common fields should decode to the array format"), ArrayPayload, FString(TEXT("[{\"message\":\"a\"}]")));
+    TestFalse(TEXT("Truncated envelope should not decode"), ITLDecodeEnvelopePayload(TEXT("{\"common\":{},\"events\":[{\"message\":\"a\"}"), ArrayPayload));
+    return true;
+}
+
+/** Extracts the messages from payloads that only contain a message field in each event. */
+static TArray<FString> ITLGetPayloadMessages(const TArray<FString>& Payloads)
+{
+    TArray<FString> Messages;
+    for (FString Payload : Payloads)
+    {
+        Payload.RemoveFromStart(TEXT("[{\"message\":\""));
+        Payload.RemoveFromEnd(TEXT("\"}]"));
+        TArray<FString> PayloadMessages;
+        Payload.ParseIntoArray(PayloadMessages, TEXT("\"},{\"message\":\""), false);
+        Messages.Append(PayloadMessages);
+    }
+    return Messages;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestPipelinedChunks, "sparklogs.UnitTests.PipelinedChunks", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestPipelinedChunks::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestPipelinedChunks::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+
+    // Write a backlog of many chunks, so the next chunk is always prepared while the current one is being processed
+    TArray<FString> ExpectedMessages;
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    for (int i = 0; i < 100; i++)
+    {
+        ExpectedMessages.Add(FString::Printf(TEXT("Line %03d of the backlog"), i));
+        ITLWriteStringToFile(LogWriter, *(ExpectedMessages.Last() + TEXT("\r\n")));
+    }
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    Settings->BytesPerRequest = 100;
+    // Only retry when the retry timer is cleared
+    Settings->ProcessingIntervalSecs = 0.1;
+    Settings->RetryIntervalSecs = 60.0;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    // The first chunk fails, and the chunk prepared in the meantime must be thrown away
+    PayloadProcessor->FailProcessing = true;
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestFalse(TEXT("FlushAndWait[1] should fail because of failure to process"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+    TestEqual(TEXT("FlushAndWait[1] should not have any payloads"), PayloadProcessor->Payloads.Num(), 0);
+    PayloadProcessor->FailProcessing = false;
+
+    for (int i = 0; i < 200 && !FlushedEverything; i++)
+    {
+        if (!TestTrue(TEXT("FlushAndWait[N] should succeed"), Streamer->FlushAndWait(1, true, false, false, 10.0, FlushedEverything)))
+        {
+            break;
+        }
+    }
+    TestTrue(TEXT("FlushAndWait[N] should eventually capture everything"), FlushedEverything);
+    TestTrue(TEXT("FlushAndWait[N] should take more than one payload"), PayloadProcessor->Payloads.Num() > 1);
+    TestTrue(TEXT("Every line should be shipped exactly once and in order"), ITLComparePayloads(this, ITLGetPayloadMessages(PayloadProcessor->Payloads), ExpectedMessages));
+    int64 ProgressMarker = 0;
+    Streamer->ReadProgressMarker(ProgressMarker);
+    TestEqual(TEXT("Progress marker should be at the end of the logfile"), ProgressMarker, IFileManager::Get().FileSize(*TestLogFile));
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything));
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestConcurrentInFlight, "sparklogs.UnitTests.ConcurrentInFlight", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestConcurrentInFlight::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestConcurrentInFlight::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+
+    // Each line is 25 bytes, so each 100 byte chunk holds exactly 4 lines
+    TArray<FString> ExpectedMessages;
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    for (int i = 0; i < 100; i++)
+    {
+        ExpectedMessages.Add(FString::Printf(TEXT("Line %03d of the backlog"), i));
+        ITLWriteStringToFile(LogWriter, *(ExpectedMessages.Last() + TEXT("\r\n")));
+    }
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    Settings->BytesPerRequest = 100;
+    Settings->MaxInFlightRequests = 4;
+    // Only retry when the retry timer is cleared
+    Settings->ProcessingIntervalSecs = 0.1;
+    Settings->RetryIntervalSecs = 60.0;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    // The second chunk of the first window fails, while the chunks around it succeed
+    PayloadProcessor->FailPayloadsContaining = TEXT("Line 005");
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestFalse(TEXT("FlushAndWait[1] should fail because of failure to process"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+    TestEqual(TEXT("FlushAndWait[1] should process the other chunks in the window"), PayloadProcessor->Payloads.Num(), 3);
+    int64 ProgressMarker = 0;
+    Streamer->ReadProgressMarker(ProgressMarker);
+    TestEqual(TEXT("FlushAndWait[1] progress marker should only advance past the first chunk"), ProgressMarker, (int64)100);
+
+    PayloadProcessor->FailPayloadsContaining.Empty();
+    for (int i = 0; i < 200 && !FlushedEverything; i++)
+    {
+        if (!TestTrue(TEXT("FlushAndWait[N] should succeed"), Streamer->FlushAndWait(1, true, false, false, 10.0, FlushedEverything)))
+        {
+            break;
+        }
+    }
+    TestTrue(TEXT("FlushAndWait[N] should eventually capture everything"), FlushedEverything);
+    // Chunks are acknowledged out of order, but none should be sent twice
+    TestEqual(TEXT("Every chunk should be processed exactly once"), PayloadProcessor->Payloads.Num(), 25);
+    TArray<FString> Messages = ITLGetPayloadMessages(PayloadProcessor->Payloads);
+    Messages.Sort();
+    TestTrue(TEXT("Every line should be shipped exactly once"), ITLComparePayloads(this, Messages, ExpectedMessages));
+    Streamer->ReadProgressMarker(ProgressMarker);
+    TestEqual(TEXT("Progress marker should be at the end of the logfile"), ProgressMarker, IFileManager::Get().FileSize(*TestLogFile));
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything));
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestFlushLatency, "sparklogs.UnitTests.FlushLatency", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestFlushLatency::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    // Only manual flushes should ever wake up the worker
+    Settings->ProcessingIntervalSecs = 3600.0;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[initial] should succeed"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+
+    constexpr int NumFlushes = 50;
+    TArray<double> FlushMillisec;
+    for (int i = 0; i < NumFlushes; i++)
+    {
+        ITLWriteStringToFile(LogWriter, *FString::Printf(TEXT("Line %d\r\n"), i));
+        LogWriter->Flush();
+        double StartTime = FPlatformTime::Seconds();
+        if (!TestTrue(TEXT("FlushAndWait[N] should succeed"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything)))
+        {
+            break;
+        }
+        FlushMillisec.Add((FPlatformTime::Seconds() - StartTime) * 1000.0);
+    }
+    TestEqual(TEXT("Every flush should ship its line"), PayloadProcessor->Payloads.Num(), NumFlushes);
+    if (TestEqual(TEXT("Every flush should be timed"), FlushMillisec.Num(), NumFlushes))
+    {
+        FlushMillisec.Sort();
+        const double MedianMillisec = FlushMillisec[NumFlushes / 2];
+        AddInfo(FString::Printf(TEXT("FlushAndWait latency: p50=%.3lf ms, max=%.3lf ms"), MedianMillisec, FlushMillisec.Last()));
+        // The worker is woken up by the flush request and the caller by the flush completing, so there is no polling interval to wait out.
+        // Both used to poll every 100 ms, which put the median near 100 ms, so polling cannot meet this bound. The max is only reported, a loaded machine can stall any one flush.
+        constexpr double MaxMedianMillisec = 20.0;
+        TestTrue(TEXT("FlushAndWait should not wait for a polling interval"), MedianMillisec < MaxMedianMillisec);
+    }
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(1, false, true, false, 10.0, FlushedEverything));
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestAdaptiveController, "sparklogs.UnitTests.AdaptiveController", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestAdaptiveController::RunTest(const FString& Parameters)
+{
+    typedef FsparklogsAdaptiveController::EDecision EDecision;
+    FsparklogsAdaptiveController Controller(1024 * 1024, 2.0);
+    TestEqual(TEXT("Initial bytes per request"), Controller.GetBytesPerRequest(), 1024 * 1024);
+
+    // A growing backlog with fast requests grows the chunk size and shortens the interval, up to the limits
+    TestEqual(TEXT("Backlog should grow"), (int32)Controller.OnSuccess(0.1, 8 * 1024 * 1024), (int32)EDecision::Grow);
+    TestEqual(TEXT("Bytes per request after growing"), Controller.GetBytesPerRequest(), 1024 * 1024 + FsparklogsAdaptiveController::BytesPerRequestStep);
+    TestEqual(TEXT("Interval after growing"), Controller.GetProcessingIntervalSecs(), 2.0 - FsparklogsAdaptiveController::ProcessingIntervalStepSecs);
+    for (int i = 0; i < 100; i++)
+    {
+        Controller.OnSuccess(0.1, 8 * 1024 * 1024);
+    }
+    TestEqual(TEXT("Bytes per request should stop at the maximum"), Controller.GetBytesPerRequest(), FsparklogsSettings::MaxBytesPerRequest);
+    TestEqual(TEXT("Interval should stop at the minimum"), Controller.GetProcessingIntervalSecs(), FsparklogsSettings::MinProcessingIntervalSecs);
+
+    // Failures and latency spikes back off multiplicatively
+    TestEqual(TEXT("Failure should back off"), (int32)Controller.OnFailure(), (int32)EDecision::BackOff);
+    TestEqual(TEXT("Bytes per request after failure"), Controller.GetBytesPerRequest(), FsparklogsSettings::MaxBytesPerRequest / 2);
+    TestEqual(TEXT("Interval after failure"), Controller.GetProcessingIntervalSecs(), FsparklogsSettings::MinProcessingIntervalSecs * 2.0);
+    TestEqual(TEXT("Latency spike should back off"), (int32)Controller.OnSuccess(5.0, 8 * 1024 * 1024), (int32)EDecision::BackOff);
+    TestEqual(TEXT("Bytes per request after latency spike"), Controller.GetBytesPerRequest(), FsparklogsSettings::MaxBytesPerRequest / 4);
+    for (int i = 0; i < 100; i++)
+    {
+        Controller.OnFailure();
+    }
+    TestEqual(TEXT("Bytes per request should stop at the minimum"), Controller.GetBytesPerRequest(), FsparklogsSettings::MinBytesPerRequest);
+    TestEqual(TEXT("Interval should stop at the idle maximum"), Controller.GetProcessingIntervalSecs(), FsparklogsAdaptiveController::MaxIdleProcessingIntervalSecs);
+
+    // With no backlog the interval lengthens, and a partial backlog leaves everything alone
+    FsparklogsAdaptiveController IdleController(1024 * 1024, 2.0);
+    TestEqual(TEXT("No backlog should be idle"), (int32)IdleController.OnSuccess(0.1, 0), (int32)EDecision::Idle);
+    TestEqual(TEXT("Interval after idle"), IdleController.GetProcessingIntervalSecs(), 2.0 + FsparklogsAdaptiveController::ProcessingIntervalStepSecs);
+    TestEqual(TEXT("Partial backlog should be steady"), (int32)IdleController.OnSuccess(0.1, 1024), (int32)EDecision::Steady);
+    TestEqual(TEXT("Bytes per request after steady"), IdleController.GetBytesPerRequest(), 1024 * 1024);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestStreamerStats, "sparklogs.UnitTests.StreamerStats", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestStreamerStats::RunTest(const FString& Parameters)
+{
+    FsparklogsStreamerStats Stats;
+    TestEqual(TEXT("No latency before any requests"), Stats.GetLatencyPercentileMillis(50.0), 0.0);
+    TestEqual(TEXT("No compression ratio before any requests"), Stats.GetCompressionRatio(), 0.0);
+    Stats.RecordRequest(0.005, true, 1000, 250);
+    Stats.RecordRequest(0.040, true, 1000, 250);
+    Stats.RecordRequest(0.040, false, 1000, 250);
+    Stats.RecordRequest(60.0, false, 0, 0);
+    TestEqual(TEXT("Requests"), Stats.NumRequests.GetValue(), (int64)4);
+    TestEqual(TEXT("Failed requests"), Stats.NumFailedRequests.GetValue(), (int64)2);
+    TestEqual(TEXT("Only acknowledged payloads count"), Stats.NumPayloads.GetValue(), (int64)2);
+    TestEqual(TEXT("Compression ratio"), Stats.GetCompressionRatio(), 4.0);
+    TestEqual(TEXT("p25 latency"), Stats.GetLatencyPercentileMillis(25.0), 10.0);
+    TestEqual(TEXT("p50 latency"), Stats.GetLatencyPercentileMillis(50.0), 50.0);
+    TestEqual(TEXT("p75 latency"), Stats.GetLatencyPercentileMillis(75.0), 50.0);
+    TestEqual(TEXT("p100 latency is past the last bound"), Stats.GetLatencyPercentileMillis(100.0), 30000.0);
+    TestEqual(TEXT("Slow request bucket"), Stats.LatencyBuckets[FsparklogsStreamerStats::NumLatencyBuckets - 1].GetValue(), (int64)1);
+    TestTrue(TEXT("Summary should count requests"), Stats.ToString().Contains(TEXT("requests=4, failed_requests=2")));
+    Stats.RecordBacklog(0);
+    TestEqual(TEXT("No backlog has no age"), Stats.GetBacklogAgeSecs(), 0.0);
+    Stats.RecordBacklog(100);
+    TestEqual(TEXT("Backlog bytes"), Stats.BacklogBytes.load(), (int64)100);
+
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n"));
+    LogWriter->Flush();
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::None;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, false, false, 10.0, FlushedEverything));
+    const FsparklogsStreamerStats& StreamerStats = Streamer->GetStats();
+    TestEqual(TEXT("Streamer lines read"), StreamerStats.NumLinesRead.GetValue(), (int64)2);
+    TestEqual(TEXT("Streamer bytes read"), StreamerStats.NumBytesRead.GetValue(), (int64)16);
+    TestEqual(TEXT("Streamer requests"), StreamerStats.NumRequests.GetValue(), (int64)1);
+    if (TestEqual(TEXT("Streamer payloads"), PayloadProcessor->Payloads.Num(), 1))
+    {
+        TestEqual(TEXT("Streamer payload bytes"), StreamerStats.NumPayloadBytes.GetValue(), (int64)PayloadProcessor->Payloads[0].Len());
+    }
+    TestEqual(TEXT("Streamer backlog"), StreamerStats.BacklogBytes.load(), (int64)0);
+    // A chunk that fails and is read again for the retry is only counted once it is shipped
+    PayloadProcessor->FailProcessing = true;
+    ITLWriteStringToFile(LogWriter, TEXT("Line 3\r\n"));
+    LogWriter->Flush();
+    TestFalse(TEXT("FlushAndWait should fail"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+    TestEqual(TEXT("Failed chunk is not counted as read"), StreamerStats.NumLinesRead.GetValue(), (int64)2);
+    PayloadProcessor->FailProcessing = false;
+    TestTrue(TEXT("FlushAndWait retry should succeed"), Streamer->FlushAndWait(1, true, true, false, 10.0, FlushedEverything));
+    TestEqual(TEXT("Retried chunk is counted once"), StreamerStats.NumLinesRead.GetValue(), (int64)3);
+    TestEqual(TEXT("Retried chunk bytes are counted once"), StreamerStats.NumBytesRead.GetValue(), (int64)24);
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestMemoryCaptureWakeup, "sparklogs.UnitTests.MemoryCaptureWakeup", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestMemoryCaptureWakeup::RunTest(const FString& Parameters)
+{
+    TSharedRef<FsparklogsMemoryCaptureDevice> CaptureDevice = MakeShared<FsparklogsMemoryCaptureDevice>(4096, nullptr);
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->BytesPerRequest = 100;
+    Settings->ProcessingIntervalSecs = 3600.0;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(CaptureDevice, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[initial] should succeed"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+
+    // Once a full chunk is buffered the worker should ship it without waiting for the (very long) processing interval
+    for (int i = 0; i < 10; i++)
+    {
+        const char* Line = "Line that is exactly 25\r\n";
+        TestTrue(TEXT("Write should fit"), CaptureDevice->Write((const uint8*)Line, FCStringAnsi::Strlen(Line)));
+    }
+    int NumPayloads = 0;
+    double StartTime = FPlatformTime::Seconds();
+    while (NumPayloads == 0 && FPlatformTime::Seconds() - StartTime < 10.0)
+    {
+        FPlatformProcess::SleepNoStats(0.01f);
+        FScopeLock ScopeLock(&PayloadProcessor->Lock);
+        NumPayloads = PayloadProcessor->Payloads.Num();
+    }
+    TestTrue(TEXT("Worker should be woken up by the capture device"), NumPayloads > 0);
+
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestEqual(TEXT("Every line should be shipped"), ITLGetPayloadMessages(PayloadProcessor->Payloads).Num(), 10);
+    Streamer.Reset();
+    return true;
+}
+
+/** Fills OutData with random log-like data made of ASCII, multi-byte UTF-8, CR/LF characters, and occasional byte order markers. */
+static void ITLGenerateRandomLineData(FRandomStream& Random, int Len, TArray<uint8>& OutData)
+{
+    static const char* Fragments[] = { "a", "bc", "hello world ", "\n", "\r\n", "\r", "\n\n", "\xCF\x80", "\xCE\xA9", "\xEF\xBB\xBF", "\t", " " };
+    OutData.Reset(Len + 16);
+    while (OutData.Num() < Len)
+    {
+        const char* Fragment = Fragments[Random.RandRange(0, UE_ARRAY_COUNT(Fragments) - 1)];
+        OutData.Append((const uint8*)Fragment, FCStringAnsi::Strlen(Fragment));
+    }
+    OutData.SetNum(Len, false);
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLineSplitter, "sparklogs.UnitTests.LineSplitter", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLineSplitter::RunTest(const FString& Parameters)
+{
+    // The vectorized newline index must produce exactly the same lines as the byte-at-a-time scan
+    FRandomStream Random(1234);
+    const int MaxLineLengths[] = { 1, 2, 3, 8, 63, 64, 65, 200, 16 * 1024 };
+    TArray<uint8> Data;
+    TArray<uint64> SimdBitmap, ScalarBitmap;
+    for (int Iteration = 0; Iteration < 400; Iteration++)
+    {
+        int Len = (Iteration < 130) ? Iteration : Random.RandRange(0, 8192);
+        ITLGenerateRandomLineData(Random, Len, Data);
+        SimdBitmap.SetNumZeroed(ITLGetNewlineBitmapWords(Len));
+        ScalarBitmap.SetNumZeroed(ITLGetNewlineBitmapWords(Len));
+        ITLBuildNewlineBitmap(Data.GetData(), Len, SimdBitmap.GetData(), false);
+        ITLBuildNewlineBitmap(Data.GetData(), Len, ScalarBitmap.GetData(), true);
+        if (!TestTrue(FString::Printf(TEXT("Newline bitmaps should match for len=%d"), Len), SimdBitmap == ScalarBitmap))
+        {
+            return false;
+        }
+        for (int MaxLineLength : MaxLineLengths)
+        {
+            FsparklogsLineSplitter Reference(Data.GetData(), Len, MaxLineLength, nullptr);
+            FsparklogsLineSplitter Indexed(Data.GetData(), Len, MaxLineLength, SimdBitmap.GetData());
+            int RefOffset = 0, RefLen = 0, IdxOffset = 0, IdxLen = 0;
+            while (true)
+            {
+                bool RefHaveLine = Reference.Next(RefOffset, RefLen);
+                bool IdxHaveLine = Indexed.Next(IdxOffset, IdxLen);
+                if (!TestEqual(FString::Printf(TEXT("Line presence should match for len=%d, max_line_length=%d"), Len, MaxLineLength), IdxHaveLine, RefHaveLine))
+                {
+                    return false;
+                }
+                if (!RefHaveLine)
+                {
+                    break;
+                }
+                if (!TestEqual(TEXT("Line offset should match"), IdxOffset, RefOffset) || !TestEqual(TEXT("Line length should match"), IdxLen, RefLen))
+                {
+                    return false;
+                }
+                TestTrue(TEXT("Line should not end with CR/LF"), Data[IdxOffset + IdxLen - 1] != '\n' && Data[IdxOffset + IdxLen - 1] != '\r');
+                TestTrue(TEXT("Line should not exceed max length"), IdxLen <= MaxLineLength);
+            }
+            TestEqual(FString::Printf(TEXT("Captured offset should match for len=%d, max_line_length=%d"), Len, MaxLineLength), Indexed.GetCapturedOffset(), Reference.GetCapturedOffset());
+        }
+    }
+    return true;
+}
+
+/** Generates a line of log-like text. EscapeDensity and UnicodeDensity are the approximate fraction of characters that need escaping or are multi-byte. */
+static void ITLGenerateRandomLogLine(FRandomStream& Random, int Len, float EscapeDensity, float UnicodeDensity, TArray<uint8>& OutData)
+{
+    static const char* EscapeFragments[] = { "\"", "\\", "\t", "\b", "\f", "\r", "\x01", "\x1F" };
+    static const char* UnicodeFragments[] = { "\xCF\x80", "\xCE\xA9", "\xE3\x81\x93", "\xE4\xB8\x96", "\xF0\x9F\x98\x80" };
+    static const char* PlainChars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .:;,-_=[]()/";
+    const int NumPlainChars = FCStringAnsi::Strlen(PlainChars);
+    OutData.Reset(Len + 8);
+    while (OutData.Num() < Len)
+    {
+        float Roll = Random.GetFraction();
+        if (Roll < EscapeDensity)
+        {
+            const char* Fragment = EscapeFragments[Random.RandRange(0, UE_ARRAY_COUNT(EscapeFragments) - 1)];
+            OutData.Append((const uint8*)Fragment, FCStringAnsi::Strlen(Fragment));
+        }
+        else if (Roll < EscapeDensity + UnicodeDensity)
+        {
+            const char* Fragment = UnicodeFragments[Random.RandRange(0, UE_ARRAY_COUNT(UnicodeFragments) - 1)];
+            OutData.Append((const uint8*)Fragment, FCStringAnsi::Strlen(Fragment));
+        }
+        else
+        {
+            OutData.Add((uint8)PlainChars[Random.RandRange(0, NumPlainChars - 1)]);
+        }
+    }
+}
+
+/**
+ * Collects the results of one benchmark and writes them as JSON to Saved/Automation/sparklogs-benchmarks/<Suite>.json
+ * (or the directory given by -SparkLogsBenchmarkDir=). If -SparkLogsBenchmarkBaselineDir= points at the output of a known-good run,
+ * every result that is more than -SparkLogsBenchmarkTolerance= (default 0.25) slower than its baseline fails the benchmark.
+ */
+class FITLBenchmarkReport
+{
+public:
+    FITLBenchmarkReport(FAutomationTestBase* InTest, const TCHAR* InSuite) : Test(InTest), Suite(InSuite) { }
+
+    /** Records one measurement (Lines is 0 if it does not apply) and reports it as test info. Returns the JSON result so more fields can be added. */
+    TSharedRef<FJsonObject> Add(const FString& Name, int64 Bytes, int64 Lines, double Seconds, const FString& Details = FString())
+    {
+        Seconds = FMath::Max(Seconds, 1e-9);
+        const double MBPerSec = (double)Bytes / (1024.0 * 1024.0) / Seconds;
+        const double LinesPerSec = (double)Lines / Seconds;
+        TSharedRef<FJsonObject> Result = MakeShared<FJsonObject>();
+        Result->SetStringField(TEXT("name"), Name);
+        Result->SetNumberField(TEXT("bytes"), (double)Bytes);
+        Result->SetNumberField(TEXT("lines"), (double)Lines);
+        Result->SetNumberField(TEXT("seconds"), Seconds);
+        Result->SetNumberField(TEXT("mb_per_sec"), MBPerSec);
+        Result->SetNumberField(TEXT("lines_per_sec"), LinesPerSec);
+        Results.Add(MakeShared<FJsonValueObject>(Result));
+        Test->AddInfo(FString::Printf(TEXT("%s %s: %.1lf MB/s, %.0lf lines/s%s%s"), *Suite, *Name, MBPerSec, LinesPerSec, Details.IsEmpty() ? TEXT("") : TEXT(", "), *Details));
+        return Result;
+    }
+
+    /** Writes the results and compares them against the baseline (if any). Returns false if anything regressed. */
+    bool Finish()
+    {
+        TSharedRef<FJsonObject> Report = MakeShared<FJsonObject>();
+        Report->SetStringField(TEXT("suite"), Suite);
+        Report->SetStringField(TEXT("platform"), FPlatformProperties::IniPlatformName());
+        Report->SetStringField(TEXT("cpu"), FPlatformMisc::GetCPUBrand().TrimStartAndEnd());
+        Report->SetStringField(TEXT("timestamp"), FDateTime::UtcNow().ToIso8601());
+        Report->SetArrayField(TEXT("results"), Results);
+        FString Json;
+        FJsonSerializer::Serialize(Report, TJsonWriterFactory<>::Create(&Json));
+        FString OutputDir = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Automation"), TEXT("sparklogs-benchmarks"));
+        FParse::Value(FCommandLine::Get(), TEXT("SparkLogsBenchmarkDir="), OutputDir);
+        const FString OutputPath = FPaths::Combine(OutputDir, Suite + TEXT(".json"));
+        if (!FFileHelper::SaveStringToFile(Json, *OutputPath))
+        {
+            Test->AddWarning(FString::Printf(TEXT("Failed to write benchmark results to %s"), *OutputPath));
+        }
+
+        FString BaselineDir;
+        if (!FParse::Value(FCommandLine::Get(), TEXT("SparkLogsBenchmarkBaselineDir="), BaselineDir))
+        {
+            return true;
+        }
+        double Tolerance = 0.25;
+        FParse::Value(FCommandLine::Get(), TEXT("SparkLogsBenchmarkTolerance="), Tolerance);
+        const FString BaselinePath = FPaths::Combine(BaselineDir, Suite + TEXT(".json"));
+        FString BaselineJson;
+        TSharedPtr<FJsonObject> Baseline;
+        if (!FFileHelper::LoadFileToString(BaselineJson, *BaselinePath) || !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(BaselineJson), Baseline) || !Baseline.IsValid())
+        {
+            Test->AddWarning(FString::Printf(TEXT("No baseline for %s in %s"), *Suite, *BaselinePath));
+            return true;
+        }
+        bool Passed = true;
+        const TArray<TSharedPtr<FJsonValue>>* BaselineResults = nullptr;
+        if (Baseline->TryGetArrayField(TEXT("results"), BaselineResults))
+        {
+            for (const TSharedPtr<FJsonValue>& BaselineValue : *BaselineResults)
+            {
+                const TSharedPtr<FJsonObject>& BaselineResult = BaselineValue->AsObject();
+                const FString Name = BaselineResult->GetStringField(TEXT("name"));
+                const double BaselineMBPerSec = BaselineResult->GetNumberField(TEXT("mb_per_sec"));
+                for (const TSharedPtr<FJsonValue>& Value : Results)
+                {
+                    const TSharedPtr<FJsonObject>& Result = Value->AsObject();
+                    const double MBPerSec = Result->GetNumberField(TEXT("mb_per_sec"));
+                    if (Result->GetStringField(TEXT("name")) == Name && MBPerSec < BaselineMBPerSec * (1.0 - Tolerance))
+                    {
+                        Test->AddError(FString::Printf(TEXT("%s %s regressed: %.1lf MB/s, baseline %.1lf MB/s (tolerance %.0lf%%)"), *Suite, *Name, MBPerSec, BaselineMBPerSec, Tolerance * 100.0));
+                        Passed = false;
+                    }
+                }
+            }
+        }
+        return Passed;
+    }
+
+private:
+    FAutomationTestBase* Test;
+    FString Suite;
+    TArray<TSharedPtr<FJsonValue>> Results;
+};
+
+/** The kinds of synthetic log data the benchmarks run on. */
+enum class EITLBenchmarkCorpus : uint8
+{
+    ShortLines,
+    LongLines,
+    UnicodeHeavy,
+    EscapeHeavy,
+    Callstacks,
+};
+static const EITLBenchmarkCorpus ITLBenchmarkCorpora[] = { EITLBenchmarkCorpus::ShortLines, EITLBenchmarkCorpus::LongLines, EITLBenchmarkCorpus::UnicodeHeavy, EITLBenchmarkCorpus::EscapeHeavy, EITLBenchmarkCorpus::Callstacks };
+
+static const TCHAR* ITLGetBenchmarkCorpusName(EITLBenchmarkCorpus Corpus)
+{
+    switch (Corpus)
+    {
+    case EITLBenchmarkCorpus::ShortLines: return TEXT("short-lines");
+    case EITLBenchmarkCorpus::LongLines: return TEXT("long-lines");
+    case EITLBenchmarkCorpus::UnicodeHeavy: return TEXT("unicode-heavy");
+    case EITLBenchmarkCorpus::EscapeHeavy: return TEXT("escape-heavy");
+    default: return TEXT("callstacks");
+    }
+}
+
+/** Generates at least Bytes of newline terminated log lines (with the engine's log line prefix) of one kind. Returns the number of lines. */
+static int64 ITLGenerateBenchmarkCorpus(EITLBenchmarkCorpus Corpus, int64 Bytes, TArray<uint8>& OutData)
+{
+    FRandomStream Random(42 + (int32)Corpus);
+    OutData.Reset(Bytes + 16 * 1024);
+    TArray<uint8> Body;
+    int64 NumLines = 0;
+    auto AppendLine = [&](const TCHAR* Category, const TArray<uint8>& LineBody)
+    {
+        FTCHARToUTF8 Prefix(*FString::Printf(TEXT("[2025.01.01-12.%02d.%02d:%03d][%3d]%s: "), (int)((NumLines / 60000) % 60), (int)((NumLines / 1000) % 60), (int)(NumLines % 1000), (int)(NumLines % 1000), Category));
+        OutData.Append((const uint8*)Prefix.Get(), Prefix.Length());
+        OutData.Append(LineBody);
+        OutData.Add('\n');
+        NumLines++;
+    };
+    while (OutData.Num() < Bytes)
+    {
+        switch (Corpus)
+        {
+        case EITLBenchmarkCorpus::ShortLines:
+            ITLGenerateRandomLogLine(Random, Random.RandRange(30, 100), 0.005f, 0.0f, Body);
+            break;
+        case EITLBenchmarkCorpus::LongLines:
+            ITLGenerateRandomLogLine(Random, Random.RandRange(2000, 8000), 0.002f, 0.0f, Body);
+            break;
+        case EITLBenchmarkCorpus::UnicodeHeavy:
+            ITLGenerateRandomLogLine(Random, Random.RandRange(100, 300), 0.005f, 0.3f, Body);
+            break;
+        case EITLBenchmarkCorpus::EscapeHeavy:
+            ITLGenerateRandomLogLine(Random, Random.RandRange(100, 300), 0.3f, 0.0f, Body);
+            break;
+        case EITLBenchmarkCorpus::Callstacks:
+        {
+            // An error followed by the callstack the engine logs with it, one frame per line
+            ITLGenerateRandomLogLine(Random, Random.RandRange(60, 120), 0.0f, 0.0f, Body);
+            AppendLine(TEXT("LogOutputDevice: Error"), Body);
+            const int NumFrames = Random.RandRange(10, 30);
+            for (int Frame = 0; Frame < NumFrames; Frame++)
+            {
+                FTCHARToUTF8 FrameLine(*FString::Printf(TEXT("[Callstack] 0x%016llx UnrealEditor-Engine.dll!UWorld::Tick%d() [D:\\build\\Engine\\Source\\Runtime\\Engine\\Private\\LevelTick%d.cpp:%d]"),
+                    (uint64)Random.GetUnsignedInt() << 16, Frame, Random.RandRange(0, 99), Random.RandRange(1, 5000)));
+                Body.Reset();
+                Body.Append((const uint8*)FrameLine.Get(), FrameLine.Length());
+                AppendLine(TEXT("LogOutputDevice"), Body);
+            }
+            continue;
+        }
+        }
+        AppendLine(TEXT("LogEngine"), Body);
+    }
+    return NumLines;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkLineSplitter, "sparklogs.Benchmarks.LineSplitter", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkLineSplitter::RunTest(const FString& Parameters)
+{
+    FITLBenchmarkReport Report(this, TEXT("LineSplitter"));
+    constexpr int64 CorpusBytes = 32 * 1024 * 1024;
+    const int ChunkSize = FsparklogsSettings::DefaultBytesPerRequest;
+    TArray<uint8> Data;
+    TArray<uint64> Bitmap;
+    Bitmap.SetNumZeroed(ITLGetNewlineBitmapWords(ChunkSize));
+    for (EITLBenchmarkCorpus Corpus : ITLBenchmarkCorpora)
+    {
+        ITLGenerateBenchmarkCorpus(Corpus, CorpusBytes, Data);
+        for (int ForceScalar = 0; ForceScalar <= 1; ForceScalar++)
+        {
+            // Split the data a chunk at a time the same way the streamer does, picking up after the last complete line
+            int64 NumLines = 0;
+            int64 Offset = 0;
+            const double StartTime = FPlatformTime::Seconds();
+            while (Offset < Data.Num())
+            {
+                const int Len = (int)FMath::Min<int64>(ChunkSize, Data.Num() - Offset);
+                ITLBuildNewlineBitmap(Data.GetData() + Offset, Len, Bitmap.GetData(), ForceScalar != 0);
+                FsparklogsLineSplitter Splitter(Data.GetData() + Offset, Len, 16 * 1024, Bitmap.GetData());
+                int LineOffset = 0, LineLen = 0;
+                while (Splitter.Next(LineOffset, LineLen))
+                {
+                    NumLines++;
+                }
+                if (Splitter.GetCapturedOffset() <= 0)
+                {
+                    break;
+                }
+                Offset += Splitter.GetCapturedOffset();
+            }
+            Report.Add(FString::Printf(TEXT("%s/%s"), ITLGetBenchmarkCorpusName(Corpus), ForceScalar ? TEXT("scalar") : TEXT("simd")), Offset, NumLines, FPlatformTime::Seconds() - StartTime);
+        }
+    }
+    return Report.Finish();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestEscapeJSON, "sparklogs.UnitTests.EscapeJSON", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestEscapeJSON::RunTest(const FString& Parameters)
+{
+    // The vectorized escaper must produce exactly the same output as the byte-at-a-time escaper
+    FRandomStream Random(4321);
+    const float Densities[] = { 0.0f, 0.01f, 0.1f, 0.5f, 1.0f };
+    TArray<uint8> Line;
+    TITLJSONStringBuilder Fast, Scalar;
+    for (int Iteration = 0; Iteration < 1000; Iteration++)
+    {
+        int Len = (Iteration < 100) ? Iteration : Random.RandRange(0, 2000);
+        ITLGenerateRandomLogLine(Random, Len, Densities[Iteration % UE_ARRAY_COUNT(Densities)], Densities[(Iteration / 5) % UE_ARRAY_COUNT(Densities)] * 0.5f, Line);
+        Fast.Reset();
+        Scalar.Reset();
+        ITLAppendUTF8AsEscapedJsonString(Fast, (const ANSICHAR*)Line.GetData(), Line.Num(), false);
+        ITLAppendUTF8AsEscapedJsonString(Scalar, (const ANSICHAR*)Line.GetData(), Line.Num(), true);
+        if (!TestTrue(FString::Printf(TEXT("Escaped output should match for iteration=%d, len=%d"), Iteration, Line.Num()), Fast.Len() == Scalar.Len() && 0 == FMemory::Memcmp(Fast.GetData(), Scalar.GetData(), Fast.Len())))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkEscapeJSON, "sparklogs.Benchmarks.EscapeJSON", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkEscapeJSON::RunTest(const FString& Parameters)
+{
+    struct FLineMix
+    {
+        const TCHAR* Name;
+        int LineLen;
+        float EscapeDensity;
+        float UnicodeDensity;
+    };
+    const FLineMix Mixes[] = {
+        { TEXT("short-ascii"), 80, 0.0f, 0.0f },
+        { TEXT("typical-log"), 200, 0.005f, 0.0f },
+        { TEXT("long-ascii"), 4000, 0.001f, 0.0f },
+        { TEXT("paths-and-quotes"), 200, 0.05f, 0.0f },
+        { TEXT("unicode-heavy"), 200, 0.005f, 0.3f },
+        { TEXT("escape-heavy"), 200, 0.5f, 0.0f },
+    };
+    constexpr int CorpusBytes = 8 * 1024 * 1024;
+    FRandomStream Random(42);
+    TITLJSONStringBuilder Builder;
+    FITLBenchmarkReport Report(this, TEXT("EscapeJSON"));
+    for (const FLineMix& Mix : Mixes)
+    {
+        TArray<TArray<uint8>> Lines;
+        int64 TotalBytes = 0;
+        while (TotalBytes < CorpusBytes)
+        {
+            TArray<uint8>& Line = Lines.AddDefaulted_GetRef();
+            ITLGenerateRandomLogLine(Random, Mix.LineLen, Mix.EscapeDensity, Mix.UnicodeDensity, Line);
+            TotalBytes += Line.Num();
+        }
+        double Seconds[2];
+        for (int ForceScalar = 0; ForceScalar <= 1; ForceScalar++)
+        {
+            double StartTime = FPlatformTime::Seconds();
+            for (const TArray<uint8>& Line : Lines)
+            {
+                Builder.Reset();
+                ITLAppendUTF8AsEscapedJsonString(Builder, (const ANSICHAR*)Line.GetData(), Line.Num(), ForceScalar != 0);
+            }
+            Seconds[ForceScalar] = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+        }
+        Report.Add(FString::Printf(TEXT("%s/simd"), Mix.Name), TotalBytes, Lines.Num(), Seconds[0], FString::Printf(TEXT("speedup=%.2lfx"), Seconds[1] / Seconds[0]));
+        Report.Add(FString::Printf(TEXT("%s/scalar"), Mix.Name), TotalBytes, Lines.Num(), Seconds[1]);
+    }
+    return Report.Finish();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLogLinePrefix, "sparklogs.UnitTests.LogLinePrefix", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLogLinePrefix::RunTest(const FString& Parameters)
+{
+    struct FCase
+    {
+        const ANSICHAR* Line;
+        const ANSICHAR* ExpectedFields;
+    };
+    const FCase Cases[] = {
+        { "[2025.01.01-12.34.56:789][123]LogNet: Warning: Connection lost", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":123,\"category\":\"LogNet\",\"severity\":\"Warning\",\"message\":\"Connection lost\"" },
+        { "[2025.01.01-12.34.56:789][  5]LogTemp: say \"hi\"", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":5,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"say \\\"hi\\\"\"" },
+        { "[2025.01.01-12.34.56:789][ 42]LogInit: VeryVerbose: a: b", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":42,\"category\":\"LogInit\",\"severity\":\"VeryVerbose\",\"message\":\"a: b\"" },
+        { "[2025.01.01-12.34.56:789][  5]LogTemp: Warnings: x", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":5,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"Warnings: x\"" },
+        { "[2025.01.01-12.34.56:789][  5]LogTemp: Warning:", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":5,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"Warning:\"" },
+        { "[2025.01.01-12.34.56:789][  5]no category here", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":5,\"message\":\"no category here\"" },
+        { "[2025.01.01-12.34.56:789][  5]", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":5,\"message\":\"\"" },
+        { "LogInit: Display: no timestamp", "\"message\":\"LogInit: Display: no timestamp\"" },
+        { "[2025.01.01-12.34.56:78][  5]LogTemp: short millis", "\"message\":\"[2025.01.01-12.34.56:78][  5]LogTemp: short millis\"" },
+        { "[2025.01.01-12.34.56:789][007]LogTemp: x", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":7,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"x\"" },
+        { "[2025.01.01-12.34.56:789][000]LogTemp: x", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":0,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"x\"" },
+        { "[2025.01.01-12.34.56:789][0000000000000000000000012]LogTemp: x", "\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":12,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"x\"" },
+        { "[2025.01.01-12.34.56:789][99999999999999999999]LogTemp: x", "\"message\":\"[2025.01.01-12.34.56:789][99999999999999999999]LogTemp: x\"" },
+        { "[2025.01.01-12.34.56:789][   ]LogTemp: no frame", "\"message\":\"[2025.01.01-12.34.56:789][   ]LogTemp: no frame\"" },
+        { "[2025.01.01-12.34.56:789]", "\"message\":\"[2025.01.01-12.34.56:789]\"" },
+        { "", "\"message\":\"\"" },
+    };
+    TITLJSONStringBuilder Builder;
+    for (const FCase& Case : Cases)
+    {
+        Builder.Reset();
+        ITLAppendLogLineAsParsedJsonFields(Builder, Case.Line, FCStringAnsi::Strlen(Case.Line));
+        TestEqual(FString::Printf(TEXT("Parsed fields for '%s'"), ANSI_TO_TCHAR(Case.Line)), FString(ANSI_TO_TCHAR(Builder.ToString())), FString(ANSI_TO_TCHAR(Case.ExpectedFields)));
+    }
+
+    // End to end through the streamer
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("[2025.01.01-12.34.56:789][123]LogNet: Error: Oops\r\nplain line\r\n"));
+    LogWriter->Flush();
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(TEXT("[{\"timestamp\":\"2025-01-01T12:34:56.789\",\"frame\":123,\"category\":\"LogNet\",\"severity\":\"Error\",\"message\":\"Oops\"},{\"message\":\"plain line\"}]"));
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->ParseLogPrefix = true;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkLogLinePrefix, "sparklogs.Benchmarks.LogLinePrefix", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkLogLinePrefix::RunTest(const FString& Parameters)
+{
+    // Lines as the engine writes them, with a mix of verbosities
+    constexpr int CorpusBytes = 8 * 1024 * 1024;
+    const TCHAR* Severities[] = { TEXT(""), TEXT(""), TEXT(""), TEXT("Display: "), TEXT("Warning: "), TEXT("Error: ") };
+    TArray<TArray<uint8>> Lines;
+    int64 TotalBytes = 0;
+    for (int Iteration = 0; TotalBytes < CorpusBytes; Iteration++)
+    {
+        FString Line = FString::Printf(TEXT("[2025.01.01-12.%02d.%02d:%03d][%3d]LogEngine: %s%s"), (Iteration / 60000) % 60, (Iteration / 1000) % 60, Iteration % 1000, Iteration % 1000, Severities[Iteration % UE_ARRAY_COUNT(Severities)], *ITLFormatStressTestMessage(1000.0 + Iteration * 0.013, Iteration % 50));
+        FTCHARToUTF8 Converter(*Line, Line.Len());
+        Lines.Emplace((const uint8*)Converter.Get(), Converter.Length());
+        TotalBytes += Converter.Length();
+    }
+    TITLJSONStringBuilder Builder;
+    double Seconds[2];
+    int64 OutputBytes[2] = { 0, 0 };
+    for (int Parse = 0; Parse <= 1; Parse++)
+    {
+        double StartTime = FPlatformTime::Seconds();
+        for (const TArray<uint8>& Line : Lines)
+        {
+            Builder.Reset();
+            if (Parse != 0)
+            {
+                ITLAppendLogLineAsParsedJsonFields(Builder, (const ANSICHAR*)Line.GetData(), Line.Num());
+            }
+            else
+            {
+                Builder.Append("\"message\":");
+                ITLAppendUTF8AsEscapedJsonString(Builder, (const ANSICHAR*)Line.GetData(), Line.Num());
+            }
+            OutputBytes[Parse] += Builder.Len();
+        }
+        Seconds[Parse] = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+    }
+    double MB = (double)TotalBytes / (1024.0 * 1024.0);
+    FITLBenchmarkReport Report(this, TEXT("LogLinePrefix"));
+    Report.Add(TEXT("raw"), TotalBytes, Lines.Num(), Seconds[0], FString::Printf(TEXT("output=%.1lf MB"), (double)OutputBytes[0] / (1024.0 * 1024.0)));
+    Report.Add(TEXT("parsed"), TotalBytes, Lines.Num(), Seconds[1], FString::Printf(TEXT("output=%.1lf MB, parse cost=%.3lf ms/MB (%.1lf ns/line)"),
+        (double)OutputBytes[1] / (1024.0 * 1024.0), (Seconds[1] - Seconds[0]) * 1000.0 / MB, (Seconds[1] - Seconds[0]) * 1e9 / Lines.Num()));
+    return Report.Finish();
+}
+
+/** Appends stress test generator log lines (as they appear in the logfile) framed as JSON the same way as in a payload, until OutData has at least Len bytes. */
+static void ITLGenerateStressTestPayload(int& InOutIteration, int Len, TITLJSONStringBuilder& OutData)
+{
+    OutData.Reset();
+    OutData.Append("[");
+    while (OutData.Len() < Len)
+    {
+        if (OutData.Len() > 1)
+        {
+            OutData.Append(",");
+        }
+        FString Line = FString::Printf(TEXT("[2025.01.01-12.%02d.%02d:%03d][%3d]LogEngine: %s"), (InOutIteration / 60000) % 60, (InOutIteration / 1000) % 60, InOutIteration % 1000, InOutIteration % 1000, *ITLFormatStressTestMessage(1000.0 + InOutIteration * 0.013, InOutIteration % 50));
+        FTCHARToUTF8 Converter(*Line, Line.Len());
+        OutData.Append("{\"message\":");
+        ITLAppendUTF8AsEscapedJsonString(OutData, (const ANSICHAR*)Converter.Get(), Converter.Length());
+        OutData.Append("}");
+        InOutIteration++;
+    }
+    OutData.Append("]");
+}
+
+static TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> ITLTrainStressTestDictionary()
+{
+    int Iteration = 0;
+    TITLJSONStringBuilder Samples;
+    ITLGenerateStressTestPayload(Iteration, 1024 * 1024, Samples);
+    TArray<uint8> Dictionary;
+    ITLTrainCompressionDictionary(TArray<uint8>((const uint8*)Samples.GetData(), Samples.Len()), FsparklogsCompressionDictionary::MaxSize, Dictionary);
+    return MakeShared<FsparklogsCompressionDictionary, ESPMode::ThreadSafe>(Dictionary.GetData(), Dictionary.Num());
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestCompressionDictionary, "sparklogs.UnitTests.CompressionDictionary", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestCompressionDictionary::RunTest(const FString& Parameters)
+{
+    TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> Dictionary = ITLTrainStressTestDictionary();
+    TestTrue(TEXT("Dictionary should not be empty"), Dictionary->GetData().Num() > 0);
+    TestTrue(TEXT("Dictionary should not exceed the maximum size"), Dictionary->GetData().Num() <= FsparklogsCompressionDictionary::MaxSize);
+
+    // Payload data the dictionary was not trained on
+    int Iteration = 1000000;
+    TITLJSONStringBuilder Payload;
+    ITLGenerateStressTestPayload(Iteration, 4 * 1024, Payload);
+    FsparklogsCompressionOptions Options;
+    Options.Dictionary = Dictionary;
+    TArray<uint8> Plain, Primed, Decompressed;
+    TestTrue(TEXT("LZ4 compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4, (const uint8*)Payload.GetData(), Payload.Len(), Plain, Options));
+    TestTrue(TEXT("LZ4Dictionary compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4Dictionary, (const uint8*)Payload.GetData(), Payload.Len(), Primed, Options));
+    AddInfo(FString::Printf(TEXT("4 KB payload: lz4=%d bytes, lz4dict=%d bytes"), Plain.Num(), Primed.Num()));
+    TestTrue(TEXT("Dictionary should improve compression of a small payload"), Primed.Num() < Plain.Num());
+    TestFalse(TEXT("LZ4Dictionary compression should fail without a dictionary"), ITLCompressData(ITLCompressionMode::LZ4Dictionary, (const uint8*)Payload.GetData(), Payload.Len(), Decompressed));
+    TestFalse(TEXT("LZ4Dictionary decompression should fail without a dictionary"), ITLDecompressData(ITLCompressionMode::LZ4Dictionary, Primed.GetData(), Primed.Num(), Payload.Len(), Decompressed));
+    TestTrue(TEXT("LZ4Dictionary decompression should succeed"), ITLDecompressData(ITLCompressionMode::LZ4Dictionary, Primed.GetData(), Primed.Num(), Payload.Len(), Decompressed, Dictionary.Get()));
+    TestTrue(TEXT("LZ4Dictionary should round trip"), Decompressed.Num() == Payload.Len() && FMemory::Memcmp(Decompressed.GetData(), Payload.GetData(), Payload.Len()) == 0);
+
+    // End to end through the streamer
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, *(ITLFormatStressTestMessage(1.0, 1) + TEXT("\r\n") + ITLFormatStressTestMessage(2.0, 2) + TEXT("\r\n")));
+    LogWriter->Flush();
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(FString::Printf(TEXT("[{\"message\":\"%s\"},{\"message\":\"%s\"}]"), *ITLFormatStressTestMessage(1.0, 1), *ITLFormatStressTestMessage(2.0, 2)));
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::LZ4Dictionary;
+    Settings->CompressionDictionary = Dictionary;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLZ4Frame, "sparklogs.UnitTests.LZ4Frame", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLZ4Frame::RunTest(const FString& Parameters)
+{
+    // Spans many blocks, so later blocks have to reference the ones before them
+    int Iteration = 0;
+    TITLJSONStringBuilder Payload;
+    ITLGenerateStressTestPayload(Iteration, 8 * FsparklogsLZ4FrameEncoder::BlockSize + 123, Payload);
+    TArray<uint8> Compressed, Decompressed;
+    TestTrue(TEXT("LZ4Frame compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4Frame, (const uint8*)Payload.GetData(), Payload.Len(), Compressed));
+    const uint8 ExpectedHeader[] = { 0x04, 0x22, 0x4D, 0x18, 0x40, 0x70, 0xDF };
+    TestTrue(TEXT("LZ4Frame should start with the frame header"), Compressed.Num() > (int)sizeof(ExpectedHeader) && FMemory::Memcmp(Compressed.GetData(), ExpectedHeader, sizeof(ExpectedHeader)) == 0);
+    TestTrue(TEXT("LZ4Frame should end with the end mark"), Compressed.Num() > 4 && FMemory::Memcmp(Compressed.GetData() + Compressed.Num() - 4, "\0\0\0\0", 4) == 0);
+    TestTrue(TEXT("LZ4Frame should compress"), Compressed.Num() < Payload.Len() / 2);
+    TestTrue(TEXT("LZ4Frame decompression should succeed"), ITLDecompressData(ITLCompressionMode::LZ4Frame, Compressed.GetData(), Compressed.Num(), Payload.Len(), Decompressed));
+    TestTrue(TEXT("LZ4Frame should round trip"), Decompressed.Num() == Payload.Len() && FMemory::Memcmp(Decompressed.GetData(), Payload.GetData(), Payload.Len()) == 0);
+    TestFalse(TEXT("LZ4Frame decompression should fail on a truncated frame"), ITLDecompressData(ITLCompressionMode::LZ4Frame, Compressed.GetData(), Compressed.Num() - 5, Payload.Len(), Decompressed));
+
+    // Incompressible blocks are stored as-is
+    FRandomStream Random(42);
+    TArray<uint8> Noise;
+    Noise.SetNumUninitialized(3 * FsparklogsLZ4FrameEncoder::BlockSize);
+    for (uint8& Byte : Noise)
+    {
+        Byte = (uint8)Random.RandRange(0, 255);
+    }
+    TestTrue(TEXT("LZ4Frame compression of noise should succeed"), ITLCompressData(ITLCompressionMode::LZ4Frame, Noise.GetData(), Noise.Num(), Compressed));
+    TestTrue(TEXT("LZ4Frame decompression of noise should succeed"), ITLDecompressData(ITLCompressionMode::LZ4Frame, Compressed.GetData(), Compressed.Num(), Noise.Num(), Decompressed));
+    TestTrue(TEXT("LZ4Frame should round trip noise"), Decompressed == Noise);
+
+    // End to end through the streamer, with a payload larger than one block
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    TITLJSONStringBuilder ExpectedPayload;
+    ExpectedPayload.Append("[");
+    for (int i = 0; i < 2000; i++)
+    {
+        FString Message = ITLFormatStressTestMessage(1.0 + i, i);
+        ITLWriteStringToFile(LogWriter, *(Message + TEXT("\r\n")));
+        FTCHARToUTF8 Converter(*Message, Message.Len());
+        ExpectedPayload.Append(i > 0 ? ",{\"message\":" : "{\"message\":");
+        ITLAppendUTF8AsEscapedJsonString(ExpectedPayload, (const ANSICHAR*)Converter.Get(), Converter.Length());
+        ExpectedPayload.Append("}");
+    }
+    ExpectedPayload.Append("]");
+    LogWriter->Flush();
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(ITLConvertUTF8(ExpectedPayload.GetData(), ExpectedPayload.Len()));
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::LZ4Frame;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestLZ4MultiBlock, "sparklogs.UnitTests.LZ4MultiBlock", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestLZ4MultiBlock::RunTest(const FString& Parameters)
+{
+    int Iteration = 0;
+    TITLJSONStringBuilder Payload;
+    FsparklogsCompressionOptions Options;
+    ITLGenerateStressTestPayload(Iteration, 5 * Options.MultiBlockSize + 123, Payload);
+    TArray<uint8> Compressed, Decompressed;
+    TestTrue(TEXT("LZ4MultiBlock compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4MultiBlock, (const uint8*)Payload.GetData(), Payload.Len(), Compressed, Options));
+    const int ExpectedBlocks = (Payload.Len() + Options.MultiBlockSize - 1) / Options.MultiBlockSize;
+    TestTrue(TEXT("LZ4MultiBlock should start with the block count"), Compressed.Num() > 4 + ExpectedBlocks * 8 && Compressed[0] == ExpectedBlocks && Compressed[1] == 0 && Compressed[2] == 0 && Compressed[3] == 0);
+    TestTrue(TEXT("LZ4MultiBlock should compress"), Compressed.Num() < Payload.Len() / 2);
+    TestTrue(TEXT("LZ4MultiBlock decompression should succeed"), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Compressed.GetData(), Compressed.Num(), Payload.Len(), Decompressed));
+    TestTrue(TEXT("LZ4MultiBlock should round trip"), Decompressed.Num() == Payload.Len() && FMemory::Memcmp(Decompressed.GetData(), Payload.GetData(), Payload.Len()) == 0);
+    TestFalse(TEXT("LZ4MultiBlock decompression should fail on truncated data"), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Compressed.GetData(), Compressed.Num() - 5, Payload.Len(), Decompressed));
+    TestFalse(TEXT("LZ4MultiBlock decompression should fail if the original length is too small"), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Compressed.GetData(), Compressed.Num(), Payload.Len() - 1, Decompressed));
+    TArray<uint8> Corrupted = Compressed;
+    Corrupted[4] ^= 0x01;
+    TestFalse(TEXT("LZ4MultiBlock decompression should fail on a corrupted block table"), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Corrupted.GetData(), Corrupted.Num(), Payload.Len(), Decompressed));
+
+    // The thread cap only changes how the blocks are scheduled, not the output
+    for (int32 MaxThreads : { 1, 2, 64 })
+    {
+        FsparklogsCompressionOptions CappedOptions;
+        CappedOptions.MaxThreads = MaxThreads;
+        TArray<uint8> Capped;
+        TestTrue(FString::Printf(TEXT("LZ4MultiBlock compression on %d threads should succeed"), MaxThreads), ITLCompressData(ITLCompressionMode::LZ4MultiBlock, (const uint8*)Payload.GetData(), Payload.Len(), Capped, CappedOptions));
+        TestTrue(FString::Printf(TEXT("LZ4MultiBlock on %d threads should match"), MaxThreads), Capped == Compressed);
+        TestTrue(FString::Printf(TEXT("LZ4MultiBlock decompression on %d threads should round trip"), MaxThreads), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Capped.GetData(), Capped.Num(), Payload.Len(), Decompressed, nullptr, MaxThreads)
+            && Decompressed.Num() == Payload.Len() && FMemory::Memcmp(Decompressed.GetData(), Payload.GetData(), Payload.Len()) == 0);
+    }
+
+    // Must match a single LZ4 block when the payload fits in one block, apart from the table
+    TArray<uint8> Single;
+    FsparklogsCompressionOptions LargeBlocks;
+    LargeBlocks.MultiBlockSize = Payload.Len();
+    TestTrue(TEXT("LZ4MultiBlock compression with one block should succeed"), ITLCompressData(ITLCompressionMode::LZ4MultiBlock, (const uint8*)Payload.GetData(), Payload.Len(), Single, LargeBlocks));
+    TestTrue(TEXT("LZ4 compression should succeed"), ITLCompressData(ITLCompressionMode::LZ4, (const uint8*)Payload.GetData(), Payload.Len(), Compressed));
+    TestTrue(TEXT("LZ4MultiBlock with one block should hold a plain LZ4 block"), Single.Num() == Compressed.Num() + 12 && FMemory::Memcmp(Single.GetData() + 12, Compressed.GetData(), Compressed.Num()) == 0);
+
+    // Incompressible data
+    FRandomStream Random(42);
+    TArray<uint8> Noise;
+    Noise.SetNumUninitialized(3 * Options.MultiBlockSize - 7);
+    for (uint8& Byte : Noise)
+    {
+        Byte = (uint8)Random.RandRange(0, 255);
+    }
+    TestTrue(TEXT("LZ4MultiBlock compression of noise should succeed"), ITLCompressData(ITLCompressionMode::LZ4MultiBlock, Noise.GetData(), Noise.Num(), Compressed));
+    TestTrue(TEXT("LZ4MultiBlock decompression of noise should succeed"), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Compressed.GetData(), Compressed.Num(), Noise.Num(), Decompressed));
+    TestTrue(TEXT("LZ4MultiBlock should round trip noise"), Decompressed == Noise);
+
+    TArray<uint8> Empty;
+    TestTrue(TEXT("LZ4MultiBlock compression of empty data should succeed"), ITLCompressData(ITLCompressionMode::LZ4MultiBlock, nullptr, 0, Empty));
+    TestTrue(TEXT("LZ4MultiBlock decompression of empty data should succeed"), ITLDecompressData(ITLCompressionMode::LZ4MultiBlock, Empty.GetData(), Empty.Num(), 0, Decompressed) && Decompressed.Num() == 0);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestGzipDeflate, "sparklogs.UnitTests.GzipDeflate", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestGzipDeflate::RunTest(const FString& Parameters)
+{
+    int Iteration = 0;
+    TITLJSONStringBuilder Payload;
+    ITLGenerateStressTestPayload(Iteration, 256 * 1024, Payload);
+    for (int Level : { 1, 6, 9 })
+    {
+        FsparklogsCompressionOptions Options;
+        Options.DeflateLevel = Level;
+        TArray<uint8> Gzip, Deflate, Decompressed;
+        TestTrue(FString::Printf(TEXT("Gzip[%d] compression should succeed"), Level), ITLCompressData(ITLCompressionMode::Gzip, (const uint8*)Payload.GetData(), Payload.Len(), Gzip, Options));
+        TestTrue(FString::Printf(TEXT("Gzip[%d] should start with the gzip magic bytes"), Level), Gzip.Num() > 2 && Gzip[0] == 0x1F && Gzip[1] == 0x8B);
+        TestTrue(FString::Printf(TEXT("Gzip[%d] should compress"), Level), Gzip.Num() < Payload.Len() / 4);
+        TestTrue(FString::Printf(TEXT("Gzip[%d] decompression should succeed"), Level), ITLDecompressData(ITLCompressionMode::Gzip, Gzip.GetData(), Gzip.Num(), Payload.Len(), Decompressed));
+        TestTrue(FString::Printf(TEXT("Gzip[%d] should round trip"), Level), Decompressed.Num() == Payload.Len() && FMemory::Memcmp(Decompressed.GetData(), Payload.GetData(), Payload.Len()) == 0);
+
+        TestTrue(FString::Printf(TEXT("Deflate[%d] compression should succeed"), Level), ITLCompressData(ITLCompressionMode::Deflate, (const uint8*)Payload.GetData(), Payload.Len(), Deflate, Options));
+        // zlib header: deflate with a 32 KB window, and a check value that makes the first two bytes a multiple of 31
+        TestTrue(FString::Printf(TEXT("Deflate[%d] should start with a zlib header"), Level), Deflate.Num() > 2 && Deflate[0] == 0x78 && ((Deflate[0] << 8) | Deflate[1]) % 31 == 0);
+        TestTrue(FString::Printf(TEXT("Deflate[%d] decompression should succeed"), Level), ITLDecompressData(ITLCompressionMode::Deflate, Deflate.GetData(), Deflate.Num(), Payload.Len(), Decompressed));
+        TestTrue(FString::Printf(TEXT("Deflate[%d] should round trip"), Level), Decompressed.Num() == Payload.Len() && FMemory::Memcmp(Decompressed.GetData(), Payload.GetData(), Payload.Len()) == 0);
+        TestFalse(FString::Printf(TEXT("Deflate[%d] data should not decompress as gzip"), Level), ITLDecompressData(ITLCompressionMode::Gzip, Deflate.GetData(), Deflate.Num(), Payload.Len(), Decompressed));
+    }
+    TArray<uint8> Empty, Decompressed;
+    TestTrue(TEXT("Gzip compression of empty data should succeed"), ITLCompressData(ITLCompressionMode::Gzip, nullptr, 0, Empty));
+    TestTrue(TEXT("Gzip decompression of empty data should succeed"), ITLDecompressData(ITLCompressionMode::Gzip, Empty.GetData(), Empty.Num(), 0, Decompressed) && Decompressed.Num() == 0);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkCompression, "sparklogs.Benchmarks.Compression", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkCompression::RunTest(const FString& Parameters)
+{
+    struct FMode
+    {
+        const TCHAR* Name;
+        ITLCompressionMode Mode;
+        int32 LZ4Acceleration;
+        int32 DeflateLevel;
+    };
+    const FMode Modes[] = {
+        { TEXT("none"), ITLCompressionMode::None, 1, 1 },
+        { TEXT("lz4"), ITLCompressionMode::LZ4, 1, 1 },
+        { TEXT("lz4-accel8"), ITLCompressionMode::LZ4, 8, 1 },
+        { TEXT("lz4dict"), ITLCompressionMode::LZ4Dictionary, 1, 1 },
+        { TEXT("lz4frame"), ITLCompressionMode::LZ4Frame, 1, 1 },
+        { TEXT("lz4multiblock"), ITLCompressionMode::LZ4MultiBlock, 1, 1 },
+        { TEXT("gzip-1"), ITLCompressionMode::Gzip, 1, 1 },
+        { TEXT("gzip-6"), ITLCompressionMode::Gzip, 1, 6 },
+        { TEXT("gzip-9"), ITLCompressionMode::Gzip, 1, 9 },
+        { TEXT("deflate-1"), ITLCompressionMode::Deflate, 1, 1 },
+    };
+    // 4 MB is where lz4multiblock spreads over enough blocks to use several cores
+    const int PayloadSizes[] = { 16 * 1024, 128 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+    constexpr int64 BytesPerRun = 32 * 1024 * 1024;
+    TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> Dictionary = ITLTrainStressTestDictionary();
+    FITLBenchmarkReport Report(this, TEXT("Compression"));
+    for (int PayloadSize : PayloadSizes)
+    {
+        // Data the dictionary was not trained on
+        int Iteration = 1000000;
+        TITLJSONStringBuilder Builder;
+        TArray<TArray<uint8>> Payloads;
+        Payloads.SetNum(FMath::Max((int)(BytesPerRun / PayloadSize), 1));
+        int64 TotalBytes = 0;
+        for (TArray<uint8>& Payload : Payloads)
+        {
+            ITLGenerateStressTestPayload(Iteration, PayloadSize, Builder);
+            Payload.Append((const uint8*)Builder.GetData(), Builder.Len());
+            TotalBytes += Payload.Num();
+        }
+        for (const FMode& Mode : Modes)
+        {
+            FsparklogsCompressionOptions Options;
+            Options.LZ4Acceleration = Mode.LZ4Acceleration;
+            Options.DeflateLevel = Mode.DeflateLevel;
+            Options.Dictionary = Dictionary;
+            TArray<TArray<uint8>> Compressed;
+            Compressed.SetNum(Payloads.Num());
+            int64 CompressedBytes = 0;
+            double StartTime = FPlatformTime::Seconds();
+            for (int i = 0; i < Payloads.Num(); i++)
+            {
+                ITLCompressData(Mode.Mode, Payloads[i].GetData(), Payloads[i].Num(), Compressed[i], Options);
+                CompressedBytes += Compressed[i].Num();
+            }
+            double CompressSecs = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+            TArray<uint8> Decompressed;
+            StartTime = FPlatformTime::Seconds();
+            for (int i = 0; i < Payloads.Num(); i++)
+            {
+                ITLDecompressData(Mode.Mode, Compressed[i].GetData(), Compressed[i].Num(), Payloads[i].Num(), Decompressed, Dictionary.Get());
+            }
+            double DecompressSecs = FMath::Max(FPlatformTime::Seconds() - StartTime, 1e-9);
+            const double Ratio = (double)TotalBytes / FMath::Max<int64>(CompressedBytes, 1);
+            const double MB = (double)TotalBytes / (1024.0 * 1024.0);
+            TSharedRef<FJsonObject> Result = Report.Add(FString::Printf(TEXT("%s/%dKB"), Mode.Name, PayloadSize / 1024), TotalBytes, 0, CompressSecs, FString::Printf(TEXT("ratio=%.2lfx, decompress=%.1lf MB/s"), Ratio, MB / DecompressSecs));
+            Result->SetNumberField(TEXT("ratio"), Ratio);
+            Result->SetNumberField(TEXT("decompress_mb_per_sec"), MB / DecompressSecs);
+        }
+    }
+    return Report.Finish();
+}
+
+/** A payload processor that only counts what it is given, so it costs (almost) nothing. */
+class FITLCountingPayloadProcessor : public IsparklogsPayloadProcessor
+{
+public:
+    FThreadSafeCounter64 NumPayloadBytes;
+    virtual bool ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override
+    {
+        NumPayloadBytes.Add(PayloadLen);
+        return true;
+    }
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkEndToEnd, "sparklogs.Benchmarks.EndToEnd", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkEndToEnd::RunTest(const FString& Parameters)
+{
+    struct FMode
+    {
+        const TCHAR* Name;
+        ITLCompressionMode Mode;
+        bool ParseLogPrefix;
+        int PayloadBuildThreads;
+    };
+    const FMode Modes[] = {
+        { TEXT("none"), ITLCompressionMode::None, false, 1 },
+        { TEXT("lz4"), ITLCompressionMode::LZ4, false, 1 },
+        { TEXT("lz4-4threads"), ITLCompressionMode::LZ4, false, 4 },
+        { TEXT("lz4-parsed"), ITLCompressionMode::LZ4, true, 1 },
+        { TEXT("lz4-parsed-4threads"), ITLCompressionMode::LZ4, true, 4 },
+        { TEXT("gzip"), ITLCompressionMode::Gzip, false, 1 },
+    };
+    constexpr int64 CorpusBytes = 32 * 1024 * 1024;
+    FITLBenchmarkReport Report(this, TEXT("EndToEnd"));
+    TArray<uint8> Data;
+    for (EITLBenchmarkCorpus Corpus : ITLBenchmarkCorpora)
+    {
+        ITLGenerateBenchmarkCorpus(Corpus, CorpusBytes, Data);
+        for (const FMode& Mode : Modes)
+        {
+            FTempDirectory TempDir(ITLGetTestDir());
+            FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("bench-sparklogs.log"));
+            FFileHelper::SaveArrayToFile(Data, *TestLogFile);
+            TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+            Settings->CompressionMode = Mode.Mode;
+            Settings->ParseLogPrefix = Mode.ParseLogPrefix;
+            Settings->PayloadBuildThreads = Mode.PayloadBuildThreads;
+            TSharedRef<FITLCountingPayloadProcessor> PayloadProcessor(new FITLCountingPayloadProcessor());
+
+            // Everything from reading the logfile to handing off the compressed payloads
+            const double StartTime = FPlatformTime::Seconds();
+            TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+            bool FlushedEverything = false;
+            while (!FlushedEverything && Streamer->FlushAndWait(1, true, false, false, 60.0, FlushedEverything))
+            {
+            }
+            const double Seconds = FPlatformTime::Seconds() - StartTime;
+            TestTrue(FString::Printf(TEXT("%s/%s should ship everything"), ITLGetBenchmarkCorpusName(Corpus), Mode.Name), FlushedEverything);
+            const FsparklogsStreamerStats& Stats = Streamer->GetStats();
+            TSharedRef<FJsonObject> Result = Report.Add(FString::Printf(TEXT("%s/%s"), ITLGetBenchmarkCorpusName(Corpus), Mode.Name), Stats.NumBytesRead.GetValue(), Stats.NumLinesRead.GetValue(), Seconds,
+                FString::Printf(TEXT("payloads=%lld, compression_ratio=%.2lfx"), Stats.NumPayloads.GetValue(), Stats.GetCompressionRatio()));
+            Result->SetNumberField(TEXT("payloads"), (double)Stats.NumPayloads.GetValue());
+            Result->SetNumberField(TEXT("compression_ratio"), Stats.GetCompressionRatio());
+            Streamer->FlushAndWait(1, true, true, false, 10.0, FlushedEverything);
+            Streamer.Reset();
+        }
+    }
+    return Report.Finish();
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestMemoryCapture, "sparklogs.UnitTests.MemoryCapture", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestMemoryCapture::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestMemoryCapture::RunTest(const FString& Parameters)
+{
+    TArray<FString> ExpectedPayloads;
+
+    TSharedRef<FsparklogsMemoryCaptureDevice> CaptureDevice = MakeShared<FsparklogsMemoryCaptureDevice>(64, nullptr);
+    const char* Data1 = "Line 1\r\nLine 2\r\n1234";
+    TestTrue(TEXT("Write[1] should fit"), CaptureDevice->Write((const uint8*)Data1, FCStringAnsi::Strlen(Data1)));
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(CaptureDevice, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Line 2\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[1] should succeed"), Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[1] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestFalse(TEXT("FlushAndWait[1] should NOT capture everything"), FlushedEverything);
+
+    // The ring buffer is 64 bytes; the partial line (4 bytes) is still held, so 61 more bytes cannot fit but 60 can
+    TArray<uint8> TooLarge;
+    TooLarge.Init('x', 61);
+    TestFalse(TEXT("Write[2] should not fit"), CaptureDevice->Write(TooLarge.GetData(), TooLarge.Num()));
+    const char* Data2 = "Line 3 wraps around the end of the ring buffer\r\n";
+    TestTrue(TEXT("Write[3] should fit after data was released"), CaptureDevice->Write((const uint8*)Data2, FCStringAnsi::Strlen(Data2)));
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"1234Line 3 wraps around the end of the ring buffer\"}]"));
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+
+    // Formatted log lines are captured the same way FOutputDeviceFile would write them
+    CaptureDevice->Serialize(TEXT("this line is far too long to fit in a 64 byte ring buffer, so it is spilled"), ELogVerbosity::Log, NAME_None);
+    TestTrue(TEXT("Lines that do not fit should be counted as spilled"), CaptureDevice->GetNumSpilledBytes() > 0);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestMemoryCaptureMultiProducer, "sparklogs.UnitTests.MemoryCaptureMultiProducer", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestMemoryCaptureMultiProducer::RunTest(const FString& Parameters)
+{
+    constexpr int NumProducers = 8;
+    constexpr int NumLinesPerProducer = 5000;
+    FsparklogsMemoryCaptureDevice CaptureDevice(16 * 1024, nullptr);
+    TArray<TFuture<void>> Producers;
+    for (int ProducerIndex = 0; ProducerIndex < NumProducers; ProducerIndex++)
+    {
+        Producers.Add(Async(EAsyncExecution::Thread, [&CaptureDevice, ProducerIndex]()
+        {
+            ANSICHAR Line[64];
+            for (int Seq = 0; Seq < NumLinesPerProducer; Seq++)
+            {
+                int Len = FCStringAnsi::Snprintf(Line, sizeof(Line), "%d:%d\n", ProducerIndex, Seq);
+                while (!CaptureDevice.Write((const uint8*)Line, Len))
+                {
+                    // Ring buffer is full, wait for the consumer
+                    FPlatformProcess::Yield();
+                }
+            }
+        }));
+    }
+
+    // Single consumer: every line must arrive intact, and lines from each producer must arrive in order
+    TArray<int> NextSeq;
+    NextSeq.SetNumZeroed(NumProducers);
+    TArray<uint8> Buffer;
+    Buffer.SetNumUninitialized(4096);
+    int64 Position = 0;
+    int NumLines = 0;
+    double StartTime = FPlatformTime::Seconds();
+    while (NumLines < NumProducers * NumLinesPerProducer && FPlatformTime::Seconds() - StartTime < 30.0)
+    {
+        int32 NumRead = CaptureDevice.Peek(Position, Buffer.GetData(), Buffer.Num());
+        int LineStart = 0;
+        for (int i = 0; i < NumRead; i++)
+        {
+            if (Buffer[i] != '\n')
+            {
+                continue;
+            }
+            FString Line = ITLConvertUTF8(Buffer.GetData() + LineStart, i - LineStart);
+            FString ProducerStr, SeqStr;
+            if (!TestTrue(FString::Printf(TEXT("Line should be well formed: %s"), *Line), Line.Split(TEXT(":"), &ProducerStr, &SeqStr)))
+            {
+                return false;
+            }
+            int ProducerIndex = FCString::Atoi(*ProducerStr);
+            if (!TestTrue(TEXT("Producer index should be valid"), ProducerIndex >= 0 && ProducerIndex < NumProducers)
+                || !TestEqual(TEXT("Lines from a producer should arrive in order"), FCString::Atoi(*SeqStr), NextSeq[ProducerIndex]))
+            {
+                return false;
+            }
+            NextSeq[ProducerIndex]++;
+            NumLines++;
+            LineStart = i + 1;
+        }
+        Position += LineStart;
+        CaptureDevice.Release(Position);
+    }
+    for (TFuture<void>& Producer : Producers)
+    {
+        Producer.Wait();
+    }
+    TestEqual(TEXT("All lines should be received"), NumLines, NumProducers * NumLinesPerProducer);
+    TestEqual(TEXT("Nothing should be spilled"), CaptureDevice.GetNumSpilledBytes(), (int64)0);
+    return true;
+}
+
+/** Output device that keeps every line it receives. */
+class FITLRecordingOutputDevice : public FOutputDevice
+{
+public:
+    TArray<FString> Lines;
+    TArray<FName> Categories;
+    virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category) override
+    {
+        Lines.Add(V);
+        Categories.Add(Category);
+    }
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestCaptureFilter, "sparklogs.UnitTests.CaptureFilter", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestCaptureFilter::RunTest(const FString& Parameters)
+{
+    FsparklogsCaptureFilterDevice::FRule DefaultRule;
+    TMap<FName, FsparklogsCaptureFilterDevice::FRule> Rules;
+    TestTrue(TEXT("Rules should parse"), FsparklogsCaptureFilterDevice::ParseRules(TEXT("LogNet=Warning;200/s;burst=1000;Log:50/s, LogSpam=off, *=Display"), DefaultRule, Rules));
+    TestEqual(TEXT("Number of rules"), Rules.Num(), 2);
+    TestEqual(TEXT("Default rule verbosity"), (int32)DefaultRule.MaxVerbosity, (int32)ELogVerbosity::Display);
+    const FsparklogsCaptureFilterDevice::FRule& NetRule = Rules.FindChecked(FName(TEXT("LogNet")));
+    TestEqual(TEXT("LogNet verbosity"), (int32)NetRule.MaxVerbosity, (int32)ELogVerbosity::Warning);
+    TestEqual(TEXT("LogNet rate"), NetRule.LinesPerSec, 200.0);
+    TestEqual(TEXT("LogNet burst"), NetRule.BurstLines, 1000.0);
+    TestEqual(TEXT("LogNet Log rate"), NetRule.VerbosityLinesPerSec[ELogVerbosity::Log], 50.0);
+    TestEqual(TEXT("LogNet Warning rate"), NetRule.VerbosityLinesPerSec[ELogVerbosity::Warning], 0.0);
+    TestTrue(TEXT("LogSpam is denied"), Rules.FindChecked(FName(TEXT("LogSpam"))).Deny);
+    TestFalse(TEXT("Empty rules"), FsparklogsCaptureFilterDevice::ParseRules(TEXT(""), DefaultRule, Rules));
+
+    FITLRecordingOutputDevice Inner;
+    FsparklogsCaptureFilterDevice Filter(&Inner, TEXT("*=off, LogAllowed=on, LogQuiet=Warning, LogFlood=1/s;burst=5"), 60.0);
+    Filter.Serialize(TEXT("denied by default"), ELogVerbosity::Log, FName(TEXT("LogOther")));
+    Filter.Serialize(TEXT("fatal is never dropped"), ELogVerbosity::Fatal, FName(TEXT("LogOther")));
+    Filter.Serialize(TEXT("allowed"), ELogVerbosity::VeryVerbose, FName(TEXT("LogAllowed")));
+    Filter.Serialize(TEXT("too verbose"), ELogVerbosity::Display, FName(TEXT("LogQuiet")));
+    Filter.Serialize(TEXT("severe enough"), ELogVerbosity::Error, FName(TEXT("LogQuiet")));
+    TArray<FString> Expected = { TEXT("fatal is never dropped"), TEXT("allowed"), TEXT("severe enough") };
+    TestEqual(TEXT("Lines allowed by the rules should be captured"), Inner.Lines, Expected);
+    TestEqual(TEXT("Lines dropped by the rules should be counted"), Filter.GetNumDropped(), (int64)2);
+
+    // The token bucket starts full, so a flood keeps the burst and then drops (allow one extra line in case the test runs slowly)
+    Inner.Lines.Reset();
+    for (int i = 0; i < 100; i++)
+    {
+        Filter.Serialize(TEXT("flood"), ELogVerbosity::Log, FName(TEXT("LogFlood")));
+    }
+    const int32 NumFloodCaptured = Inner.Lines.Num();
+    TestTrue(TEXT("Rate limit should keep the burst"), NumFloodCaptured >= 5 && NumFloodCaptured <= 6);
+
+    // A verbosity rate limit only applies to lines of that verbosity in the category
+    FITLRecordingOutputDevice VerbosityInner;
+    FsparklogsCaptureFilterDevice VerbosityFilter(&VerbosityInner, TEXT("LogChatty=Verbose;Verbose:1/s"), 60.0);
+    for (int i = 0; i < 10; i++)
+    {
+        VerbosityFilter.Serialize(TEXT("chatty"), ELogVerbosity::Verbose, FName(TEXT("LogChatty")));
+        VerbosityFilter.Serialize(TEXT("important"), ELogVerbosity::Warning, FName(TEXT("LogChatty")));
+    }
+    const int32 NumImportantCaptured = VerbosityInner.Lines.FilterByPredicate([](const FString& Line) { return Line == TEXT("important"); }).Num();
+    const int32 NumChattyCaptured = VerbosityInner.Lines.Num() - NumImportantCaptured;
+    TestEqual(TEXT("Lines of other verbosities should not be rate limited"), NumImportantCaptured, 10);
+    TestTrue(TEXT("Verbosity rate limit should keep the burst"), NumChattyCaptured >= 1 && NumChattyCaptured <= 2);
+
+    // Dropped lines are reported per category, straight to the inner device
+    Inner.Lines.Reset();
+    Inner.Categories.Reset();
+    Filter.EmitDroppedSummary();
+    if (TestEqual(TEXT("Summary should be emitted"), Inner.Lines.Num(), 1))
+    {
+        TestEqual(TEXT("Summary category"), Inner.Categories[0], LogPluginSparkLogs.GetCategoryName());
+        TestTrue(TEXT("Summary should count LogOther"), Inner.Lines[0].Contains(TEXT(" LogOther=1")));
+        TestTrue(TEXT("Summary should count LogQuiet"), Inner.Lines[0].Contains(TEXT(" LogQuiet=1")));
+        TestTrue(TEXT("Summary should count LogFlood"), Inner.Lines[0].Contains(FString::Printf(TEXT(" LogFlood=%d"), 100 - NumFloodCaptured)));
+    }
+    Filter.EmitDroppedSummary();
+    TestEqual(TEXT("Nothing to summarize after a summary"), Inner.Lines.Num(), 1);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestBacklogDropOldest, "sparklogs.UnitTests.BacklogDropOldest", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestBacklogDropOldest::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+
+    // 100 lines of 10 bytes each
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    for (int i = 0; i < 100; i++)
+    {
+        ITLWriteStringToFile(LogWriter, FString::Printf(TEXT("Line %03d\r\n"), i));
+    }
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::None;
+    Settings->MaxBacklogBytes = 400;
+    Settings->BacklogDropPolicy = ITLBacklogDropPolicy::DropOldest;
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+
+    // Over the quota, everything but the newest 3/4 of the quota is dropped (at a line boundary)
+    FString ExpectedPayload = TEXT("[");
+    for (int i = 70; i < 100; i++)
+    {
+        ExpectedPayload += FString::Printf(TEXT("%s{\"message\":\"Line %03d\"}"), (i > 70) ? TEXT(",") : TEXT(""), i);
+    }
+    ExpectedPayload += TEXT("]");
+    TArray<FString> ExpectedPayloads = { ExpectedPayload };
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("Payloads should only have the newest lines"), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+    TestTrue(TEXT("FlushAndWait should capture everything"), FlushedEverything);
+    TestEqual(TEXT("Dropped bytes"), Streamer->GetNumBacklogDroppedBytes(), (int64)700);
+    TestEqual(TEXT("Shipped offset"), Streamer->GetShippedLogOffset(), (int64)1000);
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestBacklogCapturePolicies, "sparklogs.UnitTests.BacklogCapturePolicies", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestBacklogCapturePolicies::RunTest(const FString& Parameters)
+{
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    TArray<uint8> Data;
+    Data.Init('x', 1000);
+    LogWriter->Write(Data.GetData(), Data.Num());
+    LogWriter->Flush();
+
+    // Nothing can be shipped, so the whole file is backlog
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    PayloadProcessor->FailProcessing = true;
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+
+    FITLRecordingOutputDevice SampleInner;
+    FsparklogsCaptureFilterDevice SampleFilter(&SampleInner, TEXT(""), 60.0);
+    SampleFilter.SetBacklogQuota(900, ITLBacklogDropPolicy::Sample, 10, TestLogFile);
+    SampleFilter.SetBacklogSource(Streamer.Get());
+    TestEqual(TEXT("Backlog should be the whole file"), SampleFilter.RefreshBacklogBytes(), (int64)1000);
+    for (int i = 0; i < 100; i++)
+    {
+        SampleFilter.Serialize(TEXT("sampled"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    }
+    SampleFilter.Serialize(TEXT("fatal"), ELogVerbosity::Fatal, FName(TEXT("LogTemp")));
+    TestEqual(TEXT("One in ten lines (and the fatal line) should be captured"), SampleInner.Lines.Num(), 11);
+    SampleInner.Lines.Reset();
+    SampleFilter.EmitDroppedSummary();
+    if (TestEqual(TEXT("Summary should be emitted"), SampleInner.Lines.Num(), 1))
+    {
+        TestTrue(TEXT("Summary should count bytes"), SampleInner.Lines[0].Contains(TEXT("dropped 90 log lines (about 630 bytes), 90 of them because the unshipped backlog")));
+    }
+    // Sampling has the same hard ceiling: another 25% over the quota, only fatal lines are kept
+    SampleFilter.SetBacklogQuota(700, ITLBacklogDropPolicy::Sample, 10, TestLogFile);
+    SampleFilter.RefreshBacklogBytes();
+    SampleInner.Lines.Reset();
+    for (int i = 0; i < 100; i++)
+    {
+        SampleFilter.Serialize(TEXT("sampled"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    }
+    SampleFilter.Serialize(TEXT("fatal"), ELogVerbosity::Fatal, FName(TEXT("LogTemp")));
+    TArray<FString> ExpectedSampled = { TEXT("fatal") };
+    TestEqual(TEXT("Only fatal lines should be sampled far over the quota"), SampleInner.Lines, ExpectedSampled);
+
+    FITLRecordingOutputDevice VerboseInner;
+    FsparklogsCaptureFilterDevice VerboseFilter(&VerboseInner, TEXT(""), 60.0);
+    VerboseFilter.SetBacklogQuota(900, ITLBacklogDropPolicy::DropVerboseFirst, 10, TestLogFile);
+    VerboseFilter.SetBacklogSource(Streamer.Get());
+    VerboseFilter.Serialize(TEXT("log"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    VerboseFilter.Serialize(TEXT("warning"), ELogVerbosity::Warning, FName(TEXT("LogTemp")));
+    VerboseFilter.Serialize(TEXT("error"), ELogVerbosity::Error, FName(TEXT("LogTemp")));
+    TArray<FString> Expected = { TEXT("warning"), TEXT("error") };
+    TestEqual(TEXT("Lines more verbose than Warning should be dropped"), VerboseInner.Lines, Expected);
+
+    // Once the backlog is another 25% over the quota, only fatal lines are kept
+    VerboseFilter.SetBacklogQuota(700, ITLBacklogDropPolicy::DropVerboseFirst, 10, TestLogFile);
+    VerboseFilter.RefreshBacklogBytes();
+    VerboseInner.Lines.Reset();
+    VerboseFilter.Serialize(TEXT("error"), ELogVerbosity::Error, FName(TEXT("LogTemp")));
+    VerboseFilter.Serialize(TEXT("fatal"), ELogVerbosity::Fatal, FName(TEXT("LogTemp")));
+    Expected = { TEXT("fatal") };
+    TestEqual(TEXT("Only fatal lines should be kept far over the quota"), VerboseInner.Lines, Expected);
+
+    VerboseFilter.SetBacklogSource(nullptr);
+    SampleFilter.SetBacklogSource(nullptr);
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestRepeatSuppression, "sparklogs.UnitTests.RepeatSuppression", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestRepeatSuppression::RunTest(const FString& Parameters)
+{
+    // Within the window, exact repeats (same category, verbosity, and text) are suppressed
+    FITLRecordingOutputDevice Inner;
+    FsparklogsCaptureFilterDevice Filter(&Inner, TEXT(""), 60.0);
+    Filter.SetRepeatSuppression(1000.0);
+    for (int i = 0; i < 100; i++)
+    {
+        Filter.Serialize(TEXT("storm"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+        if (i == 50)
+        {
+            Filter.Serialize(TEXT("other"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+            Filter.Serialize(TEXT("storm"), ELogVerbosity::Warning, FName(TEXT("LogTemp")));
+            Filter.Serialize(TEXT("storm"), ELogVerbosity::Log, FName(TEXT("LogOther")));
+        }
+    }
+    TArray<FString> Expected = { TEXT("storm"), TEXT("other"), TEXT("storm"), TEXT("storm") };
+    TestEqual(TEXT("Only the first of each line should be captured"), Inner.Lines, Expected);
+    TestEqual(TEXT("Suppressed repeats"), Filter.GetNumRepeatsSuppressed(), (int64)99);
+    Filter.EmitRepeatSummaries(false);
+    TestEqual(TEXT("Nothing to report before the window ends"), Inner.Lines.Num(), Expected.Num());
+    Filter.EmitRepeatSummaries(true);
+    if (TestEqual(TEXT("Forced summary should be emitted"), Inner.Lines.Num(), Expected.Num() + 1))
+    {
+        FTCHARToUTF8 Summary(*Inner.Lines.Last());
+        FsparklogsRepeatSuffix Repeat;
+        if (TestTrue(TEXT("Summary should have a repeat suffix"), ITLParseRepeatSuffix(Summary.Get(), Summary.Length(), Repeat)))
+        {
+            TestEqual(TEXT("Summary text"), Inner.Lines.Last().Left(Repeat.SuffixOffset), FString(TEXT("storm")));
+            TestEqual(TEXT("Summary repeat count"), Repeat.RepeatCount, (int64)99);
+        }
+        TestEqual(TEXT("Summary category"), Inner.Categories.Last(), FName(TEXT("LogTemp")));
+    }
+
+    // Once the window ends, the next repeat is reported along with the ones before it and starts a new window
+    FITLRecordingOutputDevice ShortInner;
+    FsparklogsCaptureFilterDevice ShortFilter(&ShortInner, TEXT(""), 60.0);
+    ShortFilter.SetRepeatSuppression(0.05);
+    ShortFilter.Serialize(TEXT("repeat"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    ShortFilter.Serialize(TEXT("repeat\r\n"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    FPlatformProcess::SleepNoStats(0.1f);
+    ShortFilter.Serialize(TEXT("repeat"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    ShortFilter.Serialize(TEXT("repeat"), ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    if (TestEqual(TEXT("First line and one summary"), ShortInner.Lines.Num(), 2))
+    {
+        TestEqual(TEXT("First line"), ShortInner.Lines[0], FString(TEXT("repeat")));
+        TestTrue(TEXT("Summary should count both repeats"), ShortInner.Lines[1].StartsWith(TEXT("repeat [repeat_count=2 first=")));
+    }
+    TestEqual(TEXT("Suppressed repeats in both windows"), ShortFilter.GetNumRepeatsSuppressed(), (int64)3);
+
+    // Fatal lines and lines too long to track are never suppressed
+    ShortFilter.Serialize(TEXT("fatal"), ELogVerbosity::Fatal, FName(TEXT("LogTemp")));
+    ShortFilter.Serialize(TEXT("fatal"), ELogVerbosity::Fatal, FName(TEXT("LogTemp")));
+    const FString LongLine = FString::ChrN(FsparklogsCaptureFilterDevice::MaxRepeatTextLen + 1, TEXT('x'));
+    ShortFilter.Serialize(*LongLine, ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    ShortFilter.Serialize(*LongLine, ELogVerbosity::Log, FName(TEXT("LogTemp")));
+    TestEqual(TEXT("Fatal and long lines should all be captured"), ShortInner.Lines.Num(), 6);
+
+    // The suffix becomes separate fields in the payload
+    const ANSICHAR* Line = "[2025.01.01-00.00.00:000][  1]LogTemp: storm [repeat_count=42 first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]";
+    const int LineLen = FCStringAnsi::Strlen(Line);
+    FsparklogsRepeatSuffix Repeat;
+    if (TestTrue(TEXT("Line should have a repeat suffix"), ITLParseRepeatSuffix(Line, LineLen, Repeat)))
+    {
+        TITLJSONStringBuilder Builder;
+        ITLAppendLogLineAsParsedJsonFields(Builder, Line, Repeat.SuffixOffset);
+        ITLAppendRepeatSuffixAsJsonFields(Builder, Line, Repeat);
+        TestEqual(TEXT("Repeat fields"), FString(ANSI_TO_TCHAR(Builder.ToString())),
+            FString(TEXT("\"timestamp\":\"2025-01-01T00:00:00.000\",\"frame\":1,\"category\":\"LogTemp\",\"severity\":\"Log\",\"message\":\"storm\",\"repeat_count\":42,\"first_timestamp\":\"2025-01-01T00:00:00.000Z\",\"last_timestamp\":\"2025-01-01T00:00:09.000Z\"")));
+    }
+    TestFalse(TEXT("No count"), ITLParseRepeatSuffix("x [repeat_count= first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]", 78, Repeat));
+    TestFalse(TEXT("Not a timestamp"), ITLParseRepeatSuffix("x [repeat_count=1 first=2025-01-01T00:00:00.000Z last=2025-01-01 00:00:09.000Z]", 79, Repeat));
+    TestFalse(TEXT("Ordinary line"), ITLParseRepeatSuffix("[1]", 3, Repeat));
+
+    // The streamer only turns the suffix into fields while repeats are suppressed, otherwise a line that ends the same way is shipped as written
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("storm [repeat_count=42 first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]\r\n"));
+    LogWriter->Flush();
+    for (int Suppress = 0; Suppress <= 1; Suppress++)
+    {
+        TArray<FString> ExpectedPayloads;
+        ExpectedPayloads.Add(Suppress
+            ? TEXT("[{\"message\":\"storm\",\"repeat_count\":42,\"first_timestamp\":\"2025-01-01T00:00:00.000Z\",\"last_timestamp\":\"2025-01-01T00:00:09.000Z\"}]")
+            : TEXT("[{\"message\":\"storm [repeat_count=42 first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]\"}]"));
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+        Settings->IncludeCommonMetadata = false;
+        Settings->RepeatSuppressionWindowSecs = Suppress ? 10.0 : 0.0;
+        TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+        TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+        bool FlushedEverything = false;
+        TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+        TestTrue(FString::Printf(TEXT("Payloads should match (suppress=%d)"), Suppress), ITLComparePayloads(this, PayloadProcessor->Payloads, ExpectedPayloads));
+        Streamer.Reset();
+    }
+    return true;
+}
+
+/** Replaces the value of every "timestamp" field with a fixed string, since records carry the current wall clock time. */
+static FString ITLMaskTimestamps(const FString& Payload)
+{
+    static const FString TimestampField = TEXT("\"timestamp\":\"");
+    FString Result = Payload;
+    int32 Index = Result.Find(TimestampField);
+    while (Index != INDEX_NONE)
+    {
+        Index += TimestampField.Len();
+        int32 End = Result.Find(TEXT("\""), ESearchCase::CaseSensitive, ESearchDir::FromStart, Index);
+        if (End == INDEX_NONE)
+        {
+            break;
+        }
+        Result = Result.Left(Index) + TEXT("T") + Result.Mid(End);
+        Index = Result.Find(TimestampField, ESearchCase::CaseSensitive, ESearchDir::FromStart, Index);
+    }
+    return Result;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestStructuredCapture, "sparklogs.UnitTests.StructuredCapture", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestStructuredCapture::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+}
+bool FsparklogsPluginUnitTestStructuredCapture::RunTest(const FString& Parameters)
+{
+    TSharedRef<FsparklogsMemoryCaptureDevice> CaptureDevice = MakeShared<FsparklogsMemoryCaptureDevice>(16 * 1024, nullptr, true);
+    TestTrue(TEXT("Device should capture structured records"), CaptureDevice->IsStructured());
+    const uint32 ThreadId = FPlatformTLS::GetCurrentThreadId();
+    const uint64 Frame = GFrameCounter;
+    CaptureDevice->Serialize(TEXT("first message"), ELogVerbosity::Warning, FName(TEXT("LogTemp")));
+    CaptureDevice->Serialize(TEXT("line 1\r\nline \"2\""), ELogVerbosity::Display, FName(TEXT("LogNet")));
+    CaptureDevice->Serialize(TEXT("third message"), (ELogVerbosity::Type)(ELogVerbosity::Error | ELogVerbosity::BreakOnLog), FName(TEXT("LogTemp")));
+
+    // Every field is preserved as written, without any line formatting
+    TArray<uint8> Buffer;
+    Buffer.SetNumUninitialized(4096);
+    int32 NumRead = CaptureDevice->Peek(0, Buffer.GetData(), Buffer.Num());
+    FsparklogsMemoryCaptureDevice::FRecord Record;
+    TestTrue(TEXT("First record should decode"), FsparklogsMemoryCaptureDevice::DecodeRecord(Buffer.GetData(), NumRead, Record));
+    TestEqual(TEXT("First record length"), (int32)Record.Len, FsparklogsMemoryCaptureDevice::RecordHeaderSize + 13);
+    TestEqual(TEXT("First record verbosity"), (int32)Record.Verbosity, (int32)ELogVerbosity::Warning);
+    TestEqual(TEXT("First record category"), CaptureDevice->GetCategoryName(Record.CategoryId), FName(TEXT("LogTemp")));
+    TestEqual(TEXT("First record thread"), Record.ThreadId, ThreadId);
+    TestEqual(TEXT("First record frame"), Record.Frame, Frame);
+    TestEqual(TEXT("First record message"), ITLConvertUTF8(Record.Message, Record.MessageLen), FString(TEXT("first message")));
+    TestFalse(TEXT("A truncated record should not decode"), FsparklogsMemoryCaptureDevice::DecodeRecord(Buffer.GetData(), Record.Len - 1, Record));
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(CaptureDevice, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait should succeed"), Streamer->FlushAndWait(2, false, true, false, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait should capture everything"), FlushedEverything);
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(FString::Printf(TEXT("[")
+        TEXT("{\"timestamp\":\"T\",\"frame\":%llu,\"thread_id\":%u,\"category\":\"LogTemp\",\"severity\":\"Warning\",\"message\":\"first message\"},")
+        TEXT("{\"timestamp\":\"T\",\"frame\":%llu,\"thread_id\":%u,\"category\":\"LogNet\",\"severity\":\"Display\",\"message\":\"line 1\\r\\nline \\\"2\\\"\"},")
+        TEXT("{\"timestamp\":\"T\",\"frame\":%llu,\"thread_id\":%u,\"category\":\"LogTemp\",\"severity\":\"Error\",\"message\":\"third message\"}]"),
+        Frame, ThreadId, Frame, ThreadId, Frame, ThreadId));
+    TArray<FString> ActualPayloads;
+    for (const FString& Payload : PayloadProcessor->Payloads)
+    {
+        ActualPayloads.Add(ITLMaskTimestamps(Payload));
+    }
+    TestTrue(TEXT("Payloads should match"), ITLComparePayloads(this, ActualPayloads, ExpectedPayloads));
+
+    Streamer.Reset();
+    return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FsparklogsPluginUnitTestHTTPIngest, "sparklogs.UnitTests.HTTPIngest", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+void FsparklogsPluginUnitTestHTTPIngest::GetTests(TArray<FString>& OutBeautifiedNames, TArray <FString>& OutTestCommands) const
+{
+    SetupCompressionModes(OutBeautifiedNames, OutTestCommands);
+    OutBeautifiedNames.Add(TEXT("LZ4Dictionary"));
+    OutTestCommands.Add(FString::FromInt((int)ITLCompressionMode::LZ4Dictionary));
+}
+bool FsparklogsPluginUnitTestHTTPIngest::RunTest(const FString& Parameters)
+{
+    FsparklogsMockIngestServer Server;
+    if (!TestTrue(TEXT("Mock ingest server should start"), Server.Start()))
+    {
+        return false;
+    }
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+    ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine \"2\"\r\n"));
+    LogWriter->Flush();
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = (ITLCompressionMode)FCString::Atoi(*Parameters);
+    if (Settings->CompressionMode == ITLCompressionMode::LZ4Dictionary)
+    {
+        Settings->CompressionDictionary = ITLTrainStressTestDictionary();
+        Server.SetCompressionDictionary(Settings->CompressionDictionary);
+    }
+    TSharedRef<FsparklogsWriteHTTPPayloadProcessor> PayloadProcessor(new FsparklogsWriteHTTPPayloadProcessor(*Server.GetEndpointURI(), TEXT("Bearer test-token"), 10.0, false));
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+    TArray<FString> ExpectedPayloads;
+    ExpectedPayloads.Add(TEXT("[{\"message\":\"Line 1\"},{\"message\":\"Line \\\"2\\\"\"}]"));
+    bool FlushedEverything = false;
+    TestTrue(TEXT("FlushAndWait[FINAL] should succeed"), Streamer->FlushAndWait(2, false, true, true, 10.0, FlushedEverything));
+    TestTrue(TEXT("FlushAndWait[FINAL] should capture everything"), FlushedEverything);
+    TestTrue(TEXT("FlushAndWait[FINAL] payloads should match"), ITLComparePayloads(this, Server.GetAcceptedPayloads(), ExpectedPayloads));
+
+    // The request should carry everything the ingest endpoint needs to decode it
+    TArray<FsparklogsMockIngestRequest> Requests = Server.GetRequests();
+    if (TestEqual(TEXT("Number of requests"), Requests.Num(), 1))
+    {
+        const FsparklogsMockIngestRequest& Request = Requests[0];
+        TestEqual(TEXT("Method"), Request.Method, FString(TEXT("POST")));
+        TestEqual(TEXT("Authorization header"), Request.Headers.FindRef(TEXT("authorization")), FString(TEXT("Bearer test-token")));
+        TestTrue(TEXT("Timezone header should be set"), Request.Headers.FindRef(TEXT("x-timezone")).StartsWith(TEXT("UTC")));
+        const TCHAR* ExpectedEncoding = TEXT("");
+        switch (Settings->CompressionMode)
+        {
+        case ITLCompressionMode::LZ4: ExpectedEncoding = TEXT("lz4-block"); break;
+        // Plain lz4-block decoders must not mistake it for an ordinary block
+        case ITLCompressionMode::LZ4Dictionary: ExpectedEncoding = TEXT("lz4-block-dict"); break;
+        case ITLCompressionMode::LZ4Frame: ExpectedEncoding = TEXT("lz4-frame"); break;
+        case ITLCompressionMode::LZ4MultiBlock: ExpectedEncoding = TEXT("lz4-multiblock"); break;
+        case ITLCompressionMode::Gzip: ExpectedEncoding = TEXT("gzip"); break;
+        default: break;
+        }
+        TestEqual(TEXT("Content-Encoding header"), Request.Headers.FindRef(TEXT("content-encoding")), FString(ExpectedEncoding));
+    }
+    TestEqual(TEXT("Nothing should fail to decode"), Server.GetNumDecodeFailures(), (int64)0);
+
+    Streamer.Reset();
+    Server.Stop();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestHTTPFaults, "sparklogs.UnitTests.HTTPFaults", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestHTTPFaults::RunTest(const FString& Parameters)
+{
+    struct FCase
+    {
+        const TCHAR* Name;
+        FsparklogsMockIngestFaults Faults;
+        /** Whether the payload is retried (otherwise it is skipped, and the flush still succeeds) */
+        bool Retried;
+    };
+    TArray<FCase> Cases;
+    Cases.Add({ TEXT("server error"), FsparklogsMockIngestFaults(), true });
+    Cases.Last().Faults.ServerErrorRate = 1.0f;
+    Cases.Add({ TEXT("too many requests"), FsparklogsMockIngestFaults(), true });
+    Cases.Last().Faults.TooManyRequestsRate = 1.0f;
+    Cases.Add({ TEXT("dropped connection"), FsparklogsMockIngestFaults(), true });
+    Cases.Last().Faults.DropConnectionRate = 1.0f;
+    Cases.Add({ TEXT("slow response"), FsparklogsMockIngestFaults(), true });
+    Cases.Last().Faults.SlowResponseRate = 1.0f;
+    Cases.Last().Faults.SlowResponseSecs = 5.0;
+    Cases.Add({ TEXT("bad request"), FsparklogsMockIngestFaults(), false });
+    Cases.Last().Faults.FailFirstN = 1;
+    Cases.Last().Faults.FailFirstStatus = 400;
+
+    FsparklogsMockIngestServer Server;
+    if (!TestTrue(TEXT("Mock ingest server should start"), Server.Start()))
+    {
+        return false;
+    }
+    for (const FCase& Case : Cases)
+    {
+        FTempDirectory TempDir(ITLGetTestDir());
+        FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+        TSharedRef<IFileHandle> LogWriter(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*TestLogFile, true, true));
+        ITLWriteStringToFile(LogWriter, TEXT("Line 1\r\nLine 2\r\n"));
+        LogWriter->Flush();
+
+        Server.SetFaults(Case.Faults);
+        const int64 StartAccepted = Server.GetNumAccepted();
+        const int64 StartInjectedFailures = Server.GetNumInjectedFailures();
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+        Settings->IncludeCommonMetadata = false;
+        Settings->ProcessingIntervalSecs = 0.1;
+        Settings->RetryIntervalSecs = 0.1;
+        // Short enough that the slow response times out
+        TSharedRef<FsparklogsWriteHTTPPayloadProcessor> PayloadProcessor(new FsparklogsWriteHTTPPayloadProcessor(*Server.GetEndpointURI(), TEXT("Bearer test-token"), 1.0, false));
+        TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+        bool FlushedEverything = false;
+        if (Case.Retried)
+        {
+            TestFalse(FString::Printf(TEXT("%s: FlushAndWait[1] should fail"), Case.Name), Streamer->FlushAndWait(1, false, false, true, 10.0, FlushedEverything));
+            TestFalse(FString::Printf(TEXT("%s: FlushAndWait[1] should NOT capture everything"), Case.Name), FlushedEverything);
+            TestTrue(FString::Printf(TEXT("%s: fault should be injected"), Case.Name), Server.GetNumInjectedFailures() > StartInjectedFailures);
+            Server.SetFaults(FsparklogsMockIngestFaults());
+        }
+        TestTrue(FString::Printf(TEXT("%s: FlushAndWait[FINAL] should succeed"), Case.Name), Streamer->FlushAndWait(2, true, true, true, 10.0, FlushedEverything));
+        TestTrue(FString::Printf(TEXT("%s: FlushAndWait[FINAL] should capture everything"), Case.Name), FlushedEverything);
+        // Retried payloads are delivered exactly once, skipped ones never
+        TestEqual(FString::Printf(TEXT("%s: accepted payloads"), Case.Name), Server.GetNumAccepted() - StartAccepted, Case.Retried ? (int64)1 : (int64)0);
+        if (Case.Retried)
+        {
+            TestTrue(FString::Printf(TEXT("%s: streamer should count the retry"), Case.Name), Streamer->GetStats().NumFailedRequests.GetValue() > 0);
+        }
+        Streamer.Reset();
+    }
+    Server.Stop();
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkHTTPIngest, "sparklogs.Benchmarks.HTTPIngest", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkHTTPIngest::RunTest(const FString& Parameters)
+{
+    struct FScenario
+    {
+        const TCHAR* Name;
+        double LatencySecs;
+        float ServerErrorRate;
+        float DropConnectionRate;
+    };
+    const FScenario Scenarios[] = {
+        { TEXT("loopback"), 0.0, 0.0f, 0.0f },
+        { TEXT("latency-20ms"), 0.02, 0.0f, 0.0f },
+        { TEXT("latency-20ms-flaky"), 0.02, 0.05f, 0.02f },
+    };
+    FsparklogsMockIngestServer Server;
+    if (!TestTrue(TEXT("Mock ingest server should start"), Server.Start()))
+    {
+        return false;
+    }
+    Server.SetKeepRequests(false);
+    FITLBenchmarkReport Report(this, TEXT("HTTPIngest"));
+    TArray<uint8> Data;
+    ITLGenerateBenchmarkCorpus(EITLBenchmarkCorpus::ShortLines, 16 * 1024 * 1024, Data);
+    for (const FScenario& Scenario : Scenarios)
+    {
+        FsparklogsMockIngestFaults Faults;
+        Faults.LatencySecs = Scenario.LatencySecs;
+        Faults.ServerErrorRate = Scenario.ServerErrorRate;
+        Faults.DropConnectionRate = Scenario.DropConnectionRate;
+        Server.SetFaults(Faults);
+        FTempDirectory TempDir(ITLGetTestDir());
+        FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("bench-sparklogs.log"));
+        FFileHelper::SaveArrayToFile(Data, *TestLogFile);
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+        Settings->ProcessingIntervalSecs = 0.01;
+        Settings->RetryIntervalSecs = 0.01;
+        TSharedRef<FsparklogsWriteHTTPPayloadProcessor> PayloadProcessor(new FsparklogsWriteHTTPPayloadProcessor(*Server.GetEndpointURI(), TEXT("Bearer test-token"), 10.0, false));
+
+        const int64 StartAccepted = Server.GetNumAccepted();
+        const double StartTime = FPlatformTime::Seconds();
+        TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+        bool FlushedEverything = false;
+        for (int Attempt = 0; !FlushedEverything && Attempt < 10000 && FPlatformTime::Seconds() - StartTime < 300.0; Attempt++)
+        {
+            Streamer->FlushAndWait(1, true, false, true, 60.0, FlushedEverything);
+        }
+        const double Seconds = FPlatformTime::Seconds() - StartTime;
+        TestTrue(FString::Printf(TEXT("%s should ship everything"), Scenario.Name), FlushedEverything);
+        const FsparklogsStreamerStats& Stats = Streamer->GetStats();
+        TSharedRef<FJsonObject> Result = Report.Add(Scenario.Name, Data.Num(), Stats.NumLinesRead.GetValue(), Seconds,
+            FString::Printf(TEXT("requests=%lld, failed=%lld, accepted=%lld, p50=%.0lf ms, p99=%.0lf ms"), Stats.NumRequests.GetValue(), Stats.NumFailedRequests.GetValue(), Server.GetNumAccepted() - StartAccepted,
+                Stats.GetLatencyPercentileMillis(50.0), Stats.GetLatencyPercentileMillis(99.0)));
+        Result->SetNumberField(TEXT("requests"), (double)Stats.NumRequests.GetValue());
+        Result->SetNumberField(TEXT("failed_requests"), (double)Stats.NumFailedRequests.GetValue());
+        Result->SetNumberField(TEXT("p99_latency_ms"), Stats.GetLatencyPercentileMillis(99.0));
+        Streamer->FlushAndWait(1, true, true, true, 10.0, FlushedEverything);
+        Streamer.Reset();
+    }
+    Server.Stop();
+    return Report.Finish();
+}
+
+/** Records the stress test entries that reach the log, from any thread. */
+class FITLStressEntryOutputDevice : public FOutputDevice
+{
+public:
+    FCriticalSection Lock;
+    int64 NumEntries = 0;
+    int32 MinLen = MAX_int32;
+    int32 MaxLen = 0;
+    TSet<FName> Categories;
+    TSet<int32> Verbosities;
+    TSet<FString> Threads;
+    virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category) override
+    {
+        // FsparklogsStressGenerator|thread=N|seq=N|<message>
+        TArray<FString> Parts;
+        if (FString(V).ParseIntoArray(Parts, TEXT("|"), false) < 4 || Parts[0] != TEXT("FsparklogsStressGenerator"))
+        {
+            return;
+        }
+        const int32 MessageLen = FCString::Strlen(V) - (Parts[0].Len() + Parts[1].Len() + Parts[2].Len() + 3);
+        FScopeLock ScopeLock(&Lock);
+        NumEntries++;
+        MinLen = FMath::Min(MinLen, MessageLen);
+        MaxLen = FMath::Max(MaxLen, MessageLen);
+        Categories.Add(Category);
+        Verbosities.Add((int32)(Verbosity & ELogVerbosity::VerbosityMask));
+        Threads.Add(Parts[1]);
+    }
+    virtual bool CanBeUsedOnMultipleThreads() const override { return true; }
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestStressGenerator, "sparklogs.UnitTests.StressGenerator", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestStressGenerator::RunTest(const FString& Parameters)
+{
+    FsparklogsLatencyHistogram Histogram;
+    Histogram.Record(500);
+    Histogram.Record(1500);
+    Histogram.Record(3000);
+    Histogram.Record(100000);
+    TestEqual(TEXT("Histogram count"), Histogram.Count.GetValue(), (int64)4);
+    TestEqual(TEXT("Histogram p50 is the upper bound of the 1024-2047ns bucket"), Histogram.GetPercentileMicros(50.0), 2.048);
+    TestEqual(TEXT("Histogram p100"), Histogram.GetPercentileMicros(100.0), 131.072);
+    TestEqual(TEXT("Histogram max"), Histogram.MaxNanos.load(), (int64)100000);
+
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->StressTestGenerateIntervalSecs = 0.01;
+    Settings->StressTestNumEntriesPerTick = 10;
+    Settings->StressTestNumThreads = 4;
+    Settings->StressTestMinMessageLen = 50;
+    Settings->StressTestMaxMessageLen = 300;
+    Settings->StressTestMessageLenSkew = 2.0;
+    Settings->StressTestUnicodeDensity = 0.1;
+    Settings->StressTestEscapeDensity = 0.1;
+    Settings->StressTestBurstIntervalSecs = 0.1;
+    Settings->StressTestBurstNumEntries = 100;
+    Settings->StressTestCategories = TEXT("LogTemp, LogNet");
+    // Fatal would crash the game, so it has to be ignored
+    Settings->StressTestVerbosities = TEXT("Display,Warning,Fatal");
+
+    FITLStressEntryOutputDevice Device;
+    GLog->AddOutputDevice(&Device);
+    TUniquePtr<FsparklogsStressGenerator> Generator = MakeUnique<FsparklogsStressGenerator>(Settings);
+    FPlatformProcess::SleepNoStats(0.5f);
+    Generator->Stop();
+    // A thread can still finish the entry it was logging when asked to stop
+    const int64 NumEntries = Generator->GetNumEntries();
+    Generator.Reset();
+    GLog->Flush();
+    GLog->RemoveOutputDevice(&Device);
+    FScopeLock ScopeLock(&Device.Lock);
+    TestTrue(TEXT("Entries should be generated"), NumEntries > 0);
+    TestTrue(TEXT("Every entry should reach the log"), Device.NumEntries >= NumEntries && Device.NumEntries <= NumEntries + 4);
+    TestEqual(TEXT("Every thread should generate entries"), Device.Threads.Num(), 4);
+    TestTrue(TEXT("Bursts should be generated"), NumEntries >= 4 * 100);
+    TestTrue(TEXT("Messages should be at least the minimum length"), Device.MinLen >= 50);
+    TestTrue(TEXT("Messages should be at most the maximum length"), Device.MaxLen <= 300);
+    TestEqual(TEXT("Categories"), Device.Categories.Num(), 2);
+    TestTrue(TEXT("LogTemp category"), Device.Categories.Contains(FName(TEXT("LogTemp"))));
+    TestTrue(TEXT("LogNet category"), Device.Categories.Contains(FName(TEXT("LogNet"))));
+    TestEqual(TEXT("Verbosities"), Device.Verbosities.Num(), 2);
+    TestFalse(TEXT("No fatal entries"), Device.Verbosities.Contains((int32)ELogVerbosity::Fatal));
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginBenchmarkProducerLatency, "sparklogs.Benchmarks.ProducerLatency", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+bool FsparklogsPluginBenchmarkProducerLatency::RunTest(const FString& Parameters)
+{
+    struct FScenario
+    {
+        const TCHAR* Name;
+        /** 0 = nothing extra attached, 1 = memory capture, 2 = structured record capture */
+        int CaptureMode;
+    };
+    const FScenario Scenarios[] = {
+        { TEXT("detached"), 0 },
+        { TEXT("memory-capture"), 1 },
+        { TEXT("records-capture"), 2 },
+    };
+    int32 NumThreads = FMath::Clamp(FPlatformMisc::NumberOfCoresIncludingHyperthreads(), 2, 64);
+    FParse::Value(FCommandLine::Get(), TEXT("SparkLogsStressThreads="), NumThreads);
+    double DurationSecs = 3.0;
+    FParse::Value(FCommandLine::Get(), TEXT("SparkLogsStressSecs="), DurationSecs);
+    FITLBenchmarkReport Report(this, TEXT("ProducerLatency"));
+    // The plugin's own output devices would otherwise be measured in every scenario, so that "detached" really is the baseline
+    const bool DetachedModuleDevices = FsparklogsModule::IsModuleLoaded() && FsparklogsModule::GetModule().SetOutputDevicesAttached(false);
+    for (const FScenario& Scenario : Scenarios)
+    {
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+        Settings->ProcessingIntervalSecs = 0.1;
+        Settings->StressTestGenerateIntervalSecs = 0.01;
+        Settings->StressTestNumEntriesPerTick = 20;
+        Settings->StressTestNumThreads = NumThreads;
+        Settings->StressTestMinMessageLen = 40;
+        Settings->StressTestMaxMessageLen = 2000;
+        Settings->StressTestMessageLenSkew = 3.0;
+        Settings->StressTestUnicodeDensity = 0.02;
+        Settings->StressTestEscapeDensity = 0.02;
+        Settings->StressTestBurstIntervalSecs = 0.5;
+        Settings->StressTestBurstNumEntries = 200;
+        Settings->StressTestCategories = TEXT("LogEngine,LogNet,LogTemp");
+        Settings->StressTestVerbosities = TEXT("Log,Display,Warning");
+
+        TSharedPtr<FsparklogsMemoryCaptureDevice> CaptureDevice;
+        TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer;
+        if (Scenario.CaptureMode != 0)
+        {
+            CaptureDevice = MakeShared<FsparklogsMemoryCaptureDevice>(FsparklogsSettings::DefaultMemoryCaptureBufferBytes, nullptr, Scenario.CaptureMode == 2);
+            Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(CaptureDevice.ToSharedRef(), Settings, MakeShared<FITLCountingPayloadProcessor>(), 16 * 1024, nullptr, nullptr);
+            GLog->AddOutputDevice(CaptureDevice.Get());
+        }
+        const double StartTime = FPlatformTime::Seconds();
+        TUniquePtr<FsparklogsStressGenerator> Generator = MakeUnique<FsparklogsStressGenerator>(Settings);
+        FPlatformProcess::SleepNoStats((float)DurationSecs);
+        Generator->Stop();
+        const double Seconds = FPlatformTime::Seconds() - StartTime;
+        FsparklogsLatencyHistogram Latency;
+        Generator->GetLatency(Latency);
+        const int64 NumEntries = Generator->GetNumEntries();
+        Generator.Reset();
+        if (CaptureDevice.IsValid())
+        {
+            GLog->RemoveOutputDevice(CaptureDevice.Get());
+            bool FlushedEverything = false;
+            Streamer->FlushAndWait(1, true, true, false, 10.0, FlushedEverything);
+            Streamer.Reset();
+        }
+
+        TSharedRef<FJsonObject> Result = Report.Add(FString::Printf(TEXT("%s/%d-threads"), Scenario.Name, NumThreads), 0, NumEntries, Seconds, Latency.ToString());
+        Result->SetNumberField(TEXT("mean_us"), Latency.GetMeanMicros());
+        Result->SetNumberField(TEXT("p50_us"), Latency.GetPercentileMicros(50.0));
+        Result->SetNumberField(TEXT("p99_us"), Latency.GetPercentileMicros(99.0));
+        Result->SetNumberField(TEXT("p999_us"), Latency.GetPercentileMicros(99.9));
+        Result->SetNumberField(TEXT("max_us"), (double)Latency.MaxNanos.load() / 1000.0);
+        Result->SetBoolField(TEXT("detached_module_devices"), DetachedModuleDevices);
+    }
+    if (DetachedModuleDevices)
+    {
+        FsparklogsModule::GetModule().SetOutputDevicesAttached(true);
+    }
+    return Report.Finish();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestParallelPayloadBuild, "sparklogs.UnitTests.ParallelPayloadBuild", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestParallelPayloadBuild::RunTest(const FString& Parameters)
+{
+    // A mix of every kind of line, including ones longer than the max line length, blank lines, and repeat summaries
+    TArray<uint8> Data;
+    TArray<uint8> Corpus;
+    for (EITLBenchmarkCorpus Kind : ITLBenchmarkCorpora)
+    {
+        ITLGenerateBenchmarkCorpus(Kind, 512 * 1024, Corpus);
+        Data.Append(Corpus);
+        const ANSICHAR* Extra = "\r\n\n[2025.01.01-00.00.00:000][  1]LogTemp: storm [repeat_count=42 first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]\r\n";
+        Data.Append((const uint8*)Extra, FCStringAnsi::Strlen(Extra));
+        Data.AddUninitialized(40 * 1024);
+        FMemory::Memset(Data.GetData() + Data.Num() - 40 * 1024, 'x', 40 * 1024);
+        Data.Add('\n');
+    }
+    FTempDirectory TempDir(ITLGetTestDir());
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs.log"));
+    FFileHelper::SaveArrayToFile(Data, *TestLogFile);
+
+    for (int Variant = 0; Variant < 4; Variant++)
+    {
+        const ITLPayloadFormat Format = (Variant & 1) ? ITLPayloadFormat::Envelope : ITLPayloadFormat::Array;
+        const bool ParseLogPrefix = (Variant & 2) != 0;
+        TArray<FString> PayloadsByThreads[2];
+        for (int Run = 0; Run < 2; Run++)
+        {
+            TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+            Settings->CompressionMode = ITLCompressionMode::None;
+            Settings->PayloadFormat = Format;
+            Settings->ParseLogPrefix = ParseLogPrefix;
+            // Everything else in the common metadata is the same for every streamer
+            Settings->AddRandomGameInstanceID = false;
+            Settings->PayloadBuildThreads = Run == 0 ? 1 : 8;
+            Settings->RepeatSuppressionWindowSecs = 10.0;
+            TSharedRef<FsparklogsStoreInMemPayloadProcessor> PayloadProcessor(new FsparklogsStoreInMemPayloadProcessor());
+            TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+            bool FlushedEverything = false;
+            while (!FlushedEverything && Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything))
+            {
+            }
+            TestTrue(TEXT("Everything should be shipped"), FlushedEverything);
+            Streamer.Reset();
+            PayloadsByThreads[Run] = PayloadProcessor->Payloads;
+        }
+        const FString Name = FString::Printf(TEXT("format=%d, parse_prefix=%d"), (int)Format, ParseLogPrefix ? 1 : 0);
+        TestTrue(FString::Printf(TEXT("%s: should ship payloads"), *Name), PayloadsByThreads[0].Num() > 0);
+        TestEqual(FString::Printf(TEXT("%s: number of payloads"), *Name), PayloadsByThreads[1].Num(), PayloadsByThreads[0].Num());
+        for (int i = 0; i < FMath::Min(PayloadsByThreads[0].Num(), PayloadsByThreads[1].Num()); i++)
+        {
+            // Not TestEqual, the payloads are megabytes long
+            TestTrue(FString::Printf(TEXT("%s: payload %d should be identical to the serially built one"), *Name, i), PayloadsByThreads[0][i].Equals(PayloadsByThreads[1][i], ESearchCase::CaseSensitive));
+        }
+    }
+    return true;
+}
+
+/** A payload processor that keeps every payload buffer it is given, like an HTTP request that is still sending after we gave up on it. */
+class FITLRetainingPayloadProcessor : public IsparklogsPayloadProcessor
+{
+public:
+    FCriticalSection Lock;
+    TArray<FsparklogsPayloadBufferRef> Retained;
+    /** Copies of the payloads at the time they were processed. */
+    TArray<TArray<uint8>> Snapshots;
+    virtual bool ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override
+    {
+        FScopeLock ScopeLock(&Lock);
+        Retained.Add(JSONPayloadInUTF8);
+        Snapshots.Emplace(JSONPayloadInUTF8->GetData(), PayloadLen);
+        return true;
+    }
+};
+
+/**
+ * Counts the heap allocations made on a given set of threads while counting is active, without callstacks or anything else that would
+ * allocate itself. It goes in front of GMalloc the first time it is used and stays there for the rest of the process (forwarding
+ * everything to the allocator it replaced), so it is never swapped back out or destroyed while another thread could be calling into it.
+ */
+class FITLAllocationCounter : public FMalloc
+{
+public:
+    static constexpr int32 MaxThreads = 32;
+
+    static FITLAllocationCounter& Get()
+    {
+        static FITLAllocationCounter* Counter = []()
+        {
+            FITLAllocationCounter* NewCounter = new FITLAllocationCounter(GMalloc);
+            GMalloc = NewCounter;
+            return NewCounter;
+        }();
+        return *Counter;
+    }
+
+    /** Starts counting on the running threads whose name contains ThreadNameSubstring. Returns the number of threads found. */
+    int32 Begin(const TCHAR* ThreadNameSubstring, SIZE_T InLargeAllocationSize)
+    {
+        check(!Active.load());
+        int32 NumFound = 0;
+        FThreadManager::Get().ForEachThread([&NumFound, ThreadNameSubstring, this](uint32 ThreadId, FRunnableThread* Thread)
+        {
+            if (NumFound < MaxThreads && Thread->GetThreadName().Contains(ThreadNameSubstring))
+            {
+                ThreadIds[NumFound++].store(ThreadId, std::memory_order_relaxed);
+            }
+        });
+        NumThreads.store(NumFound, std::memory_order_relaxed);
+        LargeAllocationSize = InLargeAllocationSize;
+        NumAllocations.Reset();
+        NumAllocatedBytes.Reset();
+        NumLargeAllocations.Reset();
+        Active.store(true);
+        return NumFound;
+    }
+    void End()
+    {
+        Active.store(false);
+    }
+
+    virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+    {
+        Record(Count);
+        return Inner->Malloc(Count, Alignment);
+    }
+    virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+    {
+        SIZE_T OriginalSize = 0;
+        if (Count > 0 && Active.load(std::memory_order_relaxed) && (Original == nullptr || !Inner->GetAllocationSize(Original, OriginalSize) || OriginalSize < Count))
+        {
+            Record(Count);
+        }
+        return Inner->Realloc(Original, Count, Alignment);
+    }
+    virtual void Free(void* Original) override { Inner->Free(Original); }
+    virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+    virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+    virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+    virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+    virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+    virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+    virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+    virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+    FThreadSafeCounter64 NumAllocations;
+    FThreadSafeCounter64 NumAllocatedBytes;
+    /** Allocations of at least the size passed to Begin, which is where payload, read, and compression buffers show up. */
+    FThreadSafeCounter64 NumLargeAllocations;
+
+protected:
+    explicit FITLAllocationCounter(FMalloc* InInner) : Inner(InInner), LargeAllocationSize(0) { }
+
+    void Record(SIZE_T Count)
+    {
+        if (!Active.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        const uint32 ThreadId = FPlatformTLS::GetCurrentThreadId();
+        const int32 NumTracked = NumThreads.load(std::memory_order_relaxed);
+        for (int32 i = 0; i < NumTracked; i++)
+        {
+            if (ThreadIds[i].load(std::memory_order_relaxed) == ThreadId)
+            {
+                NumAllocations.Increment();
+                NumAllocatedBytes.Add((int64)Count);
+                if (Count >= LargeAllocationSize)
+                {
+                    NumLargeAllocations.Increment();
+                }
+                return;
+            }
+        }
+    }
+
+    FMalloc* Inner;
+    std::atomic<bool> Active { false };
+    std::atomic<uint32> ThreadIds[MaxThreads] = {};
+    std::atomic<int32> NumThreads { 0 };
+    SIZE_T LargeAllocationSize;
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FsparklogsPluginUnitTestPayloadBufferPool, "sparklogs.UnitTests.PayloadBufferPool", EAutomationTestFlags::EditorContext | EAutomationTestFlags::CriticalPriority | EAutomationTestFlags::EngineFilter)
+bool FsparklogsPluginUnitTestPayloadBufferPool::RunTest(const FString& Parameters)
+{
+    {
+        FsparklogsPayloadBufferPool Pool(2);
+        TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> First = Pool.Acquire(1024);
+        TestTrue(TEXT("Acquired buffer should be empty with room for the capacity"), First->Num() == 0 && First->Max() >= 1024);
+        TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> Second = Pool.Acquire(1024);
+        TestTrue(TEXT("A buffer that is still referenced should not be handed out again"), First != Second);
+        TestEqual(TEXT("Allocations for two new buffers"), Pool.GetNumAllocations(), (int64)2);
+        const TArray<uint8>* SecondBuffer = Second.Get();
+        Second->AddUninitialized(4096);
+        Second.Reset();
+        TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> Reused = Pool.Acquire(1024);
+        TestTrue(TEXT("A released buffer should be reused"), Reused.Get() == SecondBuffer);
+        TestTrue(TEXT("A reused buffer should be empty and keep its capacity"), Reused->Num() == 0 && Reused->Max() >= 4096);
+        TestEqual(TEXT("Growing a buffer while it was handed out counts as an allocation"), Pool.GetNumAllocations(), (int64)3);
+        Reused.Reset();
+        Reused = Pool.Acquire(1024);
+        TestEqual(TEXT("Reusing a buffer of the same size should not allocate"), Pool.GetNumAllocations(), (int64)3);
+        TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> Extra = Pool.Acquire(1024);
+        TestTrue(TEXT("More buffers than are pooled can be handed out"), Extra.IsValid() && Extra != First && Extra != Reused);
+        TestEqual(TEXT("Only MaxPooled buffers should be pooled"), Pool.GetNumPooled(), 2);
+    }
+
+    // The same line over and over, so every chunk builds exactly the same payload
+    FTempDirectory TempDir(ITLGetTestDir());
+    // Named so that only this test's streamer threads are counted (they are named after the logfile)
+    FString TestLogFile = FPaths::Combine(TempDir.GetTempDir(), TEXT("test-sparklogs-steady-state.log"));
+    const ANSICHAR* Line = "[2025.01.01-00.00.00:000][  1]LogTemp: Display: steady state payload with a \"quoted\" word and a tab\there\r\n";
+    const int LineLen = FCStringAnsi::Strlen(Line);
+    TArray<uint8> Data;
+    while (Data.Num() < 24 * FsparklogsSettings::MinBytesPerRequest)
+    {
+        Data.Append((const uint8*)Line, LineLen);
+    }
+    FFileHelper::SaveArrayToFile(Data, *TestLogFile);
+    // Building and compressing a payload allocates nothing once the buffers are warm. Other platforms re-open the logfile on every read.
+#if PLATFORM_LINUX
+    constexpr int MaxAllocationsPerFlush = 1;
+#else
+    constexpr int MaxAllocationsPerFlush = 8;
+#endif
+    FITLAllocationCounter& AllocationCounter = FITLAllocationCounter::Get();
+    const ITLCompressionMode Modes[] = { ITLCompressionMode::None, ITLCompressionMode::LZ4, ITLCompressionMode::LZ4Frame, ITLCompressionMode::LZ4MultiBlock, ITLCompressionMode::Gzip };
+    for (ITLCompressionMode Mode : Modes)
+    {
+        TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+        Settings->IncludeCommonMetadata = false;
+        Settings->CompressionMode = Mode;
+        Settings->BytesPerRequest = FsparklogsSettings::MinBytesPerRequest;
+        TSharedRef<FITLCountingPayloadProcessor> PayloadProcessor(new FITLCountingPayloadProcessor());
+        TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, PayloadProcessor, 16 * 1024, nullptr, nullptr);
+        bool FlushedEverything = false;
+        int NumFlushes = 0;
+        int64 WarmAllocations = -1;
+        int NumCountedThreads = 0;
+        int SteadyFlushes = 0;
+        while (!FlushedEverything && Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything))
+        {
+            // Each buffer can grow once to fit the payloads, after that they are reused as they are
+            if (++NumFlushes == 6)
+            {
+                WarmAllocations = Streamer->GetPayloadBufferPool().GetNumAllocations();
+                // Count what actually reaches the heap from the streamer's worker and pool threads
+                NumCountedThreads = AllocationCounter.Begin(*FPaths::GetBaseFilename(TestLogFile), 16 * 1024);
+            }
+            else if (NumFlushes > 6)
+            {
+                SteadyFlushes++;
+            }
+        }
+        AllocationCounter.End();
+        TestTrue(TEXT("Everything should be shipped"), FlushedEverything);
+        TestTrue(TEXT("Should take many flushes"), NumFlushes > 12);
+        TestEqual(FString::Printf(TEXT("mode=%d: steady state flushes should not allocate payload buffers"), (int)Mode), Streamer->GetPayloadBufferPool().GetNumAllocations(), WarmAllocations);
+        // The worker and at least one pool thread
+        if (TestTrue(TEXT("Should measure steady state flushes on the streamer's threads"), NumCountedThreads >= 2 && SteadyFlushes > 0))
+        {
+            const double AllocationsPerFlush = (double)AllocationCounter.NumAllocations.GetValue() / SteadyFlushes;
+            TestEqual(FString::Printf(TEXT("mode=%d: steady state flushes should not make large heap allocations"), (int)Mode), AllocationCounter.NumLargeAllocations.GetValue(), (int64)0);
+            TestTrue(FString::Printf(TEXT("mode=%d: steady state flushes should make at most %d heap allocations each (made %.1f)"), (int)Mode, MaxAllocationsPerFlush, AllocationsPerFlush),
+                AllocationsPerFlush <= MaxAllocationsPerFlush);
+            AddInfo(FString::Printf(TEXT("mode=%d: %.1f heap allocations (%.0f bytes) per steady state flush"), (int)Mode,
+                AllocationsPerFlush, (double)AllocationCounter.NumAllocatedBytes.GetValue() / SteadyFlushes));
+        }
+        Streamer.Reset();
+    }
+
+    // Buffers the payload processor holds on to must not be written to again
+    TSharedRef<FsparklogsSettings> Settings(new FsparklogsSettings());
+    Settings->IncludeCommonMetadata = false;
+    Settings->CompressionMode = ITLCompressionMode::LZ4;
+    Settings->BytesPerRequest = FsparklogsSettings::MinBytesPerRequest;
+    TSharedRef<FITLRetainingPayloadProcessor> RetainingProcessor(new FITLRetainingPayloadProcessor());
+    TUniquePtr<FsparklogsReadAndStreamToCloud> Streamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*TestLogFile, Settings, RetainingProcessor, 16 * 1024, nullptr, nullptr);
+    bool FlushedEverything = false;
+    while (!FlushedEverything && Streamer->FlushAndWait(1, false, false, false, 10.0, FlushedEverything))
+    {
+    }
+    Streamer.Reset();
+    TestTrue(TEXT("Should process many payloads"), RetainingProcessor->Retained.Num() > 8);
+    for (int i = 0; i < RetainingProcessor->Retained.Num(); i++)
+    {
+        TestTrue(FString::Printf(TEXT("Retained payload %d should be unchanged"), i), *RetainingProcessor->Retained[i] == RetainingProcessor->Snapshots[i]);
+    }
+    return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -4,8 +4,14 @@
 #include "sparklogs.h"
 #include "GenericPlatform/GenericPlatformOutputDevices.h"
 #include "Misc/OutputDeviceFile.h"
+#include "Misc/OutputDeviceHelper.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Crc.h"
 #include "ISettingsModule.h"
 #include "HAL/ThreadManager.h"
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "ProfilingDebugging/CsvProfiler.h"
 
 /*
 #if UE_BUILD_SHIPPING
@@ -18,11 +24,54 @@
 #include "Trace/LZ4/lz4.c.inl"
 #undef LZ4_NAMESPACE
 
+THIRD_PARTY_INCLUDES_START
+#include "zlib.h"
+THIRD_PARTY_INCLUDES_END
+
+// SSE2 is part of the x64 baseline and NEON is always available on arm64, so no runtime CPU detection is needed.
+#if PLATFORM_CPU_X86_FAMILY
+	#include <emmintrin.h>
+	#define ITL_SIMD_SSE2 1
+	#define ITL_SIMD_NEON 0
+#elif PLATFORM_CPU_ARM_FAMILY && PLATFORM_64BITS
+	#include <arm_neon.h>
+	#define ITL_SIMD_SSE2 0
+	#define ITL_SIMD_NEON 1
+#else
+	#define ITL_SIMD_SSE2 0
+	#define ITL_SIMD_NEON 0
+#endif
+
+#if PLATFORM_LINUX
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <linux/falloc.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
 
 #define LOCTEXT_NAMESPACE "FsparklogsModule"
 
 DEFINE_LOG_CATEGORY(LogPluginSparkLogs);
 
+DECLARE_STATS_GROUP(TEXT("SparkLogs"), STATGROUP_SparkLogs, STATCAT_Advanced);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Adaptive Bytes Per Request"), STAT_SparkLogs_AdaptiveBytesPerRequest, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Adaptive Processing Interval (secs)"), STAT_SparkLogs_AdaptiveProcessingIntervalSecs, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Adaptive Smoothed Latency (secs)"), STAT_SparkLogs_AdaptiveSmoothedLatencySecs, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Lines Read"), STAT_SparkLogs_LinesRead, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Bytes Read"), STAT_SparkLogs_BytesRead, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Payload Bytes"), STAT_SparkLogs_PayloadBytes, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Compressed Bytes"), STAT_SparkLogs_CompressedBytes, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Requests"), STAT_SparkLogs_Requests, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Failed Requests"), STAT_SparkLogs_FailedRequests, STATGROUP_SparkLogs);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Retries"), STAT_SparkLogs_Retries, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Request Latency (ms)"), STAT_SparkLogs_RequestLatencyMillis, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Compression Ratio"), STAT_SparkLogs_CompressionRatio, STATGROUP_SparkLogs);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Backlog Bytes"), STAT_SparkLogs_BacklogBytes, STATGROUP_SparkLogs);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Backlog Age (secs)"), STAT_SparkLogs_BacklogAgeSecs, STATGROUP_SparkLogs);
+
+CSV_DEFINE_CATEGORY(SparkLogs, true);
+
 // =============== Globals ===============================================================================
 
 constexpr int GMaxLineLength = 16 * 1024;
@@ -83,6 +132,14 @@ FString GetITLPluginStateFilename()
 	return Name;
 }
 
+FString GetITLPluginJournalFilename()
+{
+	const TCHAR* LaunchConfiguration = GetITLLaunchConfiguration(false);
+	FString Name = FString(TEXT("sparklogs-"), FCString::Strlen(LaunchConfiguration) + FCString::Strlen(TEXT("-progress.journal")));
+	Name.Append(LaunchConfiguration).Append(TEXT("-progress.journal"));
+	return Name;
+}
+
 class FITLLogOutputDeviceInitializer
 {
 public:
@@ -124,17 +181,168 @@ FITLLogOutputDeviceInitializer& GetITLInternalOpsLog()
 	return Singleton;
 }
 
-bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, TArray<uint8>& OutData)
+// LZ4 frame format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md)
+static constexpr uint32 ITLLZ4FrameMagic = 0x184D2204;
+// Version 01, linked blocks, no checksums, no content size
+static constexpr uint8 ITLLZ4FrameFlags = 0x40;
+// 4 MB maximum block size (blocks are normally FsparklogsLZ4FrameEncoder::BlockSize, but can be larger by up to one line)
+static constexpr uint8 ITLLZ4FrameBlockDescriptor = 0x70;
+static constexpr int32 ITLLZ4FrameMaxBlockSize = 4 * 1024 * 1024;
+// Second byte of XXH32({ITLLZ4FrameFlags, ITLLZ4FrameBlockDescriptor}, seed 0)
+static constexpr uint8 ITLLZ4FrameHeaderChecksum = 0xDF;
+
+static FORCEINLINE uint32 ITLReadLittleEndian32(const uint8* Data)
+{
+	return (uint32)Data[0] | ((uint32)Data[1] << 8) | ((uint32)Data[2] << 16) | ((uint32)Data[3] << 24);
+}
+
+static FORCEINLINE void ITLWriteLittleEndian32(uint8* Data, uint32 Value)
+{
+	Data[0] = (uint8)(Value);
+	Data[1] = (uint8)(Value >> 8);
+	Data[2] = (uint8)(Value >> 16);
+	Data[3] = (uint8)(Value >> 24);
+}
+
+// LZ4 multi-block format: block count, then (compressed size, original size) for every block, then the compressed blocks back to back.
+// All values are little endian uint32. Blocks are independent of each other so they can be compressed and decompressed in parallel.
+static constexpr int32 ITLLZ4MultiBlockMinBlockSize = 16 * 1024;
+
+/** Calls Body for every block, spread over at most MaxThreads background priority tasks (the calling thread runs one of them). */
+template <typename BodyType>
+static void ITLParallelForBlocks(int32 NumBlocks, int32 MaxThreads, const BodyType& Body)
+{
+	const int32 NumTasks = FMath::Clamp(MaxThreads, 1, FMath::Max(NumBlocks, 1));
+	if (NumTasks <= 1)
+	{
+		for (int32 Block = 0; Block < NumBlocks; Block++)
+		{
+			Body(Block);
+		}
+		return;
+	}
+	ParallelFor(NumTasks, [&](int32 Task)
+	{
+		for (int32 Block = Task; Block < NumBlocks; Block += NumTasks)
+		{
+			Body(Block);
+		}
+	}, EParallelForFlags::BackgroundPriority);
+}
+
+static bool ITLCompressLZ4MultiBlock(const uint8* InData, int InDataLen, TArray<uint8>& OutData, const FsparklogsCompressionOptions& Options)
+{
+	if (InDataLen < 0 || InDataLen > LZ4_MAX_INPUT_SIZE)
+	{
+		return false;
+	}
+	const int BlockSize = FMath::Clamp(Options.MultiBlockSize, ITLLZ4MultiBlockMinBlockSize, LZ4_MAX_INPUT_SIZE);
+	const int NumBlocks = (InDataLen + BlockSize - 1) / BlockSize;
+	const int HeaderLen = 4 + NumBlocks * 8;
+	// Every block gets its worst case region of the output, and the blocks are packed together at the end
+	TArray<int64, TInlineAllocator<64>> BoundOffsets;
+	BoundOffsets.SetNumUninitialized(NumBlocks + 1);
+	BoundOffsets[0] = HeaderLen;
+	for (int Block = 0; Block < NumBlocks; Block++)
+	{
+		const int BlockLen = FMath::Min(BlockSize, InDataLen - Block * BlockSize);
+		BoundOffsets[Block + 1] = BoundOffsets[Block] + ITLLZ4::LZ4_compressBound(BlockLen);
+	}
+	if (BoundOffsets[NumBlocks] > MAX_int32)
+	{
+		return false;
+	}
+	OutData.SetNumUninitialized((int32)BoundOffsets[NumBlocks], false);
+	uint8* Out = OutData.GetData();
+	ITLWriteLittleEndian32(Out, (uint32)NumBlocks);
+	TArray<int32, TInlineAllocator<64>> CompressedSizes;
+	CompressedSizes.SetNumZeroed(NumBlocks);
+	ITLParallelForBlocks(NumBlocks, Options.MaxThreads, [&](int32 Block)
+	{
+		const int BlockLen = FMath::Min(BlockSize, InDataLen - Block * BlockSize);
+		CompressedSizes[Block] = ITLLZ4::LZ4_compress_fast((const char*)(InData + (int64)Block * BlockSize), (char*)(Out + BoundOffsets[Block]), BlockLen, (int)(BoundOffsets[Block + 1] - BoundOffsets[Block]), Options.LZ4Acceleration);
+	});
+	int OutPos = HeaderLen;
+	for (int Block = 0; Block < NumBlocks; Block++)
+	{
+		if (CompressedSizes[Block] <= 0)
+		{
+			return false;
+		}
+		ITLWriteLittleEndian32(Out + 4 + Block * 8, (uint32)CompressedSizes[Block]);
+		ITLWriteLittleEndian32(Out + 4 + Block * 8 + 4, (uint32)FMath::Min(BlockSize, InDataLen - Block * BlockSize));
+		if (OutPos != BoundOffsets[Block])
+		{
+			FMemory::Memmove(Out + OutPos, Out + BoundOffsets[Block], CompressedSizes[Block]);
+		}
+		OutPos += CompressedSizes[Block];
+	}
+	OutData.SetNumUninitialized(OutPos, false);
+	return true;
+}
+
+static bool ITLDecompressLZ4MultiBlock(const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData, int32 MaxThreads)
+{
+	OutData.SetNumUninitialized(FMath::Max(InOriginalDataLen, 0), false);
+	if (InDataLen < 4)
+	{
+		return false;
+	}
+	const uint32 NumBlocks = ITLReadLittleEndian32(InData);
+	if (NumBlocks > (uint32)(InDataLen - 4) / 8)
+	{
+		return false;
+	}
+	// Validate the whole table up front so the blocks can be decompressed independently
+	TArray<int64, TInlineAllocator<64>> InOffsets;
+	TArray<int64, TInlineAllocator<64>> OutOffsets;
+	InOffsets.SetNumUninitialized(NumBlocks + 1);
+	OutOffsets.SetNumUninitialized(NumBlocks + 1);
+	InOffsets[0] = 4 + (int64)NumBlocks * 8;
+	OutOffsets[0] = 0;
+	for (uint32 Block = 0; Block < NumBlocks; Block++)
+	{
+		InOffsets[Block + 1] = InOffsets[Block] + ITLReadLittleEndian32(InData + 4 + Block * 8);
+		OutOffsets[Block + 1] = OutOffsets[Block] + ITLReadLittleEndian32(InData + 4 + Block * 8 + 4);
+	}
+	if (InOffsets[NumBlocks] != InDataLen || OutOffsets[NumBlocks] > InOriginalDataLen)
+	{
+		return false;
+	}
+	FThreadSafeBool Failed(false);
+	ITLParallelForBlocks((int32)NumBlocks, MaxThreads, [&](int32 Block)
+	{
+		const int BlockLen = (int)(InOffsets[Block + 1] - InOffsets[Block]);
+		const int OriginalBlockLen = (int)(OutOffsets[Block + 1] - OutOffsets[Block]);
+		if (ITLLZ4::LZ4_decompress_safe((const char*)(InData + InOffsets[Block]), (char*)(OutData.GetData() + OutOffsets[Block]), BlockLen, OriginalBlockLen) != OriginalBlockLen)
+		{
+			Failed = true;
+		}
+	});
+	if (Failed)
+	{
+		return false;
+	}
+	OutData.SetNumUninitialized((int32)OutOffsets[NumBlocks], false);
+	return true;
+}
+
+bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, TArray<uint8>& OutData, const FsparklogsCompressionOptions& Options)
 {
 	int32 CompressedBufSize = 0;
 	int CompressedSize = 0;
 	switch (Mode)
 	{
 	case ITLCompressionMode::LZ4:
+	case ITLCompressionMode::LZ4Dictionary:
 		if (InDataLen > LZ4_MAX_INPUT_SIZE)
 		{
 			return false;
 		}
+		if (Mode == ITLCompressionMode::LZ4Dictionary && !Options.Dictionary.IsValid())
+		{
+			return false;
+		}
 		CompressedBufSize = (int32)ITLLZ4::LZ4_compressBound(InDataLen);
 		OutData.SetNumUninitialized(CompressedBufSize, false);
 		if (InDataLen <= 0)
@@ -142,13 +350,37 @@ bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen
 			// no-op
 			return true;
 		}
-		CompressedSize = ITLLZ4::LZ4_compress_default((const char*)InData, (char*)OutData.GetData(), InDataLen, CompressedBufSize);
+		if (Mode == ITLCompressionMode::LZ4Dictionary)
+		{
+			// Start from a copy of the state with the dictionary already loaded, which is much cheaper than loading the dictionary again
+			ITLLZ4::LZ4_stream_t Stream;
+			FMemory::Memcpy(&Stream, Options.Dictionary->GetPreparedLZ4Stream(), sizeof(Stream));
+			CompressedSize = ITLLZ4::LZ4_compress_fast_continue(&Stream, (const char*)InData, (char*)OutData.GetData(), InDataLen, CompressedBufSize, Options.LZ4Acceleration);
+		}
+		else
+		{
+			CompressedSize = ITLLZ4::LZ4_compress_fast((const char*)InData, (char*)OutData.GetData(), InDataLen, CompressedBufSize, Options.LZ4Acceleration);
+		}
 		if (CompressedSize <= 0)
 		{
 			return false;
 		}
 		OutData.SetNumUninitialized(CompressedSize, false);
 		return true;
+	case ITLCompressionMode::LZ4Frame:
+	{
+		FsparklogsLZ4FrameEncoder Encoder;
+		Encoder.Begin(OutData, Options.LZ4Acceleration);
+		return Encoder.Append(InData, InDataLen) && Encoder.Finish();
+	}
+	case ITLCompressionMode::LZ4MultiBlock:
+		return ITLCompressLZ4MultiBlock(InData, InDataLen, OutData, Options);
+	case ITLCompressionMode::Gzip:
+	case ITLCompressionMode::Deflate:
+	{
+		FsparklogsDeflateStream DeflateStream;
+		return DeflateStream.Compress(Mode, Options.DeflateLevel, InData, InDataLen, OutData);
+	}
 	case ITLCompressionMode::None:
 		OutData.SetNumUninitialized(0, false);
 		OutData.Append(InData, (int32)InDataLen);
@@ -158,25 +390,133 @@ bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen
 	}
 }
 
-bool ITLDecompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData)
+/** Decodes an LZ4 frame. Each block can reference up to 64 KB of the output before it, which covers both linked and independent blocks. */
+static bool ITLDecompressLZ4Frame(const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData)
+{
+	OutData.SetNumUninitialized(InOriginalDataLen, false);
+	if (InDataLen < 7 || ITLReadLittleEndian32(InData) != ITLLZ4FrameMagic)
+	{
+		return false;
+	}
+	const uint8 Flags = InData[4];
+	if ((Flags >> 6) != 1 || (Flags & 0x02) != 0)
+	{
+		// unsupported version or reserved bit set
+		return false;
+	}
+	const bool HasBlockChecksums = (Flags & 0x10) != 0;
+	const bool HasContentChecksum = (Flags & 0x04) != 0;
+	// FLG, BD, optional content size and dictionary ID, then the header checksum
+	int Pos = 4 + 2 + ((Flags & 0x08) != 0 ? 8 : 0) + ((Flags & 0x01) != 0 ? 4 : 0) + 1;
+	int OutPos = 0;
+	while (true)
+	{
+		if (Pos + 4 > InDataLen)
+		{
+			return false;
+		}
+		const uint32 BlockHeader = ITLReadLittleEndian32(InData + Pos);
+		Pos += 4;
+		if (BlockHeader == 0)
+		{
+			break;
+		}
+		const int BlockLen = (int)(BlockHeader & 0x7FFFFFFF);
+		if (BlockLen > InDataLen - Pos)
+		{
+			return false;
+		}
+		if ((BlockHeader & 0x80000000) != 0)
+		{
+			// stored uncompressed
+			if (BlockLen > InOriginalDataLen - OutPos)
+			{
+				return false;
+			}
+			FMemory::Memcpy(OutData.GetData() + OutPos, InData + Pos, BlockLen);
+			OutPos += BlockLen;
+		}
+		else
+		{
+			const int HistoryLen = FMath::Min(OutPos, 64 * 1024);
+			const int DecompressedBytes = ITLLZ4::LZ4_decompress_safe_usingDict((const char*)(InData + Pos), (char*)(OutData.GetData() + OutPos), BlockLen, InOriginalDataLen - OutPos, (const char*)(OutData.GetData() + OutPos - HistoryLen), HistoryLen);
+			if (DecompressedBytes < 0)
+			{
+				return false;
+			}
+			OutPos += DecompressedBytes;
+		}
+		Pos += BlockLen + (HasBlockChecksums ? 4 : 0);
+	}
+	if (HasContentChecksum && Pos + 4 > InDataLen)
+	{
+		return false;
+	}
+	OutData.SetNumUninitialized(OutPos, false);
+	return true;
+}
+
+bool ITLDecompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData, const FsparklogsCompressionDictionary* Dictionary, int32 MaxThreads)
 {
 	int DecompressedBytes = 0;
 	switch (Mode)
 	{
 	case ITLCompressionMode::LZ4:
+	case ITLCompressionMode::LZ4Dictionary:
+		if (Mode == ITLCompressionMode::LZ4Dictionary && Dictionary == nullptr)
+		{
+			return false;
+		}
 		OutData.SetNumUninitialized(InOriginalDataLen, false);
 		if (InOriginalDataLen <= 0)
 		{
 			// no-op
 			return true;
 		}
-		DecompressedBytes = ITLLZ4::LZ4_decompress_safe((const char*)InData, (char*)OutData.GetData(), InDataLen, InOriginalDataLen);
+		if (Mode == ITLCompressionMode::LZ4Dictionary)
+		{
+			DecompressedBytes = ITLLZ4::LZ4_decompress_safe_usingDict((const char*)InData, (char*)OutData.GetData(), InDataLen, InOriginalDataLen, (const char*)Dictionary->GetData().GetData(), Dictionary->GetData().Num());
+		}
+		else
+		{
+			DecompressedBytes = ITLLZ4::LZ4_decompress_safe((const char*)InData, (char*)OutData.GetData(), InDataLen, InOriginalDataLen);
+		}
 		if (DecompressedBytes < 0)
 		{
 			return false;
 		}
 		OutData.SetNumUninitialized(DecompressedBytes, false);
 		return true;
+	case ITLCompressionMode::LZ4Frame:
+		return ITLDecompressLZ4Frame(InData, InDataLen, InOriginalDataLen, OutData);
+	case ITLCompressionMode::LZ4MultiBlock:
+		return ITLDecompressLZ4MultiBlock(InData, InDataLen, InOriginalDataLen, OutData, MaxThreads);
+	case ITLCompressionMode::Gzip:
+	case ITLCompressionMode::Deflate:
+	{
+		OutData.SetNumUninitialized(InOriginalDataLen, false);
+		z_stream Stream;
+		FMemory::Memzero(Stream);
+		if (inflateInit2(&Stream, Mode == ITLCompressionMode::Gzip ? 15 + 16 : 15) != Z_OK)
+		{
+			return false;
+		}
+		Stream.next_in = (Bytef*)InData;
+		Stream.avail_in = (uInt)InDataLen;
+		// zlib rejects a null output buffer even when there is nothing to write
+		uint8 EmptyOutput = 0;
+		Stream.next_out = InOriginalDataLen > 0 ? (Bytef*)OutData.GetData() : (Bytef*)&EmptyOutput;
+		Stream.avail_out = (uInt)InOriginalDataLen;
+		const int Result = inflate(&Stream, Z_FINISH);
+		DecompressedBytes = (int)Stream.total_out;
+		inflateEnd(&Stream);
+		if (Result != Z_STREAM_END)
+		{
+			return false;
+		}
+		OutData.SetNumUninitialized(DecompressedBytes, false);
+		return true;
+	}
 	case ITLCompressionMode::None:
 		OutData.SetNumUninitialized(0, false);
 		OutData.Append(InData, (int32)InDataLen);
@@ -198,6 +538,276 @@ SPARKLOGS_API FString ITLGenerateRandomAlphaNumID(int Length)
 	return Result;
 }
 
+SPARKLOGS_API FString ITLFormatStressTestMessage(double PlatformTime, int Iteration)
+{
+	return FString::Printf(TEXT("FsparklogsStressGenerator|Stress test message is being generated at platform_time=%.3lf, iteration=%d, 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 100 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 200 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 300 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 400"), PlatformTime, Iteration);
+}
+
+// =============== FsparklogsCompressionDictionary ===============================================================================
+
+FsparklogsCompressionDictionary::FsparklogsCompressionDictionary(const uint8* InData, int32 InLen)
+{
+	const int32 Len = FMath::Clamp(InLen, 0, MaxSize);
+	Data.Append(InData + (InLen - Len), Len);
+	Id = FCrc::MemCrc32(Data.GetData(), Data.Num());
+	// The prepared state points into Data, which never changes after this
+	PreparedLZ4Stream.SetNumZeroed(sizeof(ITLLZ4::LZ4_stream_t));
+	ITLLZ4::LZ4_loadDict((ITLLZ4::LZ4_stream_t*)PreparedLZ4Stream.GetData(), (const char*)Data.GetData(), Data.Num());
+}
+
+TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> FsparklogsCompressionDictionary::LoadFromFile(const FString& Path)
+{
+	TArray<uint8> FileData;
+	if (!FFileHelper::LoadFileToArray(FileData, *Path, FILEREAD_Silent) || FileData.Num() <= 0)
+	{
+		return nullptr;
+	}
+	return MakeShared<FsparklogsCompressionDictionary, ESPMode::ThreadSafe>(FileData.GetData(), FileData.Num());
+}
+
+SPARKLOGS_API void ITLTrainCompressionDictionary(const TArray<uint8>& Samples, int32 DictionarySize, TArray<uint8>& OutDictionary)
+{
+	// Length of the substrings that are counted (the minimum LZ4 match is 4 bytes, but 8 bytes gives a better signal), and of each dictionary segment
+	constexpr int32 KeyLen = 8;
+	constexpr int32 SegmentSize = 256;
+	constexpr int32 NumKeysPerSegment = SegmentSize - KeyLen + 1;
+	OutDictionary.Reset();
+	DictionarySize = FMath::Clamp(DictionarySize, 0, FsparklogsCompressionDictionary::MaxSize);
+	const int32 NumSamples = Samples.Num();
+	if (NumSamples <= DictionarySize || NumSamples < SegmentSize)
+	{
+		// Not enough data to choose from, so just use all of it
+		OutDictionary.Append(Samples.GetData() + FMath::Max(NumSamples - DictionarySize, 0), FMath::Min(NumSamples, DictionarySize));
+		return;
+	}
+	auto KeyAt = [&Samples](int32 Pos) -> uint64
+	{
+		uint64 Key;
+		FMemory::Memcpy(&Key, Samples.GetData() + Pos, KeyLen);
+		return Key;
+	};
+
+	TMap<uint64, int32> Frequency;
+	for (int32 Pos = 0; Pos + KeyLen <= NumSamples; Pos++)
+	{
+		Frequency.FindOrAdd(KeyAt(Pos))++;
+	}
+
+	struct FSegment
+	{
+		int32 Begin;
+		int64 Score;
+	};
+	TArray<FSegment> Segments;
+	const int32 NumEpochs = FMath::Max(DictionarySize / SegmentSize, 1);
+	const int32 EpochSize = NumSamples / NumEpochs;
+	for (int32 Epoch = 0; Epoch < NumEpochs; Epoch++)
+	{
+		const int32 EpochBegin = Epoch * EpochSize;
+		const int32 EpochEnd = (Epoch == NumEpochs - 1) ? NumSamples : EpochBegin + EpochSize;
+		if (EpochEnd - EpochBegin < SegmentSize)
+		{
+			continue;
+		}
+		// Score of a segment is the sum of the frequencies of the substrings starting in it, maintained as a sliding window
+		int64 Score = 0;
+		for (int32 Pos = EpochBegin; Pos < EpochBegin + NumKeysPerSegment; Pos++)
+		{
+			Score += Frequency.FindChecked(KeyAt(Pos));
+		}
+		FSegment Best = { EpochBegin, Score };
+		for (int32 Begin = EpochBegin + 1; Begin + SegmentSize <= EpochEnd; Begin++)
+		{
+			Score += Frequency.FindChecked(KeyAt(Begin + NumKeysPerSegment - 1)) - Frequency.FindChecked(KeyAt(Begin - 1));
+			if (Score > Best.Score)
+			{
+				Best = { Begin, Score };
+			}
+		}
+		if (Best.Score <= 0)
+		{
+			continue;
+		}
+		Segments.Add(Best);
+		// The substrings in this segment are covered now, so they should not make segments from later epochs look valuable
+		for (int32 Pos = Best.Begin; Pos < Best.Begin + NumKeysPerSegment; Pos++)
+		{
+			Frequency.FindChecked(KeyAt(Pos)) = 0;
+		}
+	}
+
+	// Matches closer to the payload are cheaper to encode, so the most valuable segments go last
+	Segments.Sort([](const FSegment& A, const FSegment& B) { return A.Score < B.Score; });
+	for (const FSegment& Segment : Segments)
+	{
+		OutDictionary.Append(Samples.GetData() + Segment.Begin, SegmentSize);
+	}
+}
+
+// =============== FsparklogsDeflateStream ===============================================================================
+
+FsparklogsDeflateStream::FsparklogsDeflateStream()
+	: StreamMode(ITLCompressionMode::None)
+	, StreamLevel(0)
+{
+}
+
+FsparklogsDeflateStream::~FsparklogsDeflateStream()
+{
+	if (Stream.IsValid())
+	{
+		deflateEnd(Stream.Get());
+	}
+}
+
+bool FsparklogsDeflateStream::Compress(ITLCompressionMode Mode, int32 Level, const uint8* InData, int InDataLen, TArray<uint8>& OutData)
+{
+	check(Mode == ITLCompressionMode::Gzip || Mode == ITLCompressionMode::Deflate);
+	Level = FMath::Clamp(Level, 1, 9);
+	if (Stream.IsValid() && (StreamMode != Mode || StreamLevel != Level))
+	{
+		deflateEnd(Stream.Get());
+		Stream.Reset();
+	}
+	if (Stream.IsValid())
+	{
+		// Keeps the allocated window and hash chains, and starts a new header
+		if (deflateReset(Stream.Get()) != Z_OK)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		Stream = MakeUnique<z_stream>();
+		FMemory::Memzero(*Stream);
+		// 15 is the largest window. Adding 16 writes a gzip header and trailer instead of the zlib ones.
+		const int WindowBits = Mode == ITLCompressionMode::Gzip ? 15 + 16 : 15;
+		if (deflateInit2(Stream.Get(), Level, Z_DEFLATED, WindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			Stream.Reset();
+			return false;
+		}
+		StreamMode = Mode;
+		StreamLevel = Level;
+	}
+	const int32 CompressedBufSize = (int32)deflateBound(Stream.Get(), (uLong)InDataLen);
+	OutData.SetNumUninitialized(CompressedBufSize, false);
+	Stream->next_in = (Bytef*)InData;
+	Stream->avail_in = (uInt)InDataLen;
+	Stream->next_out = (Bytef*)OutData.GetData();
+	Stream->avail_out = (uInt)CompressedBufSize;
+	const int Result = deflate(Stream.Get(), Z_FINISH);
+	if (Result != Z_STREAM_END)
+	{
+		return false;
+	}
+	OutData.SetNumUninitialized((int32)Stream->total_out, false);
+	return true;
+}
+
+// =============== FsparklogsLZ4FrameEncoder ===============================================================================
+
+FsparklogsLZ4FrameEncoder::FsparklogsLZ4FrameEncoder()
+	: CurrentStaging(0)
+	, Out(nullptr)
+	, Acceleration(1)
+	, OriginalLen(0)
+{
+}
+
+void FsparklogsLZ4FrameEncoder::Begin(TArray<uint8>& OutData, int32 InAcceleration)
+{
+	Out = &OutData;
+	Acceleration = InAcceleration;
+	OriginalLen = 0;
+	CurrentStaging = 0;
+	Staging[0].Reset();
+	Staging[1].Reset();
+	if (LZ4Stream.Num() == 0)
+	{
+		LZ4Stream.SetNumZeroed(sizeof(ITLLZ4::LZ4_stream_t));
+	}
+	ITLLZ4::LZ4_resetStream_fast((ITLLZ4::LZ4_stream_t*)LZ4Stream.GetData());
+	Out->SetNumUninitialized(7, false);
+	uint8* Header = Out->GetData();
+	ITLWriteLittleEndian32(Header, ITLLZ4FrameMagic);
+	Header[4] = ITLLZ4FrameFlags;
+	Header[5] = ITLLZ4FrameBlockDescriptor;
+	Header[6] = ITLLZ4FrameHeaderChecksum;
+}
+
+bool FsparklogsLZ4FrameEncoder::Append(const uint8* Data, int Len)
+{
+	while (Len > 0)
+	{
+		TITLJSONStringBuilder& Block = GetStaging();
+		const int N = FMath::Min(Len, BlockSize - Block.Len());
+		Block.Append((const ANSICHAR*)Data, N);
+		Data += N;
+		Len -= N;
+		if (!EndAppend())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FsparklogsLZ4FrameEncoder::CompressStaging()
+{
+	check(Out != nullptr);
+	TITLJSONStringBuilder& Block = Staging[CurrentStaging];
+	const int BlockLen = Block.Len();
+	if (BlockLen <= 0)
+	{
+		return true;
+	}
+	if (BlockLen > ITLLZ4FrameMaxBlockSize)
+	{
+		return false;
+	}
+	const int32 StartPos = Out->Num();
+	const int32 CompressedBufSize = (int32)ITLLZ4::LZ4_compressBound(BlockLen);
+	Out->SetNumUninitialized(StartPos + 4 + CompressedBufSize, false);
+	uint8* BlockOut = Out->GetData() + StartPos;
+	// The stream remembers where the previous block is, which is why it must stay in place (in the other staging buffer) until this one is done
+	const int CompressedSize = ITLLZ4::LZ4_compress_fast_continue((ITLLZ4::LZ4_stream_t*)LZ4Stream.GetData(), (const char*)Block.GetData(), (char*)(BlockOut + 4), BlockLen, CompressedBufSize, Acceleration);
+	if (CompressedSize <= 0)
+	{
+		return false;
+	}
+	if (CompressedSize < BlockLen)
+	{
+		ITLWriteLittleEndian32(BlockOut, (uint32)CompressedSize);
+		Out->SetNumUninitialized(StartPos + 4 + CompressedSize, false);
+	}
+	else
+	{
+		// Incompressible, store as-is (the stream still uses it as history for the next block, just like the decoder will)
+		ITLWriteLittleEndian32(BlockOut, (uint32)BlockLen | 0x80000000);
+		FMemory::Memcpy(BlockOut + 4, Block.GetData(), BlockLen);
+		Out->SetNumUninitialized(StartPos + 4 + BlockLen, false);
+	}
+	OriginalLen += BlockLen;
+	CurrentStaging = 1 - CurrentStaging;
+	Staging[CurrentStaging].Reset();
+	return true;
+}
+
+bool FsparklogsLZ4FrameEncoder::Finish()
+{
+	if (!CompressStaging())
+	{
+		return false;
+	}
+	const int32 StartPos = Out->Num();
+	Out->SetNumUninitialized(StartPos + 4, false);
+	ITLWriteLittleEndian32(Out->GetData() + StartPos, 0);
+	Out = nullptr;
+	return true;
+}
+
 // =============== FsparklogsSettings ===============================================================================
 
 const TCHAR* FsparklogsSettings::PluginStateSection = TEXT("PluginState");
@@ -206,15 +816,42 @@ FsparklogsSettings::FsparklogsSettings()
 	: RequestTimeoutSecs(DefaultRequestTimeoutSecs)
 	, ActivationPercentage(DefaultActivationPercentage)
 	, BytesPerRequest(DefaultBytesPerRequest)
+	, MaxInFlightRequests(DefaultMaxInFlightRequests)
 	, ProcessingIntervalSecs(DefaultProcessingIntervalSecs)
+	, AdaptiveBatching(DefaultAdaptiveBatching)
 	, RetryIntervalSecs(DefaultRetryIntervalSecs)
 	, IncludeCommonMetadata(DefaultIncludeCommonMetadata)
 	, DebugLogRequests(DefaultDebugLogRequests)
 	, AutoStart(DefaultAutoStart)
 	, CompressionMode(ITLCompressionMode::Default)
+	, LZ4Acceleration(DefaultLZ4Acceleration)
+	, DeflateLevel(DefaultDeflateLevel)
+	, CompressionThreads(DefaultCompressionThreads)
 	, AddRandomGameInstanceID(DefaultAddRandomGameInstanceID)
+	, CaptureMode(ITLCaptureMode::Default)
+	, PayloadFormat(ITLPayloadFormat::Default)
+	, MemoryCaptureBufferBytes(DefaultMemoryCaptureBufferBytes)
+	, DropShippedFromPageCache(DefaultDropShippedFromPageCache)
+	, ParseLogPrefix(DefaultParseLogPrefix)
+	, CaptureFilterSummaryIntervalSecs(DefaultCaptureFilterSummaryIntervalSecs)
+	, MaxBacklogBytes(DefaultMaxBacklogBytes)
+	, BacklogDropPolicy(ITLBacklogDropPolicy::Default)
+	, BacklogSampleKeepOneIn(DefaultBacklogSampleKeepOneIn)
+	, RepeatSuppressionWindowSecs(DefaultRepeatSuppressionWindowSecs)
+	, ProgressJournalSyncIntervalSecs(DefaultProgressJournalSyncIntervalSecs)
+	, PayloadBuildThreads(DefaultPayloadBuildThreads)
 	, StressTestGenerateIntervalSecs(0.0)
 	, StressTestNumEntriesPerTick(0)
+	, StressTestNumThreads(DefaultStressTestNumThreads)
+	, StressTestMinMessageLen(DefaultStressTestMessageLen)
+	, StressTestMaxMessageLen(DefaultStressTestMessageLen)
+	, StressTestMessageLenSkew(0.0)
+	, StressTestUnicodeDensity(0.0)
+	, StressTestEscapeDensity(0.0)
+	, StressTestBurstIntervalSecs(0.0)
+	, StressTestBurstNumEntries(0)
+	, StressTestCategories(TEXT("LogEngine"))
+	, StressTestVerbosities(TEXT("Log"))
 {
 }
 
@@ -282,10 +919,18 @@ void FsparklogsSettings::LoadSettings()
 	{
 		BytesPerRequest = DefaultBytesPerRequest;
 	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("MaxInFlightRequests")), MaxInFlightRequests, GEngineIni))
+	{
+		MaxInFlightRequests = DefaultMaxInFlightRequests;
+	}
 	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("ProcessingIntervalSecs")), ProcessingIntervalSecs, GEngineIni))
 	{
 		ProcessingIntervalSecs = DefaultProcessingIntervalSecs;
 	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("AdaptiveBatching")), AdaptiveBatching, GEngineIni))
+	{
+		AdaptiveBatching = DefaultAdaptiveBatching;
+	}
 	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("RetryIntervalSecs")), RetryIntervalSecs, GEngineIni))
 	{
 		RetryIntervalSecs = DefaultRetryIntervalSecs;
@@ -317,7 +962,27 @@ void FsparklogsSettings::LoadSettings()
 	{
 		CompressionMode = ITLCompressionMode::None;
 	}
-	else
+	else if (CompressionModeStr == TEXT("lz4dict"))
+	{
+		CompressionMode = ITLCompressionMode::LZ4Dictionary;
+	}
+	else if (CompressionModeStr == TEXT("lz4frame"))
+	{
+		CompressionMode = ITLCompressionMode::LZ4Frame;
+	}
+	else if (CompressionModeStr == TEXT("lz4multiblock"))
+	{
+		CompressionMode = ITLCompressionMode::LZ4MultiBlock;
+	}
+	else if (CompressionModeStr == TEXT("gzip"))
+	{
+		CompressionMode = ITLCompressionMode::Gzip;
+	}
+	else if (CompressionModeStr == TEXT("deflate"))
+	{
+		CompressionMode = ITLCompressionMode::Deflate;
+	}
+	else
 	{
 		if (CompressionModeStr.Len() > 0)
 		{
@@ -325,6 +990,126 @@ void FsparklogsSettings::LoadSettings()
 		}
 		CompressionMode = ITLCompressionMode::Default;
 	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("LZ4Acceleration")), LZ4Acceleration, GEngineIni))
+	{
+		LZ4Acceleration = DefaultLZ4Acceleration;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("DeflateLevel")), DeflateLevel, GEngineIni))
+	{
+		DeflateLevel = DefaultDeflateLevel;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("CompressionThreads")), CompressionThreads, GEngineIni))
+	{
+		CompressionThreads = DefaultCompressionThreads;
+	}
+	CompressionDictionaryFile = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("CompressionDictionaryFile")), GEngineIni).TrimStartAndEnd();
+	CompressionDictionary.Reset();
+	if (CompressionDictionaryFile.Len() > 0)
+	{
+		FString DictionaryPath = FPaths::IsRelative(CompressionDictionaryFile) ? FPaths::Combine(FPaths::ProjectDir(), CompressionDictionaryFile) : CompressionDictionaryFile;
+		CompressionDictionary = FsparklogsCompressionDictionary::LoadFromFile(DictionaryPath);
+		if (!CompressionDictionary.IsValid())
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Failed to load compression dictionary from %s"), *DictionaryPath);
+		}
+	}
+
+	FString CaptureModeStr = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("CaptureMode")), GEngineIni).ToLower();
+	if (CaptureModeStr == TEXT("file"))
+	{
+		CaptureMode = ITLCaptureMode::File;
+	}
+	else if (CaptureModeStr == TEXT("memory"))
+	{
+		CaptureMode = ITLCaptureMode::Memory;
+	}
+	else if (CaptureModeStr == TEXT("records"))
+	{
+		CaptureMode = ITLCaptureMode::Records;
+	}
+	else
+	{
+		if (CaptureModeStr.Len() > 0)
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Unknown capture_mode=%s, using default mode instead..."), *CaptureModeStr);
+		}
+		CaptureMode = ITLCaptureMode::Default;
+	}
+	FString PayloadFormatStr = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("PayloadFormat")), GEngineIni).ToLower();
+	if (PayloadFormatStr == TEXT("array"))
+	{
+		PayloadFormat = ITLPayloadFormat::Array;
+	}
+	else if (PayloadFormatStr == TEXT("envelope"))
+	{
+		PayloadFormat = ITLPayloadFormat::Envelope;
+	}
+	else
+	{
+		if (PayloadFormatStr.Len() > 0)
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Unknown payload_format=%s, using default format instead..."), *PayloadFormatStr);
+		}
+		PayloadFormat = ITLPayloadFormat::Default;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("MemoryCaptureBufferBytes")), MemoryCaptureBufferBytes, GEngineIni))
+	{
+		MemoryCaptureBufferBytes = DefaultMemoryCaptureBufferBytes;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("DropShippedFromPageCache")), DropShippedFromPageCache, GEngineIni))
+	{
+		DropShippedFromPageCache = DefaultDropShippedFromPageCache;
+	}
+	if (!GConfig->GetBool(*Section, *(SettingPrefix + TEXT("ParseLogPrefix")), ParseLogPrefix, GEngineIni))
+	{
+		ParseLogPrefix = DefaultParseLogPrefix;
+	}
+	CaptureFilterRules = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("CaptureFilterRules")), GEngineIni);
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("CaptureFilterSummaryIntervalSecs")), CaptureFilterSummaryIntervalSecs, GEngineIni))
+	{
+		CaptureFilterSummaryIntervalSecs = DefaultCaptureFilterSummaryIntervalSecs;
+	}
+	if (!GConfig->GetInt64(*Section, *(SettingPrefix + TEXT("MaxBacklogBytes")), MaxBacklogBytes, GEngineIni))
+	{
+		MaxBacklogBytes = DefaultMaxBacklogBytes;
+	}
+	FString BacklogDropPolicyStr = GConfig->GetStr(*Section, *(SettingPrefix + TEXT("BacklogDropPolicy")), GEngineIni).ToLower();
+	if (BacklogDropPolicyStr == TEXT("oldest"))
+	{
+		BacklogDropPolicy = ITLBacklogDropPolicy::DropOldest;
+	}
+	else if (BacklogDropPolicyStr == TEXT("verbose"))
+	{
+		BacklogDropPolicy = ITLBacklogDropPolicy::DropVerboseFirst;
+	}
+	else if (BacklogDropPolicyStr == TEXT("sample"))
+	{
+		BacklogDropPolicy = ITLBacklogDropPolicy::Sample;
+	}
+	else
+	{
+		if (BacklogDropPolicyStr.Len() > 0)
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Unknown backlog_drop_policy=%s, using default policy instead..."), *BacklogDropPolicyStr);
+		}
+		BacklogDropPolicy = ITLBacklogDropPolicy::Default;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("BacklogSampleKeepOneIn")), BacklogSampleKeepOneIn, GEngineIni))
+	{
+		BacklogSampleKeepOneIn = DefaultBacklogSampleKeepOneIn;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("RepeatSuppressionWindowSecs")), RepeatSuppressionWindowSecs, GEngineIni))
+	{
+		RepeatSuppressionWindowSecs = DefaultRepeatSuppressionWindowSecs;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("ProgressJournalSyncIntervalSecs")), ProgressJournalSyncIntervalSecs, GEngineIni))
+	{
+		ProgressJournalSyncIntervalSecs = DefaultProgressJournalSyncIntervalSecs;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("PayloadBuildThreads")), PayloadBuildThreads, GEngineIni))
+	{
+		PayloadBuildThreads = DefaultPayloadBuildThreads;
+	}
 
 	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("StressTestGenerateIntervalSecs")), StressTestGenerateIntervalSecs, GEngineIni))
 	{
@@ -334,6 +1119,46 @@ void FsparklogsSettings::LoadSettings()
 	{
 		StressTestNumEntriesPerTick = 0;
 	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("StressTestNumThreads")), StressTestNumThreads, GEngineIni))
+	{
+		StressTestNumThreads = DefaultStressTestNumThreads;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("StressTestMinMessageLen")), StressTestMinMessageLen, GEngineIni))
+	{
+		StressTestMinMessageLen = DefaultStressTestMessageLen;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("StressTestMaxMessageLen")), StressTestMaxMessageLen, GEngineIni))
+	{
+		StressTestMaxMessageLen = DefaultStressTestMessageLen;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("StressTestMessageLenSkew")), StressTestMessageLenSkew, GEngineIni))
+	{
+		StressTestMessageLenSkew = 0.0;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("StressTestUnicodeDensity")), StressTestUnicodeDensity, GEngineIni))
+	{
+		StressTestUnicodeDensity = 0.0;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("StressTestEscapeDensity")), StressTestEscapeDensity, GEngineIni))
+	{
+		StressTestEscapeDensity = 0.0;
+	}
+	if (!GConfig->GetDouble(*Section, *(SettingPrefix + TEXT("StressTestBurstIntervalSecs")), StressTestBurstIntervalSecs, GEngineIni))
+	{
+		StressTestBurstIntervalSecs = 0.0;
+	}
+	if (!GConfig->GetInt(*Section, *(SettingPrefix + TEXT("StressTestBurstNumEntries")), StressTestBurstNumEntries, GEngineIni))
+	{
+		StressTestBurstNumEntries = 0;
+	}
+	if (!GConfig->GetString(*Section, *(SettingPrefix + TEXT("StressTestCategories")), StressTestCategories, GEngineIni))
+	{
+		StressTestCategories = TEXT("LogEngine");
+	}
+	if (!GConfig->GetString(*Section, *(SettingPrefix + TEXT("StressTestVerbosities")), StressTestVerbosities, GEngineIni))
+	{
+		StressTestVerbosities = TEXT("Log");
+	}
 
 	EnforceConstraints();
 }
@@ -359,6 +1184,14 @@ void FsparklogsSettings::EnforceConstraints()
 	{
 		BytesPerRequest = MaxBytesPerRequest;
 	}
+	if (MaxInFlightRequests < MinMaxInFlightRequests)
+	{
+		MaxInFlightRequests = MinMaxInFlightRequests;
+	}
+	if (MaxInFlightRequests > MaxMaxInFlightRequests)
+	{
+		MaxInFlightRequests = MaxMaxInFlightRequests;
+	}
 	if (ProcessingIntervalSecs < MinProcessingIntervalSecs)
 	{
 		ProcessingIntervalSecs = MinProcessingIntervalSecs;
@@ -371,18 +1204,148 @@ void FsparklogsSettings::EnforceConstraints()
 	{
 		RetryIntervalSecs = MaxRetryIntervalSecs;
 	}
+	if (MemoryCaptureBufferBytes < MinMemoryCaptureBufferBytes)
+	{
+		MemoryCaptureBufferBytes = MinMemoryCaptureBufferBytes;
+	}
+	if (MemoryCaptureBufferBytes > MaxMemoryCaptureBufferBytes)
+	{
+		MemoryCaptureBufferBytes = MaxMemoryCaptureBufferBytes;
+	}
+	if (LZ4Acceleration < MinLZ4Acceleration)
+	{
+		LZ4Acceleration = MinLZ4Acceleration;
+	}
+	if (LZ4Acceleration > MaxLZ4Acceleration)
+	{
+		LZ4Acceleration = MaxLZ4Acceleration;
+	}
+	if (DeflateLevel < MinDeflateLevel)
+	{
+		DeflateLevel = MinDeflateLevel;
+	}
+	if (DeflateLevel > MaxDeflateLevel)
+	{
+		DeflateLevel = MaxDeflateLevel;
+	}
+	CompressionThreads = FMath::Clamp(CompressionThreads, MinCompressionThreads, MaxCompressionThreads);
+	if (CaptureFilterSummaryIntervalSecs < MinCaptureFilterSummaryIntervalSecs)
+	{
+		CaptureFilterSummaryIntervalSecs = MinCaptureFilterSummaryIntervalSecs;
+	}
+	if (CaptureFilterSummaryIntervalSecs > MaxCaptureFilterSummaryIntervalSecs)
+	{
+		CaptureFilterSummaryIntervalSecs = MaxCaptureFilterSummaryIntervalSecs;
+	}
+	if (MaxBacklogBytes < 0)
+	{
+		MaxBacklogBytes = 0;
+	}
+	if (MaxBacklogBytes > 0 && MaxBacklogBytes < MinMaxBacklogBytes)
+	{
+		MaxBacklogBytes = MinMaxBacklogBytes;
+	}
+	if (MaxBacklogBytes > 0 && BacklogDropPolicy == ITLBacklogDropPolicy::DropOldest && !FsparklogsLogFileReader::CanDiscard())
+	{
+		// Skipping the oldest data would bound the catch-up time but not the logfile, which keeps growing on disk
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("The oldest backlog drop policy cannot free disk space on this platform, using the verbose policy instead..."));
+		BacklogDropPolicy = ITLBacklogDropPolicy::DropVerboseFirst;
+	}
+	if (BacklogSampleKeepOneIn < MinBacklogSampleKeepOneIn)
+	{
+		BacklogSampleKeepOneIn = MinBacklogSampleKeepOneIn;
+	}
+	if (BacklogSampleKeepOneIn > MaxBacklogSampleKeepOneIn)
+	{
+		BacklogSampleKeepOneIn = MaxBacklogSampleKeepOneIn;
+	}
+	if (RepeatSuppressionWindowSecs < 0.0)
+	{
+		RepeatSuppressionWindowSecs = 0.0;
+	}
+	if (RepeatSuppressionWindowSecs > MaxRepeatSuppressionWindowSecs)
+	{
+		RepeatSuppressionWindowSecs = MaxRepeatSuppressionWindowSecs;
+	}
+	if (ProgressJournalSyncIntervalSecs < MinProgressJournalSyncIntervalSecs)
+	{
+		ProgressJournalSyncIntervalSecs = MinProgressJournalSyncIntervalSecs;
+	}
+	if (ProgressJournalSyncIntervalSecs > MaxProgressJournalSyncIntervalSecs)
+	{
+		ProgressJournalSyncIntervalSecs = MaxProgressJournalSyncIntervalSecs;
+	}
+	PayloadBuildThreads = FMath::Clamp(PayloadBuildThreads, MinPayloadBuildThreads, MaxPayloadBuildThreads);
 	if (StressTestGenerateIntervalSecs > 0 && StressTestNumEntriesPerTick < 1)
 	{
 		StressTestNumEntriesPerTick = 1;
 	}
+	StressTestNumThreads = FMath::Clamp(StressTestNumThreads, 1, MaxStressTestNumThreads);
+	StressTestMinMessageLen = FMath::Clamp(StressTestMinMessageLen, MinStressTestMessageLen, MaxStressTestMessageLen);
+	StressTestMaxMessageLen = FMath::Clamp(StressTestMaxMessageLen, StressTestMinMessageLen, MaxStressTestMessageLen);
+	StressTestMessageLenSkew = FMath::Max(StressTestMessageLenSkew, 0.0);
+	StressTestUnicodeDensity = FMath::Clamp(StressTestUnicodeDensity, 0.0, 1.0);
+	StressTestEscapeDensity = FMath::Clamp(StressTestEscapeDensity, 0.0, 1.0 - StressTestUnicodeDensity);
+	StressTestBurstIntervalSecs = FMath::Max(StressTestBurstIntervalSecs, 0.0);
+	StressTestBurstNumEntries = FMath::Max(StressTestBurstNumEntries, 0);
+}
+
+// =============== FsparklogsPayloadBufferPool ===============================================================================
+
+FsparklogsPayloadBufferPool::FsparklogsPayloadBufferPool(int32 InMaxPooled)
+	: MaxPooled(FMath::Max(InMaxPooled, 1))
+	, NumAllocations(0)
+{
+}
+
+FsparklogsPayloadBufferRef FsparklogsPayloadBufferPool::Acquire(int32 Capacity)
+{
+	FScopeLock ScopeLock(&Lock);
+	for (FEntry& Entry : Entries)
+	{
+		// Anyone else that holds a reference (e.g. an HTTP request that is still sending it) could still be reading it
+		if (!Entry.Buffer.IsUnique())
+		{
+			continue;
+		}
+		const SIZE_T ReturnedSize = Entry.Buffer->GetAllocatedSize();
+		// Keeps the allocation unless it is smaller than Capacity
+		Entry.Buffer->Reset(Capacity);
+		const SIZE_T NewSize = Entry.Buffer->GetAllocatedSize();
+		// Counts growing while it was handed out, and growing now to make room for Capacity
+		NumAllocations += (ReturnedSize != Entry.AllocatedSize ? 1 : 0) + (NewSize != ReturnedSize ? 1 : 0);
+		Entry.AllocatedSize = NewSize;
+		return Entry.Buffer;
+	}
+	NumAllocations++;
+	FsparklogsPayloadBufferRef Buffer = MakeShared<TArray<uint8>, ESPMode::ThreadSafe>();
+	Buffer->Reserve(Capacity);
+	if (Entries.Num() < MaxPooled)
+	{
+		Entries.Add(FEntry{ Buffer, Buffer->GetAllocatedSize() });
+	}
+	return Buffer;
+}
+
+int64 FsparklogsPayloadBufferPool::GetNumAllocations() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumAllocations;
+}
+
+int32 FsparklogsPayloadBufferPool::GetNumPooled() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Entries.Num();
 }
 
 // =============== FsparklogsWriteNDJSONPayloadProcessor ===============================================================================
 
 FsparklogsWriteNDJSONPayloadProcessor::FsparklogsWriteNDJSONPayloadProcessor(FString InOutputFilePath) : OutputFilePath(InOutputFilePath) { }
 
-bool FsparklogsWriteNDJSONPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer)
+bool FsparklogsWriteNDJSONPayloadProcessor::ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer)
 {
+	FScopeLock Lock(&WriteLock);
 	TUniquePtr<IFileHandle> DebugJSONWriter;
 	DebugJSONWriter.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*OutputFilePath, true, true));
 	if (DebugJSONWriter == nullptr)
@@ -390,7 +1353,7 @@ bool FsparklogsWriteNDJSONPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPa
 		return false;
 	}
 	TArray<uint8> DecompressedData;
-	if (!ITLDecompressData(CompressionMode, JSONPayloadInUTF8.GetData(), PayloadLen, OriginalPayloadLen, DecompressedData))
+	if (!ITLDecompressData(CompressionMode, JSONPayloadInUTF8->GetData(), PayloadLen, OriginalPayloadLen, DecompressedData, Streamer != nullptr ? Streamer->GetCompressionDictionary() : nullptr))
 	{
 		UE_LOG(LogPluginSparkLogs, Warning, TEXT("WriteNDJSONPayloadProcessor: failed to decompress data in payload: mode=%d, len=%d, original_len=%d"), (int)CompressionMode, PayloadLen, OriginalPayloadLen);
 		return false;
@@ -407,10 +1370,71 @@ bool FsparklogsWriteNDJSONPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPa
 
 // =============== FsparklogsWriteHTTPPayloadProcessor ===============================================================================
 
+/**
+ * Streams a payload buffer into an HTTP request instead of copying it with SetContent. Holds a reference to the buffer, so it stays
+ * valid for as long as the HTTP layer needs it (even after we gave up waiting on a timed out request).
+ */
+class FITLPayloadBufferReader : public FArchive
+{
+public:
+	FITLPayloadBufferReader(const FsparklogsPayloadBufferRef& InBuffer, int InLen)
+		: Buffer(InBuffer)
+		, Len(FMath::Clamp(InLen, 0, InBuffer->Num()))
+		, Pos(0)
+	{
+		SetIsLoading(true);
+		SetIsPersistent(false);
+	}
+
+	virtual void Serialize(void* Data, int64 Num) override
+	{
+		if (Num <= 0)
+		{
+			return;
+		}
+		if (Num > Len - Pos)
+		{
+			SetError();
+			return;
+		}
+		FMemory::Memcpy(Data, Buffer->GetData() + Pos, Num);
+		Pos += Num;
+	}
+	virtual int64 Tell() override { return Pos; }
+	virtual int64 TotalSize() override { return Len; }
+	virtual void Seek(int64 InPos) override { Pos = FMath::Clamp<int64>(InPos, 0, Len); }
+	virtual bool AtEnd() override { return Pos >= Len; }
+	virtual FString GetArchiveName() const override { return TEXT("FITLPayloadBufferReader"); }
+
+protected:
+	FsparklogsPayloadBufferRef Buffer;
+	int64 Len;
+	int64 Pos;
+};
+
+/** Outcome of an HTTP request, shared with its completion callback, which can still run after we gave up waiting on a timed out request. */
+struct FITLHTTPRequestState
+{
+	FThreadSafeBool RequestEnded;
+	FThreadSafeBool RequestSucceeded;
+	FThreadSafeBool RetryableFailure;
+	FEventRef RequestEndedEvent;
+
+	FITLHTTPRequestState()
+		: RequestEnded(false)
+		, RequestSucceeded(false)
+		, RetryableFailure(true)
+		, RequestEndedEvent(EEventMode::ManualReset)
+	{
+	}
+};
+
 FsparklogsWriteHTTPPayloadProcessor::FsparklogsWriteHTTPPayloadProcessor(const TCHAR* InEndpointURI, const TCHAR* InAuthorizationHeader, double InTimeoutSecs, bool InLogRequests)
 	: EndpointURI(InEndpointURI)
 	, AuthorizationHeader(InAuthorizationHeader)
 	, LogRequests(InLogRequests)
+	, CachedTimezoneOffsetMinutes(MIN_int32)
+	, CachedDictionaryId(0)
 {
 	SetTimeoutSecs(InTimeoutSecs);
 }
@@ -420,7 +1444,7 @@ void FsparklogsWriteHTTPPayloadProcessor::SetTimeoutSecs(double InTimeoutSecs)
 	TimeoutMillisec.Set((int32)(InTimeoutSecs * 1000.0));
 }
 
-bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer)
+bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_ProcessPayload);
 	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|BEGIN"));
@@ -429,21 +1453,83 @@ bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayl
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: BEGIN: len=%d, original_len=%d, timeout_millisec=%d"), PayloadLen, OriginalPayloadLen, (int)(TimeoutMillisec.GetValue()));
 	}
 	
-	FThreadSafeBool RequestEnded(false);
-	FThreadSafeBool RequestSucceeded(false);
-	FThreadSafeBool RetryableFailure(true);
+	// The completion callback only references this shared state (never anything on this stack), since it can outlive this call
+	TSharedRef<FITLHTTPRequestState, ESPMode::ThreadSafe> State = MakeShared<FITLHTTPRequestState, ESPMode::ThreadSafe>();
+	FThreadSafeBool& RequestEnded = State->RequestEnded;
+	FThreadSafeBool& RequestSucceeded = State->RequestSucceeded;
+	FThreadSafeBool& RetryableFailure = State->RetryableFailure;
+	// Header names and fixed values are only converted to an FString once, instead of for every request
+	static const FString PostVerb(TEXT("POST"));
+	static const FString ContentTypeHeader(TEXT("Content-Type"));
+	static const FString ContentTypeJSON(TEXT("application/json; charset=UTF-8"));
+	static const FString PayloadFormatHeader(TEXT("X-Payload-Format"));
+	static const FString PayloadFormatEnvelope(TEXT("envelope"));
+	static const FString AuthorizationHeaderName(TEXT("Authorization"));
+	static const FString ContentEncodingHeader(TEXT("Content-Encoding"));
+	static const FString OriginalContentLengthHeader(TEXT("X-Original-Content-Length"));
+	static const FString CompressionDictionaryIdHeader(TEXT("X-Compression-Dictionary-Id"));
+	static const FString EncodingLZ4Block(TEXT("lz4-block"));
+	static const FString EncodingLZ4BlockDictionary(TEXT("lz4-block-dict"));
+	static const FString EncodingLZ4Frame(TEXT("lz4-frame"));
+	static const FString EncodingLZ4MultiBlock(TEXT("lz4-multiblock"));
+	static const FString EncodingGzip(TEXT("gzip"));
+	static const FString EncodingDeflate(TEXT("deflate"));
+	// Formatted into a string that is reused for every request on this thread (sends can run on several threads at once)
+	static thread_local FString OriginalContentLength;
+	OriginalContentLength.Reset();
+	OriginalContentLength.AppendInt(OriginalPayloadLen);
 	TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest = FHttpModule::Get().CreateRequest();
-	HttpRequest->SetURL(*EndpointURI);
-	HttpRequest->SetVerb(TEXT("POST"));
+	HttpRequest->SetURL(EndpointURI);
+	HttpRequest->SetVerb(PostVerb);
 	SetHTTPTimezoneHeader(HttpRequest);
-	HttpRequest->SetHeader(TEXT("Content-Type"), TEXT("application/json; charset=UTF-8"));
-	HttpRequest->SetHeader(TEXT("Authorization"), *AuthorizationHeader);
+	HttpRequest->SetHeader(ContentTypeHeader, ContentTypeJSON);
+	if (Streamer != nullptr && Streamer->GetPayloadFormat() == ITLPayloadFormat::Envelope)
+	{
+		// Tells the destination to merge the "common" fields into each of the "events"
+		HttpRequest->SetHeader(PayloadFormatHeader, PayloadFormatEnvelope);
+	}
+	HttpRequest->SetHeader(AuthorizationHeaderName, AuthorizationHeader);
 	HttpRequest->SetTimeout((double)(TimeoutMillisec.GetValue()) / 1000.0);
 	switch (CompressionMode)
 	{
 	case ITLCompressionMode::LZ4:
-		HttpRequest->SetHeader(TEXT("Content-Encoding"), TEXT("lz4-block"));
-		HttpRequest->SetHeader(TEXT("X-Original-Content-Length"), FString::FromInt(OriginalPayloadLen));
+		HttpRequest->SetHeader(ContentEncodingHeader, EncodingLZ4Block);
+		HttpRequest->SetHeader(OriginalContentLengthHeader, OriginalContentLength);
+		break;
+	case ITLCompressionMode::LZ4Dictionary:
+		// Still an LZ4 block, but matches can reference the dictionary, so the receiver needs to know which one to decompress with.
+		// A separate encoding makes a receiver that does not know about dictionaries reject it, instead of decoding garbage.
+		if (Streamer == nullptr || Streamer->GetCompressionDictionary() == nullptr)
+		{
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: no compression dictionary available"));
+			return false;
+		}
+		HttpRequest->SetHeader(ContentEncodingHeader, EncodingLZ4BlockDictionary);
+		HttpRequest->SetHeader(OriginalContentLengthHeader, OriginalContentLength);
+		{
+			FScopeLock ScopeLock(&HeaderCacheLock);
+			const uint32 DictionaryId = Streamer->GetCompressionDictionary()->GetId();
+			if (CachedDictionaryIdHeaderValue.IsEmpty() || CachedDictionaryId != DictionaryId)
+			{
+				CachedDictionaryId = DictionaryId;
+				CachedDictionaryIdHeaderValue = FString::Printf(TEXT("%08x"), DictionaryId);
+			}
+			HttpRequest->SetHeader(CompressionDictionaryIdHeader, CachedDictionaryIdHeaderValue);
+		}
+		break;
+	case ITLCompressionMode::LZ4Frame:
+		HttpRequest->SetHeader(ContentEncodingHeader, EncodingLZ4Frame);
+		HttpRequest->SetHeader(OriginalContentLengthHeader, OriginalContentLength);
+		break;
+	case ITLCompressionMode::LZ4MultiBlock:
+		HttpRequest->SetHeader(ContentEncodingHeader, EncodingLZ4MultiBlock);
+		HttpRequest->SetHeader(OriginalContentLengthHeader, OriginalContentLength);
+		break;
+	case ITLCompressionMode::Gzip:
+		HttpRequest->SetHeader(ContentEncodingHeader, EncodingGzip);
+		break;
+	case ITLCompressionMode::Deflate:
+		HttpRequest->SetHeader(ContentEncodingHeader, EncodingDeflate);
 		break;
 	case ITLCompressionMode::None:
 		// no special header to set
@@ -452,10 +1538,12 @@ bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayl
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("HTTPPayloadProcessor::ProcessPayload: unknown compression mode %d"), (int)CompressionMode);
 		return false;
 	}
-	HttpRequest->SetContent(JSONPayloadInUTF8);
+	// The request streams straight from the payload buffer (and keeps it alive), rather than copying it
+	HttpRequest->SetContentFromStream(MakeShared<FITLPayloadBufferReader, ESPMode::ThreadSafe>(JSONPayloadInUTF8, PayloadLen));
 	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|Headers and data prepared"));
 
-	HttpRequest->OnProcessRequestComplete().BindLambda([&](FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful)
+	const double RetrySecs = Streamer != nullptr ? Streamer->WorkerGetRetrySecs() : 0.0;
+	HttpRequest->OnProcessRequestComplete().BindLambda([State, LogRequests = LogRequests, RetrySecs](FHttpRequestPtr Request, FHttpResponsePtr Response, bool bWasSuccessful)
 		{
 			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|OnProcessRequestComplete|BEGIN"));
 			if (LogRequests)
@@ -471,41 +1559,42 @@ bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayl
 			}
 			if (bWasSuccessful && Response.IsValid())
 			{
-				FString ResponseBody = Response->GetContentAsString();
+				// The body is only converted for error responses, since there is nothing to look at in a successful one
 				int32 ResponseCode = Response->GetResponseCode();
 				if (EHttpResponseCodes::IsOk(ResponseCode))
 				{
-					RequestSucceeded.AtomicSet(true);
+					State->RequestSucceeded.AtomicSet(true);
 				}
 				else if (EHttpResponseCodes::TooManyRequests == ResponseCode || ResponseCode >= EHttpResponseCodes::ServerError)
 				{
-					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Retryable HTTP response: status=%d, msg=%s"), (int)ResponseCode, *ResponseBody.TrimStartAndEnd());
-					RequestSucceeded.AtomicSet(false);
-					RetryableFailure.AtomicSet(true);
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Retryable HTTP response: status=%d, msg=%s"), (int)ResponseCode, *Response->GetContentAsString().TrimStartAndEnd());
+					State->RequestSucceeded.AtomicSet(false);
+					State->RetryableFailure.AtomicSet(true);
 				}
 				else if (EHttpResponseCodes::BadRequest == ResponseCode)
 				{
 					// Something about this input was unable to be processed -- drop this input and pretend success so we can continue, but warn about it
-					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: HTTP response indicates input cannot be processed. Will skip this payload! status=%d, msg=%s"), (int)ResponseCode, *ResponseBody.TrimStartAndEnd());
-					RequestSucceeded.AtomicSet(true);
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: HTTP response indicates input cannot be processed. Will skip this payload! status=%d, msg=%s"), (int)ResponseCode, *Response->GetContentAsString().TrimStartAndEnd());
+					State->RequestSucceeded.AtomicSet(true);
 				}
 				else
 				{
-					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Non-Retryable HTTP response: status=%d, msg=%s"), (int)ResponseCode, *ResponseBody.TrimStartAndEnd());
-					RequestSucceeded.AtomicSet(false);
-					RetryableFailure.AtomicSet(false);
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: Non-Retryable HTTP response: status=%d, msg=%s"), (int)ResponseCode, *Response->GetContentAsString().TrimStartAndEnd());
+					State->RequestSucceeded.AtomicSet(false);
+					State->RetryableFailure.AtomicSet(false);
 				}
 			}
 			else
 			{
-				UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: General HTTP request failure; will retry; retry_seconds=%.3lf"), Streamer->WorkerGetRetrySecs());
-				RequestSucceeded.AtomicSet(false);
-				RetryableFailure.AtomicSet(true);
+				UE_LOG(LogPluginSparkLogs, Warning, TEXT("HTTPPayloadProcessor::ProcessPayload: General HTTP request failure; will retry; retry_seconds=%.3lf"), RetrySecs);
+				State->RequestSucceeded.AtomicSet(false);
+				State->RetryableFailure.AtomicSet(true);
 			}
 
 			// Signal that the request has finished (success or failure)
-			RequestEnded.AtomicSet(true);
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|OnProcessRequestComplete|END|RequestEnded=%d"), RequestEnded ? 1 : 0);
+			State->RequestEnded.AtomicSet(true);
+			State->RequestEndedEvent->Trigger();
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("HTTPPayloadProcessor::ProcessPayload|OnProcessRequestComplete|END|RequestEnded=%d"), State->RequestEnded ? 1 : 0);
 		});
 
 	// Start the HTTP request
@@ -520,7 +1609,7 @@ bool FsparklogsWriteHTTPPayloadProcessor::ProcessPayload(TArray<uint8>& JSONPayl
 	else
 	{
 		// Synchronously wait for the request to complete or fail
-		SleepWaitingForHTTPRequest(HttpRequest, RequestEnded, RequestSucceeded, RetryableFailure, StartTime);
+		SleepWaitingForHTTPRequest(HttpRequest, State->RequestEndedEvent.Get(), RequestEnded, RequestSucceeded, RetryableFailure, StartTime);
 	}
 
 	// If we had a non-retryable failure, then trigger this worker to stop
@@ -550,11 +1639,17 @@ void FsparklogsWriteHTTPPayloadProcessor::SetHTTPTimezoneHeader(TSharedRef<IHttp
 	{
 		FTimespan LocalOffset = FDateTime::Now() - FDateTime::UtcNow();
 		int32 TotalMinutes = FMath::RoundToInt(LocalOffset.GetTotalMinutes());
-		int32 Hours = FMath::Abs(TotalMinutes) / 60;
-		int32 Minutes = FMath::Abs(TotalMinutes) % 60;
-		const TCHAR* Sign = (TotalMinutes >= 0) ? TEXT("+") : TEXT("-");
-		FString TZOffset = FString::Printf(TEXT("UTC%s%02d:%02d"), Sign, Hours, Minutes);
-		HttpRequest->SetHeader(TimezoneHeader, TZOffset);
+		// The offset only changes with daylight saving time, so only format it again when it does
+		FScopeLock ScopeLock(&HeaderCacheLock);
+		if (TotalMinutes != CachedTimezoneOffsetMinutes)
+		{
+			int32 Hours = FMath::Abs(TotalMinutes) / 60;
+			int32 Minutes = FMath::Abs(TotalMinutes) % 60;
+			const TCHAR* Sign = (TotalMinutes >= 0) ? TEXT("+") : TEXT("-");
+			CachedTimezoneHeaderValue = FString::Printf(TEXT("UTC%s%02d:%02d"), Sign, Hours, Minutes);
+			CachedTimezoneOffsetMinutes = TotalMinutes;
+		}
+		HttpRequest->SetHeader(TimezoneHeader, CachedTimezoneHeaderValue);
 	}
 	else
 	{
@@ -563,7 +1658,7 @@ void FsparklogsWriteHTTPPayloadProcessor::SetHTTPTimezoneHeader(TSharedRef<IHttp
 	}
 }
 
-bool FsparklogsWriteHTTPPayloadProcessor::SleepWaitingForHTTPRequest(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest, FThreadSafeBool& RequestEnded, FThreadSafeBool& RequestSucceeded, FThreadSafeBool& RetryableFailure, double StartTime)
+bool FsparklogsWriteHTTPPayloadProcessor::SleepWaitingForHTTPRequest(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest, FEvent* RequestEndedEvent, FThreadSafeBool& RequestEnded, FThreadSafeBool& RequestSucceeded, FThreadSafeBool& RetryableFailure, double StartTime)
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsWriteHTTPPayloadProcessor_SleepWaitingForHTTPRequest);
 	while (!RequestEnded)
@@ -582,623 +1677,3461 @@ bool FsparklogsWriteHTTPPayloadProcessor::SleepWaitingForHTTPRequest(TSharedRef<
 			RetryableFailure.AtomicSet(true);
 			return false;
 		}
-		// Capture stats in this sleep to ensure it is counted as an idle scope...
-		FPlatformProcess::Sleep(0.1f);
+		// Wake up as soon as the request completes. Cap the wait so a timeout that shortened in the meantime is still honored.
+		const double WaitSecs = FMath::Min(Timeout - Elapsed, 0.25);
+		RequestEndedEvent->Wait((uint32)FMath::CeilToInt(FMath::Max(WaitSecs, 0.0) * 1000.0));
 	}
 	return true;
 }
 
-// =============== FsparklogsStressGenerator ===============================================================================
+// =============== FsparklogsLogFileReader ===============================================================================
 
-FsparklogsStressGenerator::FsparklogsStressGenerator(TSharedRef<FsparklogsSettings> InSettings)
-	: Settings(InSettings)
-	, Thread(nullptr)
+FsparklogsLogFileReader::FsparklogsLogFileReader(const TCHAR* InPath, bool InDropShippedFromPageCache)
+	: Path(InPath)
+	, DropShippedFromPageCache(InDropShippedFromPageCache)
+#if PLATFORM_LINUX
+	, Fd(-1)
+	, FileDevice(0)
+	, FileInode(0)
+	, DroppedCacheOffset(0)
+	, DiscardedOffset(0)
+#endif
 {
-	check(FPlatformProcess::SupportsMultithreading());
-	FString ThreadName = TEXT("SparkLogs_StressGenerator");
-	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+#if PLATFORM_LINUX
+	const FTCHARToUTF8 Converter(*FPlatformFileManager::Get().GetPlatformFile().ConvertToAbsolutePathForExternalAppForRead(*Path));
+	NativePath.Append((const ANSICHAR*)Converter.Get(), Converter.Length() + 1);
+#endif
 }
 
-FsparklogsStressGenerator::~FsparklogsStressGenerator()
+FsparklogsLogFileReader::~FsparklogsLogFileReader()
 {
-	if (Thread)
-	{
-		delete Thread;
-	}
-	Thread = nullptr;
+	Close();
 }
 
-bool FsparklogsStressGenerator::Init()
+#if PLATFORM_LINUX
+
+bool FsparklogsLogFileReader::Refresh(bool& OutExists, bool& OutReplaced, int64& OutSize)
 {
+	OutExists = false;
+	OutReplaced = false;
+	OutSize = 0;
+	struct stat PathStat;
+	const bool PathExists = (stat(NativePath.GetData(), &PathStat) == 0);
+	if (!PathExists && errno != ENOENT)
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to stat logfile: errno=%d, logfile='%s'"), errno, *Path);
+		return false;
+	}
+	if (Fd >= 0)
+	{
+		if (PathExists && (uint64)PathStat.st_dev == FileDevice && (uint64)PathStat.st_ino == FileInode)
+		{
+			// Still the same file, and the stat of the path already has the current size
+			OutExists = true;
+			OutSize = (int64)PathStat.st_size;
+			return true;
+		}
+		// The file was rotated away (and maybe replaced). Holding the old descriptor open until now guarantees a new file gets a new inode.
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LogFileReader|file identity changed|path_exists=%d|logfile='%s'"), PathExists ? 1 : 0, *Path);
+		Close();
+		OutReplaced = true;
+	}
+	if (!PathExists)
+	{
+		return true;
+	}
+	Fd = open(NativePath.GetData(), O_RDONLY | O_CLOEXEC);
+	if (Fd < 0)
+	{
+		if (errno == ENOENT)
+		{
+			// Rotated away between the stat and the open
+			return true;
+		}
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open logfile: errno=%d, logfile='%s'"), errno, *Path);
+		return false;
+	}
+	// Take the identity from the descriptor itself in case the path changed between the stat and the open
+	struct stat FdStat;
+	if (fstat(Fd, &FdStat) != 0)
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to stat open logfile: errno=%d, logfile='%s'"), errno, *Path);
+		Close();
+		return false;
+	}
+	FileDevice = (uint64)FdStat.st_dev;
+	FileInode = (uint64)FdStat.st_ino;
+	DroppedCacheOffset = 0;
+	OutExists = true;
+	OutSize = (int64)FdStat.st_size;
 	return true;
 }
 
-uint32 FsparklogsStressGenerator::Run()
+bool FsparklogsLogFileReader::ReadAt(int64 Offset, uint8* Dest, int64 Len)
 {
-	double StressTestGenerateIntervalSecs = Settings->StressTestGenerateIntervalSecs;
-	int StressTestNumEntriesPerTick = Settings->StressTestNumEntriesPerTick;
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator starting. StressTestGenerateIntervalSecs=%.3lf, StressTestNumEntriesPerTick=%d"), StressTestGenerateIntervalSecs, StressTestNumEntriesPerTick);
-	while (StopRequestCounter.GetValue() == 0)
+	if (Fd < 0)
 	{
-		for (int i = 0; i < StressTestNumEntriesPerTick; i++)
+		return false;
+	}
+	while (Len > 0)
+	{
+		const ssize_t NumRead = pread(Fd, Dest, (size_t)Len, (off_t)Offset);
+		if (NumRead < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to read logfile: errno=%d, offset=%ld, logfile='%s'"), errno, Offset, *Path);
+			return false;
+		}
+		if (NumRead == 0)
 		{
-			UE_LOG(LogEngine, Log, TEXT("FsparklogsStressGenerator|Stress test message is being generated at platform_time=%.3lf, iteration=%d, 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 100 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 200 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 300 12345678901234567890123456789012345678901234567890 1234567890123456789012345678901234567890123456 400"), FPlatformTime::Seconds(), i);
+			// The file was truncated since the last refresh
+			return false;
 		}
-		FPlatformProcess::SleepNoStats(StressTestGenerateIntervalSecs);
+		Dest += NumRead;
+		Offset += NumRead;
+		Len -= NumRead;
 	}
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator stopped..."));
-	return 0;
+	return true;
 }
 
-void FsparklogsStressGenerator::Stop()
+void FsparklogsLogFileReader::FinishRead()
 {
-	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator requesting stop..."));
-	StopRequestCounter.Increment();
+	// The descriptor stays open between reads
 }
 
-// =============== FsparklogsReadAndStreamToCloud ===============================================================================
-
-const TCHAR* FsparklogsReadAndStreamToCloud::ProgressMarkerValue = TEXT("ShippedLogOffset");
+void FsparklogsLogFileReader::ReleaseShipped(int64 ToOffset)
+{
+	if (!DropShippedFromPageCache || Fd < 0 || ToOffset <= DroppedCacheOffset)
+	{
+		return;
+	}
+	// Only affects clean pages, and partial pages at either end are kept, so this is safe while the file is still being written.
+	posix_fadvise(Fd, (off_t)DroppedCacheOffset, (off_t)(ToOffset - DroppedCacheOffset), POSIX_FADV_DONTNEED);
+	DroppedCacheOffset = ToOffset;
+}
 
-void FsparklogsReadAndStreamToCloud::ComputeCommonEventJSON(bool IncludeCommonMetadata, TMap<FString, FString>* AdditionalAttributes)
+void FsparklogsLogFileReader::Close()
 {
-	FString CommonEventJSON;
+	if (Fd >= 0)
+	{
+		close(Fd);
+		Fd = -1;
+	}
+	FileDevice = 0;
+	FileInode = 0;
+	DroppedCacheOffset = 0;
+	DiscardedOffset = 0;
+}
 
-	if (IncludeCommonMetadata)
+void FsparklogsLogFileReader::DiscardBefore(int64 ToOffset)
+{
+#if defined(_GNU_SOURCE) && defined(FALLOC_FL_PUNCH_HOLE)
+	// Only whole blocks can be freed
+	constexpr int64 BlockSize = 4096;
+	const int64 FromBlock = Align(DiscardedOffset, BlockSize);
+	const int64 ToBlock = AlignDown(ToOffset, BlockSize);
+	if (Fd < 0 || ToBlock <= FromBlock)
 	{
-		FString EffectiveComputerName;
-		if (OverrideComputerName.IsEmpty())
+		return;
+	}
+	// Punching a hole needs a writable descriptor. Make sure it is for the same file, the path could have been rotated since.
+	const int32 WriteFd = open(NativePath.GetData(), O_WRONLY | O_CLOEXEC);
+	if (WriteFd < 0)
+	{
+		return;
+	}
+	struct stat WriteStat;
+	if (fstat(WriteFd, &WriteStat) == 0 && (uint64)WriteStat.st_dev == FileDevice && (uint64)WriteStat.st_ino == FileInode)
+	{
+		if (fallocate(WriteFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)FromBlock, (off_t)(ToBlock - FromBlock)) == 0)
 		{
-			EffectiveComputerName = FPlatformProcess::ComputerName();
+			DiscardedOffset = ToBlock;
 		}
 		else
 		{
-			EffectiveComputerName = OverrideComputerName;
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LogFileReader|failed to free disk space|errno=%d|logfile='%s'"), errno, *Path);
 		}
-
+	}
+	close(WriteFd);
+#endif
+}
+
+bool FsparklogsLogFileReader::CanDiscard()
+{
+#if defined(_GNU_SOURCE) && defined(FALLOC_FL_PUNCH_HOLE)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool FsparklogsLogFileReader::GetFileIdentity(uint64& OutDevice, uint64& OutInode) const
+{
+	OutDevice = FileDevice;
+	OutInode = FileInode;
+	return Fd >= 0;
+}
+
+bool FsparklogsLogFileReader::GetPathIdentity(const FString& InPath, uint64& OutDevice, uint64& OutInode)
+{
+	OutDevice = 0;
+	OutInode = 0;
+	const FTCHARToUTF8 NativeInPath(*FPlatformFileManager::Get().GetPlatformFile().ConvertToAbsolutePathForExternalAppForRead(*InPath));
+	struct stat PathStat;
+	if (stat(NativeInPath.Get(), &PathStat) != 0)
+	{
+		return false;
+	}
+	OutDevice = (uint64)PathStat.st_dev;
+	OutInode = (uint64)PathStat.st_ino;
+	return true;
+}
+
+#else
+
+bool FsparklogsLogFileReader::Refresh(bool& OutExists, bool& OutReplaced, int64& OutSize)
+{
+	// UE doesn't contain a cross-platform file class that can stay open and refresh the filesize OR read up to N (but maybe less than N bytes).
+	// The only solution and stay within UE class library is to just re-open the file every refresh. This is actually quite fast on modern platforms.
+	OutExists = false;
+	OutReplaced = false;
+	OutSize = 0;
+	Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Path, true));
+	if (!Handle.IsValid())
+	{
+		if (!FPlatformFileManager::Get().GetPlatformFile().FileExists(*Path))
+		{
+			return true;
+		}
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open logfile='%s'"), *Path);
+		return false;
+	}
+	OutExists = true;
+	OutSize = Handle->Size();
+	return true;
+}
+
+bool FsparklogsLogFileReader::ReadAt(int64 Offset, uint8* Dest, int64 Len)
+{
+	if (!Handle.IsValid() || !Handle->Seek(Offset))
+	{
+		return false;
+	}
+	return Handle->Read(Dest, Len);
+}
+
+void FsparklogsLogFileReader::FinishRead()
+{
+	// Don't keep the file open between flushes (on some platforms this would prevent the logfile from being rotated)
+	Handle.Reset();
+}
+
+void FsparklogsLogFileReader::ReleaseShipped(int64 ToOffset)
+{
+}
+
+void FsparklogsLogFileReader::DiscardBefore(int64 ToOffset)
+{
+}
+
+bool FsparklogsLogFileReader::CanDiscard()
+{
+	return false;
+}
+
+void FsparklogsLogFileReader::Close()
+{
+	Handle.Reset();
+}
+
+bool FsparklogsLogFileReader::GetFileIdentity(uint64& OutDevice, uint64& OutInode) const
+{
+	OutDevice = 0;
+	OutInode = 0;
+	return false;
+}
+
+bool FsparklogsLogFileReader::GetPathIdentity(const FString& InPath, uint64& OutDevice, uint64& OutInode)
+{
+	OutDevice = 0;
+	OutInode = 0;
+	return false;
+}
+
+#endif
+
+// =============== FsparklogsProgressJournal ===============================================================================
+
+FsparklogsProgressJournal::FsparklogsProgressJournal(const TCHAR* InPath, double InSyncIntervalSecs)
+	: Path(InPath)
+	, SyncIntervalSecs(InSyncIntervalSecs)
+	, LastSequence(0)
+	, LastSyncPlatformTime(0.0)
+	, NeedsSync(false)
+#if PLATFORM_LINUX
+	, Fd(-1)
+#endif
+{
+}
+
+FsparklogsProgressJournal::~FsparklogsProgressJournal()
+{
+	Close();
+}
+
+void FsparklogsProgressJournal::EncodeRecord(const FRecord& Record, uint8* OutBytes)
+{
+	// Fixed layout in native (little-endian) byte order: magic, version, reserved, sequence, offset, device, inode, reserved, then the CRC32 of everything before it
+	FMemory::Memzero(OutBytes, RecordSize);
+	const uint32 Magic = RecordMagic;
+	const uint16 Version = RecordVersion;
+	FMemory::Memcpy(OutBytes + 0, &Magic, sizeof(Magic));
+	FMemory::Memcpy(OutBytes + 4, &Version, sizeof(Version));
+	FMemory::Memcpy(OutBytes + 8, &Record.Sequence, sizeof(Record.Sequence));
+	FMemory::Memcpy(OutBytes + 16, &Record.Offset, sizeof(Record.Offset));
+	FMemory::Memcpy(OutBytes + 24, &Record.FileDevice, sizeof(Record.FileDevice));
+	FMemory::Memcpy(OutBytes + 32, &Record.FileInode, sizeof(Record.FileInode));
+	const uint32 Crc = FCrc::MemCrc32(OutBytes, RecordSize - sizeof(uint32));
+	FMemory::Memcpy(OutBytes + RecordSize - sizeof(uint32), &Crc, sizeof(Crc));
+}
+
+bool FsparklogsProgressJournal::DecodeRecord(const uint8* Bytes, FRecord& OutRecord)
+{
+	uint32 Magic = 0;
+	uint16 Version = 0;
+	uint32 Crc = 0;
+	FMemory::Memcpy(&Magic, Bytes + 0, sizeof(Magic));
+	FMemory::Memcpy(&Version, Bytes + 4, sizeof(Version));
+	FMemory::Memcpy(&Crc, Bytes + RecordSize - sizeof(uint32), sizeof(Crc));
+	if (Magic != RecordMagic || Version != RecordVersion || Crc != FCrc::MemCrc32(Bytes, RecordSize - sizeof(uint32)))
+	{
+		return false;
+	}
+	FMemory::Memcpy(&OutRecord.Sequence, Bytes + 8, sizeof(OutRecord.Sequence));
+	FMemory::Memcpy(&OutRecord.Offset, Bytes + 16, sizeof(OutRecord.Offset));
+	FMemory::Memcpy(&OutRecord.FileDevice, Bytes + 24, sizeof(OutRecord.FileDevice));
+	FMemory::Memcpy(&OutRecord.FileInode, Bytes + 32, sizeof(OutRecord.FileInode));
+	return true;
+}
+
+bool FsparklogsProgressJournal::Read(FRecord& OutRecord) const
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *Path, FILEREAD_Silent))
+	{
+		return false;
+	}
+	bool Found = false;
+	for (int Slot = 0; Slot < 2 && Bytes.Num() >= (Slot + 1) * RecordSize; Slot++)
+	{
+		FRecord Record;
+		if (DecodeRecord(Bytes.GetData() + Slot * RecordSize, Record) && (!Found || Record.Sequence > OutRecord.Sequence))
+		{
+			OutRecord = Record;
+			Found = true;
+		}
+	}
+	return Found;
+}
+
+bool FsparklogsProgressJournal::Write(int64 Offset, uint64 FileDevice, uint64 FileInode)
+{
+	if (!Open())
+	{
+		return false;
+	}
+	FRecord Record;
+	Record.Offset = Offset;
+	Record.FileDevice = FileDevice;
+	Record.FileInode = FileInode;
+	Record.Sequence = LastSequence + 1;
+	uint8 Bytes[RecordSize];
+	EncodeRecord(Record, Bytes);
+	// Overwrite the slot that does not hold the newest record, so the newest one stays intact if this write is torn
+	if (!WriteAt((int64)(Record.Sequence % 2) * RecordSize, Bytes, RecordSize))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to write progress journal '%s'"), *Path);
+		Close();
+		return false;
+	}
+	LastSequence = Record.Sequence;
+	NeedsSync = true;
+	if (FPlatformTime::Seconds() - LastSyncPlatformTime >= SyncIntervalSecs)
+	{
+		Sync();
+	}
+	return true;
+}
+
+void FsparklogsProgressJournal::Close()
+{
+	if (!IsOpen())
+	{
+		return;
+	}
+	Sync();
+#if PLATFORM_LINUX
+	close(Fd);
+	Fd = -1;
+#else
+	Handle.Reset();
+#endif
+}
+
+void FsparklogsProgressJournal::Delete()
+{
+	Close();
+	IFileManager::Get().Delete(*Path, false, true, false);
+}
+
+bool FsparklogsProgressJournal::Open()
+{
+	if (IsOpen())
+	{
+		return true;
+	}
+	// Continue the sequence from whatever is already in the journal
+	FRecord Existing;
+	LastSequence = Read(Existing) ? Existing.Sequence : 0;
+#if PLATFORM_LINUX
+	const FTCHARToUTF8 NativePath(*FPlatformFileManager::Get().GetPlatformFile().ConvertToAbsolutePathForExternalAppForWrite(*Path));
+	Fd = open(NativePath.Get(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (Fd < 0)
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open progress journal: errno=%d, path='%s'"), errno, *Path);
+		return false;
+	}
+#else
+	// Append mode so the existing records are not truncated, each write seeks to its slot anyway
+	Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path, true, true));
+	if (!Handle.IsValid())
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open progress journal '%s'"), *Path);
+		return false;
+	}
+#endif
+	LastSyncPlatformTime = FPlatformTime::Seconds();
+	NeedsSync = false;
+	return true;
+}
+
+#if PLATFORM_LINUX
+
+bool FsparklogsProgressJournal::IsOpen() const
+{
+	return Fd >= 0;
+}
+
+bool FsparklogsProgressJournal::WriteAt(int64 FileOffset, const uint8* Data, int32 Len)
+{
+	while (Len > 0)
+	{
+		const ssize_t NumWritten = pwrite(Fd, Data, (size_t)Len, (off_t)FileOffset);
+		if (NumWritten < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		Data += NumWritten;
+		FileOffset += NumWritten;
+		Len -= (int32)NumWritten;
+	}
+	return true;
+}
+
+bool FsparklogsProgressJournal::Sync()
+{
+	LastSyncPlatformTime = FPlatformTime::Seconds();
+	if (!NeedsSync)
+	{
+		return true;
+	}
+	NeedsSync = false;
+	if (fdatasync(Fd) != 0)
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to sync progress journal: errno=%d, path='%s'"), errno, *Path);
+		return false;
+	}
+	return true;
+}
+
+#else
+
+bool FsparklogsProgressJournal::IsOpen() const
+{
+	return Handle.IsValid();
+}
+
+bool FsparklogsProgressJournal::WriteAt(int64 FileOffset, const uint8* Data, int32 Len)
+{
+	// Flush (without syncing) so the record is visible to readers right away
+	return Handle->Seek(FileOffset) && Handle->Write(Data, Len) && Handle->Flush(false);
+}
+
+bool FsparklogsProgressJournal::Sync()
+{
+	LastSyncPlatformTime = FPlatformTime::Seconds();
+	if (!NeedsSync)
+	{
+		return true;
+	}
+	NeedsSync = false;
+	if (!Handle->Flush(true))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to sync progress journal '%s'"), *Path);
+		return false;
+	}
+	return true;
+}
+
+#endif
+
+// =============== FsparklogsMemoryCaptureDevice ===============================================================================
+
+FsparklogsMemoryCaptureDevice::FsparklogsMemoryCaptureDevice(int32 InCapacity, FOutputDevice* InSpillDevice, bool InStructuredRecords)
+	: ReservePos(0)
+	, CommitPos(0)
+	, ReleasePos(0)
+	, SpillDevice(InSpillDevice)
+	, DataAvailableEvent(nullptr)
+	, DataAvailableThreshold(0)
+	, StructuredRecords(InStructuredRecords)
+{
+	check(InCapacity > 0);
+	// A power of two capacity lets stream positions map to ring offsets with a mask
+	Ring.SetNumZeroed((int32)FMath::RoundUpToPowerOfTwo((uint32)InCapacity));
+	RingMask = (int64)Ring.Num() - 1;
+	CommitBlockSize = FMath::Min<int64>(4096, Ring.Num());
+	CommitBlockBytes.SetNumZeroed(2 * (int32)(Ring.Num() / CommitBlockSize));
+}
+
+void FsparklogsMemoryCaptureDevice::Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category)
+{
+	Serialize(V, Verbosity, Category, -1.0);
+}
+
+void FsparklogsMemoryCaptureDevice::Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category, const double Time)
+{
+	if (Verbosity == ELogVerbosity::SetColor)
+	{
+		return;
+	}
+	if (StructuredRecords)
+	{
+		FRecord Record;
+		Record.Verbosity = (ELogVerbosity::Type)(Verbosity & ELogVerbosity::VerbosityMask);
+		Record.CategoryId = InternCategory(Category);
+		Record.ThreadId = FPlatformTLS::GetCurrentThreadId();
+		Record.Time = Time;
+		Record.UnixTimeMillis = (FDateTime::UtcNow() - FDateTime(1970, 1, 1)).GetTicks() / ETimespan::TicksPerMillisecond;
+		Record.Frame = GFrameCounter;
+		FTCHARToUTF8 Converter(V);
+		const uint8* Message = (const uint8*)Converter.Get();
+		int32 Remaining = Converter.Length();
+		uint8 Header[RecordHeaderSize];
+		do
+		{
+			// Split long messages at a UTF-8 character boundary
+			int32 Len = Remaining;
+			if (Len > MaxRecordMessageBytes)
+			{
+				Len = MaxRecordMessageBytes;
+				while (Len > 0 && (Message[Len] & 0xC0) == 0x80)
+				{
+					Len--;
+				}
+				if (Len <= 0)
+				{
+					// not valid UTF-8, split anywhere
+					Len = MaxRecordMessageBytes;
+				}
+			}
+			Record.Len = RecordHeaderSize + Len;
+			EncodeRecordHeader(Record, Header);
+			if (!Write(Header, RecordHeaderSize, Message, Len))
+			{
+				NumSpilledBytes.Add(Remaining);
+				if (SpillDevice != nullptr)
+				{
+					SpillDevice->Serialize(*ITLConvertUTF8(Message, Remaining), Verbosity, Category, Time);
+				}
+				return;
+			}
+			Message += Len;
+			Remaining -= Len;
+		} while (Remaining > 0);
+		return;
+	}
+	// Same format that FOutputDeviceFile writes, so the rest of the pipeline cannot tell the difference
+	FString Line = FOutputDeviceHelper::FormatLogLine(Verbosity, Category, V, GPrintLogTimes, Time);
+	Line.Append(LINE_TERMINATOR);
+	FTCHARToUTF8 Converter(*Line, Line.Len());
+	if (!Write((const uint8*)Converter.Get(), Converter.Length()))
+	{
+		NumSpilledBytes.Add(Converter.Length());
+		if (SpillDevice != nullptr)
+		{
+			SpillDevice->Serialize(V, Verbosity, Category, Time);
+		}
+	}
+}
+
+bool FsparklogsMemoryCaptureDevice::Write(const uint8* Data, int32 Len)
+{
+	return Write(Data, Len, nullptr, 0);
+}
+
+bool FsparklogsMemoryCaptureDevice::Write(const uint8* Data1, int32 Len1, const uint8* Data2, int32 Len2)
+{
+	const int64 Capacity = Ring.Num();
+	const int32 Len = Len1 + Len2;
+	if (Len <= 0)
+	{
+		return true;
+	}
+	if (Len > Capacity)
+	{
+		return false;
+	}
+	// Reserve space for this write
+	int64 Start = 0;
+	while (true)
+	{
+		Start = FPlatformAtomics::AtomicRead(&ReservePos);
+		const int64 Released = FPlatformAtomics::AtomicRead(&ReleasePos);
+		if (Start + Len - Released > Capacity)
+		{
+			return false;
+		}
+		if (FPlatformAtomics::InterlockedCompareExchange(&ReservePos, Start + Len, Start) == Start)
+		{
+			break;
+		}
+	}
+	auto CopyToRing = [this, Capacity](int64 Pos, const uint8* Data, int32 DataLen)
+	{
+		const int64 RingOffset = Pos & RingMask;
+		const int64 FirstPart = FMath::Min<int64>(DataLen, Capacity - RingOffset);
+		FMemory::Memcpy(Ring.GetData() + RingOffset, Data, FirstPart);
+		if (FirstPart < DataLen)
+		{
+			FMemory::Memcpy(Ring.GetData(), Data + FirstPart, DataLen - FirstPart);
+		}
+	};
+	CopyToRing(Start, Data1, Len1);
+	if (Len2 > 0)
+	{
+		CopyToRing(Start + Len1, Data2, Len2);
+	}
+	// Publish the bytes written into each block. The consumer works out from these where the data stops being contiguous,
+	// so this never waits on other writers (which could be descheduled, or lower priority).
+	for (int64 Pos = Start; Pos < Start + Len;)
+	{
+		const int64 BlockEnd = (Pos | (CommitBlockSize - 1)) + 1;
+		const int32 NumInBlock = (int32)(FMath::Min(BlockEnd, Start + Len) - Pos);
+		FPlatformAtomics::InterlockedAdd(&CommitBlockBytes[GetCommitBlockIndex(Pos)], NumInBlock);
+		Pos += NumInBlock;
+	}
+	// Only signal when this write is the one that crossed the threshold, so a busy producer does not trigger the event for every line
+	if (FEvent* Event = DataAvailableEvent.load(std::memory_order_acquire))
+	{
+		const int64 Unreleased = Start + Len - FPlatformAtomics::AtomicRead(&ReleasePos);
+		if (Unreleased >= DataAvailableThreshold && Unreleased - Len < DataAvailableThreshold)
+		{
+			Event->Trigger();
+		}
+	}
+	return true;
+}
+
+int64 FsparklogsMemoryCaptureDevice::GetWritePosition() const
+{
+	int64 Pos = FPlatformAtomics::AtomicRead(&CommitPos);
+	while (true)
+	{
+		const int64 BlockStart = Pos & ~(CommitBlockSize - 1);
+		const int64 BlockEnd = BlockStart + CommitBlockSize;
+		int32& BlockBytes = CommitBlockBytes[GetCommitBlockIndex(BlockStart)];
+		// Read the written bytes before the reserve position: everything counted was reserved before it, so if the two match,
+		// no reservation in the block is still being written.
+		const int32 Written = FPlatformAtomics::AtomicRead(&BlockBytes);
+		const int64 End = FMath::Min(FPlatformAtomics::AtomicRead(&ReservePos), BlockEnd);
+		if (End <= Pos || Written != End - BlockStart)
+		{
+			break;
+		}
+		Pos = End;
+		if (End < BlockEnd)
+		{
+			break;
+		}
+		// Nothing more can be written to a full block until it is released, and this happens before it can be
+		FPlatformAtomics::AtomicStore(&BlockBytes, 0);
+	}
+	FPlatformAtomics::AtomicStore(&CommitPos, Pos);
+	return Pos;
+}
+
+int32 FsparklogsMemoryCaptureDevice::Peek(int64 FromPos, uint8* Dest, int32 MaxLen) const
+{
+	const int64 Available = GetWritePosition() - FromPos;
+	if (Available <= 0 || MaxLen <= 0)
+	{
+		return 0;
+	}
+	check(FromPos >= FPlatformAtomics::AtomicRead(&ReleasePos));
+	const int32 NumToCopy = (int32)FMath::Min<int64>(Available, MaxLen);
+	const int64 RingOffset = FromPos & RingMask;
+	const int64 FirstPart = FMath::Min<int64>(NumToCopy, Ring.Num() - RingOffset);
+	FMemory::Memcpy(Dest, Ring.GetData() + RingOffset, FirstPart);
+	if (FirstPart < NumToCopy)
+	{
+		FMemory::Memcpy(Dest + FirstPart, Ring.GetData(), NumToCopy - FirstPart);
+	}
+	return NumToCopy;
+}
+
+void FsparklogsMemoryCaptureDevice::Release(int64 ToPos)
+{
+	FPlatformAtomics::AtomicStore(&ReleasePos, FMath::Min(ToPos, FPlatformAtomics::AtomicRead(&CommitPos)));
+}
+
+void FsparklogsMemoryCaptureDevice::SpillUnreleased()
+{
+	const int64 From = FPlatformAtomics::AtomicRead(&ReleasePos);
+	const int64 To = GetWritePosition();
+	if (SpillDevice == nullptr || To <= From)
+	{
+		return;
+	}
+	TArray<uint8> Data;
+	Data.SetNumUninitialized((int32)(To - From));
+	Peek(From, Data.GetData(), Data.Num());
+	if (StructuredRecords)
+	{
+		// Let the spill device format each message itself
+		FRecord Record;
+		for (int32 Offset = 0; DecodeRecord(Data.GetData() + Offset, Data.Num() - Offset, Record); Offset += Record.Len)
+		{
+			SpillDevice->Serialize(*ITLConvertUTF8(Record.Message, Record.MessageLen), Record.Verbosity, GetCategoryName(Record.CategoryId), Record.Time);
+		}
+		SpillDevice->Flush();
+		Release(To);
+		return;
+	}
+	// The data is already formatted with timestamps etc. and ends with a line terminator, so write it as-is
+	FString Lines = ITLConvertUTF8(Data.GetData(), Data.Num());
+	Lines.RemoveFromEnd(LINE_TERMINATOR);
+	bool WasSuppressed = SpillDevice->GetSuppressEventTag();
+	SpillDevice->SetSuppressEventTag(true);
+	SpillDevice->Serialize(*Lines, ELogVerbosity::Log, NAME_None);
+	SpillDevice->SetSuppressEventTag(WasSuppressed);
+	SpillDevice->Flush();
+	Release(To);
+}
+
+void FsparklogsMemoryCaptureDevice::SetDataAvailableEvent(FEvent* InEvent, int64 ThresholdBytes)
+{
+	DataAvailableThreshold = FMath::Max<int64>(ThresholdBytes, 1);
+	DataAvailableEvent.store(InEvent, std::memory_order_release);
+}
+
+uint16 FsparklogsMemoryCaptureDevice::InternCategory(const FName& Category)
+{
+	{
+		FReadScopeLock ReadLock(CategoryLock);
+		if (const uint16* Id = CategoryIds.Find(Category))
+		{
+			return *Id;
+		}
+	}
+	FWriteScopeLock WriteLock(CategoryLock);
+	if (const uint16* Id = CategoryIds.Find(Category))
+	{
+		return *Id;
+	}
+	if (Categories.Num() >= OverflowCategoryId)
+	{
+		return OverflowCategoryId;
+	}
+	const uint16 Id = (uint16)Categories.Add(Category);
+	CategoryIds.Add(Category, Id);
+	TITLJSONStringBuilder JsonString;
+	FTCHARToUTF8 Converter(*Category.ToString());
+	ITLAppendUTF8AsEscapedJsonString(JsonString, (const ANSICHAR*)Converter.Get(), Converter.Length());
+	CategoryJsonStrings.Emplace((const uint8*)JsonString.GetData(), JsonString.Len());
+	return Id;
+}
+
+FName FsparklogsMemoryCaptureDevice::GetCategoryName(uint16 CategoryId) const
+{
+	FReadScopeLock ReadLock(CategoryLock);
+	return Categories.IsValidIndex(CategoryId) ? Categories[CategoryId] : FName(NAME_None);
+}
+
+void FsparklogsMemoryCaptureDevice::AppendCategoryAsJsonString(TITLJSONStringBuilder& Builder, uint16 CategoryId) const
+{
+	FReadScopeLock ReadLock(CategoryLock);
+	if (CategoryJsonStrings.IsValidIndex(CategoryId))
+	{
+		const TArray<uint8>& JsonString = CategoryJsonStrings[CategoryId];
+		Builder.Append((const ANSICHAR*)JsonString.GetData(), JsonString.Num());
+	}
+	else
+	{
+		Builder.Append("\"None\"", 6);
+	}
+}
+
+void FsparklogsMemoryCaptureDevice::EncodeRecordHeader(const FRecord& Record, uint8* Dest)
+{
+	const uint32 Len = (uint32)Record.Len;
+	const uint8 Verbosity = (uint8)Record.Verbosity;
+	FMemory::Memzero(Dest, RecordHeaderSize);
+	FMemory::Memcpy(Dest + 0, &Len, sizeof(Len));
+	FMemory::Memcpy(Dest + 4, &Verbosity, sizeof(Verbosity));
+	FMemory::Memcpy(Dest + 6, &Record.CategoryId, sizeof(Record.CategoryId));
+	FMemory::Memcpy(Dest + 8, &Record.ThreadId, sizeof(Record.ThreadId));
+	FMemory::Memcpy(Dest + 16, &Record.Time, sizeof(Record.Time));
+	FMemory::Memcpy(Dest + 24, &Record.UnixTimeMillis, sizeof(Record.UnixTimeMillis));
+	FMemory::Memcpy(Dest + 32, &Record.Frame, sizeof(Record.Frame));
+}
+
+bool FsparklogsMemoryCaptureDevice::DecodeRecord(const uint8* Data, int32 Len, FRecord& OutRecord)
+{
+	if (Len < RecordHeaderSize)
+	{
+		return false;
+	}
+	uint32 RecordLen = 0;
+	FMemory::Memcpy(&RecordLen, Data, sizeof(RecordLen));
+	if (RecordLen < (uint32)RecordHeaderSize || RecordLen > (uint32)Len)
+	{
+		return false;
+	}
+	OutRecord.Len = (int32)RecordLen;
+	OutRecord.Verbosity = (ELogVerbosity::Type)Data[4];
+	FMemory::Memcpy(&OutRecord.CategoryId, Data + 6, sizeof(OutRecord.CategoryId));
+	FMemory::Memcpy(&OutRecord.ThreadId, Data + 8, sizeof(OutRecord.ThreadId));
+	FMemory::Memcpy(&OutRecord.Time, Data + 16, sizeof(OutRecord.Time));
+	FMemory::Memcpy(&OutRecord.UnixTimeMillis, Data + 24, sizeof(OutRecord.UnixTimeMillis));
+	FMemory::Memcpy(&OutRecord.Frame, Data + 32, sizeof(OutRecord.Frame));
+	OutRecord.Message = Data + RecordHeaderSize;
+	OutRecord.MessageLen = OutRecord.Len - RecordHeaderSize;
+	return true;
+}
+
+// =============== FsparklogsCaptureFilterDevice ===============================================================================
+
+FsparklogsCaptureFilterDevice::FsparklogsCaptureFilterDevice(FOutputDevice* InInnerDevice, const FString& InRules, double SummaryIntervalSecs)
+	: InnerDevice(InInnerDevice)
+	, SummaryIntervalCycles((uint64)(FMath::Max(SummaryIntervalSecs, 0.0) / FPlatformTime::GetSecondsPerCycle64()))
+	, NextSummaryCycles(FPlatformTime::Cycles64() + SummaryIntervalCycles)
+	, MaxBacklogBytes(0)
+	, BacklogDropPolicy(ITLBacklogDropPolicy::Default)
+	, BacklogSampleKeepOneIn(FsparklogsSettings::DefaultBacklogSampleKeepOneIn)
+	, BacklogSource(nullptr)
+	, BacklogBytes(0)
+	, NextBacklogCheckCycles(0)
+	, RepeatWindowSecs(0.0)
+	, NextRepeatSweepCycles(0)
+{
+	check(InnerDevice != nullptr);
+	for (std::atomic<FCategoryState*>& Slot : CategoryLookup)
+	{
+		Slot.store(nullptr, std::memory_order_relaxed);
+	}
+	ParseRules(InRules, DefaultRule, Rules);
+}
+
+void FsparklogsCaptureFilterDevice::FTokenBucket::Init(double LinesPerSec, double BurstLines)
+{
+	IntervalCycles = (LinesPerSec > 0.0) ? FMath::Max<uint64>((uint64)(1.0 / (LinesPerSec * FPlatformTime::GetSecondsPerCycle64())), 1) : 0;
+	BurstCycles = (uint64)(FMath::Max(BurstLines, 0.0) * IntervalCycles);
+	FullAtCycles.store(0, std::memory_order_relaxed);
+}
+
+bool FsparklogsCaptureFilterDevice::FTokenBucket::TryTake(uint64 NowCycles)
+{
+	uint64 FullAt = FullAtCycles.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		const uint64 NewFullAt = FMath::Max(FullAt, NowCycles) + IntervalCycles;
+		if (NewFullAt - NowCycles > BurstCycles)
+		{
+			return false;
+		}
+		if (FullAtCycles.compare_exchange_weak(FullAt, NewFullAt, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+}
+
+bool FsparklogsCaptureFilterDevice::ParseRules(const FString& InRules, FRule& OutDefaultRule, TMap<FName, FRule>& OutRules)
+{
+	OutDefaultRule = FRule();
+	OutRules.Reset();
+	TArray<FString> RuleStrs;
+	InRules.ParseIntoArrayWS(RuleStrs, TEXT(","));
+	for (const FString& RuleStr : RuleStrs)
+	{
+		FString CategoryStr, OptionsStr;
+		if (!RuleStr.Split(TEXT("="), &CategoryStr, &OptionsStr) || CategoryStr.TrimStartAndEnd().IsEmpty())
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Ignoring invalid capture filter rule '%s', expected Category=Option[;Option...]"), *RuleStr);
+			continue;
+		}
+		CategoryStr.TrimStartAndEndInline();
+		FRule Rule;
+		TArray<FString> Options;
+		OptionsStr.ParseIntoArray(Options, TEXT(";"));
+		for (FString& Option : Options)
+		{
+			Option.TrimStartAndEndInline();
+			FString BurstStr, VerbosityStr, VerbosityRateStr;
+			if (Option == TEXT("off"))
+			{
+				Rule.Deny = true;
+			}
+			else if (Option == TEXT("on"))
+			{
+				Rule.Deny = false;
+			}
+			else if (Option.EndsWith(TEXT("/s")) && FCString::IsNumeric(*Option.LeftChop(2)))
+			{
+				Rule.LinesPerSec = FMath::Max(FCString::Atod(*Option.LeftChop(2)), 0.0);
+			}
+			else if (Option.Split(TEXT("="), nullptr, &BurstStr) && Option.StartsWith(TEXT("burst=")) && FCString::IsNumeric(*BurstStr))
+			{
+				Rule.BurstLines = FMath::Max(FCString::Atod(*BurstStr), 0.0);
+			}
+			else if (Option.Split(TEXT(":"), &VerbosityStr, &VerbosityRateStr) && VerbosityRateStr.EndsWith(TEXT("/s")) && FCString::IsNumeric(*VerbosityRateStr.LeftChop(2)))
+			{
+				bool FoundVerbosity = false;
+				for (int32 V = ELogVerbosity::Fatal; V <= ELogVerbosity::VeryVerbose; V++)
+				{
+					if (VerbosityStr == ToString((ELogVerbosity::Type)V))
+					{
+						Rule.VerbosityLinesPerSec[V] = FMath::Max(FCString::Atod(*VerbosityRateStr.LeftChop(2)), 0.0);
+						FoundVerbosity = true;
+						break;
+					}
+				}
+				if (!FoundVerbosity)
+				{
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("Ignoring invalid option '%s' in capture filter rule for %s"), *Option, *CategoryStr);
+				}
+			}
+			else
+			{
+				bool FoundVerbosity = false;
+				for (int32 V = ELogVerbosity::Fatal; V <= ELogVerbosity::VeryVerbose; V++)
+				{
+					if (Option == ToString((ELogVerbosity::Type)V))
+					{
+						Rule.MaxVerbosity = (ELogVerbosity::Type)V;
+						FoundVerbosity = true;
+						break;
+					}
+				}
+				if (!FoundVerbosity)
+				{
+					UE_LOG(LogPluginSparkLogs, Warning, TEXT("Ignoring invalid option '%s' in capture filter rule for %s"), *Option, *CategoryStr);
+				}
+			}
+		}
+		if (CategoryStr == TEXT("*"))
+		{
+			OutDefaultRule = Rule;
+		}
+		else
+		{
+			OutRules.Add(FName(*CategoryStr), Rule);
+		}
+	}
+	return RuleStrs.Num() > 0;
+}
+
+FsparklogsCaptureFilterDevice::FCategoryState& FsparklogsCaptureFilterDevice::GetCategoryState(const FName& Category)
+{
+	const uint32 LookupHash = GetTypeHash(Category);
+	for (int32 Probe = 0; Probe < MaxCategoryLookupProbes; Probe++)
+	{
+		FCategoryState* State = CategoryLookup[(LookupHash + Probe) & (NumCategoryLookupSlots - 1)].load(std::memory_order_acquire);
+		if (State == nullptr)
+		{
+			break;
+		}
+		if (State->Category == Category)
+		{
+			return *State;
+		}
+	}
+	{
+		FReadScopeLock ReadLock(CategoryStatesLock);
+		if (const TUniquePtr<FCategoryState>* State = CategoryStates.Find(Category))
+		{
+			return **State;
+		}
+	}
+	FWriteScopeLock WriteLock(CategoryStatesLock);
+	if (const TUniquePtr<FCategoryState>* State = CategoryStates.Find(Category))
+	{
+		return **State;
+	}
+	TUniquePtr<FCategoryState> NewState = MakeUnique<FCategoryState>();
+	NewState->Category = Category;
+	const FRule* Rule = Rules.Find(Category);
+	NewState->Rule = Rule != nullptr ? *Rule : DefaultRule;
+	if (NewState->Rule.BurstLines <= 0.0)
+	{
+		NewState->Rule.BurstLines = FMath::Max(NewState->Rule.LinesPerSec, 1.0);
+	}
+	NewState->Bucket.Init(NewState->Rule.LinesPerSec, NewState->Rule.BurstLines);
+	for (int32 V = 0; V < ELogVerbosity::NumVerbosity; V++)
+	{
+		const double VerbosityLinesPerSec = NewState->Rule.VerbosityLinesPerSec[V];
+		NewState->VerbosityBuckets[V].Init(VerbosityLinesPerSec, FMath::Max(VerbosityLinesPerSec, 1.0));
+	}
+	FCategoryState& Result = *NewState;
+	CategoryStates.Add(Category, MoveTemp(NewState));
+	// Publish it for lock-free lookups. If the probe sequence is full, the category is found under the read lock instead.
+	for (int32 Probe = 0; Probe < MaxCategoryLookupProbes; Probe++)
+	{
+		std::atomic<FCategoryState*>& Slot = CategoryLookup[(LookupHash + Probe) & (NumCategoryLookupSlots - 1)];
+		if (Slot.load(std::memory_order_relaxed) == nullptr)
+		{
+			Slot.store(&Result, std::memory_order_release);
+			break;
+		}
+	}
+	return Result;
+}
+
+void FsparklogsCaptureFilterDevice::SetBacklogQuota(int64 InMaxBacklogBytes, ITLBacklogDropPolicy InBacklogDropPolicy, int32 InBacklogSampleKeepOneIn, const FString& InBacklogFilePath)
+{
+	MaxBacklogBytes = InMaxBacklogBytes;
+	BacklogDropPolicy = InBacklogDropPolicy;
+	BacklogSampleKeepOneIn = FMath::Max(InBacklogSampleKeepOneIn, 1);
+	BacklogFilePath = InBacklogFilePath;
+}
+
+void FsparklogsCaptureFilterDevice::SetBacklogSource(const FsparklogsReadAndStreamToCloud* Source)
+{
+	BacklogSource.store(Source);
+	NextBacklogCheckCycles.store(0);
+}
+
+int64 FsparklogsCaptureFilterDevice::RefreshBacklogBytes()
+{
+	const FsparklogsReadAndStreamToCloud* Source = BacklogSource.load();
+	int64 NewBacklogBytes = 0;
+	if (Source != nullptr)
+	{
+		const int64 FileSize = IFileManager::Get().FileSize(*BacklogFilePath);
+		NewBacklogBytes = FMath::Max<int64>(FileSize - Source->GetShippedLogOffset(), 0);
+	}
+	BacklogBytes.store(NewBacklogBytes, std::memory_order_relaxed);
+	return NewBacklogBytes;
+}
+
+bool FsparklogsCaptureFilterDevice::ShouldCaptureWithinBacklogQuota(ELogVerbosity::Type Verbosity)
+{
+	// Checking the size of the logfile takes a syscall, so only one line a second pays for it
+	const uint64 Now = FPlatformTime::Cycles64();
+	uint64 NextCheck = NextBacklogCheckCycles.load(std::memory_order_relaxed);
+	int64 Backlog = BacklogBytes.load(std::memory_order_relaxed);
+	if (Now >= NextCheck && NextBacklogCheckCycles.compare_exchange_strong(NextCheck, Now + (uint64)(1.0 / FPlatformTime::GetSecondsPerCycle64())))
+	{
+		Backlog = RefreshBacklogBytes();
+	}
+	if (Backlog <= MaxBacklogBytes)
+	{
+		return true;
+	}
+	switch (BacklogDropPolicy)
+	{
+	case ITLBacklogDropPolicy::DropVerboseFirst:
+		return Backlog <= MaxBacklogBytes + MaxBacklogBytes / 4 && Verbosity <= ELogVerbosity::Warning;
+	case ITLBacklogDropPolicy::Sample:
+		// Sampling only slows the growth down, so it has the same hard ceiling as DropVerboseFirst
+		return Backlog <= MaxBacklogBytes + MaxBacklogBytes / 4 && (SampleCounter.Increment() % BacklogSampleKeepOneIn) == 0;
+	default:
+		// The streamer drops the oldest data instead
+		return true;
+	}
+}
+
+void FsparklogsCaptureFilterDevice::SetRepeatSuppression(double InRepeatWindowSecs)
+{
+	RepeatWindowSecs = InRepeatWindowSecs;
+	if (RepeatWindowSecs > 0.0 && !RepeatSlots.IsValid())
+	{
+		RepeatSlots = MakeUnique<FRepeatSlot[]>(NumRepeatSlots);
+	}
+}
+
+FString FsparklogsCaptureFilterDevice::TakeRepeatSummary(FRepeatSlot& Slot)
+{
+	FString Summary(Slot.TextLen, Slot.Text);
+	Summary += FString::Printf(TEXT(" [repeat_count=%lld first=%s last=%s]"), Slot.NumSuppressed, *Slot.FirstSuppressed.ToIso8601(), *Slot.LastSuppressed.ToIso8601());
+	Slot.NumSuppressed = 0;
+	return Summary;
+}
+
+bool FsparklogsCaptureFilterDevice::SuppressRepeat(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category)
+{
+	Verbosity = (ELogVerbosity::Type)(Verbosity & ELogVerbosity::VerbosityMask);
+	int32 TextLen = FCString::Strlen(V);
+	while (TextLen > 0 && FChar::IsWhitespace(V[TextLen - 1]))
+	{
+		TextLen--;
+	}
+	if (Verbosity == ELogVerbosity::Fatal || TextLen <= 0 || TextLen > MaxRepeatTextLen)
+	{
+		return false;
+	}
+	const uint32 Hash = FCrc::MemCrc32(V, TextLen * sizeof(TCHAR), HashCombine(GetTypeHash(Category), (uint32)Verbosity));
+	FRepeatSlot& Slot = RepeatSlots[Hash % NumRepeatSlots];
+	const double Now = FPlatformTime::Seconds();
+	bool Suppress = false;
+	FString Summary;
+	FName SummaryCategory;
+	ELogVerbosity::Type SummaryVerbosity = ELogVerbosity::Log;
+	{
+		FScopeLock SlotLock(&Slot.Lock);
+		if (Slot.TextLen == TextLen && Slot.Hash == Hash && Slot.Category == Category && Slot.Verbosity == Verbosity && FMemory::Memcmp(Slot.Text, V, TextLen * sizeof(TCHAR)) == 0)
+		{
+			const bool WindowEnded = Now - Slot.WindowStartSecs >= RepeatWindowSecs;
+			if (!WindowEnded || Slot.NumSuppressed > 0)
+			{
+				// Within the window this is one more repeat. After it, this repeat is the last one reported by the summary for the window.
+				const FDateTime UtcNow = FDateTime::UtcNow();
+				if (Slot.NumSuppressed++ == 0)
+				{
+					Slot.FirstSuppressed = UtcNow;
+				}
+				Slot.LastSuppressed = UtcNow;
+				NumRepeatsSuppressed.Increment();
+				Suppress = true;
+			}
+			if (WindowEnded)
+			{
+				if (Slot.NumSuppressed > 0)
+				{
+					Summary = TakeRepeatSummary(Slot);
+					SummaryCategory = Slot.Category;
+					SummaryVerbosity = Slot.Verbosity;
+				}
+				Slot.WindowStartSecs = Now;
+			}
+		}
+		else
+		{
+			// Evict whatever was in the slot, reporting its repeats first
+			if (Slot.NumSuppressed > 0)
+			{
+				Summary = TakeRepeatSummary(Slot);
+				SummaryCategory = Slot.Category;
+				SummaryVerbosity = Slot.Verbosity;
+			}
+			Slot.Hash = Hash;
+			Slot.Category = Category;
+			Slot.Verbosity = Verbosity;
+			Slot.TextLen = TextLen;
+			FMemory::Memcpy(Slot.Text, V, TextLen * sizeof(TCHAR));
+			Slot.WindowStartSecs = Now;
+		}
+	}
+	if (!Summary.IsEmpty())
+	{
+		InnerDevice->Serialize(*Summary, SummaryVerbosity, SummaryCategory, -1.0);
+	}
+	return Suppress;
+}
+
+void FsparklogsCaptureFilterDevice::EmitRepeatSummaries(bool Force)
+{
+	if (!RepeatSlots.IsValid())
+	{
+		return;
+	}
+	const double Now = FPlatformTime::Seconds();
+	for (int32 i = 0; i < NumRepeatSlots; i++)
+	{
+		FRepeatSlot& Slot = RepeatSlots[i];
+		FString Summary;
+		FName SummaryCategory;
+		ELogVerbosity::Type SummaryVerbosity = ELogVerbosity::Log;
+		{
+			FScopeLock SlotLock(&Slot.Lock);
+			if (Slot.NumSuppressed <= 0 || (!Force && Now - Slot.WindowStartSecs < RepeatWindowSecs))
+			{
+				continue;
+			}
+			// The next repeat (if any) is captured as usual and starts a new window
+			Summary = TakeRepeatSummary(Slot);
+			SummaryCategory = Slot.Category;
+			SummaryVerbosity = Slot.Verbosity;
+		}
+		InnerDevice->Serialize(*Summary, SummaryVerbosity, SummaryCategory, -1.0);
+	}
+}
+
+bool FsparklogsCaptureFilterDevice::ShouldCapture(ELogVerbosity::Type Verbosity, const FName& Category)
+{
+	Verbosity = (ELogVerbosity::Type)(Verbosity & ELogVerbosity::VerbosityMask);
+	if (Verbosity == ELogVerbosity::Fatal)
+	{
+		return true;
+	}
+	FCategoryState& State = GetCategoryState(Category);
+	bool Capture = !State.Rule.Deny && Verbosity <= State.Rule.MaxVerbosity;
+	FTokenBucket& VerbosityBucket = State.VerbosityBuckets[FMath::Min((int32)Verbosity, ELogVerbosity::NumVerbosity - 1)];
+	if (Capture && (State.Bucket.IsLimited() || VerbosityBucket.IsLimited()))
+	{
+		// The verbosity bucket is checked first so that lines it drops don't use up the category's tokens
+		const uint64 Now = FPlatformTime::Cycles64();
+		Capture = (!VerbosityBucket.IsLimited() || VerbosityBucket.TryTake(Now)) && (!State.Bucket.IsLimited() || State.Bucket.TryTake(Now));
+	}
+	if (Capture && MaxBacklogBytes > 0 && !ShouldCaptureWithinBacklogQuota(Verbosity))
+	{
+		Capture = false;
+		NumBacklogDroppedSinceSummary.Increment();
+	}
+	if (!Capture)
+	{
+		State.NumDropped.Increment();
+		NumDroppedSinceSummary.Increment();
+		NumDroppedTotal.Increment();
+	}
+	return Capture;
+}
+
+void FsparklogsCaptureFilterDevice::EmitDroppedSummary()
+{
+	FScopeLock Lock(&SummaryLock);
+	NextSummaryCycles = FPlatformTime::Cycles64() + SummaryIntervalCycles;
+	const int64 NumDropped = NumDroppedSinceSummary.Set(0);
+	const int64 NumDroppedBytes = NumDroppedBytesSinceSummary.Set(0);
+	const int64 NumBacklogDropped = NumBacklogDroppedSinceSummary.Set(0);
+	if (NumDropped <= 0)
+	{
+		return;
+	}
+	FString Summary = FString::Printf(TEXT("Capture filter rules dropped %lld log lines (about %lld bytes)"), NumDropped, NumDroppedBytes);
+	if (NumBacklogDropped > 0)
+	{
+		Summary += FString::Printf(TEXT(", %lld of them because the unshipped backlog exceeded MaxBacklogBytes=%lld (policy=%s)"), NumBacklogDropped, MaxBacklogBytes,
+			(BacklogDropPolicy == ITLBacklogDropPolicy::Sample) ? TEXT("sample") : TEXT("verbose"));
+	}
+	Summary += TEXT(":");
+	{
+		FReadScopeLock ReadLock(CategoryStatesLock);
+		for (const TPair<FName, TUniquePtr<FCategoryState>>& Pair : CategoryStates)
+		{
+			const int64 CategoryDropped = Pair.Value->NumDropped.Set(0);
+			if (CategoryDropped > 0)
+			{
+				Summary += FString::Printf(TEXT(" %s=%lld"), *Pair.Key.ToString(), CategoryDropped);
+			}
+		}
+	}
+	// Sent straight to the capture device so the summary itself can never be filtered
+	InnerDevice->Serialize(*Summary, ELogVerbosity::Warning, LogPluginSparkLogs.GetCategoryName(), -1.0);
+}
+
+void FsparklogsCaptureFilterDevice::Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category)
+{
+	Serialize(V, Verbosity, Category, -1.0);
+}
+
+void FsparklogsCaptureFilterDevice::Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category, const double Time)
+{
+	if (Verbosity == ELogVerbosity::SetColor)
+	{
+		InnerDevice->Serialize(V, Verbosity, Category, Time);
+	}
+	else if (!ShouldCapture(Verbosity, Category))
+	{
+		// Estimated from the number of characters (exact for ASCII), converting a line just to measure it would cost more than capturing it
+		NumDroppedBytesSinceSummary.Add(FCString::Strlen(V));
+	}
+	else if (!RepeatSlots.IsValid() || !SuppressRepeat(V, Verbosity, Category))
+	{
+		InnerDevice->Serialize(V, Verbosity, Category, Time);
+	}
+	const uint64 Now = FPlatformTime::Cycles64();
+	if (NumDroppedSinceSummary.GetValue() > 0 && Now >= NextSummaryCycles.load(std::memory_order_relaxed))
+	{
+		EmitDroppedSummary();
+	}
+	// Repeats that stopped before their window ended are reported by a sweep, which happens at most once a second
+	uint64 NextSweep = NextRepeatSweepCycles.load(std::memory_order_relaxed);
+	if (RepeatSlots.IsValid() && Now >= NextSweep && NextRepeatSweepCycles.compare_exchange_strong(NextSweep, Now + (uint64)(1.0 / FPlatformTime::GetSecondsPerCycle64())))
+	{
+		EmitRepeatSummaries(false);
+	}
+}
+
+void FsparklogsCaptureFilterDevice::Flush()
+{
+	InnerDevice->Flush();
+}
+
+// =============== FsparklogsLatencyHistogram ===============================================================================
+
+/** Returns the index of the histogram bucket that Percentile (0-100) of the counts fall within, or -1 if there are none. */
+static int32 ITLGetPercentileBucket(const FThreadSafeCounter64* Buckets, int32 NumBuckets, double Percentile)
+{
+	int64 Counts[64];
+	check(NumBuckets <= UE_ARRAY_COUNT(Counts));
+	int64 Total = 0;
+	for (int32 i = 0; i < NumBuckets; i++)
+	{
+		Counts[i] = Buckets[i].GetValue();
+		Total += Counts[i];
+	}
+	if (Total <= 0)
+	{
+		return -1;
+	}
+	const int64 Rank = FMath::Max<int64>((int64)FMath::CeilToDouble(Total * FMath::Clamp(Percentile, 0.0, 100.0) / 100.0), 1);
+	int64 Seen = 0;
+	for (int32 i = 0; i < NumBuckets - 1; i++)
+	{
+		Seen += Counts[i];
+		if (Seen >= Rank)
+		{
+			return i;
+		}
+	}
+	return NumBuckets - 1;
+}
+
+FsparklogsLatencyHistogram::FsparklogsLatencyHistogram()
+	: MaxNanos(0)
+{
+}
+
+void FsparklogsLatencyHistogram::Record(int64 Nanos)
+{
+	Nanos = FMath::Max<int64>(Nanos, 1);
+	Buckets[FMath::Min<int32>(FMath::FloorLog2_64((uint64)Nanos), NumBuckets - 1)].Increment();
+	Count.Increment();
+	TotalNanos.Add(Nanos);
+	// Only one thread records, so this does not need a compare and swap
+	if (Nanos > MaxNanos.load(std::memory_order_relaxed))
+	{
+		MaxNanos.store(Nanos, std::memory_order_relaxed);
+	}
+}
+
+void FsparklogsLatencyHistogram::Merge(const FsparklogsLatencyHistogram& Other)
+{
+	for (int32 i = 0; i < NumBuckets; i++)
+	{
+		Buckets[i].Add(Other.Buckets[i].GetValue());
+	}
+	Count.Add(Other.Count.GetValue());
+	TotalNanos.Add(Other.TotalNanos.GetValue());
+	MaxNanos.store(FMath::Max(MaxNanos.load(), Other.MaxNanos.load()));
+}
+
+void FsparklogsLatencyHistogram::Reset()
+{
+	for (int32 i = 0; i < NumBuckets; i++)
+	{
+		Buckets[i].Reset();
+	}
+	Count.Reset();
+	TotalNanos.Reset();
+	MaxNanos.store(0);
+}
+
+double FsparklogsLatencyHistogram::GetPercentileMicros(double Percentile) const
+{
+	const int32 Bucket = ITLGetPercentileBucket(Buckets, NumBuckets, Percentile);
+	if (Bucket < 0)
+	{
+		return 0.0;
+	}
+	// The last bucket has no upper bound, so the slowest call is the best answer there is
+	return (Bucket < NumBuckets - 1) ? (double)(1ull << (Bucket + 1)) / 1000.0 : (double)MaxNanos.load() / 1000.0;
+}
+
+double FsparklogsLatencyHistogram::GetMeanMicros() const
+{
+	const int64 N = Count.GetValue();
+	return N > 0 ? (double)TotalNanos.GetValue() / N / 1000.0 : 0.0;
+}
+
+FString FsparklogsLatencyHistogram::ToString() const
+{
+	return FString::Printf(TEXT("calls=%lld, mean=%.1lfus, p50=%.1lfus, p99=%.1lfus, p99.9=%.1lfus, p99.99=%.1lfus, max=%.1lfus"), Count.GetValue(), GetMeanMicros(),
+		GetPercentileMicros(50.0), GetPercentileMicros(99.0), GetPercentileMicros(99.9), GetPercentileMicros(99.99), (double)MaxNanos.load() / 1000.0);
+}
+
+// =============== FsparklogsStressGenerator ===============================================================================
+
+/** Appends Len characters of fake log text, with the given fraction of characters non-ASCII and needing JSON escapes. */
+static void ITLAppendStressTestText(FRandomStream& Random, int Len, double UnicodeDensity, double EscapeDensity, FString& Out)
+{
+	static const TCHAR* PlainChars = TEXT("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .:;,-_=[]()/");
+	static const TCHAR UnicodeChars[] = { 0x03C0, 0x03A9, 0x00E9, 0x3053, 0x4E16, 0x754C, 0x0416, 0x05D0 };
+	// No newlines, those would split the entry into several lines
+	static const TCHAR EscapeChars[] = { TEXT('"'), TEXT('\\'), TEXT('\t'), TEXT('\b'), TEXT('\f'), 0x01, 0x1F };
+	const int NumPlainChars = FCString::Strlen(PlainChars);
+	Out.Reserve(Out.Len() + Len);
+	for (int i = 0; i < Len; i++)
+	{
+		const double Roll = Random.GetFraction();
+		if (Roll < UnicodeDensity)
+		{
+			Out.AppendChar(UnicodeChars[Random.RandHelper(UE_ARRAY_COUNT(UnicodeChars))]);
+		}
+		else if (Roll < UnicodeDensity + EscapeDensity)
+		{
+			Out.AppendChar(EscapeChars[Random.RandHelper(UE_ARRAY_COUNT(EscapeChars))]);
+		}
+		else
+		{
+			Out.AppendChar(PlainChars[Random.RandHelper(NumPlainChars)]);
+		}
+	}
+}
+
+class FsparklogsStressGenerator::FProducer : public FRunnable
+{
+public:
+	/** Every thread picks from this many pre-generated messages, so generating them does not limit how fast entries are logged. */
+	static constexpr int NumMessages = 256;
+
+	FsparklogsLatencyHistogram Latency;
+	FThreadSafeCounter64 NumEntries;
+
+	FProducer(const FsparklogsStressGenerator& InGenerator, int32 InIndex, double InStartTime)
+		: Generator(InGenerator)
+		, Index(InIndex)
+		, StartTime(InStartTime)
+		, Thread(nullptr)
+	{
+		Thread = FRunnableThread::Create(this, *FString::Printf(TEXT("SparkLogs_StressGenerator_%d"), Index), 0, TPri_BelowNormal);
+	}
+
+	virtual ~FProducer()
+	{
+		if (Thread != nullptr)
+		{
+			Thread->Kill(true);
+			delete Thread;
+		}
+	}
+
+	virtual uint32 Run() override
+	{
+		const FsparklogsSettings& Settings = *Generator.Settings;
+		FRandomStream Random(Index * 7919 + 1);
+		TArray<FString> Messages;
+		Messages.SetNum(NumMessages);
+		for (FString& Message : Messages)
+		{
+			const double U = FMath::Pow(Random.GetFraction(), 1.0 + Settings.StressTestMessageLenSkew);
+			const int Len = Settings.StressTestMinMessageLen + (int)((Settings.StressTestMaxMessageLen - Settings.StressTestMinMessageLen) * U);
+			ITLAppendStressTestText(Random, Len, Settings.StressTestUnicodeDensity, Settings.StressTestEscapeDensity, Message);
+		}
+
+		double NextBurstTime = StartTime + Settings.StressTestBurstIntervalSecs;
+		int64 Sequence = 0;
+		while (StopRequestCounter.GetValue() == 0)
+		{
+			int NumToGenerate = Settings.StressTestNumEntriesPerTick;
+			const double Now = FPlatformTime::Seconds();
+			if (Settings.StressTestBurstIntervalSecs > 0.0 && Now >= NextBurstTime)
+			{
+				NumToGenerate += Settings.StressTestBurstNumEntries;
+				while (NextBurstTime <= Now)
+				{
+					NextBurstTime += Settings.StressTestBurstIntervalSecs;
+				}
+			}
+			for (int i = 0; i < NumToGenerate && StopRequestCounter.GetValue() == 0; i++)
+			{
+				// The thread and sequence number keep entries unique, so they are not collapsed by repeat suppression
+				const FString Text = FString::Printf(TEXT("FsparklogsStressGenerator|thread=%d|seq=%lld|%s"), Index, Sequence++, *Messages[Random.RandHelper(NumMessages)]);
+				const FName& Category = Generator.Categories[Random.RandHelper(Generator.Categories.Num())];
+				const ELogVerbosity::Type Verbosity = Generator.Verbosities[Random.RandHelper(Generator.Verbosities.Num())];
+				// Timed the same way a UE_LOG call with a runtime category and verbosity would be
+				const uint64 StartCycles = FPlatformTime::Cycles64();
+				FMsg::Logf(__FILE__, __LINE__, Category, Verbosity, TEXT("%s"), *Text);
+				Latency.Record((int64)(FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles) * 1e9));
+				NumEntries.Increment();
+			}
+			FPlatformProcess::SleepNoStats(Settings.StressTestGenerateIntervalSecs);
+		}
+		return 0;
+	}
+
+	virtual void Stop() override
+	{
+		StopRequestCounter.Increment();
+	}
+
+protected:
+	const FsparklogsStressGenerator& Generator;
+	int32 Index;
+	double StartTime;
+	FRunnableThread* Thread;
+	/** Non-zero stops this thread */
+	FThreadSafeCounter StopRequestCounter;
+};
+
+FsparklogsStressGenerator::FsparklogsStressGenerator(TSharedRef<FsparklogsSettings> InSettings)
+	: Settings(InSettings)
+{
+	check(FPlatformProcess::SupportsMultithreading());
+	TArray<FString> Names;
+	Settings->StressTestCategories.ParseIntoArrayWS(Names, TEXT(","));
+	for (const FString& Name : Names)
+	{
+		Categories.Add(FName(*Name));
+	}
+	if (Categories.Num() <= 0)
+	{
+		Categories.Add(FName(TEXT("LogEngine")));
+	}
+	Settings->StressTestVerbosities.ParseIntoArrayWS(Names, TEXT(","));
+	for (const FString& Name : Names)
+	{
+		const ELogVerbosity::Type Verbosity = ParseLogVerbosityFromString(Name);
+		// A fatal entry would crash the game
+		if (Verbosity == ELogVerbosity::Fatal || Verbosity == ELogVerbosity::NoLogging)
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Ignoring stress test verbosity '%s'"), *Name);
+			continue;
+		}
+		Verbosities.Add(Verbosity);
+	}
+	if (Verbosities.Num() <= 0)
+	{
+		Verbosities.Add(ELogVerbosity::Log);
+	}
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator starting. threads=%d, StressTestGenerateIntervalSecs=%.3lf, StressTestNumEntriesPerTick=%d, message_len=%d-%d, unicode_density=%.3lf, escape_density=%.3lf, burst=%d every %.3lf secs"),
+		Settings->StressTestNumThreads, Settings->StressTestGenerateIntervalSecs, Settings->StressTestNumEntriesPerTick, Settings->StressTestMinMessageLen, Settings->StressTestMaxMessageLen,
+		Settings->StressTestUnicodeDensity, Settings->StressTestEscapeDensity, Settings->StressTestBurstNumEntries, Settings->StressTestBurstIntervalSecs);
+	const double StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < Settings->StressTestNumThreads; i++)
+	{
+		Producers.Add(MakeUnique<FProducer>(*this, i, StartTime));
+	}
+}
+
+FsparklogsStressGenerator::~FsparklogsStressGenerator()
+{
+	Stop();
+	FsparklogsLatencyHistogram Latency;
+	GetLatency(Latency);
+	Producers.Reset();
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator stopped. Log call latency: %s"), *Latency.ToString());
+}
+
+void FsparklogsStressGenerator::Stop()
+{
+	UE_LOG(LogPluginSparkLogs, Log, TEXT("FsparklogsStressGenerator requesting stop..."));
+	for (TUniquePtr<FProducer>& Producer : Producers)
+	{
+		Producer->Stop();
+	}
+}
+
+int64 FsparklogsStressGenerator::GetNumEntries() const
+{
+	int64 NumEntries = 0;
+	for (const TUniquePtr<FProducer>& Producer : Producers)
+	{
+		NumEntries += Producer->NumEntries.GetValue();
+	}
+	return NumEntries;
+}
+
+void FsparklogsStressGenerator::GetLatency(FsparklogsLatencyHistogram& OutLatency) const
+{
+	for (const TUniquePtr<FProducer>& Producer : Producers)
+	{
+		OutLatency.Merge(Producer->Latency);
+	}
+}
+
+void FsparklogsStressGenerator::ResetLatency()
+{
+	for (TUniquePtr<FProducer>& Producer : Producers)
+	{
+		Producer->Latency.Reset();
+	}
+}
+
+// =============== FsparklogsStreamerStats ===============================================================================
+
+FsparklogsStreamerStats::FsparklogsStreamerStats()
+	: BacklogBytes(0)
+	, LastCaughtUpPlatformTime(FPlatformTime::Seconds())
+{
+}
+
+void FsparklogsStreamerStats::RecordRead(int64 Bytes, int64 Lines)
+{
+	NumBytesRead.Add(Bytes);
+	NumLinesRead.Add(Lines);
+	INC_DWORD_STAT_BY(STAT_SparkLogs_BytesRead, Bytes);
+	INC_DWORD_STAT_BY(STAT_SparkLogs_LinesRead, Lines);
+	CSV_CUSTOM_STAT(SparkLogs, BytesRead, (int32)Bytes, ECsvCustomStatOp::Accumulate);
+	CSV_CUSTOM_STAT(SparkLogs, LinesRead, (int32)Lines, ECsvCustomStatOp::Accumulate);
+}
+
+void FsparklogsStreamerStats::RecordRequest(double LatencySecs, bool Succeeded, int64 PayloadBytes, int64 CompressedBytes)
+{
+	const double LatencyMillis = LatencySecs * 1000.0;
+	int32 Bucket = 0;
+	while (Bucket < NumLatencyBuckets - 1 && LatencyMillis > LatencyBucketMaxMillis[Bucket])
+	{
+		Bucket++;
+	}
+	LatencyBuckets[Bucket].Increment();
+	TotalLatencyMicros.Add((int64)(LatencySecs * 1000000.0));
+	NumRequests.Increment();
+	INC_DWORD_STAT(STAT_SparkLogs_Requests);
+	SET_FLOAT_STAT(STAT_SparkLogs_RequestLatencyMillis, LatencyMillis);
+	CSV_CUSTOM_STAT(SparkLogs, Requests, 1, ECsvCustomStatOp::Accumulate);
+	CSV_CUSTOM_STAT(SparkLogs, RequestLatencyMs, LatencyMillis, ECsvCustomStatOp::Max);
+	if (!Succeeded)
+	{
+		NumFailedRequests.Increment();
+		INC_DWORD_STAT(STAT_SparkLogs_FailedRequests);
+		CSV_CUSTOM_STAT(SparkLogs, FailedRequests, 1, ECsvCustomStatOp::Accumulate);
+		return;
+	}
+	NumPayloads.Increment();
+	NumPayloadBytes.Add(PayloadBytes);
+	NumCompressedBytes.Add(CompressedBytes);
+	INC_DWORD_STAT_BY(STAT_SparkLogs_PayloadBytes, PayloadBytes);
+	INC_DWORD_STAT_BY(STAT_SparkLogs_CompressedBytes, CompressedBytes);
+	SET_FLOAT_STAT(STAT_SparkLogs_CompressionRatio, GetCompressionRatio());
+	CSV_CUSTOM_STAT(SparkLogs, PayloadBytes, (int32)PayloadBytes, ECsvCustomStatOp::Accumulate);
+	CSV_CUSTOM_STAT(SparkLogs, CompressedBytes, (int32)CompressedBytes, ECsvCustomStatOp::Accumulate);
+}
+
+void FsparklogsStreamerStats::RecordFlush(bool Succeeded, bool Retry)
+{
+	if (Retry)
+	{
+		NumRetries.Increment();
+		INC_DWORD_STAT(STAT_SparkLogs_Retries);
+		CSV_CUSTOM_STAT(SparkLogs, Retries, 1, ECsvCustomStatOp::Accumulate);
+	}
+	if (!Succeeded)
+	{
+		NumFailedFlushes.Increment();
+	}
+}
+
+void FsparklogsStreamerStats::RecordBacklog(int64 Bytes)
+{
+	BacklogBytes.store(Bytes, std::memory_order_relaxed);
+	if (Bytes <= 0)
+	{
+		LastCaughtUpPlatformTime.store(FPlatformTime::Seconds(), std::memory_order_relaxed);
+	}
+	SET_DWORD_STAT(STAT_SparkLogs_BacklogBytes, (uint32)FMath::Min<int64>(Bytes, MAX_uint32));
+	SET_FLOAT_STAT(STAT_SparkLogs_BacklogAgeSecs, GetBacklogAgeSecs());
+	CSV_CUSTOM_STAT(SparkLogs, BacklogBytes, (int32)FMath::Min<int64>(Bytes, MAX_int32), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(SparkLogs, BacklogAgeSecs, GetBacklogAgeSecs(), ECsvCustomStatOp::Set);
+}
+
+double FsparklogsStreamerStats::GetCompressionRatio() const
+{
+	const int64 CompressedBytes = NumCompressedBytes.GetValue();
+	return (CompressedBytes > 0) ? (double)NumPayloadBytes.GetValue() / (double)CompressedBytes : 0.0;
+}
+
+double FsparklogsStreamerStats::GetBacklogAgeSecs() const
+{
+	if (BacklogBytes.load(std::memory_order_relaxed) <= 0)
+	{
+		return 0.0;
+	}
+	return FMath::Max(FPlatformTime::Seconds() - LastCaughtUpPlatformTime.load(std::memory_order_relaxed), 0.0);
+}
+
+double FsparklogsStreamerStats::GetLatencyPercentileMillis(double Percentile) const
+{
+	const int32 Bucket = ITLGetPercentileBucket(LatencyBuckets, NumLatencyBuckets, Percentile);
+	if (Bucket < 0)
+	{
+		return 0.0;
+	}
+	// Slower than the last bound is reported as the last bound
+	return LatencyBucketMaxMillis[FMath::Min(Bucket, NumLatencyBuckets - 2)];
+}
+
+FString FsparklogsStreamerStats::ToString() const
+{
+	const int64 Requests = NumRequests.GetValue();
+	FString Result = FString::Printf(TEXT("lines_read=%lld, bytes_read=%lld, payloads=%lld, payload_bytes=%lld, compressed_bytes=%lld, compression_ratio=%.2lf\n"),
+		NumLinesRead.GetValue(), NumBytesRead.GetValue(), NumPayloads.GetValue(), NumPayloadBytes.GetValue(), NumCompressedBytes.GetValue(), GetCompressionRatio());
+	Result += FString::Printf(TEXT("requests=%lld, failed_requests=%lld, retries=%lld, failed_flushes=%lld, backlog_bytes=%lld, backlog_age_secs=%.1lf\n"),
+		Requests, NumFailedRequests.GetValue(), NumRetries.GetValue(), NumFailedFlushes.GetValue(), BacklogBytes.load(std::memory_order_relaxed), GetBacklogAgeSecs());
+	Result += FString::Printf(TEXT("latency_ms: avg=%.1lf, p50<=%.0lf, p90<=%.0lf, p99<=%.0lf, histogram="),
+		(Requests > 0) ? TotalLatencyMicros.GetValue() / 1000.0 / Requests : 0.0, GetLatencyPercentileMillis(50.0), GetLatencyPercentileMillis(90.0), GetLatencyPercentileMillis(99.0));
+	for (int32 i = 0; i < NumLatencyBuckets; i++)
+	{
+		if (i < NumLatencyBuckets - 1)
+		{
+			Result += FString::Printf(TEXT("%s<=%.0lf:%lld"), (i > 0) ? TEXT(" ") : TEXT(""), LatencyBucketMaxMillis[i], LatencyBuckets[i].GetValue());
+		}
+		else
+		{
+			Result += FString::Printf(TEXT(" >%.0lf:%lld"), LatencyBucketMaxMillis[i - 1], LatencyBuckets[i].GetValue());
+		}
+	}
+	return Result;
+}
+
+// =============== FsparklogsAdaptiveController ===============================================================================
+
+FsparklogsAdaptiveController::FsparklogsAdaptiveController(int InitialBytesPerRequest, double InitialProcessingIntervalSecs)
+	: BytesPerRequest(FMath::Clamp(InitialBytesPerRequest, FsparklogsSettings::MinBytesPerRequest, FsparklogsSettings::MaxBytesPerRequest))
+	, ProcessingIntervalSecs(FMath::Max(InitialProcessingIntervalSecs, FsparklogsSettings::MinProcessingIntervalSecs))
+	, MaxProcessingIntervalSecs(FMath::Max(ProcessingIntervalSecs, MaxIdleProcessingIntervalSecs))
+	, SmoothedLatencySecs(0.0)
+	, LastDecision(EDecision::Steady)
+{
+}
+
+FsparklogsAdaptiveController::EDecision FsparklogsAdaptiveController::OnSuccess(double LatencySecs, int64 BacklogBytes)
+{
+	const bool LatencySpike = SmoothedLatencySecs > 0.0 && LatencySecs >= MinLatencySpikeSecs && LatencySecs > SmoothedLatencySecs * LatencySpikeFactor;
+	SmoothedLatencySecs = (SmoothedLatencySecs > 0.0) ? (SmoothedLatencySecs * 0.8 + LatencySecs * 0.2) : LatencySecs;
+	if (LatencySpike)
+	{
+		return BackOff();
+	}
+	if (BacklogBytes >= BytesPerRequest)
+	{
+		// Falling behind and the server is keeping up: additive increase
+		BytesPerRequest = FMath::Min(BytesPerRequest + BytesPerRequestStep, FsparklogsSettings::MaxBytesPerRequest);
+		ProcessingIntervalSecs = FMath::Max(ProcessingIntervalSecs - ProcessingIntervalStepSecs, FsparklogsSettings::MinProcessingIntervalSecs);
+		LastDecision = EDecision::Grow;
+	}
+	else if (BacklogBytes <= 0)
+	{
+		// Caught up, so there is no rush to send the next (small) chunk
+		ProcessingIntervalSecs = FMath::Min(ProcessingIntervalSecs + ProcessingIntervalStepSecs, MaxProcessingIntervalSecs);
+		LastDecision = EDecision::Idle;
+	}
+	else
+	{
+		LastDecision = EDecision::Steady;
+	}
+	return LastDecision;
+}
+
+FsparklogsAdaptiveController::EDecision FsparklogsAdaptiveController::OnFailure()
+{
+	return BackOff();
+}
+
+FsparklogsAdaptiveController::EDecision FsparklogsAdaptiveController::BackOff()
+{
+	// Multiplicative decrease
+	BytesPerRequest = FMath::Max(BytesPerRequest / 2, FsparklogsSettings::MinBytesPerRequest);
+	ProcessingIntervalSecs = FMath::Min(ProcessingIntervalSecs * 2.0, MaxProcessingIntervalSecs);
+	LastDecision = EDecision::BackOff;
+	return LastDecision;
+}
+
+const TCHAR* FsparklogsAdaptiveController::DecisionToString(EDecision Decision)
+{
+	switch (Decision)
+	{
+	case EDecision::Grow: return TEXT("grow");
+	case EDecision::Idle: return TEXT("idle");
+	case EDecision::BackOff: return TEXT("backoff");
+	default: return TEXT("steady");
+	}
+}
+
+// =============== FsparklogsReadAndStreamToCloud ===============================================================================
+
+const TCHAR* FsparklogsReadAndStreamToCloud::ProgressMarkerValue = TEXT("ShippedLogOffset");
+
+FsparklogsReadAndStreamToCloud::FSlotTask::FSlotTask(FsparklogsReadAndStreamToCloud& InStreamer, FPayloadSlot& InSlot)
+	: Streamer(InStreamer)
+	, Slot(InSlot)
+	, DoneEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, Started(false)
+	, Prepare(false)
+	, FromOffset(0)
+	, Result(false)
+{
+}
+
+FsparklogsReadAndStreamToCloud::FSlotTask::~FSlotTask()
+{
+	check(!Started);
+	FPlatformProcess::ReturnSynchEventToPool(DoneEvent);
+	DoneEvent = nullptr;
+}
+
+void FsparklogsReadAndStreamToCloud::FSlotTask::StartPrepare(FQueuedThreadPool& Pool, int64 InFromOffset)
+{
+	check(!Started);
+	Started = true;
+	Prepare = true;
+	FromOffset = InFromOffset;
+	Pool.AddQueuedWork(this);
+}
+
+void FsparklogsReadAndStreamToCloud::FSlotTask::StartProcess(FQueuedThreadPool& Pool)
+{
+	check(!Started);
+	Started = true;
+	Prepare = false;
+	Pool.AddQueuedWork(this);
+}
+
+bool FsparklogsReadAndStreamToCloud::FSlotTask::Wait()
+{
+	check(Started);
+	DoneEvent->Wait();
+	Started = false;
+	return Result;
+}
+
+void FsparklogsReadAndStreamToCloud::FSlotTask::DoThreadedWork()
+{
+	Result = Prepare ? Streamer.WorkerPrepareSlot(Slot, FromOffset, 0) : Streamer.WorkerProcessSlot(Slot);
+	DoneEvent->Trigger();
+}
+
+void FsparklogsReadAndStreamToCloud::FSlotTask::Abandon()
+{
+	Result = false;
+	DoneEvent->Trigger();
+}
+
+void FsparklogsReadAndStreamToCloud::ComputeCommonEventJSON(bool IncludeCommonMetadata, TMap<FString, FString>* AdditionalAttributes)
+{
+	FString CommonEventJSON;
+
+	if (IncludeCommonMetadata)
+	{
+		FString EffectiveComputerName;
+		if (OverrideComputerName.IsEmpty())
+		{
+			EffectiveComputerName = FPlatformProcess::ComputerName();
+		}
+		else
+		{
+			EffectiveComputerName = OverrideComputerName;
+		}
+
 		CommonEventJSON.Appendf(TEXT("\"hostname\": %s, \"pid\": %d"), *EscapeJsonString(EffectiveComputerName), FPlatformProcess::GetCurrentProcessId());
 		FString ProjectName = FApp::GetProjectName();
 		if (ProjectName.Len() > 0 && ProjectName != "None")
 		{
-			CommonEventJSON.Appendf(TEXT(", \"app\": %s"), *EscapeJsonString(ProjectName));
+			CommonEventJSON.Appendf(TEXT(", \"app\": %s"), *EscapeJsonString(ProjectName));
+		}
+
+		if (Settings->AddRandomGameInstanceID)
+		{
+			FString GameInstanceID = ITLGenerateRandomAlphaNumID(16);
+			CommonEventJSON.Appendf(TEXT(", \"game_instance_id\": %s"), *EscapeJsonString(GameInstanceID));
+		}
+	}
+
+	if (nullptr != AdditionalAttributes)
+	{
+		for (const TPair<FString, FString>& Pair : *AdditionalAttributes)
+		{
+			if (!CommonEventJSON.IsEmpty())
+			{
+				CommonEventJSON.Append(TEXT(","));
+			}
+			CommonEventJSON.Appendf(TEXT("%s:%s"), *EscapeJsonString(Pair.Key), *EscapeJsonString(Pair.Value));
+		}
+	}
+
+	if (!CommonEventJSON.IsEmpty())
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Common event JSON computed. unreal_engine_common_event_data={%s}"), *CommonEventJSON);
+		int64 CommonEventJSONLen = FTCHARToUTF8_Convert::ConvertedLength(*CommonEventJSON, CommonEventJSON.Len());
+		CommonEventJSONData.SetNum(0, false);
+		CommonEventJSONData.AddUninitialized(CommonEventJSONLen);
+		FTCHARToUTF8_Convert::Convert(CommonEventJSONData.GetData(), CommonEventJSONLen, *CommonEventJSON, CommonEventJSON.Len());
+	}
+}
+
+FsparklogsReadAndStreamToCloud::FsparklogsReadAndStreamToCloud(const TCHAR* InSourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes)
+	: FsparklogsReadAndStreamToCloud(InSourceLogFile, nullptr, InSettings, InPayloadProcessor, InMaxLineLength, InOverrideComputerName, AdditionalAttributes)
+{
+}
+
+FsparklogsReadAndStreamToCloud::FsparklogsReadAndStreamToCloud(TSharedRef<FsparklogsMemoryCaptureDevice> InMemorySource, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes)
+	: FsparklogsReadAndStreamToCloud(TEXT("memory"), TSharedPtr<FsparklogsMemoryCaptureDevice>(InMemorySource), InSettings, InPayloadProcessor, InMaxLineLength, InOverrideComputerName, AdditionalAttributes)
+{
+}
+
+FsparklogsReadAndStreamToCloud::FsparklogsReadAndStreamToCloud(const TCHAR* InSourceLogFile, TSharedPtr<FsparklogsMemoryCaptureDevice> InMemorySource, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes)
+	: Settings(InSettings)
+	, PayloadProcessor(InPayloadProcessor)
+	, SourceLogFile(InSourceLogFile)
+	, MemorySource(InMemorySource)
+	, MaxLineLength(InMaxLineLength)
+	, OverrideComputerName(InOverrideComputerName == nullptr ? TEXT("") : InOverrideComputerName)
+	, Thread(nullptr)
+	, WorkerWakeEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, FlushCompletedEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, PayloadBufferPool(2 * (FMath::Max(InSettings->MaxInFlightRequests, 1) + 1))
+	, WorkerEncodedPayloadCapacity(0)
+	, WorkerCurrentSlot(0)
+	, WorkerBufferedSlot(0)
+	, WorkerBufferedOffset(0)
+	, WorkerBufferedLen(0)
+	, WorkerShippedLogOffset(0)
+	, WorkerMinNextFlushPlatformTime(0)
+	, WorkerNumConsecutiveFlushFailures(0)
+	, WorkerLastFailedFlushPayloadSize(0)
+	, WorkerLastWindowLatencySecs(0.0)
+	, WorkerLastBacklogBytes(0)
+	, WorkerCommittedReadBytes(0)
+	, WorkerCommittedReadLines(0)
+	, ShippedLogOffset(0)
+	, CurrentBytesPerRequest(InSettings->BytesPerRequest)
+	, CurrentProcessingIntervalSecs(InSettings->ProcessingIntervalSecs)
+{
+	ProgressMarkerPath = FPaths::Combine(FPaths::GetPath(InSourceLogFile), GetITLPluginStateFilename());
+	CompressionOptions.LZ4Acceleration = Settings->LZ4Acceleration;
+	CompressionOptions.DeflateLevel = Settings->DeflateLevel;
+	CompressionOptions.MaxThreads = Settings->CompressionThreads;
+	CompressionOptions.Dictionary = Settings->CompressionDictionary;
+	ComputeCommonEventJSON(Settings->IncludeCommonMetadata, AdditionalAttributes);
+
+	// With adaptive batching the chunk size can grow up to the maximum, so size the buffers for that up front
+	const int ChunkBufferSize = Settings->AdaptiveBatching ? FsparklogsSettings::MaxBytesPerRequest : Settings->BytesPerRequest;
+	if (Settings->AdaptiveBatching)
+	{
+		WorkerAdaptiveController = MakeUnique<FsparklogsAdaptiveController>(Settings->BytesPerRequest, Settings->ProcessingIntervalSecs);
+	}
+	WorkerNewlineBitmap.AddUninitialized(ITLGetNewlineBitmapWords(ChunkBufferSize));
+	if (!MemorySource.IsValid())
+	{
+		WorkerFileReader = MakeUnique<FsparklogsLogFileReader>(InSourceLogFile, Settings->DropShippedFromPageCache);
+		ProgressJournal = MakeUnique<FsparklogsProgressJournal>(*FPaths::Combine(FPaths::GetPath(InSourceLogFile), GetITLPluginJournalFilename()), Settings->ProgressJournalSyncIntervalSecs);
+	}
+	int BufferSize = ChunkBufferSize + 4096 + (ChunkBufferSize / 10);
+	WorkerEncodedPayloadCapacity = BufferSize;
+	const int NumSlots = FMath::Max(Settings->MaxInFlightRequests, 1) + 1;
+	for (int i = 0; i < NumSlots; i++)
+	{
+		FPayloadSlot* Slot = new FPayloadSlot();
+		Slot->Index = i;
+		Slot->Buffer.AddUninitialized(ChunkBufferSize);
+		if (Settings->CompressionMode != ITLCompressionMode::LZ4Frame)
+		{
+			// The LZ4Frame mode builds the JSON into the (much smaller) staging blocks of FrameEncoder instead
+			Slot->Payload.AddUninitialized(BufferSize);
+		}
+		Slot->EncodedPayload = PayloadBufferPool.Acquire(WorkerEncodedPayloadCapacity);
+		Slot->Task = MakeUnique<FSlotTask>(*this, *Slot);
+		WorkerSlots.Add(Slot);
+	}
+	check(MaxLineLength > 0);
+	check(FPlatformProcess::SupportsMultithreading());
+	// One thread prepares the next chunk, the rest send the chunks of the window the worker does not process itself
+	WorkerThreadPool.Reset(FQueuedThreadPool::Allocate());
+	FString PoolName = FString::Printf(TEXT("SparkLogs_Pool_%s"), *FPaths::GetBaseFilename(InSourceLogFile));
+	verify(WorkerThreadPool->Create(FMath::Max(Settings->MaxInFlightRequests, 1), 0, TPri_BelowNormal, *PoolName));
+	FString ThreadName = FString::Printf(TEXT("SparkLogs_Reader_%s"), *FPaths::GetBaseFilename(InSourceLogFile));
+	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
+}
+
+FsparklogsReadAndStreamToCloud::~FsparklogsReadAndStreamToCloud()
+{
+	if (Thread)
+	{
+		delete Thread;
+	}
+	Thread = nullptr;
+	// The worker waits for everything it queued, so the pool is idle by now
+	WorkerThreadPool.Reset();
+	FPlatformProcess::ReturnSynchEventToPool(WorkerWakeEvent);
+	WorkerWakeEvent = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(FlushCompletedEvent);
+	FlushCompletedEvent = nullptr;
+}
+
+bool FsparklogsReadAndStreamToCloud::Init()
+{
+	return true;
+}
+
+uint32 FsparklogsReadAndStreamToCloud::Run()
+{
+	WorkerFullyCleanedUp.AtomicSet(false);
+	ReadProgressMarker(WorkerShippedLogOffset);
+	ShippedLogOffset.store(WorkerShippedLogOffset, std::memory_order_relaxed);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|BEGIN|WorkerShippedLogOffset=%d"), (int)WorkerShippedLogOffset);
+	// Once a full chunk is waiting in the capture buffer there is no point in waiting for the next periodic flush (and the buffer might fill up)
+	const int64 DataAvailableThreshold = MemorySource.IsValid() ? FMath::Min<int64>(Settings->BytesPerRequest, MemorySource->GetCapacity() / 2) : 0;
+	if (MemorySource.IsValid())
+	{
+		MemorySource->SetDataAvailableEvent(WorkerWakeEvent, DataAvailableThreshold);
+	}
+	// A pending flush will be processed before stopping
+	while (StopRequestCounter.GetValue() == 0 || FlushRequestCounter.GetValue() > 0)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|In loop|WorkerLastFlushFailed=%d|FlushRequestCounter=%d"), WorkerLastFlushFailed ? 1 : 0, (int)FlushRequestCounter.GetValue());
+		// Only allow manual flushes if we are not in a retry delay because the last operation failed.
+		if (WorkerLastFlushFailed == false && FlushRequestCounter.GetValue() > 0)
+		{
+			int32 NewValue = FlushRequestCounter.Decrement();
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested|FlushRequestCounter=%d"), (int)NewValue);
+			WorkerDoFlush();
+		}
+		else if (FPlatformTime::Seconds() > WorkerMinNextFlushPlatformTime)
+		{
+			// If we are waiting on a manual flush, and the retry timer finally expired, it's OK to mark this attempt as processing it.
+			if (FlushRequestCounter.GetValue() > 0)
+			{
+				int32 NewValue = FlushRequestCounter.Decrement();
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested after retry timer expired|FlushRequestCounter=%d"), (int)NewValue);
+			}
+			else
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Periodic flush"));
+			}
+			WorkerDoFlush();
+		}
+		else if (WorkerLastFlushFailed == false && MemorySource.IsValid() && MemorySource->GetWritePosition() - WorkerShippedLogOffset >= DataAvailableThreshold)
+		{
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Capture buffer has a full chunk"));
+			WorkerDoFlush();
+		}
+		else
+		{
+			// Sleep until the next scheduled flush, unless a flush or stop request (or new data) wakes us up first.
+			// The event stays signaled until we wait on it, so a request that came in while we were busy is not missed.
+			const double WaitSecs = FMath::Max(WorkerMinNextFlushPlatformTime - FPlatformTime::Seconds(), 0.0);
+			WorkerWakeEvent->Wait((uint32)FMath::CeilToInt(WaitSecs * 1000.0));
+		}
+	}
+	if (MemorySource.IsValid())
+	{
+		MemorySource->SetDataAvailableEvent(nullptr, 0);
+	}
+	if (WorkerFileReader.IsValid())
+	{
+		WorkerFileReader->Close();
+	}
+	if (ProgressJournal.IsValid())
+	{
+		ProgressJournal->Close();
+	}
+	WorkerFullyCleanedUp.AtomicSet(true);
+	FlushCompletedEvent->Trigger();
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|END"));
+	return 0;
+}
+
+void FsparklogsReadAndStreamToCloud::Stop()
+{
+	int32 NewValue = StopRequestCounter.Increment();
+	WorkerWakeEvent->Trigger();
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Stop|StopRequestCounter=%d"), (int)NewValue);
+}
+
+bool FsparklogsReadAndStreamToCloud::FlushAndWait(int N, bool ClearRetryTimer, bool InitiateStop, bool OnMainGameThread, double TimeoutSec, bool& OutLastFlushProcessedEverything)
+{
+	OutLastFlushProcessedEverything = false;
+	bool WasSuccessful = true;
+
+	// If we've already requested a stop, a flush is impossible
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|StopRequestCounter=%d"), (int)StopRequestCounter.GetValue());
+	if (StopRequestCounter.GetValue() > 0)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|stop already requested, exiting with false"));
+		return false;
+	}
+
+	if (ClearRetryTimer)
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Clearing retry timer..."));
+		WorkerLastFlushFailed.AtomicSet(false);
+	}
+
+	for (int i = 0; i < N; i++)
+	{
+		int StartFlushSuccessOpCounter = FlushSuccessOpCounter.GetValue();
+		int StartFlushOpCounter = FlushOpCounter.GetValue();
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Starting Loop|i=%d|N=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), (int)i, (int)N, (int)StartFlushSuccessOpCounter, (int)StartFlushOpCounter);
+		FlushRequestCounter.Increment();
+		WorkerWakeEvent->Trigger();
+		// Last time around, we might initiate a stop
+		if (InitiateStop && i == N-1)
+		{
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Initiating stop..."));
+			Stop();
+		}
+		double StartTime = FPlatformTime::Seconds();
+		double LastTime = StartTime;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for request to finish...|StartTime=%.3lf"), StartTime);
+		while (FlushOpCounter.GetValue() == StartFlushOpCounter)
+		{
+			double Now = FPlatformTime::Seconds();
+			if (Now - StartTime > TimeoutSec)
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out, returning false"));
+				return false;
+			}
+			if (OnMainGameThread)
+			{
+				// HTTP requests and other things won't be processed unless we tick
+				double DeltaTime = Now - LastTime;
+				FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+				FTicker::GetCoreTicker().Tick(DeltaTime);
+				FThreadManager::Get().Tick();
+				// NOTE: the game does not normally progress the frame count during shutdown, follow the same logic here
+				// GFrameCounter++;
+			}
+			// Returns as soon as the worker finishes a flush. On the game thread, keep the wait short so we keep ticking.
+			// Otherwise the wait is still bounded in case another caller waiting at the same time consumed the signal.
+			FlushCompletedEvent->Wait(OnMainGameThread ? 10 : 50);
+			LastTime = Now;
+		}
+		WasSuccessful = FlushSuccessOpCounter.GetValue() != StartFlushSuccessOpCounter;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Finished waiting for request|WasSuccessful=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), WasSuccessful ? 1 : 0, (int)FlushSuccessOpCounter.GetValue(), (int)FlushOpCounter.GetValue());
+	}
+	if (WasSuccessful)
+	{
+		OutLastFlushProcessedEverything = LastFlushProcessedEverything;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|LastFlushProcessedEverything=%d"), OutLastFlushProcessedEverything ? 1 : 0);
+	}
+	if (InitiateStop) {
+		// Wait for the worker to fully stop, up to the timeout
+		double StartTime = FPlatformTime::Seconds();
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for thread to stop...|StartTime=%.3lf"), StartTime);
+		while (!WorkerFullyCleanedUp)
+		{
+			if (FPlatformTime::Seconds() - StartTime > TimeoutSec)
+			{
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out waiting for thread to stop"));
+				return false;
+			}
+			FlushCompletedEvent->Wait(10);
+		}
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|END|WasSuccessful=%d"), WasSuccessful ? 1 : 0);
+	return WasSuccessful;
+}
+
+bool FsparklogsReadAndStreamToCloud::ReadProgressMarker(int64& OutMarker)
+{
+	OutMarker = 0;
+	if (MemorySource.IsValid())
+	{
+		// In-memory capture always starts from the beginning of the ring buffer
+		return true;
+	}
+	FsparklogsProgressJournal::FRecord Record;
+	if (ProgressJournal->Read(Record))
+	{
+		uint64 FileDevice = 0, FileInode = 0;
+		if (Record.FileInode != 0 && FsparklogsLogFileReader::GetPathIdentity(SourceLogFile, FileDevice, FileInode) && (FileDevice != Record.FileDevice || FileInode != Record.FileInode))
+		{
+			// The logfile was replaced since the progress was recorded, so the offset does not apply to it
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("Logfile was replaced since progress was last recorded, starting from the beginning: %s"), *SourceLogFile);
+			return true;
+		}
+		OutMarker = Record.Offset;
+		return true;
+	}
+	// Fall back to the INI progress marker written by older versions of the plugin
+	double OutDouble = 0.0;
+	if (IFileManager::Get().FileExists(*ProgressMarkerPath))
+	{
+		bool WasDisabled = GConfig->AreFileOperationsDisabled();
+		GConfig->EnableFileOperations();
+		bool Result = GConfig->GetDouble(FsparklogsSettings::PluginStateSection, ProgressMarkerValue, OutDouble, *ProgressMarkerPath);
+		if (WasDisabled)
+		{
+			GConfig->DisableFileOperations();
+		}
+		if (!Result)
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Failed to read progress marker from %s"), *ProgressMarkerPath);
+			return false;
+		}
+	}
+	// Precise to 52+ bits
+	OutMarker = (int64)(OutDouble);
+	return true;
+}
+
+bool FsparklogsReadAndStreamToCloud::WriteProgressMarker(int64 InMarker)
+{
+	if (MemorySource.IsValid())
+	{
+		// Nothing is persisted in this mode, but shipped data no longer needs to be kept in the ring buffer
+		MemorySource->Release(InMarker);
+		return true;
+	}
+	uint64 FileDevice = 0, FileInode = 0;
+	if (WorkerFileReader.IsValid())
+	{
+		WorkerFileReader->GetFileIdentity(FileDevice, FileInode);
+	}
+	return ProgressJournal->Write(InMarker, FileDevice, FileInode);
+}
+
+void FsparklogsReadAndStreamToCloud::DeleteProgressMarker()
+{
+	if (MemorySource.IsValid())
+	{
+		return;
+	}
+	ProgressJournal->Delete();
+	IFileManager::Get().Delete(*ProgressMarkerPath, false, true, false);
+}
+
+bool FindFirstByte(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex)
+{
+	OutIndex = -1;
+	for (const uint8* RESTRICT Data = Haystack, *RESTRICT End = Data + MaxToSearch; Data != End; ++Data)
+	{
+		if (*Data == Needle)
+		{
+			OutIndex = static_cast<int>(Data - Haystack);
+			return true;
+		}
+	}
+	return false;
+}
+
+#if ITL_SIMD_NEON
+alignas(16) static const uint8 ITLNeonLaneBits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+
+/** Equivalent of _mm_movemask_epi8 for the result of a NEON byte comparison (each lane is all ones or all zeros). */
+static FORCEINLINE uint32 ITLNeonMoveMask(uint8x16_t Cmp)
+{
+	uint8x16_t Masked = vandq_u8(Cmp, vld1q_u8(ITLNeonLaneBits));
+	return (uint32)vaddv_u8(vget_low_u8(Masked)) | ((uint32)vaddv_u8(vget_high_u8(Masked)) << 8);
+}
+#endif
+
+void ITLBuildNewlineBitmap(const uint8* Data, int Len, uint64* OutBitmap, bool ForceScalar)
+{
+	const int NumWords = ITLGetNewlineBitmapWords(Len);
+	int Offset = 0;
+	int Word = 0;
+#if ITL_SIMD_SSE2
+	if (!ForceScalar)
+	{
+		const __m128i Newline = _mm_set1_epi8('\n');
+		for (; Offset + 64 <= Len; Offset += 64, Word++)
+		{
+			uint64 M0 = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(Data + Offset)), Newline));
+			uint64 M1 = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(Data + Offset + 16)), Newline));
+			uint64 M2 = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(Data + Offset + 32)), Newline));
+			uint64 M3 = (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(Data + Offset + 48)), Newline));
+			OutBitmap[Word] = M0 | (M1 << 16) | (M2 << 32) | (M3 << 48);
+		}
+	}
+#elif ITL_SIMD_NEON
+	if (!ForceScalar)
+	{
+		const uint8x16_t Newline = vdupq_n_u8('\n');
+		for (; Offset + 64 <= Len; Offset += 64, Word++)
+		{
+			uint64 M0 = ITLNeonMoveMask(vceqq_u8(vld1q_u8(Data + Offset), Newline));
+			uint64 M1 = ITLNeonMoveMask(vceqq_u8(vld1q_u8(Data + Offset + 16), Newline));
+			uint64 M2 = ITLNeonMoveMask(vceqq_u8(vld1q_u8(Data + Offset + 32), Newline));
+			uint64 M3 = ITLNeonMoveMask(vceqq_u8(vld1q_u8(Data + Offset + 48), Newline));
+			OutBitmap[Word] = M0 | (M1 << 16) | (M2 << 32) | (M3 << 48);
+		}
+	}
+#endif
+	// Scalar path for the tail (or everything if SIMD is unavailable). Bits past Len are always left clear.
+	for (; Word < NumWords; Word++)
+	{
+		uint64 Bits = 0;
+		const int WordEnd = FMath::Min(Offset + 64, Len);
+		for (int i = Offset; i < WordEnd; i++)
+		{
+			Bits |= (uint64)(Data[i] == '\n') << (i - Offset);
+		}
+		OutBitmap[Word] = Bits;
+		Offset = WordEnd;
+	}
+}
+
+FsparklogsLineSplitter::FsparklogsLineSplitter(const uint8* InData, int InLen, int InMaxLineLength, const uint64* InNewlineBitmap)
+	: Data(InData)
+	, Len(InLen)
+	, MaxLineLength(InMaxLineLength)
+	, NewlineBitmap(InNewlineBitmap)
+	, NextOffset(0)
+	, CapturedOffset(0)
+{
+	check(MaxLineLength > 0);
+}
+
+bool FsparklogsLineSplitter::FindNewline(int StartOffset, int MaxToSearch, int& OutIndex) const
+{
+	if (NewlineBitmap == nullptr)
+	{
+		return FindFirstByte(Data + StartOffset, static_cast<uint8>('\n'), MaxToSearch, OutIndex);
+	}
+	OutIndex = -1;
+	const int End = StartOffset + MaxToSearch;
+	int Pos = StartOffset;
+	while (Pos < End)
+	{
+		const int Word = Pos >> 6;
+		const uint64 Bits = NewlineBitmap[Word] >> (Pos & 63);
+		if (Bits != 0)
+		{
+			const int Found = Pos + (int)FMath::CountTrailingZeros64(Bits);
+			if (Found >= End)
+			{
+				return false;
+			}
+			OutIndex = Found - StartOffset;
+			return true;
+		}
+		Pos = (Word + 1) << 6;
+	}
+	return false;
+}
+
+bool FsparklogsLineSplitter::Next(int& OutLineOffset, int& OutLineLen)
+{
+	while (NextOffset < Len)
+	{
+		// Skip the UTF-8 byte order marker (always at the start of the file)
+		int RemainingBytes = Len - NextOffset;
+		if (RemainingBytes >= (int)sizeof(UTF8ByteOrderMark) && 0 == std::memcmp(Data + NextOffset, UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark)))
+		{
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LineSplitter|skipping UTF8 BOM|offset_before=%d|offset_after=%d"), NextOffset, NextOffset + sizeof(UTF8ByteOrderMark));
+			NextOffset += sizeof(UTF8ByteOrderMark);
+			CapturedOffset = NextOffset;
+			continue;
+		}
+		// We only process whole lines. See if we can find the next end of line character.
+		int NumToSearch = FMath::Min(RemainingBytes, MaxLineLength);
+		int FoundIndex = 0;
+		int ExtraToSkip = 1; // skip over the \n char
+		bool HaveLine = FindNewline(NextOffset, NumToSearch, FoundIndex);
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LineSplitter|after newline search|NextOffset=%d|HaveLine=%d|NumToSearch=%d|FoundIndex=%d"), NextOffset, (int)HaveLine, NumToSearch, FoundIndex);
+		if (!HaveLine && NumToSearch == MaxLineLength && RemainingBytes > NumToSearch)
+		{
+			// Even though we didn't find a line, break the line at the max length and process it
+			// It's unsafe to break a line in the middle of a multi-byte UTF-8, so find a safe break point...
+			ExtraToSkip = 0;
+			FoundIndex = MaxLineLength - 1;
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LineSplitter|no newline found, search for safe breakpoint|NextOffset=%d|FoundIndex=%d"), NextOffset, FoundIndex);
+			while (FoundIndex > 0)
+			{
+				if (*(Data + NextOffset + FoundIndex) >= 0x80)
+				{
+					FoundIndex--;
+				}
+				else
+				{
+					// include this non-multi-byte character and break here
+					FoundIndex++;
+					break;
+				}
+			}
+			HaveLine = true;
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LineSplitter|found safe breakpoint|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
+		}
+		if (!HaveLine)
+		{
+			// No more complete lines to process, this is enough for now
+			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LineSplitter|no more lines to process"));
+			return false;
+		}
+		// Trim newlines control characters of any kind at the end
+		while (FoundIndex > 0)
+		{
+			// We expect the FoundIndex to be the *first* non-newline character, and ExtraToSkip set to the number of newline chars to skip.
+			// Check if the previous character is a newline character, and if so, skip capturing it.
+			uint8 c = *(Data + NextOffset + FoundIndex - 1);
+			if (c == '\n' || c == '\r')
+			{
+				ExtraToSkip++;
+				FoundIndex--;
+			}
+			else
+			{
+				break;
+			}
+		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|LineSplitter|line summary|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
+		// Skip blank lines without capturing anything
+		if (FoundIndex <= 0)
+		{
+			if (ExtraToSkip <= 0)
+			{
+				ExtraToSkip = 1;
+			}
+			NextOffset += ExtraToSkip;
+			CapturedOffset = NextOffset;
+			continue;
+		}
+		OutLineOffset = NextOffset;
+		OutLineLen = FoundIndex;
+		NextOffset += FoundIndex + ExtraToSkip;
+		CapturedOffset = NextOffset;
+		return true;
+	}
+	return false;
+}
+
+/** Appends the JSON escaped form of a single character. */
+static FORCEINLINE void ITLAppendEscapedJsonChar(TITLJSONStringBuilder& Builder, ANSICHAR Char)
+{
+	switch (Char)
+	{
+	case '\"':
+		Builder.Append("\\\"", 2 /* string length */);
+		break;
+	case '\b':
+		Builder.Append("\\b", 2 /* string length */);
+		break;
+	case '\t':
+		Builder.Append("\\t", 2 /* string length */);
+		break;
+	case '\n':
+		Builder.Append("\\n", 2 /* string length */);
+		break;
+	case '\f':
+		Builder.Append("\\f", 2 /* string length */);
+		break;
+	case '\r':
+		Builder.Append("\\r", 2 /* string length */);
+		break;
+	case '\\':
+		Builder.Append("\\\\", 2 /* string length */);
+		break;
+	default:
+		// Any character 0x20 and above can be included as-is
+		if ((uint8)(Char) >= static_cast<UTF8CHAR>(0x20))
+		{
+			Builder.Append(Char);
+		}
+		else
+		{
+			// Rare control character
+			ANSICHAR ControlFormatBuf[16];
+			FCStringAnsi::Snprintf(ControlFormatBuf, sizeof(ControlFormatBuf), "\\u%04x", static_cast<int>(Char));
+			Builder.AppendAnsi(ControlFormatBuf);
+		}
+	}
+}
+
+/** Returns the offset of the first byte that must be escaped in a JSON string (a quote, a backslash, or a byte below 0x20), or N if there is none. */
+static FORCEINLINE int ITLFindFirstJsonEscapeByte(const ANSICHAR* Data, int N)
+{
+	int i = 0;
+#if ITL_SIMD_SSE2
+	const __m128i Quote = _mm_set1_epi8('\"');
+	const __m128i Backslash = _mm_set1_epi8('\\');
+	const __m128i MaxControl = _mm_set1_epi8(0x1F);
+	for (; i + 16 <= N; i += 16)
+	{
+		__m128i V = _mm_loadu_si128((const __m128i*)(Data + i));
+		__m128i Special = _mm_or_si128(_mm_cmpeq_epi8(V, Quote), _mm_cmpeq_epi8(V, Backslash));
+		// SSE2 has no unsigned byte compare: V <= 0x1F is the same as max(V, 0x1F) == 0x1F
+		Special = _mm_or_si128(Special, _mm_cmpeq_epi8(_mm_max_epu8(V, MaxControl), MaxControl));
+		uint32 Mask = (uint32)_mm_movemask_epi8(Special);
+		if (Mask != 0)
+		{
+			return i + (int)FMath::CountTrailingZeros(Mask);
+		}
+	}
+#elif ITL_SIMD_NEON
+	const uint8x16_t Quote = vdupq_n_u8('\"');
+	const uint8x16_t Backslash = vdupq_n_u8('\\');
+	const uint8x16_t MaxControl = vdupq_n_u8(0x1F);
+	for (; i + 16 <= N; i += 16)
+	{
+		uint8x16_t V = vld1q_u8((const uint8*)(Data + i));
+		uint8x16_t Special = vorrq_u8(vorrq_u8(vceqq_u8(V, Quote), vceqq_u8(V, Backslash)), vcleq_u8(V, MaxControl));
+		// Cheap horizontal test first, most blocks need no escaping at all
+		if (vmaxvq_u8(Special) != 0)
+		{
+			return i + (int)FMath::CountTrailingZeros(ITLNeonMoveMask(Special));
+		}
+	}
+#endif
+	for (; i < N; i++)
+	{
+		uint8 c = (uint8)Data[i];
+		if (c < 0x20 || c == '\"' || c == '\\')
+		{
+			return i;
+		}
+	}
+	return N;
+}
+
+void ITLAppendUTF8AsEscapedJsonString(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N, bool ForceScalar)
+{
+	Builder.Append('\"');
+	if (ForceScalar)
+	{
+		for (const ANSICHAR* RESTRICT Data = String, *RESTRICT End = Data + N; Data != End; ++Data)
+		{
+			ITLAppendEscapedJsonChar(Builder, *Data);
+		}
+	}
+	else
+	{
+		// Copy clean runs with one bulk append and only escape the (rare) bytes that need it
+		const ANSICHAR* Data = String;
+		int Remaining = N;
+		while (Remaining > 0)
+		{
+			int CleanLen = ITLFindFirstJsonEscapeByte(Data, Remaining);
+			if (CleanLen > 0)
+			{
+				Builder.Append(Data, CleanLen);
+			}
+			if (CleanLen >= Remaining)
+			{
+				break;
+			}
+			ITLAppendEscapedJsonChar(Builder, Data[CleanLen]);
+			Data += CleanLen + 1;
+			Remaining -= CleanLen + 1;
+		}
+	}
+	Builder.Append('\"');
+}
+
+static FORCEINLINE bool ITLIsDigit(ANSICHAR c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static FORCEINLINE bool ITLIsIdentifierChar(ANSICHAR c)
+{
+	return ITLIsDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+/** Checks Line against a pattern where '9' matches any digit and every other character matches itself. */
+static FORCEINLINE bool ITLMatchesDigitPattern(const ANSICHAR* Line, const ANSICHAR* Pattern, int PatternLen)
+{
+	for (int i = 0; i < PatternLen; i++)
+	{
+		if (Pattern[i] == '9' ? !ITLIsDigit(Line[i]) : Line[i] != Pattern[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ITLParseLogLinePrefix(const ANSICHAR* Line, int Len, FsparklogsLogLinePrefix& OutPrefix)
+{
+	OutPrefix = FsparklogsLogLinePrefix();
+	// [2025.01.01-00.00.00:000]
+	static constexpr ANSICHAR TimestampPattern[] = "[9999.99.99-99.99.99:999]";
+	constexpr int TimestampPatternLen = UE_ARRAY_COUNT(TimestampPattern) - 1;
+	if (Len < TimestampPatternLen + 3 || !ITLMatchesDigitPattern(Line, TimestampPattern, TimestampPatternLen))
+	{
+		return false;
+	}
+	OutPrefix.TimestampOffset = 1;
+	OutPrefix.TimestampLen = TimestampPatternLen - 2;
+	// [  5] (the engine writes the frame number modulo 1000, padded to 3 characters)
+	int Pos = TimestampPatternLen;
+	if (Line[Pos++] != '[')
+	{
+		return false;
+	}
+	while (Pos < Len && Line[Pos] == ' ')
+	{
+		Pos++;
+	}
+	// The frame is written out as a bare JSON number, so leading zeros are dropped (keeping a lone 0) and the digits
+	// must fit in an int64, otherwise the line is not an engine prefix.
+	static constexpr int MaxFrameDigits = 18;
+	const int FrameDigitsStart = Pos;
+	while (Pos + 1 < Len && Line[Pos] == '0' && ITLIsDigit(Line[Pos + 1]))
+	{
+		Pos++;
+	}
+	OutPrefix.FrameOffset = Pos;
+	while (Pos < Len && ITLIsDigit(Line[Pos]))
+	{
+		Pos++;
+	}
+	OutPrefix.FrameLen = Pos - OutPrefix.FrameOffset;
+	if (Pos == FrameDigitsStart || OutPrefix.FrameLen > MaxFrameDigits || Pos >= Len || Line[Pos++] != ']')
+	{
+		return false;
+	}
+	OutPrefix.MessageOffset = Pos;
+
+	// LogNet: (categories are plain identifiers)
+	int CategoryEnd = Pos;
+	while (CategoryEnd < Len && ITLIsIdentifierChar(Line[CategoryEnd]))
+	{
+		CategoryEnd++;
+	}
+	if (CategoryEnd == Pos || CategoryEnd + 1 >= Len || Line[CategoryEnd] != ':' || Line[CategoryEnd + 1] != ' ')
+	{
+		// Only a timestamp and frame number
+		return true;
+	}
+	OutPrefix.CategoryOffset = Pos;
+	OutPrefix.CategoryLen = CategoryEnd - Pos;
+	Pos = CategoryEnd + 2;
+	OutPrefix.MessageOffset = Pos;
+
+	// Warning: (only the engine's verbosity names, anything else is part of the message)
+	struct FSeverityName
+	{
+		const ANSICHAR* Name;
+		int Len;
+	};
+	static constexpr FSeverityName SeverityNames[] = { { "Warning", 7 }, { "Error", 5 }, { "Display", 7 }, { "Verbose", 7 }, { "VeryVerbose", 11 }, { "Fatal", 5 } };
+	for (const FSeverityName& Severity : SeverityNames)
+	{
+		if (Pos + Severity.Len + 1 < Len && Line[Pos + Severity.Len] == ':' && Line[Pos + Severity.Len + 1] == ' ' && FMemory::Memcmp(Line + Pos, Severity.Name, Severity.Len) == 0)
+		{
+			OutPrefix.SeverityOffset = Pos;
+			OutPrefix.SeverityLen = Severity.Len;
+			OutPrefix.MessageOffset = Pos + Severity.Len + 2;
+			break;
+		}
+	}
+	return true;
+}
+
+void ITLAppendLogLineAsParsedJsonFields(TITLJSONStringBuilder& Builder, const ANSICHAR* Line, int Len)
+{
+	FsparklogsLogLinePrefix Prefix;
+	if (!ITLParseLogLinePrefix(Line, Len, Prefix))
+	{
+		Builder.Append("\"message\":", 10 /* length of `"message":` */);
+		ITLAppendUTF8AsEscapedJsonString(Builder, Line, Len);
+		return;
+	}
+	// 2025.01.01-00.00.00:000 -> 2025-01-01T00:00:00.000 (only digits and punctuation, so nothing needs escaping)
+	ANSICHAR Timestamp[23];
+	FMemory::Memcpy(Timestamp, Line + Prefix.TimestampOffset, sizeof(Timestamp));
+	Timestamp[4] = '-';
+	Timestamp[7] = '-';
+	Timestamp[10] = 'T';
+	Timestamp[13] = ':';
+	Timestamp[16] = ':';
+	Timestamp[19] = '.';
+	Builder.Append("\"timestamp\":\"", 13 /* length of `"timestamp":"` */);
+	Builder.Append(Timestamp, UE_ARRAY_COUNT(Timestamp));
+	Builder.Append("\",\"frame\":", 10 /* length of `","frame":` */);
+	Builder.Append(Line + Prefix.FrameOffset, Prefix.FrameLen);
+	if (Prefix.CategoryLen > 0)
+	{
+		Builder.Append(",\"category\":\"", 13 /* length of `,"category":"` */);
+		Builder.Append(Line + Prefix.CategoryOffset, Prefix.CategoryLen);
+		Builder.Append("\",\"severity\":\"", 14 /* length of `","severity":"` */);
+		if (Prefix.SeverityLen > 0)
+		{
+			Builder.Append(Line + Prefix.SeverityOffset, Prefix.SeverityLen);
+		}
+		else
+		{
+			Builder.Append("Log", 3);
+		}
+		Builder.Append('\"');
+	}
+	Builder.Append(",\"message\":", 11 /* length of `,"message":` */);
+	ITLAppendUTF8AsEscapedJsonString(Builder, Line + Prefix.MessageOffset, Len - Prefix.MessageOffset);
+}
+
+/** Appends N as decimal digits, zero padded to at least Width digits. */
+static FORCEINLINE void ITLAppendPaddedDecimal(TITLJSONStringBuilder& Builder, int64 N, int Width)
+{
+	ANSICHAR Digits[24];
+	int NumDigits = 0;
+	do
+	{
+		Digits[NumDigits++] = (ANSICHAR)('0' + (N % 10));
+		N /= 10;
+	} while (N > 0);
+	while (NumDigits < Width)
+	{
+		Digits[NumDigits++] = '0';
+	}
+	while (NumDigits > 0)
+	{
+		Builder.AppendChar(Digits[--NumDigits]);
+	}
+}
+
+/** Appends a quoted ISO 8601 UTC timestamp with millisecond precision, e.g. "2025-01-01T00:00:00.000Z". */
+static void ITLAppendUnixTimeMillisAsJsonString(TITLJSONStringBuilder& Builder, int64 UnixTimeMillis)
+{
+	const FDateTime Time = FDateTime(1970, 1, 1) + FTimespan(FMath::Max<int64>(UnixTimeMillis, 0) * ETimespan::TicksPerMillisecond);
+	int32 Year, Month, Day;
+	Time.GetDate(Year, Month, Day);
+	Builder.AppendChar('\"');
+	ITLAppendPaddedDecimal(Builder, Year, 4);
+	Builder.AppendChar('-');
+	ITLAppendPaddedDecimal(Builder, Month, 2);
+	Builder.AppendChar('-');
+	ITLAppendPaddedDecimal(Builder, Day, 2);
+	Builder.AppendChar('T');
+	ITLAppendPaddedDecimal(Builder, Time.GetHour(), 2);
+	Builder.AppendChar(':');
+	ITLAppendPaddedDecimal(Builder, Time.GetMinute(), 2);
+	Builder.AppendChar(':');
+	ITLAppendPaddedDecimal(Builder, Time.GetSecond(), 2);
+	Builder.AppendChar('.');
+	ITLAppendPaddedDecimal(Builder, Time.GetMillisecond(), 3);
+	Builder.Append("Z\"", 2);
+}
+
+bool ITLParseRepeatSuffix(const ANSICHAR* Line, int Len, FsparklogsRepeatSuffix& OutSuffix)
+{
+	// ` [repeat_count=42 first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]`
+	static constexpr ANSICHAR CountPrefix[] = " [repeat_count=";
+	constexpr int CountPrefixLen = UE_ARRAY_COUNT(CountPrefix) - 1;
+	static constexpr ANSICHAR TimestampsPattern[] = " first=9999-99-99T99:99:99.999Z last=9999-99-99T99:99:99.999Z]";
+	constexpr int TimestampsPatternLen = UE_ARRAY_COUNT(TimestampsPattern) - 1;
+	if (Len < CountPrefixLen + 1 + TimestampsPatternLen || Line[Len - 1] != ']')
+	{
+		return false;
+	}
+	const int TimestampsOffset = Len - TimestampsPatternLen;
+	if (!ITLMatchesDigitPattern(Line + TimestampsOffset, TimestampsPattern, TimestampsPatternLen))
+	{
+		return false;
+	}
+	int CountOffset = TimestampsOffset;
+	while (CountOffset > 0 && TimestampsOffset - CountOffset < 18 && ITLIsDigit(Line[CountOffset - 1]))
+	{
+		CountOffset--;
+	}
+	if (CountOffset == TimestampsOffset || CountOffset < CountPrefixLen || FMemory::Memcmp(Line + CountOffset - CountPrefixLen, CountPrefix, CountPrefixLen) != 0)
+	{
+		return false;
+	}
+	OutSuffix.SuffixOffset = CountOffset - CountPrefixLen;
+	OutSuffix.RepeatCount = 0;
+	for (int i = CountOffset; i < TimestampsOffset; i++)
+	{
+		OutSuffix.RepeatCount = OutSuffix.RepeatCount * 10 + (Line[i] - '0');
+	}
+	OutSuffix.FirstTimestampOffset = TimestampsOffset + 7 /* length of ` first=` */;
+	OutSuffix.LastTimestampOffset = OutSuffix.FirstTimestampOffset + 24 + 6 /* length of ` last=` */;
+	return true;
+}
+
+void ITLAppendRepeatSuffixAsJsonFields(TITLJSONStringBuilder& Builder, const ANSICHAR* Line, const FsparklogsRepeatSuffix& Suffix)
+{
+	// The count and timestamps are only digits and punctuation, so nothing needs escaping
+	Builder.Append(",\"repeat_count\":", 16 /* length of `,"repeat_count":` */);
+	ITLAppendPaddedDecimal(Builder, Suffix.RepeatCount, 1);
+	Builder.Append(",\"first_timestamp\":\"", 20 /* length of `,"first_timestamp":"` */);
+	Builder.Append(Line + Suffix.FirstTimestampOffset, 24);
+	Builder.Append("\",\"last_timestamp\":\"", 20 /* length of `","last_timestamp":"` */);
+	Builder.Append(Line + Suffix.LastTimestampOffset, 24);
+	Builder.AppendChar('\"');
+}
+
+/** Returns the verbosity name the engine uses in log lines, as a quoted JSON string. */
+static const ANSICHAR* ITLGetVerbosityJsonString(ELogVerbosity::Type Verbosity)
+{
+	switch (Verbosity & ELogVerbosity::VerbosityMask)
+	{
+	case ELogVerbosity::Fatal: return "\"Fatal\"";
+	case ELogVerbosity::Error: return "\"Error\"";
+	case ELogVerbosity::Warning: return "\"Warning\"";
+	case ELogVerbosity::Display: return "\"Display\"";
+	case ELogVerbosity::Verbose: return "\"Verbose\"";
+	case ELogVerbosity::VeryVerbose: return "\"VeryVerbose\"";
+	default: return "\"Log\"";
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerAppendRecordAsJsonFields(TITLJSONStringBuilder& Builder, const FsparklogsMemoryCaptureDevice::FRecord& Record) const
+{
+	Builder.Append("\"timestamp\":", 12 /* length of `"timestamp":` */);
+	ITLAppendUnixTimeMillisAsJsonString(Builder, Record.UnixTimeMillis);
+	Builder.Append(",\"frame\":", 9 /* length of `,"frame":` */);
+	ITLAppendPaddedDecimal(Builder, (int64)Record.Frame, 1);
+	Builder.Append(",\"thread_id\":", 13 /* length of `,"thread_id":` */);
+	ITLAppendPaddedDecimal(Builder, Record.ThreadId, 1);
+	Builder.Append(",\"category\":", 12 /* length of `,"category":` */);
+	MemorySource->AppendCategoryAsJsonString(Builder, Record.CategoryId);
+	Builder.Append(",\"severity\":", 12 /* length of `,"severity":` */);
+	Builder.Append(ITLGetVerbosityJsonString(Record.Verbosity));
+	Builder.Append(",\"message\":", 11 /* length of `,"message":` */);
+	FsparklogsRepeatSuffix Repeat;
+	if (Settings->RepeatSuppressionWindowSecs > 0.0 && ITLParseRepeatSuffix((const ANSICHAR*)Record.Message, Record.MessageLen, Repeat))
+	{
+		ITLAppendUTF8AsEscapedJsonString(Builder, (const ANSICHAR*)Record.Message, Repeat.SuffixOffset);
+		ITLAppendRepeatSuffixAsJsonFields(Builder, (const ANSICHAR*)Record.Message, Repeat);
+	}
+	else
+	{
+		ITLAppendUTF8AsEscapedJsonString(Builder, (const ANSICHAR*)Record.Message, Record.MessageLen);
+	}
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerReadNextPayload(FPayloadSlot& Slot, int& OutNumToRead, int64& InOutEffectiveLogOffset, int64& OutRemainingBytes)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerReadNextPayload);
+
+	OutNumToRead = 0;
+	OutRemainingBytes = 0;
+
+	if (MemorySource.IsValid())
+	{
+		// Drain the in-memory capture device directly. Stream positions take the place of file offsets, and data stays
+		// in the ring buffer until the progress marker is written, so a retry sees exactly the same data.
+		OutRemainingBytes = MemorySource->GetWritePosition() - InOutEffectiveLogOffset;
+		OutNumToRead = (int)(FMath::Clamp<int64>(OutRemainingBytes, 0, (int64)(Slot.ChunkSize)));
+		if (Slot.ReadLimit > 0 && OutNumToRead > Slot.ReadLimit)
+		{
+			OutNumToRead = Slot.ReadLimit;
+		}
+		if (OutNumToRead <= 0)
+		{
+			return true;
 		}
-
-		if (Settings->AddRandomGameInstanceID)
+		int32 NumCopied = MemorySource->Peek(InOutEffectiveLogOffset, Slot.Buffer.GetData(), OutNumToRead);
+		if (NumCopied != OutNumToRead)
 		{
-			FString GameInstanceID = ITLGenerateRandomAlphaNumID(16);
-			CommonEventJSON.Appendf(TEXT(", \"game_instance_id\": %s"), *EscapeJsonString(GameInstanceID));
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to read data from memory capture: position=%ld, bytes=%d, copied=%d"), InOutEffectiveLogOffset, OutNumToRead, NumCopied);
+			return false;
 		}
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data from memory capture|position=%ld|data_len=%d"), InOutEffectiveLogOffset, OutNumToRead);
+		return true;
 	}
 
-	if (nullptr != AdditionalAttributes)
+	bool FileExists = false, FileReplaced = false;
+	int64 FileSize = 0;
+	if (!WorkerFileReader->Refresh(FileExists, FileReplaced, FileSize))
 	{
-		for (const TPair<FString, FString>& Pair : *AdditionalAttributes)
+		WorkerBufferedLen = 0;
+		return false;
+	}
+	if (FileReplaced)
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Logfile was replaced, re-reading from start: previously_processed_to=%ld, logfile='%s'"), InOutEffectiveLogOffset, *SourceLogFile);
+		InOutEffectiveLogOffset = 0;
+		// Don't force a retried read to use the same payload size as last time since the whole file has changed.
+		Slot.ReadLimit = 0;
+		WorkerBufferedLen = 0;
+	}
+	if (!FileExists)
+	{
+		// The logfile is created lazily (e.g., when only used for overflow from in-memory capture), so nothing to read yet
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|logfile does not exist yet|logfile='%s'"), *SourceLogFile);
+		OutNumToRead = 0;
+		OutRemainingBytes = 0;
+		return true;
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|refreshed log file|last_offset=%ld|current_file_size=%ld|logfile='%s'"), InOutEffectiveLogOffset, FileSize, *SourceLogFile);
+	if (InOutEffectiveLogOffset > FileSize)
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Logfile reduced size, re-reading from start: new_size=%ld, previously_processed_to=%ld, logfile='%s'"), FileSize, InOutEffectiveLogOffset, *SourceLogFile);
+		InOutEffectiveLogOffset = 0;
+		// Don't force a retried read to use the same payload size as last time since the whole file has changed.
+		Slot.ReadLimit = 0;
+		WorkerBufferedLen = 0;
+	}
+	// Start at the last known shipped position, read as many bytes as possible up to the max buffer size, and capture log lines into a JSON payload
+	OutRemainingBytes = FileSize - InOutEffectiveLogOffset;
+	if (Settings->MaxBacklogBytes > 0 && Settings->BacklogDropPolicy == ITLBacklogDropPolicy::DropOldest && OutRemainingBytes > Settings->MaxBacklogBytes
+		&& InOutEffectiveLogOffset == WorkerShippedLogOffset)
+	{
+		// Only the chunk at the shipped offset drops data, so that nothing is reported as dropped twice
+		WorkerDropOldestBacklog(FileSize, InOutEffectiveLogOffset);
+		// The dropped data (including any failed chunk) will never be retried
+		Slot.ReadLimit = 0;
+		WorkerBufferedLen = 0;
+		OutRemainingBytes = FileSize - InOutEffectiveLogOffset;
+	}
+	OutNumToRead = (int)(FMath::Clamp<int64>(OutRemainingBytes, 0, (int64)(Slot.ChunkSize)));
+	if (Slot.ReadLimit > 0 && OutNumToRead > Slot.ReadLimit)
+	{
+		// Retried requests always use the same max payload size as last time,
+		// so that any retry has the same data as last time and can be deduplicated in worst-case scenarios.
+		// (e.g., an actual observed scenario where Unreal Engine HTTP plugin was sending requests successfully
+		// but was not processing responses properly and instead timing them out...)
+		OutNumToRead = Slot.ReadLimit;
+	}
+	if (OutNumToRead <= 0)
+	{
+		// We've read everything we possibly can already
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Nothing more can be read|FileSize=%ld|EffectiveShippedLogOffset=%ld"), FileSize, InOutEffectiveLogOffset);
+		WorkerFileReader->FinishRead();
+		return true;
+	}
+
+	// Whatever is left in the buffer from the last read (typically a partial trailing line) is still valid, so only read the new bytes
+	uint8* BufferData = Slot.Buffer.GetData();
+	const int SlotIndex = Slot.Index;
+	int NumReused = 0;
+	if (WorkerBufferedLen > 0 && InOutEffectiveLogOffset >= WorkerBufferedOffset && InOutEffectiveLogOffset < WorkerBufferedOffset + WorkerBufferedLen)
+	{
+		const int SkipLen = (int)(InOutEffectiveLogOffset - WorkerBufferedOffset);
+		NumReused = FMath::Min(WorkerBufferedLen - SkipLen, OutNumToRead);
+		if (WorkerBufferedSlot != SlotIndex)
 		{
-			if (!CommonEventJSON.IsEmpty())
-			{
-				CommonEventJSON.Append(TEXT(","));
-			}
-			CommonEventJSON.Appendf(TEXT("%s:%s"), *EscapeJsonString(Pair.Key), *EscapeJsonString(Pair.Value));
+			FMemory::Memcpy(BufferData, WorkerSlots[WorkerBufferedSlot].Buffer.GetData() + SkipLen, NumReused);
+		}
+		else if (SkipLen > 0)
+		{
+			FMemory::Memmove(BufferData, BufferData + SkipLen, NumReused);
 		}
 	}
-
-	if (!CommonEventJSON.IsEmpty())
+	const bool ReadSuccess = (NumReused >= OutNumToRead) || WorkerFileReader->ReadAt(InOutEffectiveLogOffset + NumReused, BufferData + NumReused, OutNumToRead - NumReused);
+	WorkerFileReader->FinishRead();
+	if (!ReadSuccess)
 	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("Common event JSON computed. unreal_engine_common_event_data={%s}"), *CommonEventJSON);
-		int64 CommonEventJSONLen = FTCHARToUTF8_Convert::ConvertedLength(*CommonEventJSON, CommonEventJSON.Len());
-		CommonEventJSONData.SetNum(0, false);
-		CommonEventJSONData.AddUninitialized(CommonEventJSONLen);
-		FTCHARToUTF8_Convert::Convert(CommonEventJSONData.GetData(), CommonEventJSONLen, *CommonEventJSON, CommonEventJSON.Len());
+		WorkerBufferedLen = 0;
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to read data: offset=%ld, bytes=%ld, logfile='%s'"), InOutEffectiveLogOffset + NumReused, OutNumToRead - NumReused, *SourceLogFile);
+		return false;
 	}
+	WorkerBufferedSlot = SlotIndex;
+	WorkerBufferedOffset = InOutEffectiveLogOffset;
+	WorkerBufferedLen = OutNumToRead;
+#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|reused_len=%d|data=%s|logfile='%s'"), InOutEffectiveLogOffset, OutNumToRead, NumReused, *ITLConvertUTF8(BufferData, OutNumToRead), *SourceLogFile);
+#else
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|reused_len=%d|logfile='%s'"), InOutEffectiveLogOffset, OutNumToRead, NumReused, *SourceLogFile);
+#endif
+	return true;
 }
 
-FsparklogsReadAndStreamToCloud::FsparklogsReadAndStreamToCloud(const TCHAR* InSourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes)
-	: Settings(InSettings)
-	, PayloadProcessor(InPayloadProcessor)
-	, SourceLogFile(InSourceLogFile)
-	, MaxLineLength(InMaxLineLength)
-	, OverrideComputerName(InOverrideComputerName == nullptr ? TEXT("") : InOverrideComputerName)
-	, Thread(nullptr)
-	, WorkerShippedLogOffset(0)
-	, WorkerMinNextFlushPlatformTime(0)
-	, WorkerNumConsecutiveFlushFailures(0)
-	, WorkerLastFailedFlushPayloadSize(0)
-{
-	ProgressMarkerPath = FPaths::Combine(FPaths::GetPath(InSourceLogFile), GetITLPluginStateFilename());
-	ComputeCommonEventJSON(Settings->IncludeCommonMetadata, AdditionalAttributes);
-
-	WorkerBuffer.AddUninitialized(Settings->BytesPerRequest);
-	int BufferSize = Settings->BytesPerRequest + 4096 + (Settings->BytesPerRequest / 10);
-	WorkerNextPayload.AddUninitialized(BufferSize);
-	WorkerNextEncodedPayload.AddUninitialized(BufferSize);
-	check(MaxLineLength > 0);
-	check(FPlatformProcess::SupportsMultithreading());
-	FString ThreadName = FString::Printf(TEXT("SparkLogs_Reader_%s"), *FPaths::GetBaseFilename(InSourceLogFile));
-	FPlatformAtomics::InterlockedExchangePtr((void**)&Thread, FRunnableThread::Create(this, *ThreadName, 0, TPri_BelowNormal));
-}
-
-FsparklogsReadAndStreamToCloud::~FsparklogsReadAndStreamToCloud()
+void FsparklogsReadAndStreamToCloud::WorkerDropOldestBacklog(int64 FileSize, int64& InOutEffectiveLogOffset)
 {
-	if (Thread)
+	// Drop down to 3/4 of the quota, so that this does not have to happen again for every few new lines
+	int64 NewOffset = FileSize - (Settings->MaxBacklogBytes / 4) * 3;
+	// Resume at the start of a line (the sample starts one byte early in case NewOffset already is one),
+	// and use the same sample to estimate how many lines were dropped
+	uint8 Sample[4096];
+	const int64 SampleOffset = NewOffset - 1;
+	const int SampleLen = (int)FMath::Min<int64>(sizeof(Sample), FileSize - SampleOffset);
+	int NumSampleLines = 0;
+	if (SampleLen > 0 && WorkerFileReader->ReadAt(SampleOffset, Sample, SampleLen))
 	{
-		delete Thread;
+		int FirstLineEnd = -1;
+		for (int i = 0; i < SampleLen; i++)
+		{
+			if (Sample[i] == '\n')
+			{
+				FirstLineEnd = (FirstLineEnd < 0) ? i : FirstLineEnd;
+				NumSampleLines++;
+			}
+		}
+		if (FirstLineEnd >= 0)
+		{
+			NewOffset = SampleOffset + FirstLineEnd + 1;
+		}
 	}
-	Thread = nullptr;
-}
-
-bool FsparklogsReadAndStreamToCloud::Init()
-{
-	return true;
+	const int64 DroppedBytes = NewOffset - InOutEffectiveLogOffset;
+	const int64 DroppedLines = (SampleLen > 0) ? DroppedBytes * NumSampleLines / SampleLen : 0;
+	NumBacklogDroppedBytes.Add(DroppedBytes);
+	UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Unshipped backlog exceeded MaxBacklogBytes=%lld, dropped the oldest %lld bytes (about %lld lines): offset=%ld, new_offset=%ld, logfile='%s'"),
+		Settings->MaxBacklogBytes, DroppedBytes, DroppedLines, InOutEffectiveLogOffset, NewOffset, *SourceLogFile);
+	WorkerFileReader->DiscardBefore(NewOffset);
+	InOutEffectiveLogOffset = NewOffset;
 }
 
-uint32 FsparklogsReadAndStreamToCloud::Run()
+bool FsparklogsReadAndStreamToCloud::WorkerBuildNextPayload(FPayloadSlot& Slot, int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines)
 {
-	WorkerFullyCleanedUp.AtomicSet(false);
-	ReadProgressMarker(WorkerShippedLogOffset);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|BEGIN|WorkerShippedLogOffset=%d"), (int)WorkerShippedLogOffset);
-	// A pending flush will be processed before stopping
-	while (StopRequestCounter.GetValue() == 0 || FlushRequestCounter.GetValue() > 0)
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerBuildNextPayload);
+	OutCapturedOffset = 0;
+	const uint8* BufferData = Slot.Buffer.GetData();
+	OutNumCapturedLines = 0;
+	// In the LZ4Frame mode the JSON is compressed a block at a time while it is built, instead of building the whole payload first
+	const bool StreamCompress = Settings->CompressionMode == ITLCompressionMode::LZ4Frame;
+	Slot.Payload.Reset();
+	// Let go of the last buffer first, so the pool can hand it right back unless the payload processor is still holding on to it
+	Slot.EncodedPayload.Reset();
+	Slot.EncodedPayload = PayloadBufferPool.Acquire(WorkerEncodedPayloadCapacity);
+	if (StreamCompress)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|In loop|WorkerLastFlushFailed=%d|FlushRequestCounter=%d"), WorkerLastFlushFailed ? 1 : 0, (int)FlushRequestCounter.GetValue());
-		// Only allow manual flushes if we are not in a retry delay because the last operation failed.
-		if (WorkerLastFlushFailed == false && FlushRequestCounter.GetValue() > 0)
+		Slot.FrameEncoder.Begin(*Slot.EncodedPayload, CompressionOptions.LZ4Acceleration);
+	}
+	TITLJSONStringBuilder* Payload = StreamCompress ? &Slot.FrameEncoder.GetStaging() : &Slot.Payload;
+	// In the envelope format the common fields are sent once for the whole payload instead of in every event
+	const bool Envelope = Settings->PayloadFormat == ITLPayloadFormat::Envelope;
+	if (Envelope)
+	{
+		Payload->Append("{\"common\":{", 11 /* length of `{"common":{` */);
+		Payload->Append((const ANSICHAR*)(CommonEventJSONData.GetData()), CommonEventJSONData.Num());
+		Payload->Append("},\"events\":[", 12 /* length of `},"events":[` */);
+	}
+	else
+	{
+		Payload->Append('[');
+	}
+	auto BeginEvent = [&]()
+	{
+		if (OutNumCapturedLines > 0)
 		{
-			int32 NewValue = FlushRequestCounter.Decrement();
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested|FlushRequestCounter=%d"), (int)NewValue);
-			WorkerDoFlush();
+			Payload->Append(',');
 		}
-		else if (FPlatformTime::Seconds() > WorkerMinNextFlushPlatformTime)
+		Payload->Append('{');
+		if (!Envelope && CommonEventJSONData.Num() > 0)
 		{
-			// If we are waiting on a manual flush, and the retry timer finally expired, it's OK to mark this attempt as processing it.
-			if (FlushRequestCounter.GetValue() > 0)
+			Payload->Append((const ANSICHAR*)(CommonEventJSONData.GetData()), CommonEventJSONData.Num());
+			Payload->Append(',');
+		}
+	};
+	auto EndEvent = [&]() -> bool
+	{
+		Payload->Append('}');
+		OutNumCapturedLines++;
+		if (StreamCompress)
+		{
+			if (!Slot.FrameEncoder.EndAppend())
 			{
-				int32 NewValue = FlushRequestCounter.Decrement();
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Manual flush requested after retry timer expired|FlushRequestCounter=%d"), (int)NewValue);
+				return false;
 			}
-			else
+			Payload = &Slot.FrameEncoder.GetStaging();
+		}
+		return true;
+	};
+	if (MemorySource.IsValid() && MemorySource->IsStructured())
+	{
+		// Structured records already carry every field separately, so there are no lines to split or prefixes to parse
+		FsparklogsMemoryCaptureDevice::FRecord Record;
+		while (FsparklogsMemoryCaptureDevice::DecodeRecord(BufferData + OutCapturedOffset, NumToRead - OutCapturedOffset, Record))
+		{
+			BeginEvent();
+			WorkerAppendRecordAsJsonFields(*Payload, Record);
+			if (!EndEvent())
 			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|Periodic flush"));
+				return false;
 			}
-			WorkerDoFlush();
+			OutCapturedOffset += Record.Len;
+		}
+	}
+	else
+	{
+		// Index every line boundary in the chunk in one vectorized pass, then walk the index
+		ITLBuildNewlineBitmap(BufferData, NumToRead, WorkerNewlineBitmap.GetData());
+		FsparklogsLineSplitter Splitter(BufferData, NumToRead, MaxLineLength, WorkerNewlineBitmap.GetData());
+		int LineOffset = 0;
+		int LineLen = 0;
+		// Splitting is cheap next to escaping, so a chunk built in parallel is still split here and only the lines are divided up
+		const int NumSegments = StreamCompress ? 1 : FMath::Clamp(NumToRead / ParallelPayloadBuildMinSegmentBytes, 1, Settings->PayloadBuildThreads);
+		if (NumSegments > 1)
+		{
+			WorkerLineSpans.Reset();
+			while (Splitter.Next(LineOffset, LineLen))
+			{
+				WorkerLineSpans.Add({ (const ANSICHAR*)(BufferData + LineOffset), LineLen });
+			}
+			WorkerBuildLineEventsInParallel(*Payload, NumSegments);
+			OutNumCapturedLines = WorkerLineSpans.Num();
 		}
 		else
 		{
-			// More coarse-grained sleep, we don't need to wake up and do work very often
-			FPlatformProcess::SleepNoStats(0.1f);
+			while (Splitter.Next(LineOffset, LineLen))
+			{
+				// Capture the data from (BufferData + LineOffset) to (BufferData + LineOffset + LineLen)
+				// NOTE: the data in the logfile was already written in UTF-8 format
+				BeginEvent();
+				WorkerAppendLineAsJsonFields(*Payload, (const ANSICHAR*)(BufferData + LineOffset), LineLen);
+#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
+				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|adding message to payload: %s"), *ITLConvertUTF8(BufferData + LineOffset, LineLen));
+#endif
+				if (!EndEvent())
+				{
+					return false;
+				}
+			}
 		}
+		OutCapturedOffset = Splitter.GetCapturedOffset();
 	}
-	WorkerFullyCleanedUp.AtomicSet(true);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Run|END"));
-	return 0;
+	if (Envelope)
+	{
+		Payload->Append("]}", 2);
+	}
+	else
+	{
+		Payload->Append(']');
+	}
+	Slot.OriginalPayloadLen = StreamCompress ? (int)(Slot.FrameEncoder.GetOriginalLen() + Payload->Len()) : Slot.Payload.Len();
+	return true;
 }
 
-void FsparklogsReadAndStreamToCloud::Stop()
+void FsparklogsReadAndStreamToCloud::WorkerAppendLineAsJsonFields(TITLJSONStringBuilder& Builder, const ANSICHAR* Line, int LineLen) const
 {
-	int32 NewValue = StopRequestCounter.Increment();
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|Stop|StopRequestCounter=%d"), (int)NewValue);
+	// Summaries of suppressed repeats carry the repeat count and timestamps in a suffix, which become separate fields.
+	// Only when repeats are suppressed, so that an ordinary line that happens to end the same way is shipped as written.
+	FsparklogsRepeatSuffix Repeat;
+	const bool IsRepeatSummary = Settings->RepeatSuppressionWindowSecs > 0.0 && ITLParseRepeatSuffix(Line, LineLen, Repeat);
+	const int MessageLen = IsRepeatSummary ? Repeat.SuffixOffset : LineLen;
+	if (Settings->ParseLogPrefix)
+	{
+		ITLAppendLogLineAsParsedJsonFields(Builder, Line, MessageLen);
+	}
+	else
+	{
+		Builder.Append("\"message\":", 10 /* length of `"message":` */);
+		ITLAppendUTF8AsEscapedJsonString(Builder, Line, MessageLen);
+	}
+	if (IsRepeatSummary)
+	{
+		ITLAppendRepeatSuffixAsJsonFields(Builder, Line, Repeat);
+	}
 }
 
-bool FsparklogsReadAndStreamToCloud::FlushAndWait(int N, bool ClearRetryTimer, bool InitiateStop, bool OnMainGameThread, double TimeoutSec, bool& OutLastFlushProcessedEverything)
+void FsparklogsReadAndStreamToCloud::WorkerBuildLineEventsInParallel(TITLJSONStringBuilder& Payload, int NumSegments)
 {
-	OutLastFlushProcessedEverything = false;
-	bool WasSuccessful = true;
-
-	// If we've already requested a stop, a flush is impossible
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|StopRequestCounter=%d"), (int)StopRequestCounter.GetValue());
-	if (StopRequestCounter.GetValue() > 0)
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerBuildLineEventsInParallel);
+	// Divide the lines so every segment has about the same number of bytes to escape
+	TArray<int, TInlineAllocator<MaxParallelPayloadSegments + 1>> SegmentStarts;
+	int64 TotalBytes = 0;
+	for (const FLineSpan& Span : WorkerLineSpans)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|stop already requested, exiting with false"));
-		return false;
+		TotalBytes += Span.Len;
 	}
-
-	if (ClearRetryTimer)
+	SegmentStarts.Add(0);
+	int64 SegmentBytes = 0;
+	for (int i = 0; i < WorkerLineSpans.Num() && SegmentStarts.Num() < NumSegments; i++)
 	{
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Clearing retry timer..."));
-		WorkerLastFlushFailed.AtomicSet(false);
+		SegmentBytes += WorkerLineSpans[i].Len;
+		if (SegmentBytes * NumSegments >= TotalBytes * SegmentStarts.Num())
+		{
+			SegmentStarts.Add(i + 1);
+		}
+	}
+	NumSegments = SegmentStarts.Num();
+	SegmentStarts.Add(WorkerLineSpans.Num());
+	while (WorkerSegmentPayloads.Num() < NumSegments)
+	{
+		WorkerSegmentPayloads.Add(MakeUnique<TITLJSONStringBuilder>());
 	}
 
-	for (int i = 0; i < N; i++)
+	const bool Envelope = Settings->PayloadFormat == ITLPayloadFormat::Envelope;
+	// Background priority, like the streamer thread itself, so catching up runs on the background workers instead of competing with game tasks
+	ParallelFor(NumSegments, [&](int32 Segment)
 	{
-		int StartFlushSuccessOpCounter = FlushSuccessOpCounter.GetValue();
-		int StartFlushOpCounter = FlushOpCounter.GetValue();
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Starting Loop|i=%d|N=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), (int)i, (int)N, (int)StartFlushSuccessOpCounter, (int)StartFlushOpCounter);
-		FlushRequestCounter.Increment();
-		// Last time around, we might initiate a stop
-		if (InitiateStop && i == N-1)
-		{
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Initiating stop..."));
-			Stop();
-		}
-		double StartTime = FPlatformTime::Seconds();
-		double LastTime = StartTime;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for request to finish...|StartTime=%.3lf"), StartTime);
-		while (FlushOpCounter.GetValue() == StartFlushOpCounter)
+		TITLJSONStringBuilder& Builder = *WorkerSegmentPayloads[Segment];
+		Builder.Reset();
+		// Exactly what the serial builder appends for each line
+		for (int i = SegmentStarts[Segment]; i < SegmentStarts[Segment + 1]; i++)
 		{
-			double Now = FPlatformTime::Seconds();
-			if (Now - StartTime > TimeoutSec)
+			if (i > 0)
 			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out, returning false"));
-				return false;
+				Builder.AppendChar(',');
 			}
-			if (OnMainGameThread)
+			Builder.AppendChar('{');
+			if (!Envelope && CommonEventJSONData.Num() > 0)
 			{
-				// HTTP requests and other things won't be processed unless we tick
-				double DeltaTime = Now - LastTime;
-				FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
-				FTicker::GetCoreTicker().Tick(DeltaTime);
-				FThreadManager::Get().Tick();
-				// NOTE: the game does not normally progress the frame count during shutdown, follow the same logic here
-				// GFrameCounter++;
+				Builder.Append((const ANSICHAR*)(CommonEventJSONData.GetData()), CommonEventJSONData.Num());
+				Builder.AppendChar(',');
 			}
-			FPlatformProcess::SleepNoStats(OnMainGameThread ? 0.01f : 0.05f);
-			LastTime = Now;
+			WorkerAppendLineAsJsonFields(Builder, WorkerLineSpans[i].Line, WorkerLineSpans[i].Len);
+			Builder.AppendChar('}');
 		}
-		WasSuccessful = FlushSuccessOpCounter.GetValue() != StartFlushSuccessOpCounter;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Finished waiting for request|WasSuccessful=%d|FlushSuccessOpCounter=%d|FlushOpCounter=%d"), WasSuccessful ? 1 : 0, (int)FlushSuccessOpCounter.GetValue(), (int)FlushOpCounter.GetValue());
+	}, EParallelForFlags::BackgroundPriority);
+	for (int Segment = 0; Segment < NumSegments; Segment++)
+	{
+		Payload.Append(WorkerSegmentPayloads[Segment]->GetData(), WorkerSegmentPayloads[Segment]->Len());
 	}
-	if (WasSuccessful)
+}
+
+bool FsparklogsReadAndStreamToCloud::WorkerCompressPayload(FPayloadSlot& Slot)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerCompressPayload);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Begin compressing payload"));
+	bool Success = false;
+	if (Settings->CompressionMode == ITLCompressionMode::LZ4Frame)
 	{
-		OutLastFlushProcessedEverything = LastFlushProcessedEverything;
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|LastFlushProcessedEverything=%d"), OutLastFlushProcessedEverything ? 1 : 0);
+		// Everything but the last block was already compressed while the payload was built
+		Success = Slot.FrameEncoder.Finish();
 	}
-	if (InitiateStop) {
-		// Wait for the worker to fully stop, up to the timeout
-		double StartTime = FPlatformTime::Seconds();
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Waiting for thread to stop...|StartTime=%.3lf"), StartTime);
-		while (!WorkerFullyCleanedUp)
-		{
-			if (FPlatformTime::Seconds() - StartTime > TimeoutSec)
-			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|Timed out waiting for thread to stop"));
-				return false;
-			}
-			FPlatformProcess::SleepNoStats(0.01f);
-		}
+	else if (Settings->CompressionMode == ITLCompressionMode::Gzip || Settings->CompressionMode == ITLCompressionMode::Deflate)
+	{
+		Success = Slot.DeflateStream.Compress(Settings->CompressionMode, CompressionOptions.DeflateLevel, (const uint8*)Slot.Payload.GetData(), Slot.Payload.Len(), *Slot.EncodedPayload);
 	}
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|FlushAndWait|END|WasSuccessful=%d"), WasSuccessful ? 1 : 0);
-	return WasSuccessful;
+	else
+	{
+		Success = ITLCompressData(Settings->CompressionMode, (const uint8*)Slot.Payload.GetData(), Slot.Payload.Len(), *Slot.EncodedPayload, CompressionOptions);
+	}
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Finish compressing payload|success=%d|original_len=%d|compressed_len=%d"), Success ? 1 : 0, Slot.OriginalPayloadLen, (int)Slot.EncodedPayload->Num());
+	return Success;
 }
 
-bool FsparklogsReadAndStreamToCloud::ReadProgressMarker(int64& OutMarker)
+bool FsparklogsReadAndStreamToCloud::WorkerPrepareSlot(FPayloadSlot& Slot, int64 FromOffset, int ReadLimit)
 {
-	OutMarker = 0;
-	double OutDouble = 0.0;
-	if (IFileManager::Get().FileExists(*ProgressMarkerPath))
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerPrepareSlot);
+	Slot.Prepared = false;
+	Slot.RequestedOffset = FromOffset;
+	Slot.StartOffset = FromOffset;
+	Slot.ReadLimit = ReadLimit;
+	Slot.ChunkSize = FMath::Min(ReadLimit > 0 ? ReadLimit : GetCurrentBytesPerRequest(), Slot.Buffer.Num());
+	Slot.NumRead = 0;
+	Slot.CapturedOffset = 0;
+	Slot.NumCapturedLines = 0;
+	Slot.OriginalPayloadLen = 0;
+	Slot.RemainingBytes = 0;
+	if (!WorkerReadNextPayload(Slot, Slot.NumRead, Slot.StartOffset, Slot.RemainingBytes))
 	{
-		bool WasDisabled = GConfig->AreFileOperationsDisabled();
-		GConfig->EnableFileOperations();
-		bool Result = GConfig->GetDouble(FsparklogsSettings::PluginStateSection, ProgressMarkerValue, OutDouble, *ProgressMarkerPath);
-		if (WasDisabled)
+		return false;
+	}
+	if (Slot.NumRead > 0)
+	{
+		if (!WorkerBuildNextPayload(Slot, Slot.NumRead, Slot.CapturedOffset, Slot.NumCapturedLines))
 		{
-			GConfig->DisableFileOperations();
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to build payload: offset=%ld, payload_input_size=%d, logfile='%s'"), Slot.StartOffset, Slot.CapturedOffset, *SourceLogFile);
+			return false;
 		}
-		if (!Result)
+#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerPrepareSlot|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|data=%s|logfile='%s'"),
+			Slot.StartOffset, Slot.CapturedOffset, Slot.NumCapturedLines, Slot.OriginalPayloadLen, *ITLConvertUTF8(Slot.Payload.GetData(), Slot.Payload.Len()), *SourceLogFile);
+#else
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerPrepareSlot|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|logfile='%s'"),
+			Slot.StartOffset, Slot.CapturedOffset, Slot.NumCapturedLines, Slot.OriginalPayloadLen, *SourceLogFile);
+#endif
+		if (Slot.NumCapturedLines > 0 && !WorkerCompressPayload(Slot))
 		{
-			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Failed to read progress marker from %s"), *ProgressMarkerPath);
+			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to compress payload: mode=%d"), (int)Settings->CompressionMode);
 			return false;
 		}
 	}
-	// Precise to 52+ bits
-	OutMarker = (int64)(OutDouble);
+	Slot.Prepared = true;
 	return true;
 }
 
-bool FsparklogsReadAndStreamToCloud::WriteProgressMarker(int64 InMarker)
+void FsparklogsReadAndStreamToCloud::WorkerDiscardPreparedSlot(FPayloadSlot& Slot)
 {
-	// TODO: should we use the sqlite plugin instead, maybe it's not as much overhead as writing INI file each time?
-	// Precise to 52+ bits
-	bool WasDisabled = GConfig->AreFileOperationsDisabled();
-	GConfig->EnableFileOperations();
-	GConfig->SetDouble(FsparklogsSettings::PluginStateSection, ProgressMarkerValue, (double)(InMarker), *ProgressMarkerPath);
-	GConfig->Flush(false, ProgressMarkerPath);
-	if (WasDisabled)
+	if (Slot.Prepared && Slot.StartOffset != Slot.RequestedOffset)
 	{
-		GConfig->DisableFileOperations();
+		// The logfile was rotated while preparing this chunk. The reader will not report that again, so start over where the chunk started.
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDiscardPreparedSlot|logfile was rotated|requested_offset=%ld|start_offset=%ld"), Slot.RequestedOffset, Slot.StartOffset);
+		WorkerShippedLogOffset = Slot.StartOffset;
+		ShippedLogOffset.store(Slot.StartOffset, std::memory_order_relaxed);
+		WorkerLastFailedFlushPayloadSize = 0;
+		WorkerFailedWindow.Reset();
 	}
-	return true;
-}
-
-void FsparklogsReadAndStreamToCloud::DeleteProgressMarker()
-{
-	IFileManager::Get().Delete(*ProgressMarkerPath, false, true, false);
+	Slot.Prepared = false;
 }
 
-bool FindFirstByte(const uint8* Haystack, uint8 Needle, int MaxToSearch, int& OutIndex)
+int FsparklogsReadAndStreamToCloud::WorkerGetRetryReadLimit(int64 Offset, bool& OutAcknowledged) const
 {
-	OutIndex = -1;
-	for (const uint8* RESTRICT Data = Haystack, *RESTRICT End = Data + MaxToSearch; Data != End; ++Data)
+	OutAcknowledged = false;
+	for (const FWindowChunk& Chunk : WorkerFailedWindow)
 	{
-		if (*Data == Needle)
+		if (Chunk.StartOffset == Offset)
 		{
-			OutIndex = static_cast<int>(Data - Haystack);
-			return true;
+			OutAcknowledged = Chunk.Acknowledged;
+			return Chunk.NumRead;
 		}
 	}
-	return false;
+	return 0;
 }
 
-void AppendUTF8AsEscapedJsonString(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N)
+bool FsparklogsReadAndStreamToCloud::WorkerProcessSlot(FPayloadSlot& Slot)
 {
-	ANSICHAR ControlFormatBuf[16];
-	Builder.Append('\"');
-	for (const ANSICHAR* RESTRICT Data = String, *RESTRICT End = Data + N; Data != End; ++Data)
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerProcessSlot|Begin processing payload|offset=%ld"), Slot.StartOffset);
+	const double StartTime = FPlatformTime::Seconds();
+	const FsparklogsPayloadBufferRef EncodedPayload = Slot.EncodedPayload.ToSharedRef();
+	const bool Succeeded = PayloadProcessor->ProcessPayload(EncodedPayload, EncodedPayload->Num(), Slot.OriginalPayloadLen, Settings->CompressionMode, this);
+	Stats.RecordRequest(FPlatformTime::Seconds() - StartTime, Succeeded, Slot.OriginalPayloadLen, EncodedPayload->Num());
+	if (!Succeeded)
 	{
-		switch (*Data)
-		{
-		case '\"':
-			Builder.Append("\\\"", 2 /* string length */);
-			break;
-		case '\b':
-			Builder.Append("\\b", 2 /* string length */);
-			break;
-		case '\t':
-			Builder.Append("\\t", 2 /* string length */);
-			break;
-		case '\n':
-			Builder.Append("\\n", 2 /* string length */);
-			break;
-		case '\f':
-			Builder.Append("\\f", 2 /* string length */);
-			break;
-		case '\r':
-			Builder.Append("\\r", 2 /* string length */);
-			break;
-		case '\\':
-			Builder.Append("\\\\", 2 /* string length */);
-			break;
-		default:
-			// Any character 0x20 and above can be included as-is
-			if ((uint8)(*Data) >= static_cast<UTF8CHAR>(0x20))
-			{
-				Builder.Append(*Data);
-			}
-			else
-			{
-				// Rare control character
-				FCStringAnsi::Snprintf(ControlFormatBuf, sizeof(ControlFormatBuf), "\\u%04x", static_cast<int>(*Data));
-				Builder.AppendAnsi(ControlFormatBuf);
-			}
-		}
+		UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to process payload: offset=%ld, num_read=%d, payload_input_size=%d, logfile='%s'"), Slot.StartOffset, Slot.NumRead, Slot.CapturedOffset, *SourceLogFile);
+		return false;
 	}
-	Builder.Append('\"');
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerProcessSlot|Finished processing payload|offset=%ld|PayloadInputSize=%d"), Slot.StartOffset, Slot.CapturedOffset);
+	return true;
 }
 
-bool FsparklogsReadAndStreamToCloud::WorkerReadNextPayload(int& OutNumToRead, int64& OutEffectiveShippedLogOffset, int64& OutRemainingBytes)
+bool FsparklogsReadAndStreamToCloud::WorkerInternalDoFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything)
 {
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerReadNextPayload);
-
-	OutEffectiveShippedLogOffset = WorkerShippedLogOffset;
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerInternalDoFlush);
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|BEGIN"));
+	OutNewShippedLogOffset = WorkerShippedLogOffset;
+	OutFlushProcessedEverything = false;
+	WorkerCommittedReadBytes = 0;
+	WorkerCommittedReadLines = 0;
+	const int NumSlots = WorkerSlots.Num();
+	auto GetSlot = [this, NumSlots](int i) -> FPayloadSlot& { return WorkerSlots[(WorkerCurrentSlot + i) % NumSlots]; };
 
-	// Re-open the file. UE doesn't contain cross-platform class that can stay open and refresh the filesize OR to read up to N (but maybe less than N bytes).
-	// The only solution and stay within UE class library is to just re-open the file every flush request. This is actually quite fast on modern platforms.
-	TUniquePtr<IFileHandle> WorkerReader;
-	WorkerReader.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*SourceLogFile, true));
-	if (WorkerReader == nullptr)
+	// A chunk prepared in the background can only be used as-is if it starts where we left off and filled the whole buffer
+	// (otherwise newer data could have been appended since, and the payload would be smaller than it needs to be).
+	FPayloadSlot& FirstSlot = GetSlot(0);
+	if (FirstSlot.Prepared && !(FirstSlot.RequestedOffset == WorkerShippedLogOffset && FirstSlot.NumRead == FirstSlot.ChunkSize))
 	{
-		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to open logfile='%s'"), *SourceLogFile);
-		return false;
+		WorkerDiscardPreparedSlot(FirstSlot);
+		OutNewShippedLogOffset = WorkerShippedLogOffset;
 	}
-	int64 FileSize = WorkerReader->Size();
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|opened log file|last_offset=%ld|current_file_size=%ld|logfile='%s'"), OutEffectiveShippedLogOffset, FileSize, *SourceLogFile);
-	if (OutEffectiveShippedLogOffset > FileSize)
+	if (FirstSlot.Prepared)
 	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Logfile reduced size, re-reading from start: new_size=%ld, previously_processed_to=%ld, logfile='%s'"), FileSize, OutEffectiveShippedLogOffset, *SourceLogFile);
-		OutEffectiveShippedLogOffset = 0;
-		// Don't force a retried read to use the same payload size as last time since the whole file has changed.
-		WorkerLastFailedFlushPayloadSize = 0;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|using chunk prepared in the background|offset=%ld|data_len=%d"), FirstSlot.StartOffset, FirstSlot.NumRead);
 	}
-	// Start at the last known shipped position, read as many bytes as possible up to the max buffer size, and capture log lines into a JSON payload
-	WorkerReader->Seek(OutEffectiveShippedLogOffset);
-	OutRemainingBytes = FileSize - OutEffectiveShippedLogOffset;
-	OutNumToRead = (int)(FMath::Clamp<int64>(OutRemainingBytes, 0, (int64)(WorkerBuffer.Num())));
-	if (WorkerLastFailedFlushPayloadSize > 0 && OutNumToRead > WorkerLastFailedFlushPayloadSize)
+	else if (!WorkerPrepareSlot(FirstSlot, WorkerShippedLogOffset, WorkerLastFailedFlushPayloadSize))
 	{
-		// Retried requests always use the same max payload size as last time,
-		// so that any retry has the same data as last time and can be deduplicated in worst-case scenarios.
-		// (e.g., an actual observed scenario where Unreal Engine HTTP plugin was sending requests successfully
-		// but was not processing responses properly and instead timing them out...)
-		OutNumToRead = WorkerLastFailedFlushPayloadSize;
+		return false;
 	}
-	if (OutNumToRead <= 0)
+	FirstSlot.Prepared = false;
+	if (FirstSlot.StartOffset != FirstSlot.RequestedOffset)
 	{
-		// We've read everything we possibly can already
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|Nothing more can be read|FileSize=%ld|EffectiveShippedLogOffset=%ld"), FileSize, OutEffectiveShippedLogOffset);
-		return true;
+		// The logfile was rotated, nothing from the last failed attempt can be retried
+		WorkerLastFailedFlushPayloadSize = 0;
+		WorkerFailedWindow.Reset();
 	}
-
-	uint8* BufferData = WorkerBuffer.GetData();
-	if (!WorkerReader->Read(BufferData, OutNumToRead))
+	if (FirstSlot.NumRead <= 0)
 	{
-		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to read data: offset=%ld, bytes=%ld, logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *SourceLogFile);
-		return false;
+		// nothing more to read (but still persist the offset if the logfile was rotated)
+		OutNewShippedLogOffset = FirstSlot.StartOffset;
+		OutFlushProcessedEverything = true;
+		WorkerLastBacklogBytes = 0;
+		return true;
 	}
-#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|data=%s|logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *ITLConvertUTF8(BufferData, OutNumToRead), *SourceLogFile);
-#else
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerReadNextPayload|read data into buffer|offset=%ld|data_len=%d|logfile='%s'"), OutEffectiveShippedLogOffset, OutNumToRead, *SourceLogFile);
-#endif
-	return true;
-}
 
-bool FsparklogsReadAndStreamToCloud::WorkerBuildNextPayload(int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines)
-{
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerBuildNextPayload);
-	OutCapturedOffset = 0;
-	const uint8* BufferData = WorkerBuffer.GetData();
-	OutNumCapturedLines = 0;
-	WorkerNextPayload.Reset();
-	WorkerNextPayload.Append('[');
-	int NextOffset = 0;
-	while (NextOffset < NumToRead)
+	// While more data is waiting, add more chunks to the window of chunks that are processed concurrently
+	TArray<FPayloadSlot*, TInlineAllocator<FsparklogsSettings::MaxMaxInFlightRequests>> Window;
+	Window.Add(&FirstSlot);
+	const int MaxWindow = FMath::Min(Settings->MaxInFlightRequests, NumSlots - 1);
+	while (Window.Num() < MaxWindow)
 	{
-		// Skip the UTF-8 byte order marker (always at the start of the file)
-		if (0 == std::memcmp(BufferData + NextOffset, UTF8ByteOrderMark, sizeof(UTF8ByteOrderMark)))
-		{
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|skipping UTF8 BOM|offset_before=%d|offset_after=%d"), NextOffset, NextOffset + sizeof(UTF8ByteOrderMark));
-			NextOffset += sizeof(UTF8ByteOrderMark);
-			OutCapturedOffset = NextOffset;
-			continue;
-		}
-		// We only process whole lines. See if we can find the next end of line character.
-		int RemainingBytes = NumToRead - NextOffset;
-		int NumToSearch = FMath::Min(RemainingBytes, MaxLineLength);
-		int FoundIndex = 0;
-		int ExtraToSkip = 1; // skip over the \n char
-		bool HaveLine = FindFirstByte(BufferData + NextOffset, static_cast<uint8>('\n'), NumToSearch, FoundIndex);
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|after newline search|NextOffset=%d|HaveLine=%d|NumToSearch=%d|FoundIndex=%d"), NextOffset, (int)HaveLine, NumToSearch, FoundIndex);
-		if (!HaveLine && NumToSearch == MaxLineLength && RemainingBytes > NumToSearch)
-		{
-			// Even though we didn't find a line, break the line at the max length and process it
-			// It's unsafe to break a line in the middle of a multi-byte UTF-8, so find a safe break point...
-			ExtraToSkip = 0;
-			FoundIndex = MaxLineLength - 1;
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|no newline found, search for safe breakpoint|NextOffset=%d|FoundIndex=%d"), NextOffset, FoundIndex);
-			while (FoundIndex > 0)
-			{
-				if (*(BufferData + NextOffset + FoundIndex) >= 0x80)
-				{
-					FoundIndex--;
-				}
-				else
-				{
-					// include this non-multi-byte character and break here
-					FoundIndex++;
-					break;
-				}
-			}
-			HaveLine = true;
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|found safe breakpoint|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
-		}
-		if (!HaveLine)
+		const FPayloadSlot& LastSlot = *Window.Last();
+		if (LastSlot.CapturedOffset <= 0 || (int64)(LastSlot.CapturedOffset) >= LastSlot.RemainingBytes)
 		{
-			// No more complete lines to process, this is enough for now
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|no more lines to process, break"));
 			break;
 		}
-		// Trim newlines control characters of any kind at the end
-		while (FoundIndex > 0)
-		{
-			// We expect the FoundIndex to be the *first* non-newline character, and ExtraToSkip set to the number of newline chars to skip.
-			// Check if the previous character is a newline character, and if so, skip capturing it.
-			uint8 c = *(BufferData + NextOffset + FoundIndex - 1);
-			if (c == '\n' || c == '\r')
-			{
-				ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|character at NextOffset=%d, FoundIndex=%d is newline, will skip it"), NextOffset, FoundIndex);
-				ExtraToSkip++;
-				FoundIndex--;
-			}
-			else
-			{
-				break;
-			}
-		}
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|line summary|NextOffset=%d|FoundIndex=%d|ExtraToSkip=%d"), NextOffset, FoundIndex, ExtraToSkip);
-		// Skip blank lines without capturing anything
-		if (FoundIndex <= 0)
+		FPayloadSlot& Candidate = GetSlot(Window.Num());
+		const int64 CandidateOffset = LastSlot.StartOffset + LastSlot.CapturedOffset;
+		bool AlreadyAcknowledged = false;
+		const int ReadLimit = WorkerGetRetryReadLimit(CandidateOffset, AlreadyAcknowledged);
+		if (!WorkerPrepareSlot(Candidate, CandidateOffset, ReadLimit) || Candidate.StartOffset != CandidateOffset || Candidate.CapturedOffset <= 0)
 		{
-			ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|skipping blank line..."));
-			if (ExtraToSkip <= 0)
-			{
-				ExtraToSkip = 1;
-			}
-			NextOffset += ExtraToSkip;
-			OutCapturedOffset = NextOffset;
-			continue;
+			// Leave it for the next flush (which also takes care of a logfile that was rotated in the meantime)
+			break;
 		}
-		// Capture the data from (BufferData + NextOffset) to (BufferData + NextOffset + FoundIndex)
-		// NOTE: the data in the logfile was already written in UTF-8 format
-		if (OutNumCapturedLines > 0)
+		Candidate.Prepared = false;
+		Window.Add(&Candidate);
+	}
+	const FPayloadSlot& LastSlot = *Window.Last();
+	const int64 NextOffset = LastSlot.StartOffset + LastSlot.CapturedOffset;
+
+	// If there is at least another full chunk waiting, prepare it on the pool while the window is being processed.
+	// Retries are left alone so that they see exactly the same data as last time.
+	FPayloadSlot& NextSlot = GetSlot(Window.Num());
+	if (!NextSlot.Prepared && LastSlot.NumCapturedLines > 0 && WorkerLastFailedFlushPayloadSize == 0 && WorkerFailedWindow.Num() == 0
+		&& LastSlot.RemainingBytes - LastSlot.CapturedOffset >= GetCurrentBytesPerRequest())
+	{
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|preparing next chunk in the background|offset=%ld"), NextOffset);
+		NextSlot.Task->StartPrepare(*WorkerThreadPool, NextOffset);
+	}
+
+	// Process every chunk in the window at the same time (the first one on this thread). Chunks that were already acknowledged
+	// during a previous attempt of the same window are not sent again.
+	TArray<bool, TInlineAllocator<FsparklogsSettings::MaxMaxInFlightRequests>> Acknowledged;
+	Acknowledged.Init(false, Window.Num());
+	for (int i = 0; i < Window.Num(); i++)
+	{
+		FPayloadSlot* WindowSlot = Window[i];
+		bool AlreadyAcknowledged = false;
+		WorkerGetRetryReadLimit(WindowSlot->StartOffset, AlreadyAcknowledged);
+		if (WindowSlot->NumCapturedLines <= 0 || AlreadyAcknowledged)
 		{
-			WorkerNextPayload.Append(',');
+			Acknowledged[i] = true;
 		}
-		WorkerNextPayload.Append('{');
-		if (CommonEventJSONData.Num() > 0)
+		else if (i > 0)
 		{
-			WorkerNextPayload.Append((const ANSICHAR*)(CommonEventJSONData.GetData()), CommonEventJSONData.Num());
-			WorkerNextPayload.Append(',');
+			// Sends block for the whole round trip, so they go to our own pool rather than the engine's shared one
+			WindowSlot->Task->StartProcess(*WorkerThreadPool);
 		}
-		WorkerNextPayload.Append("\"message\":", 10 /* length of `"message":` */);
-		AppendUTF8AsEscapedJsonString(WorkerNextPayload, (const ANSICHAR*)(BufferData + NextOffset), FoundIndex);
-#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerBuildNextPayload|adding message to payload: %s"), *ITLConvertUTF8(BufferData + NextOffset, FoundIndex));
-#endif
-		WorkerNextPayload.Append('}');
-		OutNumCapturedLines++;
-		NextOffset += FoundIndex + ExtraToSkip;
-		OutCapturedOffset = NextOffset;
 	}
-	WorkerNextPayload.Append(']');
-	return true;
-}
-
-bool FsparklogsReadAndStreamToCloud::WorkerCompressPayload()
-{
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerCompressPayload);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Begin compressing payload"));
-	bool Success = ITLCompressData(Settings->CompressionMode, (const uint8*)WorkerNextPayload.GetData(), WorkerNextPayload.Len(), WorkerNextEncodedPayload);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerCompressPayload|Finish compressing payload|success=%d|original_len=%d|compressed_len=%d"), Success ? 1 : 0, (int)WorkerNextPayload.Len(), (int)WorkerNextEncodedPayload.Num());
-	return Success;
-}
-
-bool FsparklogsReadAndStreamToCloud::WorkerInternalDoFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything)
-{
-	QUICK_SCOPE_CYCLE_COUNTER(STAT_FsparklogsReadAndStreamToCloud_WorkerInternalDoFlush);
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|BEGIN"));
-	OutNewShippedLogOffset = WorkerShippedLogOffset;
-	OutFlushProcessedEverything = false;
-	
-	int NumToRead = 0;
-	int64 EffectiveShippedLogOffset = WorkerShippedLogOffset, RemainingBytes;
-	if (!WorkerReadNextPayload(NumToRead, EffectiveShippedLogOffset, RemainingBytes))
+	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|processing window|num_chunks=%d|offset=%ld|end_offset=%ld"), Window.Num(), FirstSlot.StartOffset, NextOffset);
+	const double WindowStartTime = FPlatformTime::Seconds();
+	if (!Acknowledged[0])
 	{
-		return false;
+		Acknowledged[0] = WorkerProcessSlot(FirstSlot);
 	}
-	if (NumToRead <= 0)
+	// Never leave background work running past this point, it uses the same worker state
+	for (int i = 1; i < Window.Num(); i++)
 	{
-		// nothing more to read
-		OutFlushProcessedEverything = true;
-		return true;
+		if (Window[i]->Task->IsStarted())
+		{
+			Acknowledged[i] = Window[i]->Task->Wait();
+		}
 	}
-	
-	int CapturedOffset = 0;
-	int NumCapturedLines = 0;
-	if (!WorkerBuildNextPayload(NumToRead, CapturedOffset, NumCapturedLines))
+	WorkerLastWindowLatencySecs = FPlatformTime::Seconds() - WindowStartTime;
+	WorkerLastBacklogBytes = FMath::Max<int64>(LastSlot.RemainingBytes - LastSlot.CapturedOffset, 0);
+	if (NextSlot.Task->IsStarted() && !NextSlot.Task->Wait())
 	{
-		UE_LOG(LogPluginSparkLogs, Warning, TEXT("STREAMER: Failed to build payload: offset=%ld, payload_input_size=%d, logfile='%s'"), EffectiveShippedLogOffset, CapturedOffset, *SourceLogFile);
-		return false;
+		NextSlot.Prepared = false;
 	}
 
-#if ITL_INTERNAL_DEBUG_LOG_DATA == 1
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|data=%s|logfile='%s'"),
-		EffectiveShippedLogOffset, CapturedOffset, NumCapturedLines, WorkerNextPayload.Len(), *ITLConvertUTF8(WorkerNextPayload.GetData(), WorkerNextPayload.Len()), *SourceLogFile);
-#else
-	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|payload is ready to process|offset=%ld|payload_input_size=%d|captured_lines=%d|data_len=%d|logfile='%s'"),
-		EffectiveShippedLogOffset, CapturedOffset, NumCapturedLines, WorkerNextPayload.Len(), *SourceLogFile);
-#endif
-	if (NumCapturedLines > 0)
+	// Only advance past the contiguous run of acknowledged chunks at the start of the window
+	int NumAcknowledged = 0;
+	while (NumAcknowledged < Window.Num() && Acknowledged[NumAcknowledged])
+	{
+		// Chunks prepared but never committed (rebuilt or discarded) are not counted as read
+		WorkerCommittedReadBytes += Window[NumAcknowledged]->CapturedOffset;
+		WorkerCommittedReadLines += Window[NumAcknowledged]->NumCapturedLines;
+		NumAcknowledged++;
+	}
+	if (NumAcknowledged < Window.Num())
 	{
-		if (!WorkerCompressPayload())
+		const FPayloadSlot& FailedSlot = *Window[NumAcknowledged];
+		WorkerFailedWindow.Reset();
+		for (int i = NumAcknowledged; i < Window.Num(); i++)
 		{
-			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to compress payload: mode=%d"), (int)Settings->CompressionMode);
-			return false;
+			FWindowChunk& Chunk = WorkerFailedWindow.AddDefaulted_GetRef();
+			Chunk.StartOffset = Window[i]->StartOffset;
+			Chunk.NumRead = Window[i]->NumRead;
+			Chunk.Acknowledged = Acknowledged[i];
 		}
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|Begin processing payload"));
-		if (!PayloadProcessor->ProcessPayload(WorkerNextEncodedPayload, WorkerNextEncodedPayload.Num(), WorkerNextPayload.Len(), Settings->CompressionMode, this))
+		WorkerLastFailedFlushPayloadSize = FailedSlot.NumRead;
+		OutNewShippedLogOffset = FailedSlot.StartOffset;
+		// Everything from the failed chunk on is still waiting
+		WorkerLastBacklogBytes = FMath::Max<int64>(FirstSlot.RemainingBytes - (FailedSlot.StartOffset - FirstSlot.StartOffset), 0);
+		if (NextSlot.Prepared && NextSlot.StartOffset != NextSlot.RequestedOffset)
 		{
-			UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER: Failed to process payload: offset=%ld, num_read=%d, payload_input_size=%d, logfile='%s'"), EffectiveShippedLogOffset, NumToRead, CapturedOffset, *SourceLogFile);
-			WorkerLastFailedFlushPayloadSize = NumToRead;
-			return false;
+			// The logfile was rotated while the window was in flight, so the failed chunks can never be read again
+			OutNewShippedLogOffset = NextSlot.StartOffset;
+			WorkerLastFailedFlushPayloadSize = 0;
+			WorkerFailedWindow.Reset();
 		}
-		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|Finished processing payload|PayloadInputSize=%ld"), CapturedOffset);
+		NextSlot.Prepared = false;
+		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|END|window failed|num_acknowledged=%d|num_chunks=%d"), NumAcknowledged, Window.Num());
+		return false;
 	}
-	int ProcessedOffset = CapturedOffset;
 
 	// If we processed everything up until the end of the file, we captured everything we can.
-	OutNewShippedLogOffset = EffectiveShippedLogOffset + ProcessedOffset;
-	if ((int64)(ProcessedOffset) >= RemainingBytes)
+	WorkerFailedWindow.Reset();
+	OutNewShippedLogOffset = NextOffset;
+	if ((int64)(LastSlot.CapturedOffset) >= LastSlot.RemainingBytes)
 	{
 		OutFlushProcessedEverything = true;
 	}
+	WorkerCurrentSlot = (WorkerCurrentSlot + Window.Num()) % NumSlots;
 	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerInternalDoFlush|END|FlushProcessedEverything=%d"), OutFlushProcessedEverything);
 	return true;
 }
@@ -1209,9 +5142,18 @@ bool FsparklogsReadAndStreamToCloud::WorkerDoFlush()
 	int64 ShippedNewLogOffset = 0;
 	bool FlushProcessedEverything = false;
 	bool Result = WorkerInternalDoFlush(ShippedNewLogOffset, FlushProcessedEverything);
+	Stats.RecordFlush(Result, WorkerNumConsecutiveFlushFailures > 0);
+	Stats.RecordBacklog((Result && FlushProcessedEverything) ? 0 : WorkerLastBacklogBytes);
 	if (!Result)
 	{
+		if (ShippedNewLogOffset != WorkerShippedLogOffset)
+		{
+			// Chunks at the start of the window were acknowledged before the one that failed
+			WorkerSetShippedLogOffset(ShippedNewLogOffset);
+			Stats.RecordRead(WorkerCommittedReadBytes, WorkerCommittedReadLines);
+		}
 		WorkerLastFlushFailed.AtomicSet(true);
+		WorkerUpdateAdaptiveBatching(false);
 		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + WorkerGetRetrySecs();
 		LastFlushProcessedEverything.AtomicSet(false);
 		// Increment this counter after the retry interval is calculated
@@ -1223,18 +5165,54 @@ bool FsparklogsReadAndStreamToCloud::WorkerDoFlush()
 		WorkerLastFlushFailed.AtomicSet(false);
 		WorkerNumConsecutiveFlushFailures = 0;
 		WorkerLastFailedFlushPayloadSize = 0;
-		WorkerShippedLogOffset = ShippedNewLogOffset;
-		WriteProgressMarker(ShippedNewLogOffset);
-		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + Settings->ProcessingIntervalSecs;
+		WorkerSetShippedLogOffset(ShippedNewLogOffset);
+		Stats.RecordRead(WorkerCommittedReadBytes, WorkerCommittedReadLines);
+		WorkerUpdateAdaptiveBatching(true);
+		// If the next chunk is already prepared there is a backlog, so don't wait to process it
+		WorkerMinNextFlushPlatformTime = FPlatformTime::Seconds() + (WorkerSlots[WorkerCurrentSlot].Prepared ? 0.0 : GetCurrentProcessingIntervalSecs());
 		LastFlushProcessedEverything.AtomicSet(FlushProcessedEverything);
 		FlushSuccessOpCounter.Increment();
 		ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|internal flush succeeded|ShippedNewLogOffset=%d|WorkerMinNextFlushPlatformTime=%.3lf|FlushProcessedEverything=%d"), (int)ShippedNewLogOffset, WorkerMinNextFlushPlatformTime, FlushProcessedEverything ? 1 : 0);
 	}
 	FlushOpCounter.Increment();
+	FlushCompletedEvent->Trigger();
 	ITL_DBG_UE_LOG(LogPluginSparkLogs, Display, TEXT("STREAMER|WorkerDoFlush|END|Result=%d"), Result ? 1 : 0);
 	return Result;
 }
 
+void FsparklogsReadAndStreamToCloud::WorkerSetShippedLogOffset(int64 NewOffset)
+{
+	WorkerShippedLogOffset = NewOffset;
+	ShippedLogOffset.store(NewOffset, std::memory_order_relaxed);
+	WriteProgressMarker(NewOffset);
+	if (WorkerFileReader.IsValid())
+	{
+		WorkerFileReader->ReleaseShipped(NewOffset);
+	}
+}
+
+void FsparklogsReadAndStreamToCloud::WorkerUpdateAdaptiveBatching(bool FlushSucceeded)
+{
+	if (!WorkerAdaptiveController.IsValid())
+	{
+		return;
+	}
+	const FsparklogsAdaptiveController::EDecision PrevDecision = WorkerAdaptiveController->GetLastDecision();
+	const FsparklogsAdaptiveController::EDecision Decision = FlushSucceeded ? WorkerAdaptiveController->OnSuccess(WorkerLastWindowLatencySecs, WorkerLastBacklogBytes) : WorkerAdaptiveController->OnFailure();
+	CurrentBytesPerRequest.store(WorkerAdaptiveController->GetBytesPerRequest(), std::memory_order_relaxed);
+	CurrentProcessingIntervalSecs.store(WorkerAdaptiveController->GetProcessingIntervalSecs(), std::memory_order_relaxed);
+	SET_DWORD_STAT(STAT_SparkLogs_AdaptiveBytesPerRequest, WorkerAdaptiveController->GetBytesPerRequest());
+	SET_FLOAT_STAT(STAT_SparkLogs_AdaptiveProcessingIntervalSecs, WorkerAdaptiveController->GetProcessingIntervalSecs());
+	SET_FLOAT_STAT(STAT_SparkLogs_AdaptiveSmoothedLatencySecs, WorkerAdaptiveController->GetSmoothedLatencySecs());
+	// Only log when the controller changes direction (or keeps backing off), every step would be too noisy
+	if (Decision != PrevDecision || Decision == FsparklogsAdaptiveController::EDecision::BackOff)
+	{
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("STREAMER: Adaptive batching decision=%s, bytes_per_request=%d, processing_interval_secs=%.2lf, latency_secs=%.3lf, smoothed_latency_secs=%.3lf, backlog_bytes=%ld, logfile='%s'"),
+			FsparklogsAdaptiveController::DecisionToString(Decision), WorkerAdaptiveController->GetBytesPerRequest(), WorkerAdaptiveController->GetProcessingIntervalSecs(),
+			WorkerLastWindowLatencySecs, WorkerAdaptiveController->GetSmoothedLatencySecs(), WorkerLastBacklogBytes, *SourceLogFile);
+	}
+}
+
 double FsparklogsReadAndStreamToCloud::WorkerGetRetrySecs()
 {
 	double RetrySecs = Settings->RetryIntervalSecs * (WorkerNumConsecutiveFlushFailures + 1);
@@ -1352,6 +5330,7 @@ bool FsparklogsModule::StartShippingEngine(const TCHAR* OverrideAgentID, const T
 	}
 
 	// If we're sending data to the SparkLogs cloud then use lz4 compression by default, otherwise use none as lz4 support is nonstandard.
+	// (Custom HTTP destinations that support it can use the standard gzip or deflate modes instead.)
 	if (Settings->CompressionMode == ITLCompressionMode::Default)
 	{
 		if (UsingSparkLogsCloud || (!EffectiveAgentID.IsEmpty() && !EffectiveAgentAuthToken.IsEmpty()))
@@ -1361,10 +5340,27 @@ bool FsparklogsModule::StartShippingEngine(const TCHAR* OverrideAgentID, const T
 		}
 		else
 		{
-			UE_LOG(LogPluginSparkLogs, Log, TEXT("Sending data to custom HTTP destination, so using none as default compression mode."));
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("Sending data to custom HTTP destination, so using none as default compression mode. Set CompressionMode to gzip or deflate if the destination supports it."));
 			Settings->CompressionMode = ITLCompressionMode::None;
 		}
 	}
+	if (Settings->CompressionMode == ITLCompressionMode::LZ4Dictionary && !Settings->CompressionDictionary.IsValid())
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("Compression mode lz4dict needs a valid CompressionDictionaryFile, using lz4 instead."));
+		Settings->CompressionMode = ITLCompressionMode::LZ4;
+	}
+	// The SparkLogs cloud rejects anything but a JSON array compressed as a plain lz4 block with a 400, which is treated as a payload
+	// that can never be accepted and skipped, so every batch would be silently dropped.
+	if (UsingSparkLogsCloud && Settings->PayloadFormat != ITLPayloadFormat::Array)
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("Payload format envelope is not supported by the SparkLogs cloud, using array instead."));
+		Settings->PayloadFormat = ITLPayloadFormat::Array;
+	}
+	if (UsingSparkLogsCloud && (Settings->CompressionMode == ITLCompressionMode::LZ4Dictionary || Settings->CompressionMode == ITLCompressionMode::LZ4Frame || Settings->CompressionMode == ITLCompressionMode::LZ4MultiBlock))
+	{
+		UE_LOG(LogPluginSparkLogs, Warning, TEXT("Compression modes lz4dict, lz4frame and lz4multiblock are not supported by the SparkLogs cloud, using lz4 instead."));
+		Settings->CompressionMode = ITLCompressionMode::LZ4;
+	}
 
 	if (!FPlatformProcess::SupportsMultithreading())
 	{
@@ -1378,13 +5374,22 @@ bool FsparklogsModule::StartShippingEngine(const TCHAR* OverrideAgentID, const T
 	{
 		// Log all plugin messages to the ITL operations log
 		GLog->AddOutputDevice(GetITLInternalOpsLog().LogDevice.Get());
-		// Log all engine messages to an internal log just for this plugin, which we will then read from the file as we push log data to the cloud
-		GLog->AddOutputDevice(GetITLInternalGameLog().LogDevice.Get());
+		if (Settings->CaptureMode == ITLCaptureMode::Memory || Settings->CaptureMode == ITLCaptureMode::Records)
+		{
+			// Capture all engine messages in memory and stream them directly. The internal logfile only receives overflow.
+			MemoryCaptureDevice = MakeShared<FsparklogsMemoryCaptureDevice>(Settings->MemoryCaptureBufferBytes, GetITLInternalGameLog().LogDevice.Get(), Settings->CaptureMode == ITLCaptureMode::Records);
+			AddCaptureDevice(MemoryCaptureDevice.Get(), false);
+		}
+		else
+		{
+			// Log all engine messages to an internal log just for this plugin, which we will then read from the file as we push log data to the cloud
+			AddCaptureDevice(GetITLInternalGameLog().LogDevice.Get(), true);
+		}
 	}
 	UE_LOG(LogPluginSparkLogs, Log, TEXT("Starting up: LaunchConfiguration=%s, HttpEndpointURI=%s, AgentID=%s, ActivationPercentage=%lf, DiceRoll=%f, Activated=%s"), GetITLLaunchConfiguration(true), *EffectiveHttpEndpointURI, *EffectiveAgentID, Settings->ActivationPercentage, DiceRoll, LoggingActive ? TEXT("yes") : TEXT("no"));
 	if (LoggingActive)
 	{
-		UE_LOG(LogPluginSparkLogs, Log, TEXT("Ingestion parameters: RequestTimeoutSecs=%lf, BytesPerRequest=%d, ProcessingIntervalSecs=%lf, RetryIntervalSecs=%lf"), Settings->RequestTimeoutSecs, Settings->BytesPerRequest, Settings->ProcessingIntervalSecs, Settings->RetryIntervalSecs);
+		UE_LOG(LogPluginSparkLogs, Log, TEXT("Ingestion parameters: RequestTimeoutSecs=%lf, BytesPerRequest=%d, MaxInFlightRequests=%d, ProcessingIntervalSecs=%lf, RetryIntervalSecs=%lf, CaptureMode=%s"), Settings->RequestTimeoutSecs, Settings->BytesPerRequest, Settings->MaxInFlightRequests, Settings->ProcessingIntervalSecs, Settings->RetryIntervalSecs, (Settings->CaptureMode == ITLCaptureMode::Records) ? TEXT("records") : ((Settings->CaptureMode == ITLCaptureMode::Memory) ? TEXT("memory") : TEXT("file")));
 		FString SourceLogFile = GetITLInternalGameLog().LogFilePath;
 		FString AuthorizationHeader;
 		if (EffectiveHttpAuthorizationHeaderValue.IsEmpty())
@@ -1396,7 +5401,16 @@ bool FsparklogsModule::StartShippingEngine(const TCHAR* OverrideAgentID, const T
 			AuthorizationHeader = EffectiveHttpAuthorizationHeaderValue;
 		}
 		CloudPayloadProcessor = TSharedPtr<FsparklogsWriteHTTPPayloadProcessor>(new FsparklogsWriteHTTPPayloadProcessor(*EffectiveHttpEndpointURI, *AuthorizationHeader, Settings->RequestTimeoutSecs, Settings->DebugLogRequests));
+		// Even when capturing in memory, the logfile streamer ships overflow and anything left over from a previous session
 		CloudStreamer = MakeUnique<FsparklogsReadAndStreamToCloud>(*SourceLogFile, Settings, CloudPayloadProcessor.ToSharedRef(), GMaxLineLength, OverrideComputerName, AdditionalAttributes);
+		if (CaptureFilterDevice.IsValid())
+		{
+			CaptureFilterDevice->SetBacklogSource(CloudStreamer.Get());
+		}
+		if (MemoryCaptureDevice.IsValid())
+		{
+			MemoryStreamer = MakeUnique<FsparklogsReadAndStreamToCloud>(MemoryCaptureDevice.ToSharedRef(), Settings, CloudPayloadProcessor.ToSharedRef(), GMaxLineLength, OverrideComputerName, AdditionalAttributes);
+		}
 		FCoreDelegates::OnExit.AddRaw(this, &FsparklogsModule::OnEngineExit);
 
 		if (Settings->StressTestGenerateIntervalSecs > 0)
@@ -1412,20 +5426,35 @@ void FsparklogsModule::StopShippingEngine()
 	if (LoggingActive || CloudStreamer.IsValid())
 	{
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("Shutting down and flushing logs to cloud..."));
+		if (CaptureFilterDevice.IsValid())
+		{
+			CaptureFilterDevice->EmitRepeatSummaries(true);
+			CaptureFilterDevice->EmitDroppedSummary();
+		}
 		GLog->Flush();
 		if (StressGenerator.IsValid())
 		{
 			StressGenerator->Stop();
 		}
+		if (CloudPayloadProcessor.IsValid())
+		{
+			// Set the retry interval to something short so we don't delay shutting down the game...
+			Settings->RetryIntervalSecs = 0.2;
+			// When the engine is shutting down, wait no more than 6 seconds to flush the final log request
+			CloudPayloadProcessor->SetTimeoutSecs(FMath::Min(Settings->RequestTimeoutSecs, 6.0));
+		}
+		if (MemoryStreamer.IsValid())
+		{
+			bool MemoryFlushProcessedEverything = false;
+			bool MemoryFlushed = MemoryStreamer->FlushAndWait(2, true, true, true, FsparklogsSettings::WaitForFlushToCloudOnShutdown, MemoryFlushProcessedEverything);
+			UE_LOG(LogPluginSparkLogs, Log, TEXT("Flushed in-memory logs. Success=%d, LastFlushedEverything=%d"), MemoryFlushed ? 1 : 0, MemoryFlushProcessedEverything ? 1 : 0);
+			RemoveCaptureDevice(MemoryCaptureDevice.Get());
+			MemoryStreamer.Reset();
+			// Anything that could not be shipped is spilled to the logfile, which is shipped below or in the next session
+			MemoryCaptureDevice->SpillUnreleased();
+		}
 		if (CloudStreamer.IsValid())
 		{
-			if (CloudPayloadProcessor.IsValid())
-			{
-				// Set the retry interval to something short so we don't delay shutting down the game...
-				Settings->RetryIntervalSecs = 0.2;
-				// When the engine is shutting down, wait no more than 6 seconds to flush the final log request
-				CloudPayloadProcessor->SetTimeoutSecs(FMath::Min(Settings->RequestTimeoutSecs, 6.0));
-			}
 			bool LastFlushProcessedEverything = false;
 			if (CloudStreamer->FlushAndWait(2, true, true, true, FsparklogsSettings::WaitForFlushToCloudOnShutdown, LastFlushProcessedEverything))
 			{
@@ -1433,7 +5462,7 @@ void FsparklogsModule::StopShippingEngine()
 				UE_LOG(LogPluginSparkLogs, Log, TEXT("Flushed logs successfully. LastFlushedEverything=%d"), (int)LastFlushProcessedEverything);
 				// Purge this plugin's logfile and delete the progress marker (fully flushed shutdown should start with an empty log next game session).
 				FOutputDevice* LogDevice = GetITLInternalGameLog().LogDevice.Get();
-				GLog->RemoveOutputDevice(LogDevice);
+				RemoveCaptureDevice(LogDevice);
 				LogDevice->Flush();
 				LogDevice->TearDown();
 				if (LastFlushProcessedEverything)
@@ -1449,15 +5478,121 @@ void FsparklogsModule::StopShippingEngine()
 				// NOTE: the progress marker would not have been updated, so we'll keep trying the next time
 				// the game engine starts right from where we left off, so we shouldn't lose anything.
 			}
+			if (CaptureFilterDevice.IsValid())
+			{
+				CaptureFilterDevice->SetBacklogSource(nullptr);
+			}
 			CloudStreamer.Reset();
 		}
 		CloudPayloadProcessor.Reset();
+		MemoryCaptureDevice.Reset();
 		StressGenerator.Reset();
 		UE_LOG(LogPluginSparkLogs, Log, TEXT("Shutdown."));
 		LoggingActive = false;
 	}
 }
 
+void FsparklogsModule::DumpStats(FOutputDevice& Ar) const
+{
+	if (!CloudStreamer.IsValid())
+	{
+		Ar.Logf(TEXT("SparkLogs: the shipping engine is not running"));
+		return;
+	}
+	auto DumpStreamerStats = [&Ar](const TCHAR* Name, const FsparklogsReadAndStreamToCloud& Streamer)
+	{
+		Ar.Logf(TEXT("SparkLogs %s streamer: shipped_offset=%lld, backlog_dropped_bytes=%lld"), Name, Streamer.GetShippedLogOffset(), Streamer.GetNumBacklogDroppedBytes());
+		TArray<FString> Lines;
+		Streamer.GetStats().ToString().ParseIntoArrayLines(Lines);
+		for (const FString& Line : Lines)
+		{
+			Ar.Logf(TEXT("  %s"), *Line);
+		}
+	};
+	DumpStreamerStats(TEXT("logfile"), *CloudStreamer);
+	if (MemoryStreamer.IsValid())
+	{
+		DumpStreamerStats(TEXT("memory"), *MemoryStreamer);
+		Ar.Logf(TEXT("SparkLogs memory capture: spilled_bytes=%lld"), MemoryCaptureDevice->GetNumSpilledBytes());
+	}
+	if (CaptureFilterDevice.IsValid())
+	{
+		Ar.Logf(TEXT("SparkLogs capture filter: dropped_lines=%lld, suppressed_repeats=%lld"), CaptureFilterDevice->GetNumDropped(), CaptureFilterDevice->GetNumRepeatsSuppressed());
+	}
+	if (StressGenerator.IsValid())
+	{
+		FsparklogsLatencyHistogram Latency;
+		StressGenerator->GetLatency(Latency);
+		Ar.Logf(TEXT("SparkLogs stress generator: entries=%lld, log call latency: %s"), StressGenerator->GetNumEntries(), *Latency.ToString());
+	}
+}
+
+static FAutoConsoleCommandWithOutputDevice ITLStatsCommand(
+	TEXT("sparklogs.stats"),
+	TEXT("Shows how much the SparkLogs plugin has read, compressed, and sent, request latency, retries, and the current backlog."),
+	FConsoleCommandWithOutputDeviceDelegate::CreateLambda([](FOutputDevice& Ar)
+	{
+		if (FsparklogsModule::IsModuleLoaded())
+		{
+			FsparklogsModule::GetModule().DumpStats(Ar);
+		}
+	}));
+
+void FsparklogsModule::AddCaptureDevice(FOutputDevice* Device, bool WritesLogFile)
+{
+	// The drop oldest backlog policy is handled by the streamer, the others have to stop lines from being written in the first place
+	const bool NeedsBacklogQuota = WritesLogFile && Settings->MaxBacklogBytes > 0 && Settings->BacklogDropPolicy != ITLBacklogDropPolicy::DropOldest;
+	if (NeedsBacklogQuota || Settings->RepeatSuppressionWindowSecs > 0.0 || !Settings->CaptureFilterRules.TrimStartAndEnd().IsEmpty())
+	{
+		CaptureFilterDevice = MakeShared<FsparklogsCaptureFilterDevice>(Device, Settings->CaptureFilterRules, Settings->CaptureFilterSummaryIntervalSecs);
+		if (NeedsBacklogQuota)
+		{
+			CaptureFilterDevice->SetBacklogQuota(Settings->MaxBacklogBytes, Settings->BacklogDropPolicy, Settings->BacklogSampleKeepOneIn, GetITLInternalGameLog().LogFilePath);
+		}
+		CaptureFilterDevice->SetRepeatSuppression(Settings->RepeatSuppressionWindowSecs);
+		GLog->AddOutputDevice(CaptureFilterDevice.Get());
+	}
+	else
+	{
+		GLog->AddOutputDevice(Device);
+	}
+}
+
+bool FsparklogsModule::SetOutputDevicesAttached(bool Attached)
+{
+	if (!LoggingActive)
+	{
+		return false;
+	}
+	// Whatever AddCaptureDevice put in GLog
+	FOutputDevice* CaptureDevice = CaptureFilterDevice.IsValid() ? CaptureFilterDevice.Get() : (MemoryCaptureDevice.IsValid() ? (FOutputDevice*)MemoryCaptureDevice.Get() : GetITLInternalGameLog().LogDevice.Get());
+	FOutputDevice* OpsLogDevice = GetITLInternalOpsLog().LogDevice.Get();
+	if (Attached)
+	{
+		GLog->AddOutputDevice(OpsLogDevice);
+		GLog->AddOutputDevice(CaptureDevice);
+	}
+	else
+	{
+		GLog->RemoveOutputDevice(CaptureDevice);
+		GLog->RemoveOutputDevice(OpsLogDevice);
+	}
+	return true;
+}
+
+void FsparklogsModule::RemoveCaptureDevice(FOutputDevice* Device)
+{
+	if (CaptureFilterDevice.IsValid() && CaptureFilterDevice->GetInnerDevice() == Device)
+	{
+		GLog->RemoveOutputDevice(CaptureFilterDevice.Get());
+		CaptureFilterDevice.Reset();
+	}
+	else
+	{
+		GLog->RemoveOutputDevice(Device);
+	}
+}
+
 void FsparklogsModule::OnPostEngineInit()
 {
 	if (UObjectInitialized())
@@ -0,0 +1,87 @@
+// Copyright (C) 2024-2025 IT Lightning, LLC. All rights reserved.
+// Licensed software - see LICENSE
+
+#include "sparklogsTrainDictionaryCommandlet.h"
+#include "sparklogs.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+USparkLogsTrainDictionaryCommandlet::USparkLogsTrainDictionaryCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 USparkLogsTrainDictionaryCommandlet::Main(const FString& Params)
+{
+	FString LogDir = FPaths::ProjectLogDir();
+	FParse::Value(*Params, TEXT("LogDir="), LogDir);
+	FString OutputPath = FPaths::Combine(FPaths::ProjectConfigDir(), TEXT("sparklogs-dictionary.bin"));
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+	int32 DictionarySize = FsparklogsCompressionDictionary::MaxSize;
+	FParse::Value(*Params, TEXT("Size="), DictionarySize);
+	int32 MaxSampleBytes = 8 * 1024 * 1024;
+	FParse::Value(*Params, TEXT("MaxSampleBytes="), MaxSampleBytes);
+
+	TArray<FString> LogFiles;
+	IFileManager::Get().FindFiles(LogFiles, *FPaths::Combine(LogDir, TEXT("sparklogs-*-run*.log")), true, false);
+	if (LogFiles.Num() <= 0)
+	{
+		UE_LOG(LogPluginSparkLogs, Error, TEXT("No sparklogs-*-run*.log files found in %s"), *LogDir);
+		return 1;
+	}
+	LogFiles.Sort();
+
+	// Frame each line the same way as in a payload, so common JSON syntax ends up in the dictionary too
+	TITLJSONStringBuilder Samples;
+	for (const FString& LogFile : LogFiles)
+	{
+		TArray<uint8> Data;
+		if (!FFileHelper::LoadFileToArray(Data, *FPaths::Combine(LogDir, LogFile)))
+		{
+			UE_LOG(LogPluginSparkLogs, Warning, TEXT("Failed to read %s, skipping..."), *LogFile);
+			continue;
+		}
+		UE_LOG(LogPluginSparkLogs, Display, TEXT("Sampling %s (%d bytes)..."), *LogFile, Data.Num());
+		int LineStart = 0;
+		for (int i = 0; i < Data.Num() && Samples.Len() < MaxSampleBytes; i++)
+		{
+			if (Data[i] != '\n')
+			{
+				continue;
+			}
+			int LineEnd = (i > LineStart && Data[i - 1] == '\r') ? i - 1 : i;
+			if (LineEnd > LineStart)
+			{
+				Samples.Append(Samples.Len() == 0 ? "[{\"message\":" : ",{\"message\":");
+				ITLAppendUTF8AsEscapedJsonString(Samples, (const ANSICHAR*)Data.GetData() + LineStart, LineEnd - LineStart);
+				Samples.AppendChar('}');
+			}
+			LineStart = i + 1;
+		}
+		if (Samples.Len() >= MaxSampleBytes)
+		{
+			break;
+		}
+	}
+
+	TArray<uint8> SampleData((const uint8*)Samples.GetData(), Samples.Len());
+	TArray<uint8> Dictionary;
+	ITLTrainCompressionDictionary(SampleData, DictionarySize, Dictionary);
+	if (Dictionary.Num() <= 0)
+	{
+		UE_LOG(LogPluginSparkLogs, Error, TEXT("Not enough log data to train a dictionary"));
+		return 1;
+	}
+	if (!FFileHelper::SaveArrayToFile(Dictionary, *OutputPath))
+	{
+		UE_LOG(LogPluginSparkLogs, Error, TEXT("Failed to write dictionary to %s"), *OutputPath);
+		return 1;
+	}
+	FsparklogsCompressionDictionary Trained(Dictionary.GetData(), Dictionary.Num());
+	UE_LOG(LogPluginSparkLogs, Display, TEXT("Wrote %d byte dictionary (id=%08x) trained on %d bytes of samples to %s. Set CompressionDictionaryFile to this path and CompressionMode to lz4dict to use it."), Dictionary.Num(), Trained.GetId(), SampleData.Num(), *OutputPath);
+	return 0;
+}
@@ -0,0 +1,27 @@
+// Copyright (C) 2024-2025 IT Lightning, LLC. All rights reserved.
+// Licensed software - see LICENSE
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "sparklogsTrainDictionaryCommandlet.generated.h"
+
+/**
+ * Trains a dictionary for the lz4dict compression mode from logfiles previously written by this plugin (sparklogs-*-run*.log).
+ * Log lines are framed as JSON the same way they are in payloads, so the dictionary also covers the JSON syntax.
+ *
+ * Usage: UnrealEditor-Cmd.exe <Project> -run=SparkLogsTrainDictionary [-LogDir=<dir>] [-Output=<file>] [-Size=<bytes>] [-MaxSampleBytes=<bytes>]
+ */
+UCLASS()
+class USparkLogsTrainDictionaryCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	USparkLogsTrainDictionaryCommandlet();
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+};
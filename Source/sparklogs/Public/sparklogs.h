@@ -8,8 +8,14 @@
 #include "UObject/Object.h"
 #include "Modules/ModuleManager.h"
 #include "HAL/Runnable.h"
+#include "HAL/Event.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "Misc/IQueuedWork.h"
+#include "Misc/QueuedThreadPool.h"
+#include "GenericPlatform/GenericPlatformFile.h"
 #include "Interfaces/IHttpResponse.h"
 #include "HttpModule.h"
+#include <atomic>
 #include "sparklogs.generated.h"
 
 #define ITL_CONFIG_SECTION_NAME TEXT("/Script/sparklogs.SparkLogsRuntimeSettings")
@@ -36,13 +42,155 @@ enum class SPARKLOGS_API ITLCompressionMode
 {
 	Default = 0,
 	LZ4 = 0,
-	None = 1
+	None = 1,
+	/** LZ4 block primed with a pre-trained dictionary (see FsparklogsCompressionDictionary), sent with Content-Encoding: lz4-block-dict. */
+	LZ4Dictionary = 2,
+	/** LZ4 frame with linked blocks, compressed while the payload is being built (see FsparklogsLZ4FrameEncoder). */
+	LZ4Frame = 3,
+	/** Standard gzip (RFC 1952), sent with Content-Encoding: gzip. */
+	Gzip = 4,
+	/** Standard zlib-wrapped deflate (RFC 1950), sent with Content-Encoding: deflate. */
+	Deflate = 5,
+	/** Independent LZ4 blocks behind a block size table, so large payloads can be compressed (and decompressed) on several cores at once. */
+	LZ4MultiBlock = 6
 };
 
-SPARKLOGS_API bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, TArray<uint8>& OutData);
-SPARKLOGS_API bool ITLDecompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData);
+/** How engine log output is captured before it is shipped. */
+enum class SPARKLOGS_API ITLCaptureMode
+{
+	Default = 0,
+	/** Log lines are written to a logfile on disk, which is then read back and shipped. */
+	File = 0,
+	/** Log lines are captured into a bounded in-memory ring buffer and shipped directly. The logfile is only used when the buffer overflows. */
+	Memory = 1,
+	/**
+	 * Like Memory, but each log message is captured as a binary record with its verbosity, category, time, frame, and thread ID
+	 * instead of as formatted text, and shipped as typed fields without any line splitting or parsing.
+	 */
+	Records = 2
+};
+
+/** How log events are laid out in a payload. */
+enum class SPARKLOGS_API ITLPayloadFormat
+{
+	Default = 0,
+	/** A JSON array of events, each with a copy of the common metadata fields: [{<common>,"message":...},...] */
+	Array = 0,
+	/** A JSON object with the common metadata fields sent once per payload: {"common":{<common>},"events":[{"message":...},...]} */
+	Envelope = 1
+};
+
+/** What to do when more than MaxBacklogBytes of the logfile is waiting to be shipped. */
+enum class SPARKLOGS_API ITLBacklogDropPolicy
+{
+	Default = 0,
+	/**
+	 * Keep capturing everything, and skip over the oldest data that has not been shipped yet, freeing its disk space.
+	 * Only Linux can free part of a logfile that is still being written, so elsewhere this falls back to DropVerboseFirst, which does bound the logfile.
+	 */
+	DropOldest = 0,
+	/** Stop capturing lines more verbose than Warning, and once the backlog is another 25% over the quota, everything but Fatal lines. */
+	DropVerboseFirst = 1,
+	/** Only capture one in every BacklogSampleKeepOneIn lines, and once the backlog is another 25% over the quota, nothing but Fatal lines (which are always captured). */
+	Sample = 2
+};
+
+/**
+ * A preset dictionary for the LZ4Dictionary compression mode, trained from typical log payloads (see USparkLogsTrainDictionaryCommandlet).
+ * Priming the compressor with it lets even small payloads reference common text (JSON framing, log categories, repeated messages) right away.
+ * The LZ4 state for the dictionary is prepared once, so each payload only pays for a copy of it.
+ */
+class SPARKLOGS_API FsparklogsCompressionDictionary
+{
+protected:
+	TArray<uint8> Data;
+	uint32 Id;
+	/** Opaque LZ4 stream state with Data already loaded. */
+	TArray<uint8> PreparedLZ4Stream;
+
+public:
+	/** LZ4 can only reference the last 64 KB of history, so a longer dictionary is trimmed to its last 64 KB. */
+	static constexpr int32 MaxSize = 64 * 1024;
+
+	FsparklogsCompressionDictionary(const uint8* InData, int32 InLen);
+	FsparklogsCompressionDictionary(const FsparklogsCompressionDictionary&) = delete;
+	FsparklogsCompressionDictionary& operator=(const FsparklogsCompressionDictionary&) = delete;
+	/** Returns null if the file cannot be read or is empty. */
+	static TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> LoadFromFile(const FString& Path);
+
+	const TArray<uint8>& GetData() const { return Data; }
+	/** CRC32 of the dictionary data, sent along with payloads so the receiver can pick the same dictionary. */
+	uint32 GetId() const { return Id; }
+	const uint8* GetPreparedLZ4Stream() const { return PreparedLZ4Stream.GetData(); }
+};
+
+/** Options for compression modes that support them. */
+struct SPARKLOGS_API FsparklogsCompressionOptions
+{
+	/** LZ4 acceleration factor. 1 gives the best ratio, higher values are faster with a lower ratio. */
+	int32 LZ4Acceleration = 1;
+	/** Required by the LZ4Dictionary mode. */
+	TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> Dictionary;
+	/** zlib compression level for the gzip and deflate modes. 1 is the fastest, 9 gives the best ratio. */
+	int32 DeflateLevel = 1;
+	/** Uncompressed size of each block in the LZ4MultiBlock mode. */
+	int32 MultiBlockSize = 256 * 1024;
+	/** The most threads (including the calling one) that compress the blocks of one payload in the LZ4MultiBlock mode, as background priority tasks. */
+	int32 MaxThreads = 4;
+};
+
+SPARKLOGS_API bool ITLCompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, TArray<uint8>& OutData, const FsparklogsCompressionOptions& Options = FsparklogsCompressionOptions());
+/**
+ * Dictionary is required by the LZ4Dictionary mode and must be the same one the data was compressed with.
+ * MaxThreads is the most threads that decompress the blocks of the LZ4MultiBlock mode, like FsparklogsCompressionOptions::MaxThreads.
+ */
+SPARKLOGS_API bool ITLDecompressData(ITLCompressionMode Mode, const uint8* InData, int InDataLen, int InOriginalDataLen, TArray<uint8>& OutData, const FsparklogsCompressionDictionary* Dictionary = nullptr, int32 MaxThreads = 4);
+/**
+ * Builds a compression dictionary of up to DictionarySize bytes from sample payload data. Follows the idea of zstd's COVER trainer:
+ * the samples are split into one epoch per dictionary segment, and from each epoch the segment whose 8-byte substrings are most frequent
+ * across all samples (and not yet covered by earlier segments) is picked. The most valuable segments end up last, closest to the payload.
+ */
+SPARKLOGS_API void ITLTrainCompressionDictionary(const TArray<uint8>& Samples, int32 DictionarySize, TArray<uint8>& OutDictionary);
+/** Returns the message the stress test generator logs, so benchmarks can use the same corpus. */
+SPARKLOGS_API FString ITLFormatStressTestMessage(double PlatformTime, int Iteration);
 SPARKLOGS_API FString ITLGenerateRandomAlphaNumID(int Length);
 
+/** Returns the number of uint64 words needed for a newline bitmap covering Len bytes. */
+constexpr int ITLGetNewlineBitmapWords(int Len) { return (Len + 63) / 64; }
+/**
+ * Indexes every '\n' byte in Data in a single pass, setting bit (i % 64) of word (i / 64) in OutBitmap for each newline at offset i.
+ * OutBitmap must hold at least ITLGetNewlineBitmapWords(Len) words. Uses SIMD when available unless ForceScalar is true.
+ */
+SPARKLOGS_API void ITLBuildNewlineBitmap(const uint8* Data, int Len, uint64* OutBitmap, bool ForceScalar = false);
+
+/**
+ * Splits a buffer of UTF-8 log data into complete lines. Skips the UTF-8 byte order marker and blank lines,
+ * trims trailing CR/LF characters, and breaks lines longer than MaxLineLength bytes at a safe UTF-8 boundary.
+ */
+class SPARKLOGS_API FsparklogsLineSplitter
+{
+public:
+	/** If InNewlineBitmap is null then newlines are found with a byte-at-a-time scan, otherwise the bitmap (from ITLBuildNewlineBitmap) is used. */
+	FsparklogsLineSplitter(const uint8* InData, int InLen, int InMaxLineLength, const uint64* InNewlineBitmap);
+
+	/** Finds the next non-blank line and returns its offset and length (excluding line terminators). Returns false if there are no more complete lines. */
+	bool Next(int& OutLineOffset, int& OutLineLen);
+
+	/** The number of bytes fully consumed so far (captured lines, skipped blank lines, and byte order markers). */
+	int GetCapturedOffset() const { return CapturedOffset; }
+
+protected:
+	/** Searches for the next '\n' in [StartOffset, StartOffset + MaxToSearch). Sets OutIndex relative to StartOffset. */
+	bool FindNewline(int StartOffset, int MaxToSearch, int& OutIndex) const;
+
+	const uint8* Data;
+	int Len;
+	int MaxLineLength;
+	const uint64* NewlineBitmap;
+	int NextOffset;
+	int CapturedOffset;
+};
+
 /**
  * Manages plugin settings.
  */
@@ -58,6 +206,9 @@ public:
 	static constexpr int DefaultBytesPerRequest = 3 * 1024 * 1024;
 	static constexpr int MinBytesPerRequest = 1024 * 128;
 	static constexpr int MaxBytesPerRequest = 1024 * 1024 * 4;
+	static constexpr int DefaultMaxInFlightRequests = 1;
+	static constexpr int MinMaxInFlightRequests = 1;
+	static constexpr int MaxMaxInFlightRequests = 8;
 	static constexpr double DefaultProcessingIntervalSecs = 2.0;
 	static constexpr double MinProcessingIntervalSecs = 0.5;
 	static constexpr double DefaultRetryIntervalSecs = 30.0;
@@ -69,6 +220,42 @@ public:
 	static constexpr bool DefaultDebugLogRequests = false;
 	static constexpr bool DefaultAutoStart = true;
 	static constexpr bool DefaultAddRandomGameInstanceID = true;
+	static constexpr int DefaultMemoryCaptureBufferBytes = 16 * 1024 * 1024;
+	static constexpr int MinMemoryCaptureBufferBytes = 1024 * 1024;
+	static constexpr int MaxMemoryCaptureBufferBytes = 256 * 1024 * 1024;
+	static constexpr bool DefaultDropShippedFromPageCache = true;
+	static constexpr bool DefaultParseLogPrefix = false;
+	static constexpr double DefaultProgressJournalSyncIntervalSecs = 1.0;
+	static constexpr double MinProgressJournalSyncIntervalSecs = 0.0;
+	static constexpr double MaxProgressJournalSyncIntervalSecs = 60.0;
+	static constexpr int DefaultPayloadBuildThreads = 1;
+	static constexpr int MinPayloadBuildThreads = 1;
+	static constexpr int MaxPayloadBuildThreads = 16;
+	static constexpr int DefaultLZ4Acceleration = 1;
+	static constexpr int MinLZ4Acceleration = 1;
+	static constexpr int MaxLZ4Acceleration = 64;
+	static constexpr int DefaultDeflateLevel = 1;
+	static constexpr int MinDeflateLevel = 1;
+	static constexpr int MaxDeflateLevel = 9;
+	static constexpr int DefaultCompressionThreads = 4;
+	static constexpr int MinCompressionThreads = 1;
+	static constexpr int MaxCompressionThreads = 64;
+	static constexpr bool DefaultAdaptiveBatching = false;
+	static constexpr int64 DefaultMaxBacklogBytes = 0;
+	static constexpr int64 MinMaxBacklogBytes = 2 * MaxBytesPerRequest;
+	static constexpr int DefaultBacklogSampleKeepOneIn = 10;
+	static constexpr int MinBacklogSampleKeepOneIn = 2;
+	static constexpr int MaxBacklogSampleKeepOneIn = 1000;
+	static constexpr double DefaultCaptureFilterSummaryIntervalSecs = 60.0;
+	static constexpr double MinCaptureFilterSummaryIntervalSecs = 1.0;
+	static constexpr double MaxCaptureFilterSummaryIntervalSecs = 60.0 * 60.0;
+	static constexpr double DefaultRepeatSuppressionWindowSecs = 0.0;
+	static constexpr double MaxRepeatSuppressionWindowSecs = 60.0 * 60.0;
+	static constexpr int DefaultStressTestNumThreads = 1;
+	static constexpr int MaxStressTestNumThreads = 256;
+	static constexpr int DefaultStressTestMessageLen = 400;
+	static constexpr int MinStressTestMessageLen = 16;
+	static constexpr int MaxStressTestMessageLen = 32 * 1024;
 
 	/** The cloud region we want to send logs to, such as 'us' or 'eu' */
 	FString CloudRegion;
@@ -86,8 +273,15 @@ public:
 	double ActivationPercentage;
 	/** Desired maximum bytes to read and process at one time (one "chunk"). */
 	int32 BytesPerRequest;
+	/**
+	 * Maximum number of chunks that can be processed concurrently (e.g., HTTP requests in flight) when catching up on a backlog.
+	 * The streamer keeps this many below normal priority threads of its own to send and prepare chunks alongside its worker thread.
+	 */
+	int32 MaxInFlightRequests;
 	/** Desired seconds between attempts to read and process a chunk. */
 	double ProcessingIntervalSecs;
+	/** Whether to continually adjust the chunk size and processing interval (starting from BytesPerRequest and ProcessingIntervalSecs) based on the backlog and how requests are doing. */
+	bool AdaptiveBatching;
 	/** The amount of time to wait after a failed request before retrying. */
 	double RetryIntervalSecs;
 	/** Whether or not to include common metadata in each log event. */
@@ -98,13 +292,85 @@ public:
 	bool AutoStart;
 	/** The type of data compression to use on the log payload. */
 	ITLCompressionMode CompressionMode;
+	/** LZ4 acceleration factor for the lz4 modes. 1 gives the best ratio, higher values are faster with a lower ratio. */
+	int32 LZ4Acceleration;
+	/** zlib compression level for the gzip and deflate modes. 1 is the fastest (and usually plenty for log data), 9 gives the best ratio. */
+	int32 DeflateLevel;
+	/**
+	 * The most threads that compress the blocks of one payload in the lz4multiblock mode, as background priority tasks on the task graph
+	 * (the streamer thread is one of them). 1 compresses every block on the streamer thread. Raise it on build and cook machines, keep it low on clients.
+	 */
+	int32 CompressionThreads;
+	/** Path to a dictionary file trained with the SparkLogsTrainDictionary commandlet (relative to the project directory). Required by the lz4dict compression mode. */
+	FString CompressionDictionaryFile;
+	/** The dictionary loaded from CompressionDictionaryFile, if any. */
+	TSharedPtr<FsparklogsCompressionDictionary, ESPMode::ThreadSafe> CompressionDictionary;
 	/** Whether or not to automatically add a game_instance_id field with a random ID (set once at engine startup) */
 	bool AddRandomGameInstanceID;
+	/** How log output is captured before it is shipped (logfile on disk, or in-memory ring buffer). */
+	ITLCaptureMode CaptureMode;
+	/** How log events are laid out in a payload (array of events, or an envelope with the common metadata sent once). */
+	ITLPayloadFormat PayloadFormat;
+	/** Size of the in-memory ring buffer when CaptureMode is Memory or Records (rounded up to a power of two). */
+	int32 MemoryCaptureBufferBytes;
+	/** Whether to tell the OS to drop logfile data from the page cache once it has been shipped (Linux only). */
+	bool DropShippedFromPageCache;
+	/** Whether to parse the timestamp, frame number, category, and severity out of each log line into separate fields. */
+	bool ParseLogPrefix;
+	/**
+	 * Per-category rules applied to every log line before it is captured, e.g. "LogNet=Warning;200/s;burst=1000, LogSpam=off, *=on".
+	 * Each rule is Category=Option[;Option...], where an option is on, off, the most verbose verbosity to keep (e.g. Warning),
+	 * a rate limit in lines per second (e.g. 200/s), the token bucket size for the rate limit (e.g. burst=1000, defaults to one second of lines),
+	 * or a rate limit for one verbosity within the category (e.g. Log:50/s, which holds one second of lines), applied on top of the category one.
+	 * The * category applies to every category without its own rule (so "*=off" turns the other rules into an allow list). Empty captures everything.
+	 */
+	FString CaptureFilterRules;
+	/** Seconds between summary events that report how many lines the capture filter rules (or the backlog quota) dropped. */
+	double CaptureFilterSummaryIntervalSecs;
+	/** If non-zero, the most logfile data that can be waiting to be shipped (e.g., while the endpoint is down). BacklogDropPolicy decides what is dropped beyond that. */
+	int64 MaxBacklogBytes;
+	/** What is dropped once the backlog is over MaxBacklogBytes. */
+	ITLBacklogDropPolicy BacklogDropPolicy;
+	/** With the sample backlog drop policy, one in this many lines is captured while the backlog is over MaxBacklogBytes (and only Fatal lines past 125% of it). */
+	int32 BacklogSampleKeepOneIn;
+	/**
+	 * If non-zero, a line that exactly repeats one captured within this many seconds (same category, verbosity, and text) is not captured.
+	 * Instead, one event per window reports the text with its repeat_count and the first/last timestamps of the repeats.
+	 * Those fields are only parsed back out of the logfile while this is non-zero, otherwise lines are always shipped as written.
+	 */
+	double RepeatSuppressionWindowSecs;
+	/** Minimum seconds between syncing the progress journal to disk. 0 syncs after every flush. Progress since the last sync can be lost (and re-sent) on power loss, but not on a crash. */
+	double ProgressJournalSyncIntervalSecs;
+	/**
+	 * The most threads that escape and encode a chunk of the logfile in parallel. A large chunk is split at line boundaries into at most this
+	 * many segments, which are built as background priority tasks on the task graph and concatenated in order (the payload is exactly the same
+	 * as when it is built on one thread). The cap is on segments, so the streamer thread plus at most this many minus one task graph workers
+	 * are busy with one payload. 1 builds every payload on the streamer thread. Keep this low on clients so catching up on a backlog does
+	 * not compete with the game for cores. Not used with the LZ4Frame compression mode or structured record capture.
+	 */
+	int32 PayloadBuildThreads;
 
 	/** If non-zero, then will generate fake logs periodically */
 	double StressTestGenerateIntervalSecs;
-	/** The number of log entries to generate every generation interval. */
+	/** The number of log entries each stress test thread generates every generation interval. */
 	int StressTestNumEntriesPerTick;
+	/** The number of threads generating stress test log entries. */
+	int StressTestNumThreads;
+	/** Stress test messages are between this many and StressTestMaxMessageLen characters long. */
+	int StressTestMinMessageLen;
+	int StressTestMaxMessageLen;
+	/** 0 picks stress test message lengths uniformly. Higher values make short messages more common (length = min + (max - min) * U^(1 + skew)). */
+	double StressTestMessageLenSkew;
+	/** Fraction of stress test message characters that are non-ASCII. */
+	double StressTestUnicodeDensity;
+	/** Fraction of stress test message characters that have to be escaped in JSON (quotes, backslashes, control characters). */
+	double StressTestEscapeDensity;
+	/** If non-zero, every stress test thread generates StressTestBurstNumEntries extra entries at once this often (all threads burst at the same time). */
+	double StressTestBurstIntervalSecs;
+	int StressTestBurstNumEntries;
+	/** Comma separated log categories and verbosities that stress test entries are randomly logged with. */
+	FString StressTestCategories;
+	FString StressTestVerbosities;
 
 	FsparklogsSettings();
 
@@ -245,6 +511,10 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Bytes Per Request")
 	int32 ServerBytesPerRequest = FsparklogsSettings::DefaultBytesPerRequest;
 
+	// Maximum number of chunks (HTTP requests) that can be in flight at the same time while catching up on a backlog. Higher values help on high-latency links.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Max In-Flight Requests")
+	int32 ServerMaxInFlightRequests = FsparklogsSettings::DefaultMaxInFlightRequests;
+
 	// Target seconds between attempts to read and process a chunk.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Processing Interval in Seconds")
 	float ServerProcessingIntervalSecs = FsparklogsSettings::DefaultProcessingIntervalSecs;
@@ -257,10 +527,18 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Include Common Metadata")
 	bool ServerIncludeCommonMetadata = FsparklogsSettings::DefaultIncludeCommonMetadata;
 
-	// How to compress the payload. Use 'lz4' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload.
+	// How to compress the payload. Use 'lz4', 'lz4dict', 'lz4frame', 'lz4multiblock', 'gzip', 'deflate', or 'none'. Defaults to lz4 for the SparkLogs cloud and none for a custom HTTP endpoint. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. 'lz4dict' also needs CompressionDictionaryFile and a destination that has the same dictionary. 'lz4frame' compresses while the payload is built, using less memory. 'lz4multiblock' compresses large payloads in independent blocks on several cores. 'gzip' and 'deflate' are standard HTTP content encodings for custom HTTP endpoints. The SparkLogs cloud only accepts 'lz4' or 'none'; 'lz4dict', 'lz4frame' and 'lz4multiblock' fall back to 'lz4' there.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Compression Mode")
 	FString ServerCompressionMode;
 
+	// How to capture logs before shipping them. Use 'file', 'memory', or 'records'. Defaults to file. 'memory' captures into an in-memory ring buffer and skips the disk round-trip (the logfile is only used when the buffer overflows), but logs not yet shipped are lost if the process crashes. 'records' is like 'memory', but ships the timestamp, frame, thread ID, category, and severity of each message as separate fields, and keeps multi-line messages together.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Capture Mode")
+	FString ServerCaptureMode;
+
+	// How to lay out log events in each payload. Use 'array' or 'envelope'. Defaults to array. 'envelope' sends the common metadata (hostname, game name, additional attributes) once per payload instead of in every event, so the destination has to merge it back into each event. The SparkLogs cloud only accepts 'array'.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "Payload Format")
+	FString ServerPayloadFormat;
+
 	// For Debugging: Whether or not to log requests.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Server Launch Configuration", DisplayName = "DEBUG: Log All HTTP Request")
 	bool ServerDebugLogRequests = FsparklogsSettings::DefaultDebugLogRequests;
@@ -271,6 +549,10 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Bytes Per Request")
 	int32 EditorBytesPerRequest = FsparklogsSettings::DefaultBytesPerRequest;
 
+	// Maximum number of chunks (HTTP requests) that can be in flight at the same time while catching up on a backlog. Higher values help on high-latency links. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Max In-Flight Requests")
+	int32 EditorMaxInFlightRequests = FsparklogsSettings::DefaultMaxInFlightRequests;
+
 	// Target seconds between attempts to read and process a chunk. [EDITOR RESTART REQUIRED]
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Processing Interval in Seconds")
 	float EditorProcessingIntervalSecs = FsparklogsSettings::DefaultProcessingIntervalSecs;
@@ -283,10 +565,18 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Include Common Metadata")
 	bool EditorIncludeCommonMetadata = FsparklogsSettings::DefaultIncludeCommonMetadata;
 
-	// How to compress the payload. Use 'lz4' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. [EDITOR RESTART REQUIRED]
+	// How to compress the payload. Use 'lz4', 'lz4dict', 'lz4frame', 'lz4multiblock', 'gzip', 'deflate', or 'none'. Defaults to lz4 for the SparkLogs cloud and none for a custom HTTP endpoint. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. 'lz4dict' also needs CompressionDictionaryFile and a destination that has the same dictionary. 'lz4frame' compresses while the payload is built, using less memory. 'lz4multiblock' compresses large payloads in independent blocks on several cores. 'gzip' and 'deflate' are standard HTTP content encodings for custom HTTP endpoints. The SparkLogs cloud only accepts 'lz4' or 'none'; 'lz4dict', 'lz4frame' and 'lz4multiblock' fall back to 'lz4' there. [EDITOR RESTART REQUIRED]
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Compression Mode")
 	FString EditorCompressionMode;
 
+	// How to capture logs before shipping them. Use 'file', 'memory', or 'records'. Defaults to file. 'memory' captures into an in-memory ring buffer and skips the disk round-trip (the logfile is only used when the buffer overflows), but logs not yet shipped are lost if the process crashes. 'records' is like 'memory', but ships the timestamp, frame, thread ID, category, and severity of each message as separate fields, and keeps multi-line messages together. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Capture Mode")
+	FString EditorCaptureMode;
+
+	// How to lay out log events in each payload. Use 'array' or 'envelope'. Defaults to array. 'envelope' sends the common metadata (hostname, game name, additional attributes) once per payload instead of in every event, so the destination has to merge it back into each event. The SparkLogs cloud only accepts 'array'. [EDITOR RESTART REQUIRED]
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "Payload Format")
+	FString EditorPayloadFormat;
+
 	// For Debugging: Whether or not to log requests. [EDITOR RESTART REQUIRED]
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Editor Launch Configuration", Meta = (ConfigRestartRequired = true), DisplayName = "DEBUG: Log All HTTP Request")
 	bool EditorDebugLogRequests = FsparklogsSettings::DefaultDebugLogRequests;
@@ -297,6 +587,10 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Bytes Per Request")
 	int32 ClientBytesPerRequest = FsparklogsSettings::DefaultBytesPerRequest;
 
+	// Maximum number of chunks (HTTP requests) that can be in flight at the same time while catching up on a backlog. Higher values help on high-latency links.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Max In-Flight Requests")
+	int32 ClientMaxInFlightRequests = FsparklogsSettings::DefaultMaxInFlightRequests;
+
 	// Target seconds between attempts to read and process a chunk.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Processing Interval in Seconds")
 	float ClientProcessingIntervalSecs = FsparklogsSettings::DefaultProcessingIntervalSecs;
@@ -309,10 +603,18 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Include Common Metadata")
 	bool ClientIncludeCommonMetadata = FsparklogsSettings::DefaultIncludeCommonMetadata;
 
-	// How to compress the payload. Use 'lz4' or 'none'. Defaults to lz4. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload.
+	// How to compress the payload. Use 'lz4', 'lz4dict', 'lz4frame', 'lz4multiblock', 'gzip', 'deflate', or 'none'. Defaults to lz4 for the SparkLogs cloud and none for a custom HTTP endpoint. 'lz4' is normally more CPU efficient as it reduces the size of the TLS payload. 'lz4dict' also needs CompressionDictionaryFile and a destination that has the same dictionary. 'lz4frame' compresses while the payload is built, using less memory. 'lz4multiblock' compresses large payloads in independent blocks on several cores. 'gzip' and 'deflate' are standard HTTP content encodings for custom HTTP endpoints. The SparkLogs cloud only accepts 'lz4' or 'none'; 'lz4dict', 'lz4frame' and 'lz4multiblock' fall back to 'lz4' there.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Compression Mode")
 	FString ClientCompressionMode;
 
+	// How to capture logs before shipping them. Use 'file', 'memory', or 'records'. Defaults to file. 'memory' captures into an in-memory ring buffer and skips the disk round-trip (the logfile is only used when the buffer overflows), but logs not yet shipped are lost if the process crashes. 'records' is like 'memory', but ships the timestamp, frame, thread ID, category, and severity of each message as separate fields, and keeps multi-line messages together.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Capture Mode")
+	FString ClientCaptureMode;
+
+	// How to lay out log events in each payload. Use 'array' or 'envelope'. Defaults to array. 'envelope' sends the common metadata (hostname, game name, additional attributes) once per payload instead of in every event, so the destination has to merge it back into each event. The SparkLogs cloud only accepts 'array'.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "Payload Format")
+	FString ClientPayloadFormat;
+
 	// For Debugging: Whether or not to log requests.
 	UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "Advanced Settings In Client Launch Configuration", DisplayName = "DEBUG: Log All HTTP Request")
 	bool ClientDebugLogRequests = FsparklogsSettings::DefaultDebugLogRequests;
@@ -320,6 +622,41 @@ public:
 
 class SPARKLOGS_API FsparklogsReadAndStreamToCloud;
 
+/** A reference counted payload buffer, so a payload can be handed to the HTTP layer without copying it. */
+using FsparklogsPayloadBufferRef = TSharedRef<TArray<uint8>, ESPMode::ThreadSafe>;
+
+/**
+ * Payload buffers that are reused from one flush to the next, so a steady stream of payloads does not allocate. A buffer is only
+ * handed out again once nothing else references it, e.g. an HTTP request that was given up on after a timeout but is still sending it.
+ */
+class SPARKLOGS_API FsparklogsPayloadBufferPool
+{
+public:
+	/** Keeps up to MaxPooled buffers around. More can be handed out, but they are freed once they are no longer referenced. */
+	explicit FsparklogsPayloadBufferPool(int32 InMaxPooled);
+	/** Returns an empty buffer with room for at least Capacity bytes, that nothing else references. Thread safe. */
+	FsparklogsPayloadBufferRef Acquire(int32 Capacity);
+	/**
+	 * The number of times a buffer had to be allocated or grown. A buffer that grows while it is handed out is counted when it is
+	 * acquired again. Stays the same once payload sizes are steady.
+	 */
+	int64 GetNumAllocations() const;
+	int32 GetNumPooled() const;
+
+protected:
+	struct FEntry
+	{
+		FsparklogsPayloadBufferRef Buffer;
+		/** The allocated size of the buffer when it was last handed out. */
+		SIZE_T AllocatedSize;
+	};
+
+	mutable FCriticalSection Lock;
+	TArray<FEntry> Entries;
+	int32 MaxPooled;
+	int64 NumAllocations;
+};
+
 /**
  * An interface that takes a (potentially compressed) JSON log payload from the WORKER thread of the streamer, and processes it.
  */
@@ -327,8 +664,11 @@ class SPARKLOGS_API IsparklogsPayloadProcessor
 {
 public:
 	virtual ~IsparklogsPayloadProcessor() = default;
-	/** Processes the JSON payload, and returns true on success or false on failure. */
-	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) = 0;
+	/**
+	 * Processes the JSON payload, and returns true on success or false on failure. Can be called from several threads at once when MaxInFlightRequests > 1.
+	 * The streamer does not write to the payload buffer again while a reference to it is held, so it can be kept past the return without a copy.
+	 */
+	virtual bool ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) = 0;
 };
 
 /** A payload processor that writes the data to a local file (for DEBUG purposes only). */
@@ -336,9 +676,11 @@ class SPARKLOGS_API FsparklogsWriteNDJSONPayloadProcessor : public IsparklogsPay
 {
 protected:
 	FString OutputFilePath;
+	/** Concurrent payloads are appended one at a time */
+	FCriticalSection WriteLock;
 public:
 	FsparklogsWriteNDJSONPayloadProcessor(FString InOutputFilePath);
-	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override;
+	virtual bool ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override;
 };
 
 /** A payload processor that synchronously POSTs the data to an HTTP(S) endpoint. */
@@ -349,44 +691,674 @@ protected:
 	FString AuthorizationHeader;
 	FThreadSafeCounter TimeoutMillisec;
 	bool LogRequests;
+	/** Header values that rarely change are formatted once and reused for every request. */
+	FCriticalSection HeaderCacheLock;
+	int32 CachedTimezoneOffsetMinutes;
+	FString CachedTimezoneHeaderValue;
+	uint32 CachedDictionaryId;
+	FString CachedDictionaryIdHeaderValue;
 public:
 	FsparklogsWriteHTTPPayloadProcessor(const TCHAR* InEndpointURI, const TCHAR* InAuthorizationHeader, double InTimeoutSecs, bool InLogRequests);
-	virtual bool ProcessPayload(TArray<uint8>& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override;
+	virtual bool ProcessPayload(const FsparklogsPayloadBufferRef& JSONPayloadInUTF8, int PayloadLen, int OriginalPayloadLen, ITLCompressionMode CompressionMode, FsparklogsReadAndStreamToCloud* Streamer) override;
 	void SetTimeoutSecs(double InTimeoutSecs);
 
 protected:
 	/** Sets an HTTP header to communicate proper timezone information */
 	void SetHTTPTimezoneHeader(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest);
 	/** Wait for the HTTP request to complete. Returns false on timeout or true if the request completed. */
-	bool SleepWaitingForHTTPRequest(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest, FThreadSafeBool& RequestEnded, FThreadSafeBool& RequestSucceeded, FThreadSafeBool& RetryableFailure, double StartTime);
+	bool SleepWaitingForHTTPRequest(TSharedRef<IHttpRequest, ESPMode::ThreadSafe> HttpRequest, FEvent* RequestEndedEvent, FThreadSafeBool& RequestEnded, FThreadSafeBool& RequestSucceeded, FThreadSafeBool& RetryableFailure, double StartTime);
 };
 
 using TITLJSONStringBuilder = TAnsiStringBuilder<4 * 1024>;
 
 /**
- * Background thread that generates fake log entries to stress the logging system.
+ * Appends N bytes of UTF-8 data as a quoted and escaped JSON string. Runs of bytes that need no escaping are found with SIMD
+ * (16 bytes at a time) and appended in bulk. If ForceScalar is true, every byte is processed one at a time instead (reference implementation).
+ */
+SPARKLOGS_API void ITLAppendUTF8AsEscapedJsonString(TITLJSONStringBuilder& Builder, const ANSICHAR* String, int N, bool ForceScalar = false);
+
+/** The parts of a UE log line prefix, as offsets into the line (nothing is copied). A length of 0 means the part is not present. */
+struct FsparklogsLogLinePrefix
+{
+	/** Start of the 23 character timestamp, as in `2025.01.01-00.00.00:000`. */
+	int TimestampOffset = 0;
+	int TimestampLen = 0;
+	/** Frame number digits (the engine pads them with spaces, which are not included, and leading zeros are skipped). */
+	int FrameOffset = 0;
+	int FrameLen = 0;
+	int CategoryOffset = 0;
+	int CategoryLen = 0;
+	/** Verbosity name. Not present for Log verbosity, which the engine does not write out. */
+	int SeverityOffset = 0;
+	int SeverityLen = 0;
+	/** Where the message text starts after the prefix. */
+	int MessageOffset = 0;
+};
+
+/**
+ * Scans the prefix the engine writes in front of each log line, e.g. `[2025.01.01-00.00.00:000][123]LogNet: Warning: ...`.
+ * Returns false (and the line should be shipped as-is) unless the line starts with a timestamp and frame number.
+ * The category and severity are optional since not every line has them.
+ */
+SPARKLOGS_API bool ITLParseLogLinePrefix(const ANSICHAR* Line, int Len, FsparklogsLogLinePrefix& OutPrefix);
+/**
+ * Appends the JSON fields for one log line (without the surrounding braces). If the line has a UE log line prefix, it is turned into
+ * `"timestamp"` (ISO 8601, e.g. `2025-01-01T00:00:00.000`), `"frame"`, `"category"` and `"severity"` fields followed by the rest of the line
+ * as `"message"`. Otherwise the whole line is the message.
+ */
+SPARKLOGS_API void ITLAppendLogLineAsParsedJsonFields(TITLJSONStringBuilder& Builder, const ANSICHAR* Line, int Len);
+
+/**
+ * The suffix FsparklogsCaptureFilterDevice adds to the text of a suppressed line to report its repeats, as offsets into the line, e.g.
+ * `Connection lost [repeat_count=42 first=2025-01-01T00:00:00.000Z last=2025-01-01T00:00:09.000Z]`.
+ */
+struct FsparklogsRepeatSuffix
+{
+	/** Where the suffix starts, which is also the length of the text before it. */
+	int SuffixOffset = 0;
+	int64 RepeatCount = 0;
+	/** Start of the 24 character ISO 8601 UTC timestamps of the first and last repeat. */
+	int FirstTimestampOffset = 0;
+	int LastTimestampOffset = 0;
+};
+
+/** Returns true if the line ends with a repeat suffix. Only looks past the last byte of the line if that is a ']'. */
+SPARKLOGS_API bool ITLParseRepeatSuffix(const ANSICHAR* Line, int Len, FsparklogsRepeatSuffix& OutSuffix);
+/** Appends `,"repeat_count":N,"first_timestamp":"...","last_timestamp":"..."` for a parsed repeat suffix. */
+SPARKLOGS_API void ITLAppendRepeatSuffixAsJsonFields(TITLJSONStringBuilder& Builder, const ANSICHAR* Line, const FsparklogsRepeatSuffix& Suffix);
+
+/**
+ * Incrementally encodes data as an LZ4 frame with linked blocks, so a payload can be compressed while it is being built
+ * instead of in a second pass over the complete payload. Data is appended to a small staging block; once it holds BlockSize bytes
+ * it is compressed and the next block is staged in a second buffer, which keeps the previous block in place as history for matches.
+ */
+class SPARKLOGS_API FsparklogsLZ4FrameEncoder
+{
+public:
+	/** Size of each staged block. Small enough to stay in cache, large enough to give LZ4 a full 64 KB window. */
+	static constexpr int32 BlockSize = 64 * 1024;
+
+	FsparklogsLZ4FrameEncoder();
+	FsparklogsLZ4FrameEncoder(const FsparklogsLZ4FrameEncoder&) = delete;
+	FsparklogsLZ4FrameEncoder& operator=(const FsparklogsLZ4FrameEncoder&) = delete;
+
+	/** Starts a new frame by replacing the contents of OutData with the frame header. OutData must stay valid until Finish. */
+	void Begin(TArray<uint8>& OutData, int32 InAcceleration);
+	/** The builder to append data to. Can change after every call to EndAppend, so do not hold on to it. */
+	TITLJSONStringBuilder& GetStaging() { return Staging[CurrentStaging]; }
+	/** Call after appending to GetStaging(). Compresses the staged block once it is full. Returns false on failure. */
+	bool EndAppend() { return Staging[CurrentStaging].Len() < BlockSize || CompressStaging(); }
+	/** Appends a buffer of data, compressing blocks as they fill up. */
+	bool Append(const uint8* Data, int Len);
+	/** Compresses whatever is still staged and writes the end mark. Returns false on failure. */
+	bool Finish();
+	/** The number of uncompressed bytes appended to the frame so far. */
+	int64 GetOriginalLen() const { return OriginalLen; }
+
+protected:
+	bool CompressStaging();
+
+	TITLJSONStringBuilder Staging[2];
+	int CurrentStaging;
+	TArray<uint8>* Out;
+	/** Opaque LZ4 stream state. */
+	TArray<uint8> LZ4Stream;
+	int32 Acceleration;
+	int64 OriginalLen;
+};
+
+struct z_stream_s;
+
+/** zlib deflate state for the gzip and deflate modes, which is reset for each payload instead of being set up (and allocated) again. */
+class SPARKLOGS_API FsparklogsDeflateStream
+{
+public:
+	FsparklogsDeflateStream();
+	~FsparklogsDeflateStream();
+	FsparklogsDeflateStream(const FsparklogsDeflateStream&) = delete;
+	FsparklogsDeflateStream& operator=(const FsparklogsDeflateStream&) = delete;
+
+	/** Replaces the contents of OutData with all of InData compressed in the Gzip or Deflate mode. Returns false on failure. */
+	bool Compress(ITLCompressionMode Mode, int32 Level, const uint8* InData, int InDataLen, TArray<uint8>& OutData);
+
+protected:
+	/** Null until the first payload. Set up for StreamMode and StreamLevel. */
+	TUniquePtr<z_stream_s> Stream;
+	ITLCompressionMode StreamMode;
+	int32 StreamLevel;
+};
+
+/**
+ * Reads newly appended data from a logfile that another device is still writing to.
+ * On Linux a single descriptor stays open for the life of the reader: each refresh costs a single stat of the path,
+ * and reads use pread, so there is no open/seek per flush. Rotation is detected by file identity (device and inode), which also
+ * catches a replacement file that happens to be the same size. Shipped ranges can optionally be dropped from the page cache.
+ * Other platforms re-open the file on every refresh and can only detect rotation when the file shrinks.
+ */
+class SPARKLOGS_API FsparklogsLogFileReader
+{
+protected:
+	FString Path;
+	bool DropShippedFromPageCache;
+#if PLATFORM_LINUX
+	/** Path as a null terminated native (UTF-8) string, converted once rather than on every refresh. */
+	TArray<ANSICHAR> NativePath;
+	int32 Fd;
+	uint64 FileDevice;
+	uint64 FileInode;
+	/** Offset up to which the page cache has already been told to drop the data. */
+	int64 DroppedCacheOffset;
+	/** Offset up to which the disk space has already been freed. */
+	int64 DiscardedOffset;
+#else
+	TUniquePtr<IFileHandle> Handle;
+#endif
+
+public:
+	FsparklogsLogFileReader(const TCHAR* InPath, bool InDropShippedFromPageCache);
+	~FsparklogsLogFileReader();
+
+	/**
+	 * Picks up the current state of the logfile. OutExists is false if there is no logfile (yet). OutReplaced is true if the file
+	 * at the path is no longer the one previously read from, in which case all offsets start over at zero. Returns false on failure.
+	 */
+	bool Refresh(bool& OutExists, bool& OutReplaced, int64& OutSize);
+	/** Reads exactly Len bytes at Offset. Only valid after a successful Refresh that found the file. Returns false on failure. */
+	bool ReadAt(int64 Offset, uint8* Dest, int64 Len);
+	/** Called once the caller is done reading for now. Platforms without a persistent descriptor close the file here. */
+	void FinishRead();
+	/** Data before ToOffset has been shipped and will not be read again. */
+	void ReleaseShipped(int64 ToOffset);
+	/** Data before ToOffset will never be read again, so free its disk space where supported (see CanDiscard). The file keeps its size so offsets stay valid. */
+	void DiscardBefore(int64 ToOffset);
+	/**
+	 * Whether DiscardBefore frees disk space on this platform. Only Linux can (by punching a hole in the file). On Windows the engine's log writer
+	 * does not share write access, which zeroing a range of a sparse file needs, and other platforms have no way to do it at all.
+	 */
+	static bool CanDiscard();
+	void Close();
+	/** Gets the identity (device and inode) of the file currently being read. Returns false if unknown (or not supported on this platform). */
+	bool GetFileIdentity(uint64& OutDevice, uint64& OutInode) const;
+	/** Gets the identity (device and inode) of the file at a path. Returns false if there is no such file (or not supported on this platform). */
+	static bool GetPathIdentity(const FString& InPath, uint64& OutDevice, uint64& OutInode);
+};
+
+/**
+ * Crash-safe binary record of how far a logfile has been shipped. The journal holds two fixed-size records, each with a sequence number
+ * and CRC, which are overwritten alternately so that a torn write can only ever damage the older one. Records are written in place
+ * (pwrite on Linux) with no temporary files or config system involved, and only synced to disk every SyncIntervalSecs.
+ */
+class SPARKLOGS_API FsparklogsProgressJournal
+{
+public:
+	struct FRecord
+	{
+		/** The logfile offset up to which everything has been shipped. */
+		int64 Offset = 0;
+		/** Identity of the logfile the offset applies to. Both are zero if unknown. */
+		uint64 FileDevice = 0;
+		uint64 FileInode = 0;
+		/** Incremented for every record written. The intact record with the highest sequence number wins. */
+		uint64 Sequence = 0;
+	};
+
+	static constexpr uint32 RecordMagic = 0x4A4C5449;
+	static constexpr uint16 RecordVersion = 1;
+	static constexpr int32 RecordSize = 64;
+
+protected:
+	FString Path;
+	double SyncIntervalSecs;
+	/** Sequence number of the newest record in the journal. Only valid once the journal is open for writing. */
+	uint64 LastSequence;
+	double LastSyncPlatformTime;
+	/** Whether a record was written since the last sync. */
+	bool NeedsSync;
+#if PLATFORM_LINUX
+	int32 Fd;
+#else
+	TUniquePtr<IFileHandle> Handle;
+#endif
+
+	bool IsOpen() const;
+	bool Open();
+	bool WriteAt(int64 FileOffset, const uint8* Data, int32 Len);
+	bool Sync();
+
+public:
+	FsparklogsProgressJournal(const TCHAR* InPath, double InSyncIntervalSecs);
+	~FsparklogsProgressJournal();
+
+	/** Reads the newest intact record. Returns false if there is no journal or neither record is intact. */
+	bool Read(FRecord& OutRecord) const;
+	/** Writes a new record over the older of the two. Returns false on failure. */
+	bool Write(int64 Offset, uint64 FileDevice, uint64 FileInode);
+	/** Syncs the last record to disk if needed and closes the journal. */
+	void Close();
+	/** Closes and deletes the journal. */
+	void Delete();
+
+	static void EncodeRecord(const FRecord& Record, uint8* OutBytes);
+	/** Returns false if the bytes do not hold an intact record. */
+	static bool DecodeRecord(const uint8* Bytes, FRecord& OutRecord);
+};
+
+/**
+ * Output device that captures formatted log lines (in UTF-8) into a bounded multi-producer, single-consumer ring buffer,
+ * which a FsparklogsReadAndStreamToCloud drains directly without a round-trip through the disk.
+ * Producers reserve space with a compare-and-swap and never take a lock, or wait on each other: each one publishes its own bytes, and the
+ * consumer only sees data up to the first block that still has a write in progress. Lines that do not fit are forwarded to the spill device (if any).
+ */
+class SPARKLOGS_API FsparklogsMemoryCaptureDevice : public FOutputDevice
+{
+protected:
+	/** Storage for the ring buffer. Size is always a power of two. */
+	TArray<uint8> Ring;
+	int64 RingMask;
+	/** Stream position up to which producers have reserved space. */
+	volatile int64 ReservePos;
+	/** [CONSUMER] Stream position up to which data is known to be fully written. Advanced by the consumer in GetWritePosition. */
+	mutable volatile int64 CommitPos;
+	/** Stream position before which the consumer no longer needs the data. */
+	volatile int64 ReleasePos;
+	/** Size of the blocks of the ring that writes are published in. A power of two, no larger than the ring. */
+	int64 CommitBlockSize;
+	/**
+	 * For each block of the ring, the number of bytes written into it so far during the current pass over the ring. Once that matches
+	 * what has been reserved in the block, everything in it is written. Reset by the consumer once a block is full and committed.
+	 * There are two counters per block, for even and odd passes, since writes of the next pass can start once the start of the block is released.
+	 */
+	mutable TArray<int32> CommitBlockBytes;
+	/** Receives log lines that do not fit in the ring buffer. Can be null. */
+	FOutputDevice* SpillDevice;
+	/** The number of UTF-8 bytes forwarded to the spill device (or dropped if there is none) because the buffer was full. */
+	FThreadSafeCounter64 NumSpilledBytes;
+	/** Triggered when the amount of unreleased data crosses DataAvailableThreshold. Can be null. */
+	std::atomic<FEvent*> DataAvailableEvent;
+	int64 DataAvailableThreshold;
+	/** Whether messages are captured as binary records (see FRecord) instead of formatted text lines. */
+	bool StructuredRecords;
+	/** Categories seen so far in structured records, indexed by their ID. */
+	TArray<FName> Categories;
+	/** Each category name as a quoted and escaped UTF-8 JSON string, indexed by ID. */
+	TArray<TArray<uint8>> CategoryJsonStrings;
+	TMap<FName, uint16> CategoryIds;
+	mutable FRWLock CategoryLock;
+
+	/** [PRODUCER] Appends Len1 bytes of Data1 followed by Len2 bytes of Data2 as one contiguous write. Returns false (and appends nothing) if it does not fit. */
+	bool Write(const uint8* Data1, int32 Len1, const uint8* Data2, int32 Len2);
+	/** Index in CommitBlockBytes of the counter for the block holding stream position Pos. */
+	int32 GetCommitBlockIndex(int64 Pos) const { return (int32)(2 * ((Pos & RingMask) / CommitBlockSize) + ((Pos / Ring.Num()) & 1)); }
+	/** [PRODUCER] Returns the ID of a category, assigning the next one the first time the category is seen. */
+	uint16 InternCategory(const FName& Category);
+
+public:
+	/**
+	 * A structured capture record as it is laid out in the ring buffer: a fixed size header followed by the UTF-8 message.
+	 * Header: total record length (uint32), verbosity (uint8), unused (uint8), category ID (uint16), thread ID (uint32), unused (uint32),
+	 * Time as passed to Serialize (double), UTC wall clock time in milliseconds since the Unix epoch (int64), frame number (uint64).
+	 */
+	struct FRecord
+	{
+		int32 Len = 0;
+		ELogVerbosity::Type Verbosity = ELogVerbosity::Log;
+		uint16 CategoryId = 0;
+		uint32 ThreadId = 0;
+		double Time = -1.0;
+		int64 UnixTimeMillis = 0;
+		uint64 Frame = 0;
+		const uint8* Message = nullptr;
+		int32 MessageLen = 0;
+	};
+	static constexpr int32 RecordHeaderSize = 40;
+	/** Longer messages are split into several records, the same way long lines are split when reading from a logfile. */
+	static constexpr int32 MaxRecordMessageBytes = 16 * 1024;
+	/** Category ID used once all other IDs are taken. */
+	static constexpr uint16 OverflowCategoryId = 0xFFFF;
+
+	FsparklogsMemoryCaptureDevice(int32 InCapacity, FOutputDevice* InSpillDevice, bool InStructuredRecords = false);
+
+	//~ Begin FOutputDevice Interface
+	virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category) override;
+	virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category, const double Time) override;
+	virtual bool CanBeUsedOnAnyThread() const override { return true; }
+	virtual bool CanBeUsedOnMultipleThreads() const override { return true; }
+	//~ End FOutputDevice Interface
+
+	/** [PRODUCER] Appends already formatted UTF-8 data. Returns false (and appends nothing) if it does not fit. */
+	bool Write(const uint8* Data, int32 Len);
+	/** [CONSUMER] Returns the stream position just past the last fully written byte. */
+	int64 GetWritePosition() const;
+	/** [CONSUMER] Copies up to MaxLen bytes starting at stream position FromPos, which must not have been released. Returns the number of bytes copied. */
+	int32 Peek(int64 FromPos, uint8* Dest, int32 MaxLen) const;
+	/** [CONSUMER] Releases all data before stream position ToPos so producers can reuse the space. */
+	void Release(int64 ToPos);
+	/** Forwards all data that has not been released yet to the spill device. Only call once producers and the consumer have stopped. */
+	void SpillUnreleased();
+	/**
+	 * [CONSUMER] Triggers InEvent whenever a write makes the amount of unreleased data reach ThresholdBytes, so the consumer can
+	 * sleep until there is enough to do instead of polling. Only triggers once per crossing. Pass null to stop signaling.
+	 */
+	void SetDataAvailableEvent(FEvent* InEvent, int64 ThresholdBytes);
+
+	int32 GetCapacity() const { return Ring.Num(); }
+	int64 GetNumSpilledBytes() const { return NumSpilledBytes.GetValue(); }
+	bool IsStructured() const { return StructuredRecords; }
+	/** Returns the name of a category interned by a structured record, or NAME_None if the ID is unknown. */
+	FName GetCategoryName(uint16 CategoryId) const;
+	/** Appends the name of a category interned by a structured record as a JSON string. */
+	void AppendCategoryAsJsonString(TITLJSONStringBuilder& Builder, uint16 CategoryId) const;
+
+	/** Writes the header of a structured record to Dest (RecordHeaderSize bytes). */
+	static void EncodeRecordHeader(const FRecord& Record, uint8* Dest);
+	/** Decodes the structured record at the start of Data. Returns false if Data does not hold a complete record. */
+	static bool DecodeRecord(const uint8* Data, int32 Len, FRecord& OutRecord);
+};
+
+/**
+ * Output device that drops log lines before they are captured according to per-category rules (allow/deny, maximum verbosity,
+ * and token bucket rate limits for the category and for each verbosity within it), and forwards the rest to the capture device.
+ * Fatal lines are never dropped. Looking up the state of a category that has been logged before takes no locks.
+ * Dropped lines are counted per category and reported periodically as a summary event sent to the capture device.
+ * Optionally also suppresses exact repeats of recent lines, tracked in a fixed-size table so that a storm of repeats costs no allocations.
+ */
+class SPARKLOGS_API FsparklogsCaptureFilterDevice : public FOutputDevice
+{
+public:
+	static constexpr int32 NumRepeatSlots = 256;
+	/** Longer lines are never treated as repeats, which bounds the size of the table. */
+	static constexpr int32 MaxRepeatTextLen = 512;
+
+	struct FRule
+	{
+		bool Deny = false;
+		/** The most verbose verbosity that is kept. */
+		ELogVerbosity::Type MaxVerbosity = ELogVerbosity::All;
+		/** Token bucket refill rate. 0 means no rate limit. */
+		double LinesPerSec = 0.0;
+		/** Token bucket size. 0 means one second of lines. */
+		double BurstLines = 0.0;
+		/** Token bucket refill rate for each verbosity on top of the category one (the bucket holds one second of lines). 0 means no rate limit. */
+		double VerbosityLinesPerSec[ELogVerbosity::NumVerbosity] = {};
+	};
+
+	/** Categories whose state can be found without taking a lock. Any more are found in CategoryStates under a read lock. */
+	static constexpr int32 NumCategoryLookupSlots = 1024;
+	static constexpr int32 MaxCategoryLookupProbes = 8;
+
+protected:
+	/**
+	 * Lock-free token bucket, tracked as the time at which the bucket will be full again (the generic cell rate algorithm).
+	 * Taking a token moves that time one interval later, and fails if it would be more than the burst ahead of now.
+	 */
+	struct FTokenBucket
+	{
+		/** Cycles per line. 0 means no rate limit. */
+		uint64 IntervalCycles = 0;
+		/** Cycles of lines the bucket holds. */
+		uint64 BurstCycles = 0;
+		std::atomic<uint64> FullAtCycles { 0 };
+
+		void Init(double LinesPerSec, double BurstLines);
+		bool IsLimited() const { return IntervalCycles > 0; }
+		bool TryTake(uint64 NowCycles);
+	};
+
+	/** Filter state for one category. Created the first time the category is logged, and never destroyed. */
+	struct FCategoryState
+	{
+		FName Category;
+		FRule Rule;
+		FTokenBucket Bucket;
+		FTokenBucket VerbosityBuckets[ELogVerbosity::NumVerbosity];
+		/** Lines dropped since the last summary. */
+		FThreadSafeCounter64 NumDropped;
+	};
+
+	FOutputDevice* InnerDevice;
+	FRule DefaultRule;
+	TMap<FName, FRule> Rules;
+	/** Owns the state of every category, for summaries and for categories that did not fit in CategoryLookup. */
+	TMap<FName, TUniquePtr<FCategoryState>> CategoryStates;
+	mutable FRWLock CategoryStatesLock;
+	/** Open addressed by the hash of the category name. Slots are only ever filled in (under the write lock), so readers need no lock. */
+	std::atomic<FCategoryState*> CategoryLookup[NumCategoryLookupSlots];
+	uint64 SummaryIntervalCycles;
+	std::atomic<uint64> NextSummaryCycles;
+	FCriticalSection SummaryLock;
+	/** Lines dropped since the last summary, across all categories. */
+	FThreadSafeCounter64 NumDroppedSinceSummary;
+	FThreadSafeCounter64 NumDroppedBytesSinceSummary;
+	FThreadSafeCounter64 NumBacklogDroppedSinceSummary;
+	FThreadSafeCounter64 NumDroppedTotal;
+	/** Backlog quota for the logfile the inner device writes. 0 means there is none. */
+	int64 MaxBacklogBytes;
+	ITLBacklogDropPolicy BacklogDropPolicy;
+	int32 BacklogSampleKeepOneIn;
+	FString BacklogFilePath;
+	/** The streamer that ships BacklogFilePath, which knows how much of it has been shipped. Can be null. */
+	std::atomic<const FsparklogsReadAndStreamToCloud*> BacklogSource;
+	/** The backlog as of the last check, which happens at most once a second. */
+	std::atomic<int64> BacklogBytes;
+	std::atomic<uint64> NextBacklogCheckCycles;
+	FThreadSafeCounter64 SampleCounter;
+
+	/** A recently captured line. Lines hash to one slot, and a different line that hashes to an occupied slot evicts it. */
+	struct FRepeatSlot
+	{
+		FCriticalSection Lock;
+		uint32 Hash = 0;
+		FName Category;
+		ELogVerbosity::Type Verbosity = ELogVerbosity::Log;
+		/** 0 means the slot is empty. */
+		int32 TextLen = 0;
+		double WindowStartSecs = 0.0;
+		/** Repeats suppressed in the current window, and when the first and last of them were logged. */
+		int64 NumSuppressed = 0;
+		FDateTime FirstSuppressed;
+		FDateTime LastSuppressed;
+		TCHAR Text[MaxRepeatTextLen];
+	};
+	/** Seconds a captured line suppresses its repeats for. 0 means repeats are not suppressed. */
+	double RepeatWindowSecs;
+	/** NumRepeatSlots slots, allocated once when repeat suppression is turned on. */
+	TUniquePtr<FRepeatSlot[]> RepeatSlots;
+	std::atomic<uint64> NextRepeatSweepCycles;
+	FThreadSafeCounter64 NumRepeatsSuppressed;
+
+	FCategoryState& GetCategoryState(const FName& Category);
+	/** Returns true if the backlog quota allows capturing a line that passed the rules. */
+	bool ShouldCaptureWithinBacklogQuota(ELogVerbosity::Type Verbosity);
+	/** Returns true if the line repeats one captured within the window, and should not be captured. Sends repeat summaries that are due to the capture device. */
+	bool SuppressRepeat(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category);
+	/** Returns the text of the event that reports the suppressed repeats of a slot, and resets its count. The slot must be locked. */
+	static FString TakeRepeatSummary(FRepeatSlot& Slot);
+
+public:
+	FsparklogsCaptureFilterDevice(FOutputDevice* InInnerDevice, const FString& InRules, double SummaryIntervalSecs);
+
+	/** Parses rules in the format of FsparklogsSettings::CaptureFilterRules, warning about (and skipping) anything invalid. Returns false if there are no rules. */
+	static bool ParseRules(const FString& InRules, FRule& OutDefaultRule, TMap<FName, FRule>& OutRules);
+
+	//~ Begin FOutputDevice Interface
+	virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category) override;
+	virtual void Serialize(const TCHAR* V, ELogVerbosity::Type Verbosity, const FName& Category, const double Time) override;
+	virtual void Flush() override;
+	virtual bool CanBeUsedOnAnyThread() const override { return InnerDevice->CanBeUsedOnAnyThread(); }
+	virtual bool CanBeUsedOnMultipleThreads() const override { return InnerDevice->CanBeUsedOnMultipleThreads(); }
+	//~ End FOutputDevice Interface
+
+	/** Returns true if a line should be captured, or counts it as dropped and returns false. */
+	bool ShouldCapture(ELogVerbosity::Type Verbosity, const FName& Category);
+	/** Sends a summary of the lines dropped since the last summary (if any) to the capture device. */
+	void EmitDroppedSummary();
+	/** Applies a backlog quota to the logfile at InBacklogFilePath (written by the inner device). Only call before the device is in use. */
+	void SetBacklogQuota(int64 InMaxBacklogBytes, ITLBacklogDropPolicy InBacklogDropPolicy, int32 InBacklogSampleKeepOneIn, const FString& InBacklogFilePath);
+	/** Sets the streamer that ships the logfile the backlog quota applies to. Set to null before the streamer is destroyed. */
+	void SetBacklogSource(const FsparklogsReadAndStreamToCloud* Source);
+	/** Measures the backlog now instead of waiting for the next periodic check, and returns it. */
+	int64 RefreshBacklogBytes();
+	/** Turns on suppressing repeats of a line for InRepeatWindowSecs after it is captured. Only call before the device is in use. */
+	void SetRepeatSuppression(double InRepeatWindowSecs);
+	/** Sends the repeat summaries whose window has ended (or all of them if Force) to the capture device. */
+	void EmitRepeatSummaries(bool Force);
+	int64 GetNumRepeatsSuppressed() const { return NumRepeatsSuppressed.GetValue(); }
+	FOutputDevice* GetInnerDevice() const { return InnerDevice; }
+	int64 GetNumDropped() const { return NumDroppedTotal.GetValue(); }
+};
+
+/** Histogram of call latencies in power-of-two nanosecond buckets. Recording is lock-free, but expects a single thread to record into it. */
+class SPARKLOGS_API FsparklogsLatencyHistogram
+{
+public:
+	/** Bucket i holds latencies in [2^i, 2^(i+1)) nanoseconds. The last bucket has no upper bound. */
+	static constexpr int32 NumBuckets = 40;
+
+	FThreadSafeCounter64 Buckets[NumBuckets];
+	FThreadSafeCounter64 Count;
+	FThreadSafeCounter64 TotalNanos;
+	std::atomic<int64> MaxNanos;
+
+	FsparklogsLatencyHistogram();
+
+	void Record(int64 Nanos);
+	void Merge(const FsparklogsLatencyHistogram& Other);
+	void Reset();
+	/** The upper bound (in microseconds) of the bucket that Percentile (0-100) of calls completed within, or 0 if there were none. */
+	double GetPercentileMicros(double Percentile) const;
+	double GetMeanMicros() const;
+	/** One human readable line, e.g. calls=1000, mean=1.2us, p50=1.0us, ... */
+	FString ToString() const;
+};
+
+/**
+ * Generates fake log entries to stress the logging system, from StressTestNumThreads threads that each log StressTestNumEntriesPerTick
+ * entries every StressTestGenerateIntervalSecs (plus periodic bursts). Message lengths, unicode and escape density, categories, and verbosities
+ * are configurable (see FsparklogsSettings). Each thread records how long every log call took, which is the latency the capture path adds
+ * to a game thread (compare against a run without the plugin's output devices attached).
  */
-class SPARKLOGS_API FsparklogsStressGenerator : public FRunnable
+class SPARKLOGS_API FsparklogsStressGenerator
 {
 protected:
+	class FProducer;
+
 	TSharedRef<FsparklogsSettings> Settings;
-	volatile FRunnableThread* Thread;
-	/** Non-zero stops this thread */
-	FThreadSafeCounter StopRequestCounter;
+	TArray<FName> Categories;
+	TArray<ELogVerbosity::Type> Verbosities;
+	TArray<TUniquePtr<FProducer>> Producers;
 
 public:
 	FsparklogsStressGenerator(TSharedRef<FsparklogsSettings> InSettings);
+	/** Stops and waits for all of the threads. */
 	~FsparklogsStressGenerator();
 
-	//~ Begin FRunnable Interface
-	virtual bool Init();
-	virtual uint32 Run();
-	virtual void Stop();
-	//~ End FRunnable Interface
+	/** Asks all of the threads to stop, without waiting for them. */
+	void Stop();
+	int64 GetNumEntries() const;
+	/** Merges the log call latencies of all of the threads into OutLatency. */
+	void GetLatency(FsparklogsLatencyHistogram& OutLatency) const;
+	void ResetLatency();
 };
 
 /**
-* On a background thread, reads data from a logfile on disk and streams to the cloud.
+ * AIMD controller for the chunk size and processing interval. While a backlog builds up and requests succeed quickly, it grows the
+ * chunk size and shortens the interval a step at a time. When there is no backlog it lengthens the interval so an idle game is less
+ * chatty. On a failure or latency spike it halves the chunk size and doubles the interval. Always stays within the FsparklogsSettings limits.
+ */
+class SPARKLOGS_API FsparklogsAdaptiveController
+{
+public:
+	enum class EDecision : uint8
+	{
+		Steady,
+		Grow,
+		Idle,
+		BackOff,
+	};
+
+	static constexpr int BytesPerRequestStep = 128 * 1024;
+	static constexpr double ProcessingIntervalStepSecs = 0.25;
+	/** The interval never grows past this (or the configured interval, if that is longer) when idle. */
+	static constexpr double MaxIdleProcessingIntervalSecs = 10.0;
+	/** A request is a latency spike if it takes this many times longer than the smoothed latency... */
+	static constexpr double LatencySpikeFactor = 2.0;
+	/** ...and at least this long. */
+	static constexpr double MinLatencySpikeSecs = 1.0;
+
+	FsparklogsAdaptiveController(int InitialBytesPerRequest, double InitialProcessingIntervalSecs);
+
+	/** Updates the decision after a flush succeeded. BacklogBytes is how much data is still waiting to be processed. */
+	EDecision OnSuccess(double LatencySecs, int64 BacklogBytes);
+	/** Updates the decision after a flush failed. */
+	EDecision OnFailure();
+
+	int GetBytesPerRequest() const { return BytesPerRequest; }
+	double GetProcessingIntervalSecs() const { return ProcessingIntervalSecs; }
+	double GetSmoothedLatencySecs() const { return SmoothedLatencySecs; }
+	EDecision GetLastDecision() const { return LastDecision; }
+	static const TCHAR* DecisionToString(EDecision Decision);
+
+protected:
+	int BytesPerRequest;
+	double ProcessingIntervalSecs;
+	double MaxProcessingIntervalSecs;
+	/** Exponentially weighted moving average of request latency. 0 until the first success. */
+	double SmoothedLatencySecs;
+	EDecision LastDecision;
+
+	EDecision BackOff();
+};
+
+/**
+ * Statistics for one streamer. Updated by the WORKER (and the threads it sends payloads on) and readable from any thread, without locks.
+ * Every update is also published to the SparkLogs stat group and the SparkLogs CSV profiler category.
+ */
+class SPARKLOGS_API FsparklogsStreamerStats
+{
+public:
+	static constexpr int32 NumLatencyBuckets = 12;
+	/** Upper bounds of the request latency histogram buckets, in milliseconds. The last bucket has no upper bound. */
+	static constexpr double LatencyBucketMaxMillis[NumLatencyBuckets - 1] = { 10.0, 25.0, 50.0, 100.0, 250.0, 500.0, 1000.0, 2500.0, 5000.0, 10000.0, 30000.0 };
+
+	/** Lines and bytes read from the log, counted once when the chunks they were shipped in are committed. */
+	FThreadSafeCounter64 NumLinesRead;
+	FThreadSafeCounter64 NumBytesRead;
+	/** Payloads that were acknowledged, and their size before and after compression. */
+	FThreadSafeCounter64 NumPayloads;
+	FThreadSafeCounter64 NumPayloadBytes;
+	FThreadSafeCounter64 NumCompressedBytes;
+	FThreadSafeCounter64 NumRequests;
+	FThreadSafeCounter64 NumFailedRequests;
+	/** Flushes that were attempted after the previous one failed. */
+	FThreadSafeCounter64 NumRetries;
+	FThreadSafeCounter64 NumFailedFlushes;
+	/** The number of requests that completed within each latency bucket. */
+	FThreadSafeCounter64 LatencyBuckets[NumLatencyBuckets];
+	FThreadSafeCounter64 TotalLatencyMicros;
+	/** The number of bytes waiting to be shipped as of the last flush. */
+	std::atomic<int64> BacklogBytes;
+	/** FPlatformTime::Seconds() when there last was no backlog. */
+	std::atomic<double> LastCaughtUpPlatformTime;
+
+	FsparklogsStreamerStats();
+
+	void RecordRead(int64 Bytes, int64 Lines);
+	void RecordRequest(double LatencySecs, bool Succeeded, int64 PayloadBytes, int64 CompressedBytes);
+	void RecordFlush(bool Succeeded, bool Retry);
+	void RecordBacklog(int64 Bytes);
+
+	/** Payload bytes per compressed byte, or 0 if nothing was sent yet. */
+	double GetCompressionRatio() const;
+	/** Seconds since there was last no backlog, or 0 if there is none. */
+	double GetBacklogAgeSecs() const;
+	/** The upper bound (in milliseconds) of the histogram bucket that Percentile (0-100) of requests completed within, or 0 if there were none. */
+	double GetLatencyPercentileMillis(double Percentile) const;
+	/** A few human readable lines, as shown by the sparklogs.stats console command. */
+	FString ToString() const;
+};
+
+/**
+* On a background thread, reads data from a logfile on disk (or from an in-memory capture device) and streams to the cloud.
 */
 class SPARKLOGS_API FsparklogsReadAndStreamToCloud : public FRunnable
 {
@@ -395,8 +1367,14 @@ protected:
 
 	TSharedRef<FsparklogsSettings> Settings;
 	TSharedRef<IsparklogsPayloadProcessor> PayloadProcessor;
+	/** INI progress marker written by older versions of the plugin. Only read if there is no progress journal yet. */
 	FString ProgressMarkerPath;
+	/** Records how far SourceLogFile has been shipped. Not used when streaming from MemorySource. */
+	TUniquePtr<FsparklogsProgressJournal> ProgressJournal;
+	FsparklogsCompressionOptions CompressionOptions;
 	FString SourceLogFile;
+	/** If valid, data is drained from this in-memory capture device instead of SourceLogFile, and offsets are stream positions in the device. */
+	TSharedPtr<FsparklogsMemoryCaptureDevice> MemorySource;
 	int MaxLineLength;
 
 	/** If non-empty, will override the computer name */
@@ -417,28 +1395,171 @@ protected:
 	FThreadSafeBool LastFlushProcessedEverything;
 	/** Whether or not the worker fully cleaned up */
 	FThreadSafeBool WorkerFullyCleanedUp;
-	/** [WORKER] buffer to hold data for current chunk being processed. Will be BytesPerRequest in size. */
-	TArray<uint8> WorkerBuffer;
-	/** [WORKER] string buffer that holds JSON data for next payload to deliver to the cloud. Will be BytesPerRequest in size. */
-	TITLJSONStringBuilder WorkerNextPayload;
-	/** [WORKER] byte buffer that holds the encoded data for the next payload. Can vary in size based on compression mode. */
-	TArray<uint8> WorkerNextEncodedPayload;
+	/** Wakes up the worker when a flush or stop is requested, or when the in-memory capture device has a full chunk of data. */
+	FEvent* WorkerWakeEvent;
+	/** Triggered by the worker each time it finishes a flush (success or fail), and once it has fully cleaned up. */
+	FEvent* FlushCompletedEvent;
+	struct FPayloadSlot;
+	/** Prepares or processes a slot on WorkerThreadPool. Each slot has its own, so handing work to the pool does not allocate. */
+	class FSlotTask : public IQueuedWork
+	{
+	public:
+		FSlotTask(FsparklogsReadAndStreamToCloud& InStreamer, FPayloadSlot& InSlot);
+		virtual ~FSlotTask();
+		/** [WORKER] Queues WorkerPrepareSlot for the slot on the pool. */
+		void StartPrepare(FQueuedThreadPool& Pool, int64 InFromOffset);
+		/** [WORKER] Queues WorkerProcessSlot for the slot on the pool. */
+		void StartProcess(FQueuedThreadPool& Pool);
+		/** [WORKER] Whether work was queued that has not been waited on yet. */
+		bool IsStarted() const { return Started; }
+		/** [WORKER] Waits for the queued work to finish and returns its result. */
+		bool Wait();
+
+		//~ Begin IQueuedWork Interface
+		virtual void DoThreadedWork() override;
+		virtual void Abandon() override;
+		//~ End IQueuedWork Interface
+
+	protected:
+		FsparklogsReadAndStreamToCloud& Streamer;
+		FPayloadSlot& Slot;
+		FEvent* DoneEvent;
+		bool Started;
+		bool Prepare;
+		int64 FromOffset;
+		bool Result;
+	};
+	/** Everything needed to turn one chunk of the logfile into an encoded payload. */
+	struct FPayloadSlot
+	{
+		/** Index of this slot in WorkerSlots. */
+		int Index = 0;
+		/** buffer to hold data for the chunk. Will be BytesPerRequest in size (MaxBytesPerRequest with adaptive batching). */
+		TArray<uint8> Buffer;
+		/** string buffer that holds JSON data for the payload to deliver to the cloud. Will be BytesPerRequest in size. Not used (or allocated) in the LZ4Frame compression mode. */
+		TITLJSONStringBuilder Payload;
+		/** In the LZ4Frame compression mode, compresses JSON data straight into EncodedPayload while the payload is built. */
+		FsparklogsLZ4FrameEncoder FrameEncoder;
+		/** In the Gzip and Deflate compression modes, compresses the payload into EncodedPayload. */
+		FsparklogsDeflateStream DeflateStream;
+		/**
+		 * byte buffer that holds the encoded data for the payload. Can vary in size based on compression mode. Comes from PayloadBufferPool
+		 * before each payload is built, since the payload processor can still hold on to the last one.
+		 */
+		TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> EncodedPayload;
+		/** The length of the JSON data in the payload before it was encoded. */
+		int OriginalPayloadLen = 0;
+		/** Whether the chunk has been read, built, and encoded, and is ready to be processed. */
+		bool Prepared = false;
+		/** The logfile offset the chunk was requested at. */
+		int64 RequestedOffset = 0;
+		/** The logfile offset the chunk actually starts at (differs from RequestedOffset if the logfile was rotated). */
+		int64 StartOffset = 0;
+		/** If non-zero, at most this many bytes are read (so a retried chunk has exactly the same data as last time). */
+		int ReadLimit = 0;
+		/** The maximum number of bytes to read into Buffer for this chunk. */
+		int ChunkSize = 0;
+		/** The number of bytes read into Buffer. */
+		int NumRead = 0;
+		/** The number of bytes captured into the payload. */
+		int CapturedOffset = 0;
+		int NumCapturedLines = 0;
+		/** The number of bytes available at StartOffset when the chunk was read. */
+		int64 RemainingBytes = 0;
+		/** Runs the work for this slot that does not happen on the worker thread itself. */
+		TUniquePtr<FSlotTask> Task;
+	};
+
+	/** A chunk that was part of a window of concurrently processed chunks that did not fully succeed. */
+	struct FWindowChunk
+	{
+		int64 StartOffset = 0;
+		int NumRead = 0;
+		bool Acknowledged = false;
+	};
+
+	/**
+	 * [WORKER] Ring of chunks (MaxInFlightRequests + 1 of them). Up to MaxInFlightRequests chunks are processed concurrently when
+	 * catching up on a backlog, and while they are in flight the chunk after them is read, built, and compressed on WorkerThreadPool.
+	 */
+	TIndirectArray<FPayloadSlot> WorkerSlots;
+	/**
+	 * Below normal priority threads (MaxInFlightRequests of them) that prepare the next chunk and send the other chunks of a window while
+	 * the worker processes the first one. Their own threads rather than the engine's, since sends block for a whole HTTP round trip.
+	 */
+	TUniquePtr<FQueuedThreadPool> WorkerThreadPool;
+	/** Encoded payload buffers for the slots. Has room for one more buffer per slot, for the ones still held by timed out requests. */
+	FsparklogsPayloadBufferPool PayloadBufferPool;
+	/** [WORKER] The capacity to acquire encoded payload buffers with. */
+	int WorkerEncodedPayloadCapacity;
+	/** [WORKER] Index of the slot holding the chunk to process next. */
+	int WorkerCurrentSlot;
+	/**
+	 * [WORKER] The chunks of the last window, starting from the first one that failed. A retry rebuilds exactly the same chunks
+	 * (same offsets and sizes) so they can be deduplicated, and does not send the ones that were already acknowledged again.
+	 */
+	TArray<FWindowChunk> WorkerFailedWindow;
+	/** [WORKER] bitmap of newline positions in a slot buffer, rebuilt for each chunk. */
+	TArray<uint64> WorkerNewlineBitmap;
+	/** A chunk is only split into segments that are built in parallel if each segment gets at least this many bytes. */
+	static constexpr int ParallelPayloadBuildMinSegmentBytes = 256 * 1024;
+	static constexpr int MaxParallelPayloadSegments = FsparklogsSettings::MaxPayloadBuildThreads;
+	/** A line in a slot buffer. */
+	struct FLineSpan
+	{
+		const ANSICHAR* Line;
+		int Len;
+	};
+	/** [WORKER] The lines of the chunk being built, when it is built in parallel. */
+	TArray<FLineSpan> WorkerLineSpans;
+	/** [WORKER] The events of each segment of the chunk being built in parallel, reused from chunk to chunk. */
+	TArray<TUniquePtr<TITLJSONStringBuilder>> WorkerSegmentPayloads;
+	/** [WORKER] Persistent reader for SourceLogFile. Not used when streaming from MemorySource. */
+	TUniquePtr<FsparklogsLogFileReader> WorkerFileReader;
+	/** [WORKER] Index of the slot whose buffer was read most recently. */
+	int WorkerBufferedSlot;
+	/** [WORKER] The logfile offset of the first byte in the most recently read slot buffer. Only valid if WorkerBufferedLen > 0. */
+	int64 WorkerBufferedOffset;
+	/** [WORKER] The number of bytes in the most recently read slot buffer that still match the logfile, so that a partial trailing line is not read from disk again. */
+	int WorkerBufferedLen;
 	/** [WORKER] The offset where we next need to start processing data in the logfile. */
 	int64 WorkerShippedLogOffset;
 	/** [WORKER] If non-zero, the minimum time when we can attempt to flush to cloud again automatically. Useful to wait longer to retry after a failure. */
 	double WorkerMinNextFlushPlatformTime;
 	/** [WORKER] The number of consecutive flush failures we've had in a row. */
 	int WorkerNumConsecutiveFlushFailures;
-	/** [WORKER] The payload size of the request the last time we failed to flush. */
+	/** [WORKER] The payload size of the request the last time we failed to flush (the first chunk of WorkerFailedWindow). */
 	int WorkerLastFailedFlushPayloadSize;
 	/** Whether or not the next flush platform time is because of a failure. */
 	FThreadSafeBool WorkerLastFlushFailed;
+	/** [WORKER] Adjusts the chunk size and processing interval when adaptive batching is on, otherwise null. */
+	TUniquePtr<FsparklogsAdaptiveController> WorkerAdaptiveController;
+	/** [WORKER] Seconds it took to process the last window of chunks. */
+	double WorkerLastWindowLatencySecs;
+	/** [WORKER] The number of bytes still waiting to be processed after the last window of chunks. */
+	int64 WorkerLastBacklogBytes;
+	/** [WORKER] The captured bytes and lines of the chunks the last flush committed, recorded as read once the shipped offset advances past them. */
+	int64 WorkerCommittedReadBytes;
+	int64 WorkerCommittedReadLines;
+	/** Published copy of WorkerShippedLogOffset for other threads. */
+	std::atomic<int64> ShippedLogOffset;
+	/** The number of bytes skipped because the backlog exceeded MaxBacklogBytes with the drop oldest policy. */
+	FThreadSafeCounter64 NumBacklogDroppedBytes;
+	/** The chunk size and processing interval currently in use (can change with adaptive batching). */
+	std::atomic<int> CurrentBytesPerRequest;
+	std::atomic<double> CurrentProcessingIntervalSecs;
+	FsparklogsStreamerStats Stats;
 
 	virtual void ComputeCommonEventJSON(bool IncludeCommonMetadata, TMap<FString, FString>* AdditionalAttributes);
 
+	FsparklogsReadAndStreamToCloud(const TCHAR* SourceLogFile, TSharedPtr<FsparklogsMemoryCaptureDevice> InMemorySource, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes);
+
 public:
 
+	/** Streams data from a logfile on disk. */
 	FsparklogsReadAndStreamToCloud(const TCHAR* SourceLogFile, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes);
+	/** Streams data directly from an in-memory capture device. Progress is not persisted across sessions in this mode. */
+	FsparklogsReadAndStreamToCloud(TSharedRef<FsparklogsMemoryCaptureDevice> InMemorySource, TSharedRef<FsparklogsSettings> InSettings, TSharedRef<IsparklogsPayloadProcessor> InPayloadProcessor, int InMaxLineLength, const TCHAR* InOverrideComputerName, TMap<FString, FString>* AdditionalAttributes);
 	~FsparklogsReadAndStreamToCloud();
 
 	//~ Begin FRunnable Interface
@@ -460,15 +1581,52 @@ public:
 	/** [WORKER] Returns the number of seconds to wait during a flush retry based on the number of consecutive failures. */
 	virtual double WorkerGetRetrySecs();
 
+	/** The dictionary payloads are compressed with in the LZ4Dictionary mode, or null if there is none. */
+	const FsparklogsCompressionDictionary* GetCompressionDictionary() const { return CompressionOptions.Dictionary.Get(); }
+	/** How log events are laid out in the payloads this streamer builds. */
+	ITLPayloadFormat GetPayloadFormat() const { return Settings->PayloadFormat; }
+	/** How far the log has been shipped (a logfile offset, or a stream position in the in-memory capture device). */
+	int64 GetShippedLogOffset() const { return ShippedLogOffset.load(std::memory_order_relaxed); }
+	/** The number of bytes dropped from the logfile because the backlog exceeded MaxBacklogBytes (with the drop oldest policy). */
+	int64 GetNumBacklogDroppedBytes() const { return NumBacklogDroppedBytes.GetValue(); }
+	/** The maximum size of a chunk read from the log. */
+	int GetCurrentBytesPerRequest() const { return CurrentBytesPerRequest.load(std::memory_order_relaxed); }
+	/** The number of seconds to wait between flushes when there is no backlog. */
+	double GetCurrentProcessingIntervalSecs() const { return WorkerAdaptiveController.IsValid() ? CurrentProcessingIntervalSecs.load(std::memory_order_relaxed) : Settings->ProcessingIntervalSecs; }
+	/** Lines, bytes, requests, latency, and backlog of this streamer so far. */
+	const FsparklogsStreamerStats& GetStats() const { return Stats; }
+	/** Where the encoded payload buffers come from. */
+	const FsparklogsPayloadBufferPool& GetPayloadBufferPool() const { return PayloadBufferPool; }
+
 protected:
-	/** [WORKER] Re-opens the logfile and reads more data into the work buffer. */
-	virtual bool WorkerReadNextPayload(int& OutNumToRead, int64& OutEffectiveShippedLogOffset, int64& OutRemainingBytes);
-	/** [WORKER] Build the JSON payload from as much of the data in WorkerBuffer as possible, up to NumToRead bytes. Sets OutCapturedOffset to the number of bytes captured into the payload. Returns false on failure. Do not call directly. */
-	virtual bool WorkerBuildNextPayload(int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines);
-	/** [WORKER] Compress the current payload in WorkerNextPayload and store in WorkerNextEncodedPayload. */
-	virtual bool WorkerCompressPayload();
+	/** [WORKER] Reads newly appended data from the logfile (or drains the in-memory capture device) into the slot buffer, starting at InOutEffectiveLogOffset (which is reset if the logfile was rotated). */
+	virtual bool WorkerReadNextPayload(FPayloadSlot& Slot, int& OutNumToRead, int64& InOutEffectiveLogOffset, int64& OutRemainingBytes);
+	/** [WORKER] Skips the logfile ahead (to the start of a line) so that less than MaxBacklogBytes is left to ship, and reports what was dropped. */
+	virtual void WorkerDropOldestBacklog(int64 FileSize, int64& InOutEffectiveLogOffset);
+	/** [WORKER] Build the JSON payload from as much of the data in the slot buffer as possible, up to NumToRead bytes. Sets OutCapturedOffset to the number of bytes captured into the payload. Returns false on failure. Do not call directly. */
+	virtual bool WorkerBuildNextPayload(FPayloadSlot& Slot, int NumToRead, int& OutCapturedOffset, int& OutNumCapturedLines);
+	/** [WORKER] Compress the payload in the slot and store in its EncodedPayload. */
+	virtual bool WorkerCompressPayload(FPayloadSlot& Slot);
+	/** [WORKER] Appends the JSON fields for a structured record from MemorySource (without the surrounding braces). */
+	void WorkerAppendRecordAsJsonFields(TITLJSONStringBuilder& Builder, const FsparklogsMemoryCaptureDevice::FRecord& Record) const;
+	/** [WORKER] Appends the JSON fields for a line from the logfile (without the surrounding braces). */
+	void WorkerAppendLineAsJsonFields(TITLJSONStringBuilder& Builder, const ANSICHAR* Line, int LineLen) const;
+	/** [WORKER] Builds the events for the lines in WorkerLineSpans on up to PayloadBuildThreads threads, and appends them to the payload in order. */
+	void WorkerBuildLineEventsInParallel(TITLJSONStringBuilder& Payload, int NumSegments);
+	/** [WORKER] Reads, builds, and compresses the chunk at FromOffset (reading at most ReadLimit bytes if non-zero) into the slot. May run on WorkerThreadPool while the worker is waiting on other slots. Returns false on failure. */
+	virtual bool WorkerPrepareSlot(FPayloadSlot& Slot, int64 FromOffset, int ReadLimit);
+	/** [WORKER] Returns the read limit for a chunk at Offset that is retried as part of the failed window, or 0 if there is none. */
+	virtual int WorkerGetRetryReadLimit(int64 Offset, bool& OutAcknowledged) const;
+	/** [WORKER] Processes the payload in the slot. May run on another thread while other slots are processed concurrently. Returns false on failure. */
+	virtual bool WorkerProcessSlot(FPayloadSlot& Slot);
+	/** [WORKER] Throws away a prepared chunk that will not be used. */
+	virtual void WorkerDiscardPreparedSlot(FPayloadSlot& Slot);
 	/** [WORKER] Does the actual work for the flush operation, returns true on success. Does not update progress marker or thread state. Do not call directly. */
 	virtual bool WorkerInternalDoFlush(int64& OutNewShippedLogOffset, bool& OutFlushProcessedEverything);
+	/** [WORKER] Records how far the log has been shipped (in memory, and in the progress marker). */
+	virtual void WorkerSetShippedLogOffset(int64 NewOffset);
+	/** [WORKER] Feeds the outcome of a flush to the adaptive controller (if any) and publishes its decision. */
+	virtual void WorkerUpdateAdaptiveBatching(bool FlushSucceeded);
 	/** [WORKER] Attempts to flush any newly available logs to the cloud. Response for updating flush op counters, LastFlushProcessedEverything, and MinNextFlushPlatformTime state. Returns false on failure. Only call from worker thread. */
 	virtual bool WorkerDoFlush();
 };
@@ -527,6 +1685,15 @@ public:
 	/** Stops the log shipping engine. It will not start again unless StartShippingEngine is manually called. */
 	void StopShippingEngine();
 
+	/** Writes the statistics of the shipping engine to Ar (what the sparklogs.stats console command shows). */
+	void DumpStats(FOutputDevice& Ar) const;
+
+	/**
+	 * Removes the plugin's output devices (the capture device and the operations log) from GLog, or adds them back, e.g. to measure
+	 * what logging costs without the plugin. Lines logged in between are not captured. Returns false if the shipping engine is not active.
+	 */
+	bool SetOutputDevicesAttached(bool Attached);
+
 protected:
 	/** Called by the engine after it has fully initialized. */
 	void OnPostEngineInit();
@@ -538,10 +1705,19 @@ private:
 	bool LoggingActive;
 	TSharedRef<FsparklogsSettings> Settings;
 	TUniquePtr<FsparklogsReadAndStreamToCloud> CloudStreamer;
+	/** When capturing logs in memory, the capture device and the streamer that drains it. CloudStreamer still ships anything spilled to the logfile. */
+	TSharedPtr<FsparklogsMemoryCaptureDevice> MemoryCaptureDevice;
+	/** Wraps the capture device when there are capture filter rules. */
+	TSharedPtr<FsparklogsCaptureFilterDevice> CaptureFilterDevice;
+	TUniquePtr<FsparklogsReadAndStreamToCloud> MemoryStreamer;
 	TUniquePtr<FsparklogsStressGenerator> StressGenerator;
 	/** The payload processor that sends data to the cloud */
 	TSharedPtr<FsparklogsWriteHTTPPayloadProcessor> CloudPayloadProcessor;
 
+	/** Adds a device that captures engine log output to GLog, behind a capture filter if there are capture filter rules (or a backlog quota for the logfile it writes). */
+	void AddCaptureDevice(FOutputDevice* Device, bool WritesLogFile);
+	/** Removes a device added by AddCaptureDevice from GLog. */
+	void RemoveCaptureDevice(FOutputDevice* Device);
 	void RegisterSettings();
 	void UnregisterSettings();
 };
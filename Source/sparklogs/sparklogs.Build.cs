@@ -24,7 +24,7 @@ public class sparklogs : ModuleRules
             }
 			);
 
-		//AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
+		AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib");
 		
 		PublicDependencyModuleNames.AddRange(
 			new string[]
@@ -56,6 +56,18 @@ public class sparklogs : ModuleRules
 			}
 			);
 
+        // Only the automation tests (benchmark reports and the mock ingest server) use these, which are compiled out of shipping builds
+        if (Target.Configuration != UnrealTargetConfiguration.Shipping || Target.bForceCompileDevelopmentAutomationTests)
+        {
+            PrivateDependencyModuleNames.AddRange(
+                new string[]
+                {
+                    "Json",
+                    "Sockets",
+                }
+                );
+        }
+
         PrivateIncludePathModuleNames.AddRange(
             new string[] {
                 "Settings",